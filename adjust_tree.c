@@ -1,17 +1,42 @@
 #include "r_tree.h"
 #include "adjust_tree.h"
 
-/* Pass this function the r_tree_node in which you are inserting an index_record
-* and the index record you are inserting. This will recursively expand the minimum bounding rectangles
+/* Pass this function the path that choose_leaf took to the r_tree_node in which you are inserting an index_record
+* and the index record you are inserting. This will walk back up the path and expand the minimum bounding rectangles
 * of the index_records above the index_record that you are inserting so that all MBR's above will be
 * valid and include all child MBRs
 */
-void adjust_tree(r_tree_node *rt, index_record *ir) {
-	// Stop at the parent
-	if (rt->parent == NULL)
-		return;
+void adjust_tree(tree_path *path, index_record *ir) {
+	int i;
 
-	expand_mbr(rt->parent->mbr, ir->mbr);
+	// The last node on the path is the one ir was added to, so start at the index_record pointing to it
+	for (i = path->depth - 2; i >= 0; i--) {
+		MBR *parent_mbr = path->nodes[i]->index_records[path->indices[i]]->mbr;
 
-	adjust_tree(rt->parent->host, rt->parent);
+		// Every MBR further up already contains this one, so they can't need expanding either
+		if (fully_contains(parent_mbr, ir->mbr))
+			return;
+
+		expand_mbr(parent_mbr, ir->mbr);
+	}
+}
+
+
+// Adds part into the aggregate of every index_record on path above its last node, for an entry being added to that node
+void add_to_path(tree_path *path, aggregate *part) {
+	int i;
+
+	// Unlike the MBRs, every aggregate on the way up changes
+	for (i = path->depth - 2; i >= 0; i--)
+		add_aggregate(&path->nodes[i]->index_records[path->indices[i]]->agg, part);
+}
+
+
+// Takes part back out of the aggregate of every index_record on path above its last node, for an entry being removed
+// from that node
+void subtract_from_path(tree_path *path, aggregate *part) {
+	int i;
+
+	for (i = path->depth - 2; i >= 0; i--)
+		subtract_aggregate(&path->nodes[i]->index_records[path->indices[i]]->agg, part);
 }
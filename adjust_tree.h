@@ -7,12 +7,21 @@
 #include <math.h>
 #include <unistd.h>
 
-/* Pass this function the r_tree_node in which you are inserting an index_record
-* and the index record you are inserting. This will recursively expand the minimum bounding rectangles
+/* Pass this function the path that choose_leaf took to the r_tree_node in which you are inserting an index_record
+* and the index record you are inserting. This will walk back up the path and expand the minimum bounding rectangles
 * of the index_records above the index_record that you are inserting so that all MBR's above will be
 * valid and include all child MBRs
 */
-void adjust_tree(r_tree_node *rt, index_record *ir);
+void adjust_tree(tree_path *path, index_record *ir);
+
+
+// Adds part into the aggregate of every index_record on path above its last node, for an entry being added to that node
+void add_to_path(tree_path *path, aggregate *part);
+
+
+// Takes part back out of the aggregate of every index_record on path above its last node, for an entry being removed
+// from that node
+void subtract_from_path(tree_path *path, aggregate *part);
 
 
 #endif
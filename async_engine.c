@@ -0,0 +1,301 @@
+#include "r_tree.h"
+#include "choose_leaf.h"
+#include "async_engine.h"
+#include <sched.h>
+
+
+static void initialize_ring(op_ring *ring, long size) {
+	unsigned long capacity = 2;
+	unsigned long i;
+
+	while (capacity < (unsigned long) size)
+		capacity *= 2;
+
+	ring->slots = (ring_slot *)malloc(sizeof(ring_slot) * capacity);
+
+	if (ring->slots == NULL) {
+		fprintf(stderr, "Malloc failed in initialize_ring(). Exiting program\n");
+		exit(1);
+	}
+
+	// Slot i is free for the producer of position i
+	for (i = 0; i < capacity; i++) {
+		atomic_init(&ring->slots[i].sequence, i);
+		ring->slots[i].op = NULL;
+	}
+
+	ring->mask = capacity - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+}
+
+
+// Returns false if the ring is full
+static bool ring_push(op_ring *ring, async_op *op) {
+	unsigned long position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	while (true) {
+		ring_slot *slot = &ring->slots[position & ring->mask];
+		unsigned long sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		long difference = (long)(sequence - position);
+
+		if (difference == 0) {
+			// The slot is free. Claim its position, or retry from the position another producer moved head to
+			if (atomic_compare_exchange_weak_explicit(&ring->head, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+				slot->op = op;
+				atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+				return true;
+			}
+		} else if (difference < 0) {
+			// The slot still holds the op pushed one lap ago
+			return false;
+		} else {
+			position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		}
+	}
+}
+
+
+// Returns NULL if the ring is empty
+static async_op *ring_pop(op_ring *ring) {
+	unsigned long position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	while (true) {
+		ring_slot *slot = &ring->slots[position & ring->mask];
+		unsigned long sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		long difference = (long)(sequence - (position + 1));
+
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+				async_op *op = slot->op;
+
+				// Free the slot for the producer one lap ahead
+				atomic_store_explicit(&slot->sequence, position + ring->mask + 1, memory_order_release);
+				return op;
+			}
+		} else if (difference < 0) {
+			return NULL;
+		} else {
+			position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		}
+	}
+}
+
+
+// Identifies the node ASYNC_GROUP_LEVELS levels below root that choose_leaf would send ir through
+static long insertion_region(r_tree_node *root, index_record *ir) {
+	r_tree_node *node = root;
+	long region = 0;
+	int level;
+
+	for (level = 0; level < ASYNC_GROUP_LEVELS && !is_leaf(node); level++) {
+		int index = sequential_get_insertion_index(node, ir);
+
+		region = region * node->max_members + index;
+		node = node->index_records[index]->child;
+	}
+
+	return region;
+}
+
+
+static int compare_region(const void *a, const void *b) {
+	async_op *op_a = *(async_op **)a;
+	async_op *op_b = *(async_op **)b;
+
+	if (op_a->region != op_b->region)
+		return (op_a->region > op_b->region) - (op_a->region < op_b->region);
+
+	return (op_a->position > op_b->position) - (op_a->position < op_b->position);
+}
+
+
+// Runs the num_writes writes of a batch in order, except that runs of insertions are grouped by region
+static void run_writes(async_engine *engine, async_op **writes, int num_writes) {
+	int start = 0;
+	int i;
+
+	while (start < num_writes) {
+		int end = start;
+
+		while (end < num_writes && writes[end]->type == ASYNC_INSERT) {
+			writes[end]->region = insertion_region(*engine->root, writes[end]->ir);
+			writes[end]->position = end;
+			end++;
+		}
+
+		qsort(writes + start, end - start, sizeof(async_op *), compare_region);
+
+		for (i = start; i < end; i++)
+			insert(engine->root, writes[i]->ir, 1);
+
+		if (end < num_writes) {
+			async_op *op = writes[end];
+
+			op->deleted = delete_record(engine->root, &op->window, op->id);
+			end++;
+		}
+
+		start = end;
+	}
+}
+
+
+static void complete(async_engine *engine, async_op *op) {
+	if (op->done != NULL) {
+		op->done(op);
+		return;
+	}
+
+	// Wait for the caller to make room, unless the engine is being stopped and nobody might be polling
+	while (!ring_push(&engine->completions, op)) {
+		if (atomic_load(&engine->stop))
+			return;
+
+		sched_yield();
+	}
+}
+
+
+// writes needs room for num_ops operations
+static void run_batch(async_engine *engine, async_op **batch, int num_ops, async_op **writes) {
+	int num_writes = 0;
+	int i;
+
+	for (i = 0; i < num_ops; i++) {
+		if (batch[i]->type != ASYNC_SEARCH)
+			writes[num_writes++] = batch[i];
+	}
+
+	if (num_writes > 0) {
+		pthread_rwlock_wrlock(&engine->tree_lock);
+		run_writes(engine, writes, num_writes);
+		pthread_rwlock_unlock(&engine->tree_lock);
+	}
+
+	if (num_writes < num_ops) {
+		pthread_rwlock_rdlock(&engine->tree_lock);
+
+		for (i = 0; i < num_ops; i++) {
+			if (batch[i]->type == ASYNC_SEARCH)
+				batch[i]->found = search(*engine->root, &batch[i]->window, batch[i]->callback, batch[i]->arg);
+		}
+
+		pthread_rwlock_unlock(&engine->tree_lock);
+	}
+
+	atomic_fetch_add(&engine->num_batches, 1);
+	atomic_fetch_add(&engine->num_ops, num_ops);
+
+	for (i = 0; i < num_ops; i++)
+		complete(engine, batch[i]);
+}
+
+
+static void *run_engine(void *arg) {
+	async_engine *engine = (async_engine *)arg;
+	async_op **batch = (async_op **)malloc(sizeof(async_op *) * engine->batch_size);
+	async_op **writes = (async_op **)malloc(sizeof(async_op *) * engine->batch_size);
+
+	if (batch == NULL || writes == NULL) {
+		fprintf(stderr, "Malloc failed in run_engine(). Exiting program\n");
+		exit(1);
+	}
+
+	while (true) {
+		int num_ops = 0;
+		async_op *op;
+
+		while (num_ops < engine->batch_size && (op = ring_pop(&engine->submissions)) != NULL)
+			batch[num_ops++] = op;
+
+		if (num_ops > 0) {
+			run_batch(engine, batch, num_ops, writes);
+			continue;
+		}
+
+		// Only stop once the ring is found empty after the stop flag was set, so nothing submitted is left behind
+		if (atomic_load(&engine->stop)) {
+			if ((op = ring_pop(&engine->submissions)) == NULL)
+				break;
+
+			run_batch(engine, &op, 1, writes);
+			continue;
+		}
+
+		usleep(ASYNC_IDLE_MICROSECONDS);
+	}
+
+	free(batch);
+	free(writes);
+	return NULL;
+}
+
+
+// Starts num_threads engine threads running operations on the tree rooted at *root, at most batch_size at a time.
+// Each ring has room for ring_size operations (rounded up to a power of 2). Nothing else may use the tree until
+// stop_async_engine returns
+async_engine *start_async_engine(r_tree_node **root, int num_threads, int batch_size, long ring_size) {
+	async_engine *engine = (async_engine *)malloc(sizeof(async_engine));
+	int i;
+
+	if (engine == NULL) {
+		fprintf(stderr, "Malloc failed in start_async_engine(). Exiting program\n");
+		exit(1);
+	}
+
+	engine->root = root;
+	pthread_rwlock_init(&engine->tree_lock, NULL);
+	initialize_ring(&engine->submissions, ring_size);
+	initialize_ring(&engine->completions, ring_size);
+
+	engine->num_threads = num_threads;
+	engine->batch_size = batch_size > 0 ? batch_size : 1;
+	atomic_init(&engine->stop, false);
+	atomic_init(&engine->num_batches, 0);
+	atomic_init(&engine->num_ops, 0);
+
+	engine->threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+
+	if (engine->threads == NULL) {
+		fprintf(stderr, "Malloc failed in start_async_engine(). Exiting program\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_create(&engine->threads[i], NULL, run_engine, engine);
+
+	return engine;
+}
+
+
+// Queues op. Returns false, without queueing it, if the submission ring is full
+bool async_submit(async_engine *engine, async_op *op) {
+	return ring_push(&engine->submissions, op);
+}
+
+
+// Returns an operation that has completed (one without a done callback), or NULL if there is none yet.
+// Engine threads wait for room on the completion ring, so it has to be polled if any operation lacks a callback
+async_op *async_poll(async_engine *engine) {
+	return ring_pop(&engine->completions);
+}
+
+
+// Waits for every operation submitted so far to complete, then stops and frees the engine. Operations on the
+// completion ring that were never polled are dropped, as are those that find it full while the engine stops.
+// Nothing may be submitted once this has been called
+void stop_async_engine(async_engine *engine) {
+	int i;
+
+	atomic_store(&engine->stop, true);
+
+	for (i = 0; i < engine->num_threads; i++)
+		pthread_join(engine->threads[i], NULL);
+
+	pthread_rwlock_destroy(&engine->tree_lock);
+	free(engine->submissions.slots);
+	free(engine->completions.slots);
+	free(engine->threads);
+	free(engine);
+}
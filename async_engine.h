@@ -0,0 +1,133 @@
+#ifndef _async_engine_h
+#define _async_engine_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* Asynchronous interface to a tree: callers submit operations and collect them once they are done.
+*
+* Callers fill in an async_op and push a pointer to it onto the submission ring with async_submit, which never blocks
+* (it returns false if the ring is full). Engine threads pop operations off the ring up to batch_size at a time and run
+* each batch together: the writes first, under the tree's write lock, then the searches, under its read lock, so that
+* several engine threads can search at once. Runs of consecutive insertions in a batch are reordered so that the ones
+* choose_leaf sends to the same part of the tree (the same node ASYNC_GROUP_LEVELS levels below the root) go in one
+* after another, while deletions keep their place among the writes. A finished operation is handed to its done
+* callback on the engine thread if it has one, and otherwise pushed onto the completion ring for async_poll.
+*
+* Both rings are bounded lock-free multi-producer, multi-consumer queues: every slot carries a sequence number telling
+* producers and consumers whether it is theirs to fill or empty, so claiming a slot is a single compare-and-swap.
+*
+* Operations in the same batch can complete in any order, and searches see every write of their batch. An operation
+* submitted after another one completed always runs after it. The async_op stays owned by the caller, and must stay
+* untouched until it has completed
+*/
+
+// Slots of either ring are padded apart from the indices producers and consumers fight over
+#define ASYNC_CACHE_LINE_SIZE 64
+
+// Levels of the tree below the root that decide which insertions of a batch are grouped together
+#define ASYNC_GROUP_LEVELS 2
+
+// How long an engine thread sleeps when it finds the submission ring empty
+#define ASYNC_IDLE_MICROSECONDS 50
+
+
+typedef enum async_op_type {
+	ASYNC_INSERT,
+	ASYNC_SEARCH,
+	ASYNC_DELETE
+} async_op_type;
+
+
+struct async_op;
+
+// Called on an engine thread once op has completed
+typedef void (*async_done_callback)(struct async_op *op);
+
+
+typedef struct async_op {
+	async_op_type type;
+
+	// ASYNC_INSERT: the leaf-level index_record to insert, which the tree takes ownership of
+	index_record *ir;
+
+	// ASYNC_SEARCH: the window searched, with callback and arg passed on to search() (callback may be NULL).
+	// ASYNC_DELETE: the MBR and id of the record to delete
+	MBR window;
+	search_callback callback;
+	void *arg;
+	record_id id;
+
+	// Optional, used instead of the completion ring if set
+	async_done_callback done;
+	void *user_data;
+
+	// Set on completion. ASYNC_SEARCH: the number of records found. ASYNC_DELETE: the deleted index_record (NULL if
+	// there was none), left to the caller to free
+	long found;
+	index_record *deleted;
+
+	// Used by the engine to group insertions
+	long region;
+	long position;
+} async_op;
+
+
+typedef struct ring_slot {
+	atomic_ulong sequence;
+	async_op *op;
+} ring_slot;
+
+
+typedef struct op_ring {
+	ring_slot *slots;
+	unsigned long mask;
+
+	_Alignas(ASYNC_CACHE_LINE_SIZE) atomic_ulong head;
+	_Alignas(ASYNC_CACHE_LINE_SIZE) atomic_ulong tail;
+} op_ring;
+
+
+typedef struct async_engine {
+	r_tree_node **root;
+	pthread_rwlock_t tree_lock;
+
+	op_ring submissions;
+	op_ring completions;
+
+	int num_threads;
+	int batch_size;
+	pthread_t *threads;
+	atomic_bool stop;
+
+	// For benchmarking
+	atomic_long num_batches;
+	atomic_long num_ops;
+} async_engine;
+
+
+// Starts num_threads engine threads running operations on the tree rooted at *root, at most batch_size at a time.
+// Each ring has room for ring_size operations (rounded up to a power of 2). Nothing else may use the tree until
+// stop_async_engine returns
+async_engine *start_async_engine(r_tree_node **root, int num_threads, int batch_size, long ring_size);
+
+
+// Queues op. Returns false, without queueing it, if the submission ring is full
+bool async_submit(async_engine *engine, async_op *op);
+
+
+// Returns an operation that has completed (one without a done callback), or NULL if there is none yet.
+// Engine threads wait for room on the completion ring, so it has to be polled if any operation lacks a callback
+async_op *async_poll(async_engine *engine);
+
+
+// Waits for every operation submitted so far to complete, then stops and frees the engine. Operations on the
+// completion ring that were never polled are dropped, as are those that find it full while the engine stops.
+// Nothing may be submitted once this has been called
+void stop_async_engine(async_engine *engine);
+
+
+#endif
@@ -0,0 +1,228 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include "buffer_pool.h"
+
+
+// Reads or writes all POOL_PAGE_SIZE bytes of page page_id, retrying short transfers
+static void transfer_page(buffer_pool *pool, long page_id, void *data, bool write) {
+	char *bytes = (char *)data;
+	size_t done = 0;
+
+	while (done < POOL_PAGE_SIZE) {
+		off_t offset = (off_t)page_id * POOL_PAGE_SIZE + done;
+		ssize_t n = write ? pwrite(pool->fd, bytes + done, POOL_PAGE_SIZE - done, offset)
+			: pread(pool->fd, bytes + done, POOL_PAGE_SIZE - done, offset);
+
+		if (n <= 0) {
+			fprintf(stderr, "%s of page %ld failed in transfer_page(). Exiting program\n", write ? "Write" : "Read", page_id);
+			exit(1);
+		}
+
+		done += n;
+	}
+
+	if (write)
+		pool->num_writes++;
+	else
+		pool->num_reads++;
+}
+
+
+// Returns the index of a frame that holds no page, evicting one with the clock hand if they are all taken
+static long take_frame(buffer_pool *pool) {
+	long scanned;
+
+	// The first lap clears every reference bit, so the second one is bound to find an unpinned frame if there is one
+	for (scanned = 0; scanned < 2 * pool->num_frames; scanned++) {
+		long index = pool->clock_hand;
+		pool_frame *frame = &pool->frames[index];
+
+		pool->clock_hand = (pool->clock_hand + 1) % pool->num_frames;
+
+		if (frame->page_id == -1)
+			return index;
+
+		if (frame->pin_count > 0)
+			continue;
+
+		if (frame->referenced) {
+			frame->referenced = false;
+			continue;
+		}
+
+		if (frame->dirty)
+			transfer_page(pool, frame->page_id, frame->data, true);
+
+		pool->page_frames[frame->page_id] = -1;
+		frame->page_id = -1;
+		frame->dirty = false;
+
+		return index;
+	}
+
+	fprintf(stderr, "Every frame of the buffer pool is pinned. Exiting program\n");
+	exit(1);
+}
+
+
+// Puts page_id into a free frame, pinned once
+static pool_frame *load_frame(buffer_pool *pool, long page_id) {
+	long index = take_frame(pool);
+	pool_frame *frame = &pool->frames[index];
+
+	frame->page_id = page_id;
+	frame->pin_count = 1;
+	frame->dirty = false;
+	frame->referenced = true;
+	pool->page_frames[page_id] = index;
+
+	return frame;
+}
+
+
+// Creates a pool over a new (or truncated) file at path, with as many frames as fit in memory_budget bytes
+buffer_pool *create_buffer_pool(const char *path, long memory_budget) {
+	buffer_pool *pool = (buffer_pool *)malloc(sizeof(buffer_pool));
+	long i;
+
+	if (pool == NULL) {
+		fprintf(stderr, "Malloc failed in create_buffer_pool(). Exiting program\n");
+		exit(1);
+	}
+
+	pool->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (pool->fd < 0) {
+		fprintf(stderr, "Could not open %s in create_buffer_pool(). Exiting program\n", path);
+		exit(1);
+	}
+
+	pool->num_frames = memory_budget / POOL_PAGE_SIZE;
+
+	if (pool->num_frames < POOL_MIN_FRAMES)
+		pool->num_frames = POOL_MIN_FRAMES;
+
+	void *memory;
+	pool->frames = (pool_frame *)malloc(sizeof(pool_frame) * pool->num_frames);
+
+	// Page-aligned, so the frames could also be used with O_DIRECT
+	if (pool->frames == NULL || posix_memalign(&memory, POOL_PAGE_SIZE, (size_t)pool->num_frames * POOL_PAGE_SIZE) != 0) {
+		fprintf(stderr, "Malloc failed in create_buffer_pool(). Exiting program\n");
+		exit(1);
+	}
+
+	for (i = 0; i < pool->num_frames; i++) {
+		pool->frames[i].page_id = -1;
+		pool->frames[i].pin_count = 0;
+		pool->frames[i].dirty = false;
+		pool->frames[i].referenced = false;
+		pool->frames[i].data = (char *)memory + i * POOL_PAGE_SIZE;
+	}
+
+	pool->num_pages = 0;
+	pool->clock_hand = 0;
+	pool->page_frames = NULL;
+	pool->page_frames_capacity = 0;
+	pool->num_hits = 0;
+	pool->num_reads = 0;
+	pool->num_writes = 0;
+	pool->num_prefetches = 0;
+
+	return pool;
+}
+
+
+// Adds a zeroed page to the end of the file and returns it pinned. Its id is written to *page_id
+void *allocate_page(buffer_pool *pool, long *page_id) {
+	if (pool->num_pages == pool->page_frames_capacity) {
+		pool->page_frames_capacity = pool->page_frames_capacity == 0 ? 1024 : pool->page_frames_capacity * 2;
+		pool->page_frames = (long *)realloc(pool->page_frames, sizeof(long) * pool->page_frames_capacity);
+
+		if (pool->page_frames == NULL) {
+			fprintf(stderr, "Realloc failed in allocate_page(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	*page_id = pool->num_pages++;
+
+	// Never on disk yet, so it is only written once it gets evicted or flushed
+	pool_frame *frame = load_frame(pool, *page_id);
+	frame->dirty = true;
+	memset(frame->data, 0, POOL_PAGE_SIZE);
+
+	return frame->data;
+}
+
+
+// Returns the contents of page page_id, reading it in if it isn't cached. The page stays in memory until unpinned
+void *pin_page(buffer_pool *pool, long page_id) {
+	if (page_id < 0 || page_id >= pool->num_pages) {
+		fprintf(stderr, "Page %ld does not exist. Exiting program\n", page_id);
+		exit(1);
+	}
+
+	long index = pool->page_frames[page_id];
+
+	if (index != -1) {
+		pool_frame *frame = &pool->frames[index];
+
+		frame->pin_count++;
+		frame->referenced = true;
+		pool->num_hits++;
+
+		return frame->data;
+	}
+
+	pool_frame *frame = load_frame(pool, page_id);
+	transfer_page(pool, page_id, frame->data, false);
+
+	return frame->data;
+}
+
+
+// Releases a pin taken by pin_page or allocate_page. dirty says whether the page was changed while pinned
+void unpin_page(buffer_pool *pool, long page_id, bool dirty) {
+	pool_frame *frame = &pool->frames[pool->page_frames[page_id]];
+
+	frame->pin_count--;
+	frame->dirty = frame->dirty || dirty;
+}
+
+
+// Starts reading page page_id in the background if it isn't cached
+void prefetch_page(buffer_pool *pool, long page_id) {
+	if (pool->page_frames[page_id] != -1)
+		return;
+
+	posix_fadvise(pool->fd, (off_t)page_id * POOL_PAGE_SIZE, POOL_PAGE_SIZE, POSIX_FADV_WILLNEED);
+	pool->num_prefetches++;
+}
+
+
+// Writes every dirty page back to the file
+void flush_buffer_pool(buffer_pool *pool) {
+	long i;
+
+	for (i = 0; i < pool->num_frames; i++) {
+		pool_frame *frame = &pool->frames[i];
+
+		if (frame->page_id != -1 && frame->dirty) {
+			transfer_page(pool, frame->page_id, frame->data, true);
+			frame->dirty = false;
+		}
+	}
+}
+
+
+// Writes back every dirty page, closes the file and frees the pool. The file itself is left in place
+void free_buffer_pool(buffer_pool *pool) {
+	flush_buffer_pool(pool);
+	close(pool->fd);
+
+	free(pool->frames[0].data);
+	free(pool->frames);
+	free(pool->page_frames);
+	free(pool);
+}
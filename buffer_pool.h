@@ -0,0 +1,84 @@
+#ifndef _buffer_pool_h
+#define _buffer_pool_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Fixed-size pages of a file cached in a bounded number of in-memory frames.
+*
+* A page has to be pinned (pin_page or allocate_page) while it is being read or changed, and unpinned afterwards,
+* saying whether it was changed. Once every frame is taken, the next page read evicts an unpinned page picked by the
+* CLOCK algorithm (each frame has a reference bit that the clock hand clears on its first pass and evicts on its
+* second), writing it back to the file first if it is dirty. The memory used is fixed when the pool is created, so a
+* tree stored in its pages can grow far past memory_budget; only the file grows.
+*
+* prefetch_page asks the kernel to start reading a page that is about to be pinned (posix_fadvise WILLNEED), so the
+* reads for several pages can be in flight while the caller is still working on the current one
+*/
+
+#define POOL_PAGE_SIZE 4096
+
+// Fewest frames a pool is created with, whatever its memory budget. Each frame holds one page
+#define POOL_MIN_FRAMES 16
+
+
+typedef struct pool_frame {
+	// Page held by the frame, -1 if it is free
+	long page_id;
+	int pin_count;
+	bool dirty;
+	bool referenced;
+	void *data;
+} pool_frame;
+
+
+typedef struct buffer_pool {
+	int fd;
+	long num_pages;
+
+	pool_frame *frames;
+	long num_frames;
+	long clock_hand;
+
+	// Frame holding each page, -1 if the page is only on disk. Grows with num_pages
+	long *page_frames;
+	long page_frames_capacity;
+
+	// For benchmarking
+	long num_hits;
+	long num_reads;
+	long num_writes;
+	long num_prefetches;
+} buffer_pool;
+
+
+// Creates a pool over a new (or truncated) file at path, with as many frames as fit in memory_budget bytes
+buffer_pool *create_buffer_pool(const char *path, long memory_budget);
+
+
+// Adds a zeroed page to the end of the file and returns it pinned. Its id is written to *page_id
+void *allocate_page(buffer_pool *pool, long *page_id);
+
+
+// Returns the contents of page page_id, reading it in if it isn't cached. The page stays in memory until unpinned
+void *pin_page(buffer_pool *pool, long page_id);
+
+
+// Releases a pin taken by pin_page or allocate_page. dirty says whether the page was changed while pinned
+void unpin_page(buffer_pool *pool, long page_id, bool dirty);
+
+
+// Starts reading page page_id in the background if it isn't cached
+void prefetch_page(buffer_pool *pool, long page_id);
+
+
+// Writes every dirty page back to the file
+void flush_buffer_pool(buffer_pool *pool);
+
+
+// Writes back every dirty page, closes the file and frees the pool. The file itself is left in place
+void free_buffer_pool(buffer_pool *pool);
+
+
+#endif
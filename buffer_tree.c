@@ -0,0 +1,349 @@
+#include "r_tree.h"
+#include "choose_leaf.h"
+#include "buffer_tree.h"
+
+
+// Appends ir to node's buffer, creating the buffer if node has none yet
+static void buffer_append(r_tree_node *node, index_record *ir) {
+	node_buffer *buffer = node->buffer;
+
+	if (buffer == NULL) {
+		buffer = (node_buffer *)malloc(sizeof(node_buffer));
+
+		if (buffer == NULL) {
+			fprintf(stderr, "Malloc failed in buffer_append(). Exiting program\n");
+			exit(1);
+		}
+
+		buffer->records = NULL;
+		buffer->num_records = 0;
+		buffer->capacity = 0;
+		node->buffer = buffer;
+	}
+
+	if (buffer->num_records == buffer->capacity) {
+		buffer->capacity = buffer->capacity == 0 ? 16 : buffer->capacity * 2;
+		buffer->records = (index_record **)realloc(buffer->records, sizeof(index_record *) * buffer->capacity);
+
+		if (buffer->records == NULL) {
+			fprintf(stderr, "Realloc failed in buffer_append(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	buffer->records[buffer->num_records++] = ir;
+}
+
+
+// Moves the records waiting in bt->pending into records, leaving bt->pending empty. Returns how many there were
+static long take_pending(buffer_tree *bt, index_record ***records) {
+	long num_records = bt->num_pending;
+
+	*records = bt->pending;
+	bt->pending = NULL;
+	bt->num_pending = 0;
+	bt->pending_capacity = 0;
+
+	return num_records;
+}
+
+
+static void add_pending(buffer_tree *bt, index_record *ir) {
+	if (bt->num_pending == bt->pending_capacity) {
+		bt->pending_capacity = bt->pending_capacity == 0 ? 16 : bt->pending_capacity * 2;
+		bt->pending = (index_record **)realloc(bt->pending, sizeof(index_record *) * bt->pending_capacity);
+
+		if (bt->pending == NULL) {
+			fprintf(stderr, "Realloc failed in add_pending(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	bt->pending[bt->num_pending++] = ir;
+}
+
+
+// Routes records (all covered by the MBR of the last node on path) into that node's children: into their buffers, or
+// straight into them if they are leaves. Returns how many nodes at the top of path are still where path says they are,
+// which is path->depth unless a leaf split climbed past the node. In that case the records not placed yet are left in
+// bt->pending for the deepest node the split did not reach
+static int distribute(buffer_tree *bt, tree_path *path, index_record **records, long num_records) {
+	r_tree_node *node = path->nodes[path->depth - 1];
+	int depth = path->depth;
+	long i;
+
+	bool leaves_below = is_leaf(node->index_records[0]->child);
+
+	for (i = 0; i < num_records; i++) {
+		index_record *ir = records[i];
+		int index = sequential_get_insertion_index(node, ir);
+		index_record *child_ir = node->index_records[index];
+
+		if (!leaves_below) {
+			expand_mbr(child_ir->mbr, ir->mbr);
+			buffer_append(child_ir->child, ir);
+			continue;
+		}
+
+		// A split climbs from the leaf through every full node above it, so the first node that isn't full
+		// (and everything above that) stays put
+		int intact = depth;
+
+		if (is_full(child_ir->child)) {
+			while (intact > 0 && is_full(path->nodes[intact - 1]))
+				intact--;
+		}
+
+		path->indices[depth - 1] = index;
+		push_path(path, child_ir->child, -1);
+		insert_at_node(path, ir, &bt->root, 1);
+		path->depth = depth;
+		bt->num_buffered--;
+
+		if (intact < depth) {
+			for (i = i + 1; i < num_records; i++)
+				add_pending(bt, records[i]);
+
+			return intact;
+		}
+	}
+
+	return depth;
+}
+
+
+// Whether the child child_ir points to overlaps window (if given) and has at least min_records buffered
+static bool needs_flush(index_record *child_ir, MBR *window, long min_records) {
+	node_buffer *buffer = child_ir->child->buffer;
+
+	if (window != NULL && !mbr_overlaps(child_ir->mbr, window))
+		return false;
+
+	if (min_records == 0)
+		return true;
+
+	return buffer != NULL && buffer->num_records >= min_records;
+}
+
+
+// Empties the buffer of the last node on path into its children, then goes on to the children whose buffers filled up.
+// With force it goes on to every child overlapping window (or every child if window is NULL) instead, however little
+// their buffers hold. Returns the same as distribute
+static int flush_node(buffer_tree *bt, tree_path *path, MBR *window, bool force) {
+	r_tree_node *node = path->nodes[path->depth - 1];
+	int depth = path->depth;
+	index_record **records;
+	long num_records;
+	int intact;
+	int i, j;
+
+	if (is_leaf(node))
+		return depth;
+
+	if (node->buffer != NULL && node->buffer->num_records > 0) {
+		// Detached up front, so nothing on the path holds buffered records if a split comes up through it
+		records = node->buffer->records;
+		num_records = node->buffer->num_records;
+
+		node->buffer->records = NULL;
+		node->buffer->num_records = 0;
+		node->buffer->capacity = 0;
+		bt->num_flushes++;
+
+		intact = distribute(bt, path, records, num_records);
+		free(records);
+
+		if (intact < depth)
+			return intact;
+	}
+
+	if (is_leaf(node->index_records[0]->child))
+		return depth;
+
+	// Splits below can add members to node, which land at the end and are still visited
+	for (i = 0; i < node->num_members; i++) {
+		index_record *child_ir = node->index_records[i];
+
+		if (!needs_flush(child_ir, window, force ? 0 : bt->buffer_size))
+			continue;
+
+		path->indices[depth - 1] = i;
+		push_path(path, child_ir->child, -1);
+		intact = flush_node(bt, path, window, force);
+		path->depth = depth;
+
+		if (intact < depth)
+			return intact;
+
+		if (intact == depth + 1)
+			continue;
+
+		// A split stopped at node, so the records left over from below are node's to place
+		while (bt->num_pending > 0) {
+			num_records = take_pending(bt, &records);
+			intact = distribute(bt, path, records, num_records);
+			free(records);
+
+			if (intact < depth)
+				return intact;
+		}
+
+		// The child's flush was cut short and the leftover records may have gone to children already visited, so go
+		// back to the first one they filled (any at all with force). Every split places a record, so this ends
+		for (j = 0; j < i && !needs_flush(node->index_records[j], window, force ? 1 : bt->buffer_size); j++)
+			;
+
+		i = j - 1;
+	}
+
+	return depth;
+}
+
+
+// Empties the root's buffer and then every buffer flush_node picks out below it. Only a root split, after which
+// nothing on the path is where it was, makes it start over from the new root
+static void flush_from_root(buffer_tree *bt, MBR *window, bool force) {
+	tree_path path;
+	index_record **records;
+	long num_records, i;
+
+	while (true) {
+		path.depth = 0;
+		push_path(&path, bt->root, -1);
+
+		if (flush_node(bt, &path, window, force) > 0)
+			break;
+
+		num_records = take_pending(bt, &records);
+
+		for (i = 0; i < num_records; i++)
+			buffer_append(bt->root, records[i]);
+
+		free(records);
+	}
+}
+
+
+// Creates an empty buffer_tree whose nodes hold up to max_members index_records and whose buffers are emptied
+// once they hold buffer_size records
+buffer_tree *create_buffer_tree(int max_members, long buffer_size) {
+	buffer_tree *bt = (buffer_tree *)malloc(sizeof(buffer_tree));
+
+	if (bt == NULL) {
+		fprintf(stderr, "Malloc failed in create_buffer_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	bt->root = initialize_rt(max_members);
+	bt->buffer_size = buffer_size > 0 ? buffer_size : 1;
+	bt->num_buffered = 0;
+	bt->num_flushes = 0;
+	bt->pending = NULL;
+	bt->num_pending = 0;
+	bt->pending_capacity = 0;
+
+	return bt;
+}
+
+
+// Adds ir to the tree, usually just by appending it to the root's buffer
+void buffer_tree_insert(buffer_tree *bt, index_record *ir) {
+	// Until the root splits for the first time there are no internal nodes to buffer at
+	if (is_leaf(bt->root)) {
+		insert(&bt->root, ir, 1);
+		return;
+	}
+
+	buffer_append(bt->root, ir);
+	bt->num_buffered++;
+
+	if (bt->root->buffer->num_records >= bt->buffer_size)
+		flush_from_root(bt, NULL, false);
+}
+
+
+// Pushes every buffered record down into the leaves
+void flush_buffer_tree(buffer_tree *bt) {
+	flush_from_root(bt, NULL, true);
+}
+
+
+// Recursive part of buffer_tree_search
+static long search_buffered(r_tree_node *node, MBR *window, search_callback callback, void *arg) {
+	long found = 0;
+	long i;
+
+	if (node->buffer != NULL) {
+		for (i = 0; i < node->buffer->num_records; i++) {
+			index_record *curr_ir = node->buffer->records[i];
+
+			if (!mbr_overlaps(curr_ir->mbr, window))
+				continue;
+
+			if (callback != NULL)
+				callback(curr_ir, arg);
+			found++;
+		}
+	}
+
+	if (node->num_members == 0)
+		return found;
+
+	bool leaf = is_leaf(node);
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *curr_ir = node->index_records[i];
+
+		if (!mbr_overlaps(curr_ir->mbr, window))
+			continue;
+
+		if (leaf) {
+			if (callback != NULL)
+				callback(curr_ir, arg);
+			found++;
+		} else {
+			found += search_buffered(curr_ir->child, window, callback, arg);
+		}
+	}
+
+	return found;
+}
+
+
+// Same as search() in r_tree.h, also returning the buffered records overlapping window. With flush_first, the buffers
+// of every node the search visits are emptied into the leaves beforehand, so later searches there find no buffers
+long buffer_tree_search(buffer_tree *bt, MBR *window, bool flush_first, search_callback callback, void *arg) {
+	if (flush_first)
+		flush_from_root(bt, window, true);
+
+	return search_buffered(bt->root, window, callback, arg);
+}
+
+
+// Frees every buffer below node, along with the records still in them
+static void free_buffers(r_tree_node *node) {
+	long i;
+
+	if (node->buffer != NULL) {
+		for (i = 0; i < node->buffer->num_records; i++)
+			free_index_record(node->buffer->records[i]);
+
+		free(node->buffer->records);
+		free(node->buffer);
+		node->buffer = NULL;
+	}
+
+	if (is_leaf(node))
+		return;
+
+	for (i = 0; i < node->num_members; i++)
+		free_buffers(node->index_records[i]->child);
+}
+
+
+// Frees the tree (including the index_records inserted into it, buffered or not)
+void free_buffer_tree(buffer_tree *bt) {
+	free_buffers(bt->root);
+	free_tree(bt->root);
+	free(bt);
+}
@@ -0,0 +1,69 @@
+#ifndef _buffer_tree_h
+#define _buffer_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Buffer r-tree with lazy insertion (after Arge et al.).
+*
+* Every internal r_tree_node can carry a buffer of records that still have to be pushed down. An insertion only appends
+* to the root's buffer. Once a buffer holds buffer_size records it is emptied in one go: each record is routed to a
+* child with sequential_get_insertion_index, the child's MBR grows to cover it and the record lands in the child's
+* buffer (or, below the last internal level, goes into the leaf through insert_at_node). Then any child buffer that
+* filled up is emptied the same way. Each node visit and insertion-index scan is shared by a whole buffer of records.
+*
+* A node's MBR always covers the records buffered anywhere below it, so searches stay correct by also scanning the
+* buffers of the nodes they visit, or they can have those buffers flushed first.
+*
+* Splits only happen along the path of the buffer being emptied, and every buffer on that path has already been
+* detached, so a node never splits while holding buffered records. A leaf split that climbs past the last internal
+* level does leave the path below the highest split node stale, so the flush unwinds to the deepest node the split did
+* not reach and carries on from there with the records it had not placed yet (all still inside that node's MBR)
+*/
+
+typedef struct node_buffer {
+	index_record **records;
+	long num_records;
+	long capacity;
+} node_buffer;
+
+
+typedef struct buffer_tree {
+	r_tree_node *root;
+	long buffer_size;
+
+	// Records a flush still has to place after a split cut it short
+	index_record **pending;
+	long num_pending;
+	long pending_capacity;
+
+	// Records sitting in buffers, and the number of buffers emptied, for benchmarking
+	long num_buffered;
+	long num_flushes;
+} buffer_tree;
+
+
+// Creates an empty buffer_tree whose nodes hold up to max_members index_records and whose buffers are emptied
+// once they hold buffer_size records
+buffer_tree *create_buffer_tree(int max_members, long buffer_size);
+
+
+// Adds ir to the tree, usually just by appending it to the root's buffer
+void buffer_tree_insert(buffer_tree *bt, index_record *ir);
+
+
+// Pushes every buffered record down into the leaves
+void flush_buffer_tree(buffer_tree *bt);
+
+
+// Same as search() in r_tree.h, also returning the buffered records overlapping window. With flush_first, the buffers
+// of every node the search visits are emptied into the leaves beforehand, so later searches there find no buffers
+long buffer_tree_search(buffer_tree *bt, MBR *window, bool flush_first, search_callback callback, void *arg);
+
+
+// Frees the tree (including the index_records inserted into it, buffered or not)
+void free_buffer_tree(buffer_tree *bt);
+
+
+#endif
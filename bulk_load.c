@@ -0,0 +1,189 @@
+#include "r_tree.h"
+#include "bulk_load.h"
+
+
+static double centre_x(index_record *ir) {
+	return ((double)ir->mbr->min_x + ir->mbr->max_x) / 2;
+}
+
+
+static double centre_y(index_record *ir) {
+	return ((double)ir->mbr->min_y + ir->mbr->max_y) / 2;
+}
+
+
+static int compare_centre_x(const void *a, const void *b) {
+	double centre_a = centre_x(*(index_record **)a);
+	double centre_b = centre_x(*(index_record **)b);
+	return (centre_a > centre_b) - (centre_a < centre_b);
+}
+
+
+static int compare_centre_y(const void *a, const void *b) {
+	double centre_a = centre_y(*(index_record **)a);
+	double centre_b = centre_y(*(index_record **)b);
+	return (centre_a > centre_b) - (centre_a < centre_b);
+}
+
+
+// Puts entries[0 .. num_entries) into one new node, returning the index_record pointing to it
+static index_record *pack_node(index_record **entries, int num_entries, int max_members) {
+	index_record *node_ir = initialize_split_node(max_members, entries[0]->mbr);
+	int i;
+
+	for (i = 0; i < num_entries; i++) {
+		add_member(node_ir->child, entries[i]);
+		expand_mbr(node_ir->mbr, entries[i]->mbr);
+		add_aggregate(&node_ir->agg, &entries[i]->agg);
+	}
+
+	return node_ir;
+}
+
+
+// Packs one level of num_entries entries into nodes of up to fanout of them (fanout being at most max_members),
+// writing the index_records pointing to the new nodes to the front of entries. Returns how many nodes were made
+static long pack_level(index_record **entries, long num_entries, int max_members, int fanout) {
+	long num_nodes = (num_entries + fanout - 1) / fanout;
+	long num_slices = (long) ceil(sqrt((double)num_nodes));
+	long slice_size = ((num_nodes + num_slices - 1) / num_slices) * fanout;
+	long start, i, made = 0;
+
+	qsort(entries, num_entries, sizeof(index_record *), compare_centre_x);
+
+	for (start = 0; start < num_entries; start += slice_size) {
+		long slice_end = start + slice_size < num_entries ? start + slice_size : num_entries;
+
+		qsort(entries + start, slice_end - start, sizeof(index_record *), compare_centre_y);
+
+		// The nodes made so far always take up fewer slots than the entries already packed, so writing them to
+		// the front of entries never overwrites an entry that still has to be packed
+		for (i = start; i < slice_end; i += fanout) {
+			int run = slice_end - i < fanout ? slice_end - i : fanout;
+			entries[made++] = pack_node(entries + i, run, max_members);
+		}
+	}
+
+	return made;
+}
+
+
+// Packs num_records leaf-level index_records into as few subtrees of at most max_height levels as possible
+// (a height of 1 means leaves). Returns a malloc'd array of the index_records pointing to the subtree roots, with their
+// number in *num_subtrees and their (shared) height in *subtree_height. Used to graft the records into an existing
+// tree with insert_subtree
+index_record **bulk_load_subtrees(index_record **records, long num_records, int max_members, int max_height, long *num_subtrees, int *subtree_height) {
+	index_record **entries = (index_record **)malloc(sizeof(index_record *) * (num_records > 0 ? num_records : 1));
+	long num_entries = num_records;
+	int height;
+
+	if (entries == NULL) {
+		fprintf(stderr, "Malloc failed in bulk_load_subtrees(). Exiting program\n");
+		exit(1);
+	}
+
+	memcpy(entries, records, sizeof(index_record *) * num_records);
+
+	// Stop early once everything fits under a single subtree root
+	for (height = 0; height < max_height && num_entries > 1; height++)
+		num_entries = pack_level(entries, num_entries, max_members, max_members);
+
+	// A single record still needs a leaf to go into
+	if (height == 0 && num_entries == 1 && max_height > 0) {
+		num_entries = pack_level(entries, num_entries, max_members, max_members);
+		height = 1;
+	}
+
+	*num_subtrees = num_entries;
+	*subtree_height = height;
+	return entries;
+}
+
+
+// Packs num_records leaf-level index_records into a new tree and returns its root. The tree takes ownership of them
+r_tree_node *bulk_load(index_record **records, long num_records, int max_members) {
+	r_tree_node *root = initialize_rt(max_members);
+	long num_entries = num_records;
+	long i;
+
+	index_record **entries = (index_record **)malloc(sizeof(index_record *) * (num_records > 0 ? num_records : 1));
+
+	if (entries == NULL) {
+		fprintf(stderr, "Malloc failed in bulk_load(). Exiting program\n");
+		exit(1);
+	}
+
+	memcpy(entries, records, sizeof(index_record *) * num_records);
+
+	// Pack levels until the rest fits into the root
+	while (num_entries > max_members)
+		num_entries = pack_level(entries, num_entries, max_members, max_members);
+
+	for (i = 0; i < num_entries; i++)
+		add_member(root, entries[i]);
+
+	free(entries);
+	return root;
+}
+
+
+// Number of entries levels levels of nodes of fanout members hold
+static double level_capacity(int fanout, int levels) {
+	double capacity = 1;
+	int i;
+
+	for (i = 0; i < levels; i++)
+		capacity *= fanout;
+
+	return capacity;
+}
+
+
+// Smallest fanout that fits num_entries entries under levels levels of nodes
+static int even_fanout(long num_entries, int levels) {
+	int fanout = (int) ceil(pow((double)num_entries, 1.0 / levels));
+
+	// pow can land either side of an exact root
+	if (fanout < 1)
+		fanout = 1;
+	while (level_capacity(fanout, levels) < num_entries)
+		fanout++;
+	while (fanout > 1 && level_capacity(fanout - 1, levels) >= num_entries)
+		fanout--;
+
+	return fanout;
+}
+
+
+// Same as bulk_load, but the tree is exactly height levels tall (a height of 1 means a single leaf). The records are
+// spread evenly over the levels: every level's nodes get about num_records^(1/height) members, so the root has
+// several children instead of the levels the records don't fill being single-member nodes.
+// num_records has to be between 1 and max_members^height. Used to rebuild a subtree in place without changing the
+// height of the tree around it
+r_tree_node *bulk_load_height(index_record **records, long num_records, int max_members, int height) {
+	r_tree_node *root = initialize_rt(max_members);
+	long num_entries = num_records;
+	long i;
+	int level;
+
+	index_record **entries = (index_record **)malloc(sizeof(index_record *) * num_records);
+
+	if (entries == NULL) {
+		fprintf(stderr, "Malloc failed in bulk_load_height(). Exiting program\n");
+		exit(1);
+	}
+
+	memcpy(entries, records, sizeof(index_record *) * num_records);
+
+	// Every level below the root, each with the fanout that spreads what is left evenly over the levels still to go
+	for (level = height; level > 1; level--) {
+		int fanout = even_fanout(num_entries, level);
+		num_entries = pack_level(entries, num_entries, max_members, fanout < max_members ? fanout : max_members);
+	}
+
+	for (i = 0; i < num_entries; i++)
+		add_member(root, entries[i]);
+
+	free(entries);
+	return root;
+}
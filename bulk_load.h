@@ -0,0 +1,34 @@
+#ifndef _bulk_load_h
+#define _bulk_load_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* Sort-Tile-Recursive bulk loading.
+*
+* Each level is packed bottom-up: the entries are sorted by the x centre of their MBRs and cut into vertical slices,
+* each slice is sorted by y centre and cut into runs of max_members entries, and every run becomes one full node.
+* The records are never passed through choose_leaf or split_node, and every node except the last of a slice is full
+*/
+
+// Packs num_records leaf-level index_records into a new tree and returns its root. The tree takes ownership of them
+r_tree_node *bulk_load(index_record **records, long num_records, int max_members);
+
+
+// Packs num_records leaf-level index_records into as few subtrees of at most max_height levels as possible
+// (a height of 1 means leaves). Returns a malloc'd array of the index_records pointing to the subtree roots, with their
+// number in *num_subtrees and their (shared) height in *subtree_height. Used to graft the records into an existing
+// tree with insert_subtree
+index_record **bulk_load_subtrees(index_record **records, long num_records, int max_members, int max_height, long *num_subtrees, int *subtree_height);
+
+
+// Same as bulk_load, but the tree is exactly height levels tall (a height of 1 means a single leaf). The records are
+// spread evenly over the levels: every level's nodes get about num_records^(1/height) members, so the root has
+// several children instead of the levels the records don't fill being single-member nodes.
+// num_records has to be between 1 and max_members^height. Used to rebuild a subtree in place without changing the
+// height of the tree around it
+r_tree_node *bulk_load_height(index_record **records, long num_records, int max_members, int height);
+
+
+#endif
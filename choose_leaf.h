@@ -8,10 +8,6 @@
 #include <unistd.h>
 
 
-double min_enlargements[NUM_CORES];
-int min_enlargement_indices[NUM_CORES];
-
-
 // Used to store the parameters to be passed to the function for each thread which finds the minimum enlargement of an MBR when inserting a
 // new record
 typedef struct param0 {
@@ -22,8 +18,9 @@ typedef struct param0 {
 	int start_index;
 	int end_index;
 
-	// Index into the static array min_enlargements in which to write the result
-	int result_index;
+	// Written by the thread: the smallest enlargement in its subset and the index of the index_record that needs it
+	double min_enlargement;
+	int min_enlargement_index;
 } param0;
 
 
@@ -36,16 +33,17 @@ int sequential_get_insertion_index(r_tree_node *rt, index_record *insertion_ir);
 void *parallel_get_insertion_index(void *arg);
 
 
-// Used to initialize shared memory objects for the threads when they need to get the insertion index for a new record
-param0 **initialize_threads(r_tree_node *rt, index_record *insertion_ir, int num_threads);
+// Used to initialize the caller-owned param_objects array (one per thread) when the threads need to get the insertion index for a new record
+void initialize_threads(param0 *param_objects, r_tree_node *rt, index_record *insertion_ir, int num_threads);
 
 
 // Find the optimal leaf for insertion. Programmed according to Antonin Guttman's instructions in his 1984 paper
 // I decided to not account for ties due to the great unlikelihood of there being an exact tie
-r_tree_node *choose_leaf_sequential(r_tree_node *node, index_record *new_record);
+// The descent is recorded in path so that adjust_tree and insert_at_node can walk back up without back-pointers
+r_tree_node *choose_leaf_sequential(r_tree_node *node, index_record *new_record, tree_path *path);
 
 
-r_tree_node *choose_leaf_parallel(r_tree_node *node, index_record *new_record, int num_threads);
+r_tree_node *choose_leaf_parallel(r_tree_node *node, index_record *new_record, int num_threads, tree_path *path);
 
 
 #endif
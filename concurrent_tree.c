@@ -0,0 +1,240 @@
+#include "r_tree.h"
+#include "choose_leaf.h"
+#include "adjust_tree.h"
+#include "concurrent_tree.h"
+
+
+// Coordinates of MBRs readers can see are only ever grown, one coordinate at a time, so they are read and
+// written atomically but need no ordering of their own
+static coord_t load_coord(coord_t *coord) {
+	coord_t value;
+	__atomic_load(coord, &value, __ATOMIC_RELAXED);
+	return value;
+}
+
+
+static void store_coord(coord_t *coord, coord_t value) {
+	__atomic_store(coord, &value, __ATOMIC_RELAXED);
+}
+
+
+// Same as mbr_overlaps, for an MBR the writer might be growing
+static bool shared_mbr_overlaps(MBR *mbr, MBR *window) {
+	return load_coord(&mbr->min_x) <= window->max_x && window->min_x <= load_coord(&mbr->max_x) &&
+		load_coord(&mbr->min_y) <= window->max_y && window->min_y <= load_coord(&mbr->max_y);
+}
+
+
+// Same as expand_mbr, for an MBR readers can see
+static void expand_shared_mbr(MBR *mbr, MBR *child_mbr) {
+	if (child_mbr->min_x < mbr->min_x)
+		store_coord(&mbr->min_x, child_mbr->min_x);
+	if (child_mbr->min_y < mbr->min_y)
+		store_coord(&mbr->min_y, child_mbr->min_y);
+	if (child_mbr->max_x > mbr->max_x)
+		store_coord(&mbr->max_x, child_mbr->max_x);
+	if (child_mbr->max_y > mbr->max_y)
+		store_coord(&mbr->max_y, child_mbr->max_y);
+}
+
+
+static void retire_node(void *ptr) {
+	free_node((r_tree_node *)ptr);
+}
+
+
+static void retire_entry(void *ptr) {
+	free_entry((index_record *)ptr);
+}
+
+
+// Creates an empty concurrent_tree whose nodes hold up to max_members index_records
+concurrent_tree *create_concurrent_tree(int max_members) {
+	concurrent_tree *ct = (concurrent_tree *)malloc(sizeof(concurrent_tree));
+
+	if (ct == NULL) {
+		fprintf(stderr, "Malloc failed in create_concurrent_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	atomic_init(&ct->root, initialize_rt(max_members));
+	ct->epochs = create_epoch_domain();
+	pthread_mutex_init(&ct->writer_lock, NULL);
+
+	return ct;
+}
+
+
+// Registers the calling reader thread. Returns the reader slot it has to pass to concurrent_search
+int register_reader(concurrent_tree *ct) {
+	return epoch_register(ct->epochs);
+}
+
+
+// Inserts ir, publishing the change atomically for concurrent readers. num_threads works the same as in insert()
+void concurrent_insert(concurrent_tree *ct, index_record *ir, int num_threads) {
+	pthread_mutex_lock(&ct->writer_lock);
+
+	r_tree_node *root = atomic_load_explicit(&ct->root, memory_order_relaxed);
+	tree_path path;
+	int i;
+
+	if (num_threads > root->max_members) {
+		fprintf(stderr, "Cannot use more threads than number of max_members in your r_tree_node\n");
+		fprintf(stderr, "Aborting insertion\n");
+		exit(1);
+	}
+
+	if (num_threads > 1)
+		choose_leaf_parallel(root, ir, num_threads, &path);
+	else
+		choose_leaf_sequential(root, ir, &path);
+
+	// Grow the MBRs above the leaf first, so ir is covered by the time any reader can reach it
+	for (i = path.depth - 2; i >= 0; i--) {
+		MBR *mbr = path.nodes[i]->index_records[path.indices[i]]->mbr;
+
+		if (fully_contains(mbr, ir->mbr))
+			break;
+
+		expand_shared_mbr(mbr, ir->mbr);
+	}
+
+	// Readers never look at the aggregates, so they can be updated in place even on nodes about to be replaced
+	add_to_path(&path, &ir->agg);
+
+	r_tree_node *leaf = path.nodes[path.depth - 1];
+
+	if (!is_full(leaf)) {
+#if BACK_POINTERS
+		ir->host = leaf;
+		ir->index = leaf->num_members;
+#endif
+		// Readers only look at the slots below num_members, so the release store publishes ir
+		leaf->index_records[leaf->num_members] = ir;
+		__atomic_store_n(&leaf->num_members, leaf->num_members + 1, __ATOMIC_RELEASE);
+
+		pthread_mutex_unlock(&ct->writer_lock);
+		return;
+	}
+
+	// The index_records pointing to each node on the path, which are replaced along with the nodes
+	index_record *path_irs[MAX_TREE_HEIGHT];
+
+	for (i = 1; i < path.depth; i++)
+		path_irs[i] = path.nodes[i - 1]->index_records[path.indices[i - 1]];
+
+	// Copy the full nodes bottom-up and split the copies, until a copy has room for what the split below it
+	// sends up (or the root splits). replacement is the index_record standing in for the copied child
+	int level = path.depth - 1;
+	index_record *replacement = NULL;
+	index_record *carry = ir;
+	r_tree_node *copy;
+
+	while (true) {
+		copy = copy_node(path.nodes[level]);
+
+		if (replacement != NULL) {
+			copy->index_records[path.indices[level]] = replacement;
+#if BACK_POINTERS
+			replacement->host = copy;
+			replacement->index = path.indices[level];
+#endif
+		}
+
+		if (add_member(copy, carry))
+			break;
+
+		replacement = initialize_ir(copy_mbr(carry->mbr));
+		replacement->child = copy;
+#if BACK_POINTERS
+		copy->parent = replacement;
+#endif
+		carry = split_node(copy, replacement, carry, num_threads);
+
+		if (level == 0) {
+			// The root split, so the tree grows by one level
+			copy = initialize_rt(root->max_members);
+			add_member(copy, replacement);
+			add_member(copy, carry);
+			break;
+		}
+
+		level--;
+	}
+
+	// copy is the new version of path.nodes[level]. Swapping it in is the only change readers can see
+	if (level == 0) {
+		atomic_store_explicit(&ct->root, copy, memory_order_release);
+	} else {
+		r_tree_node *parent = path.nodes[level - 1];
+		index_record *copy_ir = initialize_ir(copy_mbr(path_irs[level]->mbr));
+
+		copy_ir->child = copy;
+		copy_ir->agg = path_irs[level]->agg;
+#if BACK_POINTERS
+		copy->parent = copy_ir;
+		copy_ir->host = parent;
+		copy_ir->index = path.indices[level - 1];
+#endif
+		__atomic_store_n(&parent->index_records[path.indices[level - 1]], copy_ir, __ATOMIC_RELEASE);
+	}
+
+	// Readers that started before the swap may still be in the old nodes, so they are only freed once those are done
+	for (i = level; i < path.depth; i++) {
+		if (i > 0 && !path.nodes[i]->embeds_entry)
+			epoch_retire(ct->epochs, path_irs[i], retire_entry);
+
+		epoch_retire(ct->epochs, path.nodes[i], retire_node);
+	}
+
+	pthread_mutex_unlock(&ct->writer_lock);
+}
+
+
+// Recursive part of concurrent_search, run inside an epoch critical section
+static long search_published(r_tree_node *node, MBR *window, search_callback callback, void *arg) {
+	int num_members = __atomic_load_n(&node->num_members, __ATOMIC_ACQUIRE);
+	long found = 0;
+	int i;
+
+	for (i = 0; i < num_members; i++) {
+		index_record *curr_ir = __atomic_load_n(&node->index_records[i], __ATOMIC_ACQUIRE);
+
+		if (!shared_mbr_overlaps(curr_ir->mbr, window))
+			continue;
+
+		if (curr_ir->child == NULL) {
+			if (callback != NULL)
+				callback(curr_ir, arg);
+			found++;
+		} else {
+			found += search_published(curr_ir->child, window, callback, arg);
+		}
+	}
+
+	return found;
+}
+
+
+// Same as search() in r_tree.h, but safe to run while another thread inserts. Never blocks.
+// reader is the slot returned by register_reader for the calling thread
+long concurrent_search(concurrent_tree *ct, int reader, MBR *window, search_callback callback, void *arg) {
+	epoch_enter(ct->epochs, reader);
+
+	long found = search_published(atomic_load_explicit(&ct->root, memory_order_acquire), window, callback, arg);
+
+	epoch_exit(ct->epochs, reader);
+
+	return found;
+}
+
+
+// Frees the tree (including the index_records inserted into it) and everything still waiting to be reclaimed.
+// No reader or writer may be using it
+void free_concurrent_tree(concurrent_tree *ct) {
+	free_tree(atomic_load(&ct->root));
+	free_epoch_domain(ct->epochs);
+	pthread_mutex_destroy(&ct->writer_lock);
+	free(ct);
+}
@@ -0,0 +1,53 @@
+#ifndef _concurrent_tree_h
+#define _concurrent_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+/* R-tree that lock-free readers can search while one writer inserts.
+*
+* An insertion that fits in its leaf fills the next free slot and then publishes it by bumping num_members, after the
+* MBRs above the leaf have been grown to cover it. An insertion that splits never touches a node readers can see:
+* every node on the path that changes is copied, the copies are split privately with split_node, and the whole new
+* subtree is published with a single atomic store, either of the index_record slot pointing to it in its (unchanged)
+* parent or of the root. Readers therefore see the tree either before or after each split, never halfway through.
+* The replaced nodes and index_records are retired through an epoch_domain and freed once no reader can reach them.
+*
+* Writers are serialised by writer_lock. Readers never take it
+*/
+
+typedef struct concurrent_tree {
+	_Atomic(r_tree_node *) root;
+	epoch_domain *epochs;
+	pthread_mutex_t writer_lock;
+} concurrent_tree;
+
+
+// Creates an empty concurrent_tree whose nodes hold up to max_members index_records
+concurrent_tree *create_concurrent_tree(int max_members);
+
+
+// Registers the calling reader thread. Returns the reader slot it has to pass to concurrent_search
+int register_reader(concurrent_tree *ct);
+
+
+// Inserts ir, publishing the change atomically for concurrent readers. num_threads works the same as in insert()
+void concurrent_insert(concurrent_tree *ct, index_record *ir, int num_threads);
+
+
+// Same as search() in r_tree.h, but safe to run while another thread inserts. Never blocks.
+// reader is the slot returned by register_reader for the calling thread
+long concurrent_search(concurrent_tree *ct, int reader, MBR *window, search_callback callback, void *arg);
+
+
+// Frees the tree (including the index_records inserted into it) and everything still waiting to be reclaimed.
+// No reader or writer may be using it
+void free_concurrent_tree(concurrent_tree *ct);
+
+
+#endif
@@ -0,0 +1,430 @@
+#include "r_tree.h"
+#include "math_utils.h"
+#include "work_pool.h"
+#include "dataset.h"
+
+#define TWO_PI 6.283185307179586
+
+// Streams of the records of a dataset and of its cluster centres. Every node of a seeded tree has a stream of its own
+// (see node_stream), which never equals these two
+#define RECORD_STREAM 0
+#define CLUSTER_STREAM 1
+
+// Random numbers drawn for each record of a dataset, and at most used by any distribution
+#define DRAWS_PER_RECORD 8
+
+
+// Returns output number counter of the random sequence named by seed and stream
+uint64_t counter_random(uint64_t seed, uint64_t stream, uint64_t counter) {
+	// The state SplitMix64 would reach after counter steps from a start picked by seed and stream
+	uint64_t start = mix64(mix64(seed) ^ stream);
+
+	return mix64(start + (counter + 1) * GOLDEN_GAMMA);
+}
+
+
+// Same as counter_random, scaled to a double in [0, 1)
+double counter_uniform(uint64_t seed, uint64_t stream, uint64_t counter) {
+	return (counter_random(seed, stream, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// Same as random_within_range, for draw counter of stream
+static inline double uniform_within_range(uint64_t seed, uint64_t stream, uint64_t counter, double min, double max) {
+	return min + counter_uniform(seed, stream, counter) * (max - min);
+}
+
+
+// Fills in spec with the given seed and distribution, and defaults for everything else (16 clusters with a spread of
+// 2, a skew of 3 and MBRs of at most 1 by 1 like random_small_mbr)
+void initialize_dataset_spec(dataset_spec *spec, uint64_t seed, dataset_distribution distribution) {
+	spec->seed = seed;
+	spec->distribution = distribution;
+	spec->num_clusters = 16;
+	spec->cluster_spread = 2;
+	spec->skew = 3;
+	spec->max_side = 1;
+}
+
+
+// Writes MBR number index of the dataset described by spec to mbr
+void dataset_mbr(dataset_spec *spec, long index, MBR *mbr) {
+	uint64_t first = (uint64_t)index * DRAWS_PER_RECORD;
+	uint64_t seed = spec->seed;
+	double x, y;
+
+	switch (spec->distribution) {
+	case DATASET_CLUSTERED: {
+		uint64_t cluster = (uint64_t)(counter_uniform(seed, RECORD_STREAM, first) * spec->num_clusters);
+		double centre_x = uniform_within_range(seed, CLUSTER_STREAM, 2 * cluster, 0, MAX_RAND_NUM);
+		double centre_y = uniform_within_range(seed, CLUSTER_STREAM, 2 * cluster + 1, 0, MAX_RAND_NUM);
+
+		// Box-Muller. 1 - u keeps the logarithm away from 0
+		double radius = sqrt(-2 * log(1 - counter_uniform(seed, RECORD_STREAM, first + 1))) * spec->cluster_spread;
+		double angle = TWO_PI * counter_uniform(seed, RECORD_STREAM, first + 2);
+
+		x = fmin(fmax(centre_x + radius * cos(angle), 0), MAX_RAND_NUM);
+		y = fmin(fmax(centre_y + radius * sin(angle), 0), MAX_RAND_NUM);
+		break;
+	}
+	case DATASET_SKEWED:
+		x = pow(counter_uniform(seed, RECORD_STREAM, first), spec->skew) * MAX_RAND_NUM;
+		y = pow(counter_uniform(seed, RECORD_STREAM, first + 1), spec->skew) * MAX_RAND_NUM;
+		break;
+	default:
+		x = uniform_within_range(seed, RECORD_STREAM, first, 0, MAX_RAND_NUM);
+		y = uniform_within_range(seed, RECORD_STREAM, first + 1, 0, MAX_RAND_NUM);
+		break;
+	}
+
+	double width = uniform_within_range(seed, RECORD_STREAM, first + 3, 0, spec->max_side);
+	double height = uniform_within_range(seed, RECORD_STREAM, first + 4, 0, spec->max_side);
+
+	// (x, y) is the centre, and the MBR is cut off at the edges of the box
+	mbr->min_x = coord_floor(fmax(x - width / 2, 0));
+	mbr->min_y = coord_floor(fmax(y - height / 2, 0));
+	mbr->max_x = coord_ceil(fmin(x + width / 2, MAX_RAND_NUM));
+	mbr->max_y = coord_ceil(fmin(y + height / 2, MAX_RAND_NUM));
+}
+
+
+typedef struct dataset_context {
+	dataset_spec *spec;
+	long num_mbrs;
+
+	// One of the two is filled in, the other is NULL
+	MBR *mbrs;
+	index_record **records;
+
+	atomic_long next_chunk;
+} dataset_context;
+
+
+// Hands out the next chunk of DATASET_CHUNK records
+static bool next_chunk(work_pool *pool, int worker, work_task *task) {
+	dataset_context *context = (dataset_context *)pool->context;
+	long chunk = atomic_fetch_add(&context->next_chunk, 1);
+
+	if (chunk * DATASET_CHUNK >= context->num_mbrs)
+		return false;
+
+	task->first = NULL;
+	task->second = NULL;
+	task->id = chunk;
+
+	return true;
+}
+
+
+// Generates the records of the chunk in task
+static void generate_chunk(work_pool *pool, int worker, work_task *task) {
+	dataset_context *context = (dataset_context *)pool->context;
+	long first = task->id * DATASET_CHUNK;
+	long last = first + DATASET_CHUNK < context->num_mbrs ? first + DATASET_CHUNK : context->num_mbrs;
+	long i;
+
+	for (i = first; i < last; i++) {
+		if (context->mbrs != NULL) {
+			dataset_mbr(context->spec, i, &context->mbrs[i]);
+		} else {
+			MBR mbr;
+
+			dataset_mbr(context->spec, i, &mbr);
+			context->records[i] = initialize_record(copy_mbr(&mbr), i);
+		}
+	}
+}
+
+
+// Generates the dataset into exactly one of mbrs and records
+static void run_dataset(dataset_spec *spec, long num_mbrs, int num_threads, MBR *mbrs, index_record **records) {
+	dataset_context context;
+
+	context.spec = spec;
+	context.num_mbrs = num_mbrs;
+	context.mbrs = mbrs;
+	context.records = records;
+	atomic_init(&context.next_chunk, 0);
+
+	work_pool *pool = create_work_pool(num_threads, generate_chunk, &context);
+	pool->source = next_chunk;
+
+	run_work_pool(pool);
+	free_work_pool(pool);
+}
+
+
+// Returns a malloc'd array of the first num_mbrs MBRs of the dataset, generated on num_threads threads
+MBR *generate_dataset(dataset_spec *spec, long num_mbrs, int num_threads) {
+	MBR *mbrs = (MBR *)malloc(sizeof(MBR) * (num_mbrs > 0 ? num_mbrs : 1));
+
+	if (mbrs == NULL) {
+		fprintf(stderr, "Malloc failed in generate_dataset(). Exiting program\n");
+		exit(1);
+	}
+
+	run_dataset(spec, num_mbrs, num_threads, mbrs, NULL);
+
+	return mbrs;
+}
+
+
+// Returns a malloc'd array of num_records leaf-level index_records holding the first num_records MBRs of the dataset,
+// generated on num_threads threads. Record i has id i
+index_record **generate_records(dataset_spec *spec, long num_records, int num_threads) {
+	index_record **records = (index_record **)malloc(sizeof(index_record *) * (num_records > 0 ? num_records : 1));
+
+	if (records == NULL) {
+		fprintf(stderr, "Malloc failed in generate_records(). Exiting program\n");
+		exit(1);
+	}
+
+	run_dataset(spec, num_records, num_threads, NULL, records);
+
+	return records;
+}
+
+
+typedef struct tree_context {
+	uint64_t seed;
+	int max_levels;
+	int members_per_node;
+
+	// Level at which the tree is split into subtrees, and the nodes at that level (with the index_records pointing to
+	// them, NULL for the root) in pre-order, which is also the order of their offsets
+	int split_level;
+	r_tree_node **nodes;
+	index_record **parents;
+	long num_nodes;
+
+	atomic_long next_node;
+} tree_context;
+
+
+// A node's offset is its position among the nodes of its level, counting from the left. Both together name its stream
+static inline uint64_t node_stream(int level, uint64_t offset) {
+	return ((uint64_t)(level + 1) << 56) | offset;
+}
+
+
+// Same as random_mbr, drawing the coordinates of member index of the node named by stream
+static MBR *seeded_mbr(uint64_t seed, uint64_t stream, int index, index_record *parent) {
+	double min_min_x = 0, min_min_y = 0, max_max_x = MAX_RAND_NUM, max_max_y = MAX_RAND_NUM;
+	uint64_t first = (uint64_t)index * 4;
+	MBR mbr;
+
+	if (parent != NULL) {
+		min_min_x = parent->mbr->min_x;
+		min_min_y = parent->mbr->min_y;
+		max_max_x = parent->mbr->max_x;
+		max_max_y = parent->mbr->max_y;
+	}
+
+	double x1 = uniform_within_range(seed, stream, first, min_min_x, max_max_x);
+	double x2 = uniform_within_range(seed, stream, first + 1, min_min_x, max_max_x);
+	double y1 = uniform_within_range(seed, stream, first + 2, min_min_y, max_max_y);
+	double y2 = uniform_within_range(seed, stream, first + 3, min_min_y, max_max_y);
+
+	mbr.min_x = coord_floor(fmin(x1, x2));
+	mbr.min_y = coord_floor(fmin(y1, y2));
+	mbr.max_x = coord_ceil(fmax(x1, x2));
+	mbr.max_y = coord_ceil(fmax(y1, y2));
+
+	return copy_mbr(&mbr);
+}
+
+
+// Fills node (at level, with the given offset) with its members. At the leaves they are records, otherwise they point
+// to new empty nodes
+static void fill_node(tree_context *context, r_tree_node *node, index_record *parent, int level, uint64_t offset) {
+	uint64_t stream = node_stream(level, offset);
+	int i;
+
+	for (i = 0; i < context->members_per_node; i++) {
+		MBR *mbr = seeded_mbr(context->seed, stream, i, parent);
+
+		if (level >= context->max_levels) {
+			add_member(node, initialize_record(mbr, offset * context->members_per_node + i));
+			continue;
+		}
+
+		index_record *new_ir = initialize_ir(mbr);
+		r_tree_node *child_node = initialize_rt(node->max_members);
+
+		new_ir->child = child_node;
+#if BACK_POINTERS
+		child_node->parent = new_ir;
+#endif
+
+		add_member(node, new_ir);
+	}
+}
+
+
+// Generates the whole subtree below node, like generate_random_subtree
+static void generate_subtree(tree_context *context, r_tree_node *node, index_record *parent, int level, uint64_t offset) {
+	int i;
+
+	fill_node(context, node, parent, level, offset);
+
+	if (level < context->max_levels) {
+		for (i = 0; i < node->num_members; i++) {
+			index_record *child_ir = node->index_records[i];
+			generate_subtree(context, child_ir->child, child_ir, level + 1, offset * context->members_per_node + i);
+		}
+	}
+
+	validate_node(node, parent);
+}
+
+
+// Generates the levels above split_level, writing the nodes reached at split_level to context->nodes
+static void generate_top(tree_context *context, r_tree_node *node, index_record *parent, int level, uint64_t offset) {
+	int i;
+
+	if (level == context->split_level) {
+		context->nodes[context->num_nodes] = node;
+		context->parents[context->num_nodes] = parent;
+		context->num_nodes++;
+		return;
+	}
+
+	fill_node(context, node, parent, level, offset);
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *child_ir = node->index_records[i];
+		generate_top(context, child_ir->child, child_ir, level + 1, offset * context->members_per_node + i);
+	}
+}
+
+
+// Validates the levels above split_level once the subtrees below them are done
+static void validate_top(tree_context *context, r_tree_node *node, index_record *parent, int level) {
+	int i;
+
+	if (level == context->split_level)
+		return;
+
+	for (i = 0; i < node->num_members; i++)
+		validate_top(context, node->index_records[i]->child, node->index_records[i], level + 1);
+
+	validate_node(node, parent);
+}
+
+
+// Hands out the next subtree at split_level
+static bool next_subtree(work_pool *pool, int worker, work_task *task) {
+	tree_context *context = (tree_context *)pool->context;
+	long index = atomic_fetch_add(&context->next_node, 1);
+
+	if (index >= context->num_nodes)
+		return false;
+
+	task->first = context->nodes[index];
+	task->second = context->parents[index];
+	task->id = index;
+
+	return true;
+}
+
+
+// Generates the subtree in task, whose offset is its index among the nodes at split_level
+static void generate_subtree_task(work_pool *pool, int worker, work_task *task) {
+	tree_context *context = (tree_context *)pool->context;
+
+	generate_subtree(context, (r_tree_node *)task->first, (index_record *)task->second, context->split_level, task->id);
+}
+
+
+// Same as generate_random_tree (with current_level 0), but drawing from seed instead of rand() and building separate
+// subtrees on num_threads threads. The leaf-level records are numbered from 0 in pre-order
+void generate_seeded_tree(r_tree_node *root, int max_levels, uint64_t seed, int num_threads) {
+	tree_context context;
+	long nodes_at_level = 1;
+
+	context.seed = seed;
+	context.max_levels = max_levels;
+	context.members_per_node = (int)ceil(root->max_members * TREE_DENSITY);
+	context.split_level = 0;
+	context.num_nodes = 0;
+	atomic_init(&context.next_node, 0);
+
+	// Deep enough to give every thread a few subtrees to balance out, which the calling thread reaches on its own
+	while (context.split_level < max_levels && nodes_at_level < (long)num_threads * DATASET_SUBTREES_PER_THREAD) {
+		nodes_at_level *= context.members_per_node;
+		context.split_level++;
+	}
+
+	context.nodes = (r_tree_node **)malloc(sizeof(r_tree_node *) * nodes_at_level);
+	context.parents = (index_record **)malloc(sizeof(index_record *) * nodes_at_level);
+
+	if (context.nodes == NULL || context.parents == NULL) {
+		fprintf(stderr, "Malloc failed in generate_seeded_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	generate_top(&context, root, NULL, 0, 0);
+
+	work_pool *pool = create_work_pool(num_threads, generate_subtree_task, &context);
+	pool->source = next_subtree;
+
+	run_work_pool(pool);
+	free_work_pool(pool);
+
+	validate_top(&context, root, NULL, 0);
+
+	free(context.nodes);
+	free(context.parents);
+}
+
+
+// Folds the coordinates and id of ir into hash
+static uint64_t fold_record(uint64_t hash, index_record *ir) {
+	double coords[4] = {ir->mbr->min_x, ir->mbr->min_y, ir->mbr->max_x, ir->mbr->max_y};
+	uint64_t bits;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		memcpy(&bits, &coords[i], sizeof(bits));
+		hash = fold_hash(hash, bits);
+	}
+
+	return fold_hash(hash, (uint64_t)ir->id);
+}
+
+
+// Folds the subtree below node into hash in pre-order
+static uint64_t fold_node(uint64_t hash, r_tree_node *node) {
+	int i;
+
+	hash = fold_hash(hash, node->num_members);
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *ir = node->index_records[i];
+
+		hash = fold_record(hash, ir);
+
+		if (!is_leaf(node))
+			hash = fold_node(hash, ir->child);
+	}
+
+	return hash;
+}
+
+
+// Hash of the MBRs, ids and shape of the tree, equal for two trees exactly when they are (all but certainly) the same
+uint64_t tree_fingerprint(r_tree_node *root) {
+	return fold_node(0, root);
+}
+
+
+// Hash of the MBRs and ids of num_records index_records, in order
+uint64_t records_fingerprint(index_record **records, long num_records) {
+	uint64_t hash = fold_hash(0, num_records);
+	long i;
+
+	for (i = 0; i < num_records; i++)
+		hash = fold_record(hash, records[i]);
+
+	return hash;
+}
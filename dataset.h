@@ -0,0 +1,92 @@
+#ifndef _dataset_h
+#define _dataset_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Reproducible synthetic datasets and trees, generated in parallel.
+*
+* Nothing here touches rand(). Every random number is drawn from a counter-based generator: counter_random(seed,
+* stream, counter) is the counter-th output of a SplitMix64 sequence started from seed and stream, so any draw can
+* be made on its own, by any thread, in any order. The i-th record of a dataset only depends on the seed and i, and
+* every node of a seeded tree only on the seed and its position in the tree, which is why the output is bit-identical
+* for a given seed whatever the number of threads. The threads are the workers of a work_pool, handed chunks of
+* records or whole subtrees.
+*
+* Datasets can be uniform over the (0, 0) to (MAX_RAND_NUM, MAX_RAND_NUM) box like random_mbr, clustered around
+* num_clusters centres (Gaussian with a standard deviation of cluster_spread) or skewed towards the origin (each
+* coordinate is a uniform draw raised to the power skew). Seeded trees have the same shape as generate_random_tree
+*/
+
+// Records handed to a worker at a time by generate_dataset and generate_records
+#define DATASET_CHUNK 4096
+
+// generate_seeded_tree splits the tree into at least this many subtrees per thread
+#define DATASET_SUBTREES_PER_THREAD 4
+
+
+typedef enum dataset_distribution {
+	DATASET_UNIFORM,
+	DATASET_CLUSTERED,
+	DATASET_SKEWED
+} dataset_distribution;
+
+
+typedef struct dataset_spec {
+	uint64_t seed;
+	dataset_distribution distribution;
+
+	// Only used by DATASET_CLUSTERED
+	int num_clusters;
+	double cluster_spread;
+
+	// Only used by DATASET_SKEWED. 1 is uniform, larger values pack the records closer to the origin
+	double skew;
+
+	// Widths and heights are uniform between 0 and max_side
+	double max_side;
+} dataset_spec;
+
+
+// Returns output number counter of the random sequence named by seed and stream
+uint64_t counter_random(uint64_t seed, uint64_t stream, uint64_t counter);
+
+
+// Same as counter_random, scaled to a double in [0, 1)
+double counter_uniform(uint64_t seed, uint64_t stream, uint64_t counter);
+
+
+// Fills in spec with the given seed and distribution, and defaults for everything else (16 clusters with a spread of
+// 2, a skew of 3 and MBRs of at most 1 by 1 like random_small_mbr)
+void initialize_dataset_spec(dataset_spec *spec, uint64_t seed, dataset_distribution distribution);
+
+
+// Writes MBR number index of the dataset described by spec to mbr
+void dataset_mbr(dataset_spec *spec, long index, MBR *mbr);
+
+
+// Returns a malloc'd array of the first num_mbrs MBRs of the dataset, generated on num_threads threads
+MBR *generate_dataset(dataset_spec *spec, long num_mbrs, int num_threads);
+
+
+// Returns a malloc'd array of num_records leaf-level index_records holding the first num_records MBRs of the dataset,
+// generated on num_threads threads. Record i has id i
+index_record **generate_records(dataset_spec *spec, long num_records, int num_threads);
+
+
+// Same as generate_random_tree (with current_level 0), but drawing from seed instead of rand() and building separate
+// subtrees on num_threads threads. The leaf-level records are numbered from 0 in pre-order
+void generate_seeded_tree(r_tree_node *root, int max_levels, uint64_t seed, int num_threads);
+
+
+// Hash of the MBRs, ids and shape of the tree, equal for two trees exactly when they are (all but certainly) the same
+uint64_t tree_fingerprint(r_tree_node *root);
+
+
+// Hash of the MBRs and ids of num_records index_records, in order
+uint64_t records_fingerprint(index_record **records, long num_records);
+
+
+#endif
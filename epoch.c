@@ -0,0 +1,139 @@
+#include "epoch.h"
+
+
+epoch_domain *create_epoch_domain() {
+	epoch_domain *domain = (epoch_domain *)aligned_alloc(EPOCH_CACHE_LINE_SIZE, sizeof(epoch_domain));
+	int i;
+
+	if (domain == NULL) {
+		fprintf(stderr, "Malloc failed in create_epoch_domain(). Exiting program\n");
+		exit(1);
+	}
+
+	atomic_init(&domain->global_epoch, 0);
+	atomic_init(&domain->num_slots, 0);
+
+	for (i = 0; i < EPOCH_MAX_THREADS; i++)
+		atomic_init(&domain->slots[i].state, 0);
+
+	for (i = 0; i < EPOCH_NUM_BUCKETS; i++) {
+		domain->buckets[i].items = NULL;
+		domain->buckets[i].num_items = 0;
+		domain->buckets[i].capacity = 0;
+	}
+
+	pthread_mutex_init(&domain->retire_lock, NULL);
+
+	return domain;
+}
+
+
+// Registers a reader thread. Returns the slot it has to pass to epoch_enter and epoch_exit
+int epoch_register(epoch_domain *domain) {
+	int slot = atomic_fetch_add(&domain->num_slots, 1);
+
+	if (slot >= EPOCH_MAX_THREADS) {
+		fprintf(stderr, "More than EPOCH_MAX_THREADS readers registered. Exiting program\n");
+		exit(1);
+	}
+
+	return slot;
+}
+
+
+// Starts a read-side critical section. Nothing retired after this point is freed until the matching epoch_exit
+void epoch_enter(epoch_domain *domain, int slot) {
+	// Sequentially consistent, so a writer trying to advance either sees this reader as active in the epoch it
+	// read, or the reader's traversal sees everything the writer unlinked before advancing
+	atomic_store(&domain->slots[slot].state, (atomic_load(&domain->global_epoch) << 1) | 1);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+
+void epoch_exit(epoch_domain *domain, int slot) {
+	atomic_store_explicit(&domain->slots[slot].state, 0, memory_order_release);
+}
+
+
+// Frees every item in list and empties it
+static void free_retired_list(retired_list *list) {
+	long i;
+
+	for (i = 0; i < list->num_items; i++)
+		list->items[i].free_fn(list->items[i].ptr);
+
+	list->num_items = 0;
+}
+
+
+// Advances the global epoch if every active reader has caught up with it, freeing whatever is now safe to free
+// Caller holds retire_lock
+static void try_advance_locked(epoch_domain *domain) {
+	unsigned long epoch = atomic_load(&domain->global_epoch);
+	int num_slots = atomic_load(&domain->num_slots);
+	int i;
+
+	if (num_slots > EPOCH_MAX_THREADS)
+		num_slots = EPOCH_MAX_THREADS;
+
+	for (i = 0; i < num_slots; i++) {
+		unsigned long state = atomic_load(&domain->slots[i].state);
+
+		if ((state & 1) && (state >> 1) != epoch)
+			return;
+	}
+
+	atomic_store(&domain->global_epoch, epoch + 1);
+
+	// Every active reader entered during epoch or later, after anything retired in epoch - 2 had been unlinked.
+	// That is the bucket epoch + 1 is about to reuse
+	free_retired_list(&domain->buckets[(epoch + 1) % EPOCH_NUM_BUCKETS]);
+}
+
+
+// Hands ptr over to be freed by free_fn once no reader can still be using it
+void epoch_retire(epoch_domain *domain, void *ptr, retire_callback free_fn) {
+	pthread_mutex_lock(&domain->retire_lock);
+
+	retired_list *list = &domain->buckets[atomic_load(&domain->global_epoch) % EPOCH_NUM_BUCKETS];
+
+	if (list->num_items == list->capacity) {
+		list->capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+		list->items = (retired_item *)realloc(list->items, sizeof(retired_item) * list->capacity);
+
+		if (list->items == NULL) {
+			fprintf(stderr, "Realloc failed in epoch_retire(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	list->items[list->num_items].ptr = ptr;
+	list->items[list->num_items].free_fn = free_fn;
+	list->num_items++;
+
+	try_advance_locked(domain);
+
+	pthread_mutex_unlock(&domain->retire_lock);
+}
+
+
+// Advances the global epoch if every active reader has caught up with it, freeing whatever is now safe to free
+void epoch_try_advance(epoch_domain *domain) {
+	pthread_mutex_lock(&domain->retire_lock);
+	try_advance_locked(domain);
+	pthread_mutex_unlock(&domain->retire_lock);
+}
+
+
+// Frees everything still waiting to be reclaimed, then the domain itself. No reader may be active
+void free_epoch_domain(epoch_domain *domain) {
+	int i;
+
+	for (i = 0; i < EPOCH_NUM_BUCKETS; i++) {
+		free_retired_list(&domain->buckets[i]);
+		free(domain->buckets[i].items);
+	}
+
+	pthread_mutex_destroy(&domain->retire_lock);
+	free(domain);
+}
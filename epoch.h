@@ -0,0 +1,88 @@
+#ifndef _epoch_h
+#define _epoch_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* Epoch-based reclamation.
+*
+* Readers wrap every traversal in epoch_enter()/epoch_exit(). Memory that a writer unlinks from a shared structure
+* is handed to epoch_retire() instead of being freed. It is only freed once the global epoch has advanced twice,
+* which can only happen after every reader that might still hold a pointer to it has left its critical section
+*/
+
+// Most reader threads that can register with one epoch_domain
+#define EPOCH_MAX_THREADS 64
+
+// Retired memory is sorted into one bucket per epoch. A bucket is freed when the epoch that reuses it starts,
+// by which point no reader can have entered before the memory in it was unlinked
+#define EPOCH_NUM_BUCKETS 3
+
+#define EPOCH_CACHE_LINE_SIZE 64
+
+
+// Called to free a piece of retired memory
+typedef void (*retire_callback)(void *ptr);
+
+
+typedef struct retired_item {
+	void *ptr;
+	retire_callback free_fn;
+} retired_item;
+
+
+typedef struct retired_list {
+	retired_item *items;
+	long num_items;
+	long capacity;
+} retired_list;
+
+
+// One per registered reader, on its own cache line. state holds the global epoch the reader saw when it entered
+// its current critical section shifted left by one, with the lowest bit set while it is inside that section
+typedef struct epoch_slot {
+	_Alignas(EPOCH_CACHE_LINE_SIZE) atomic_ulong state;
+} epoch_slot;
+
+
+typedef struct epoch_domain {
+	_Alignas(EPOCH_CACHE_LINE_SIZE) atomic_ulong global_epoch;
+	atomic_int num_slots;
+	epoch_slot slots[EPOCH_MAX_THREADS];
+
+	// Only touched by writers, under retire_lock
+	pthread_mutex_t retire_lock;
+	retired_list buckets[EPOCH_NUM_BUCKETS];
+} epoch_domain;
+
+
+epoch_domain *create_epoch_domain();
+
+
+// Registers a reader thread. Returns the slot it has to pass to epoch_enter and epoch_exit
+int epoch_register(epoch_domain *domain);
+
+
+// Starts a read-side critical section. Nothing retired after this point is freed until the matching epoch_exit
+void epoch_enter(epoch_domain *domain, int slot);
+
+
+void epoch_exit(epoch_domain *domain, int slot);
+
+
+// Hands ptr over to be freed by free_fn once no reader can still be using it
+void epoch_retire(epoch_domain *domain, void *ptr, retire_callback free_fn);
+
+
+// Advances the global epoch if every active reader has caught up with it, freeing whatever is now safe to free
+void epoch_try_advance(epoch_domain *domain);
+
+
+// Frees everything still waiting to be reclaimed, then the domain itself. No reader may be active
+void free_epoch_domain(epoch_domain *domain);
+
+
+#endif
@@ -0,0 +1,117 @@
+/* Node kernels for one capacity, used as a template: fanout_tree.c defines FANOUT_LINES and includes this file once
+* for every node size it specialises. Every kernel gives exactly the same result as its generic counterpart, it just
+* knows at compile time how many index_records it is working on
+*/
+
+#define FANOUT_CAPACITY LINE_FANOUT(FANOUT_LINES)
+
+// A split node holds its full capacity plus the index_record that did not fit
+#define FANOUT_ENTRIES (FANOUT_CAPACITY + 1)
+
+
+// Same as sequential_get_insertion_index
+static int FANOUT_KERNEL(insertion_index)(r_tree_node *rt, index_record *insertion_ir) {
+	MBR *mbr = insertion_ir->mbr;
+	double enlargements[FANOUT_CAPACITY];
+	int num_members = rt->num_members;
+	int i, best = 0;
+
+	// Only the filled slots are worked out. Internal nodes are seldom full, so running over the empty ones costs more
+	for (i = 0; i < num_members; i++)
+		enlargements[i] = area_increase(rt->index_records[i]->mbr, mbr);
+
+	// Ties go to the first index as in the generic version
+	for (i = 1; i < num_members; i++) {
+		if (enlargements[i] < enlargements[best])
+			best = i;
+	}
+
+	return best;
+}
+
+
+// Same as pick_seeds_sequential
+static void FANOUT_KERNEL(pick_seeds)(index_record **irs, int num_index_records, double *biggest_waste, int *seed_indices) {
+	if (num_index_records != FANOUT_ENTRIES) {
+		pick_seeds_sequential(irs, num_index_records, biggest_waste, seed_indices);
+		return;
+	}
+
+	coord_t min_x[FANOUT_ENTRIES], min_y[FANOUT_ENTRIES], max_x[FANOUT_ENTRIES], max_y[FANOUT_ENTRIES];
+	double areas[FANOUT_ENTRIES];
+	double wastes[FANOUT_ENTRIES];
+	int i, j;
+
+	for (i = 0; i < FANOUT_ENTRIES; i++) {
+		MBR *mbr = irs[i]->mbr;
+
+		min_x[i] = mbr->min_x;
+		min_y[i] = mbr->min_y;
+		max_x[i] = mbr->max_x;
+		max_y[i] = mbr->max_y;
+		areas[i] = area_of(mbr);
+	}
+
+	double curr_biggest_waste = get_merged_area(irs[0]->mbr, irs[1]->mbr) - areas[0] - areas[1];
+
+	seed_indices[0] = 0;
+	seed_indices[1] = 1;
+
+	for (i = 0; i < FANOUT_ENTRIES - 1; i++) {
+		// A whole row of wastes is worked out before any is compared, so this loop has no branches to stop it vectorising
+		for (j = i + 1; j < FANOUT_ENTRIES; j++) {
+			span_t width = (span_t)coord_max(max_x[i], max_x[j]) - coord_min(min_x[i], min_x[j]);
+			span_t height = (span_t)coord_max(max_y[i], max_y[j]) - coord_min(min_y[i], min_y[j]);
+
+			wastes[j] = (double)width * height - areas[i] - areas[j];
+		}
+
+		for (j = i + 1; j < FANOUT_ENTRIES; j++) {
+			if (wastes[j] > curr_biggest_waste) {
+				curr_biggest_waste = wastes[j];
+				seed_indices[0] = i;
+				seed_indices[1] = j;
+			}
+		}
+	}
+
+	*biggest_waste = curr_biggest_waste;
+}
+
+
+// Same as linear_split_sequential
+static void FANOUT_KERNEL(split)(index_record **irs, int num_index_records, index_record *ir1, index_record *ir2) {
+	if (num_index_records != FANOUT_ENTRIES - 2) {
+		linear_split_sequential(irs, num_index_records, ir1, ir2);
+		return;
+	}
+
+	r_tree_node *r1 = ir1->child;
+	r_tree_node *r2 = ir2->child;
+
+	// Grown on the stack and written back once at the end
+	MBR mbr1 = *ir1->mbr;
+	MBR mbr2 = *ir2->mbr;
+	int i;
+
+	for (i = 0; i < FANOUT_ENTRIES - 2; i++) {
+		MBR *mbr = irs[i]->mbr;
+		double enlargement_1 = area_increase(&mbr1, mbr);
+		double enlargement_2 = area_increase(&mbr2, mbr);
+
+		if (enlargement_1 < enlargement_2 || (enlargement_1 == enlargement_2 && r1->num_members < r2->num_members)) {
+			append_member(r1, irs[i]);
+			grow_mbr(&mbr1, mbr);
+		} else {
+			append_member(r2, irs[i]);
+			grow_mbr(&mbr2, mbr);
+		}
+	}
+
+	*ir1->mbr = mbr1;
+	*ir2->mbr = mbr2;
+}
+
+
+#undef FANOUT_ENTRIES
+#undef FANOUT_CAPACITY
@@ -0,0 +1,145 @@
+#include "r_tree.h"
+#include "choose_leaf.h"
+#include "pick_seeds.h"
+#include "linear_split.h"
+#include "fanout_tree.h"
+
+
+// Same as get_area, inlined into the kernels
+static inline double area_of(MBR *mbr) {
+	return (double)((span_t)mbr->max_x - mbr->min_x) * ((span_t)mbr->max_y - mbr->min_y);
+}
+
+
+// Same as get_area_increase
+static inline double area_increase(MBR *original, MBR *new_child) {
+	double original_area = area_of(original);
+
+	span_t new_width = (span_t)coord_max(original->max_x, new_child->max_x) - coord_min(original->min_x, new_child->min_x);
+	span_t new_height = (span_t)coord_max(original->max_y, new_child->max_y) - coord_min(original->min_y, new_child->min_y);
+
+	return (double)new_width * new_height - original_area;
+}
+
+
+// Same as expand_mbr
+static inline void grow_mbr(MBR *mbr, MBR *child_mbr) {
+	mbr->min_x = coord_min(mbr->min_x, child_mbr->min_x);
+	mbr->min_y = coord_min(mbr->min_y, child_mbr->min_y);
+	mbr->max_x = coord_max(mbr->max_x, child_mbr->max_x);
+	mbr->max_y = coord_max(mbr->max_y, child_mbr->max_y);
+}
+
+
+// Same as add_member, for a node a split has already made sure has room
+static inline void append_member(r_tree_node *host_node, index_record *new_member) {
+#if BACK_POINTERS
+	new_member->index = host_node->num_members;
+	new_member->host = host_node;
+#endif
+	host_node->index_records[host_node->num_members++] = new_member;
+}
+
+
+#define FANOUT_PASTE(name, lines) name##_##lines
+#define FANOUT_NAME(name, lines) FANOUT_PASTE(name, lines)
+#define FANOUT_KERNEL(name) FANOUT_NAME(name, FANOUT_LINES)
+
+#define FANOUT_LINES FANOUT_LINES_SMALL
+#include "fanout_kernels.h"
+#undef FANOUT_LINES
+
+#define FANOUT_LINES FANOUT_LINES_MEDIUM
+#include "fanout_kernels.h"
+#undef FANOUT_LINES
+
+#define FANOUT_LINES FANOUT_LINES_LARGE
+#include "fanout_kernels.h"
+#undef FANOUT_LINES
+
+#define FANOUT_LINES FANOUT_LINES_PAGE
+#include "fanout_kernels.h"
+#undef FANOUT_LINES
+
+#define FANOUT_KERNELS(lines) \
+	{LINE_FANOUT(lines), lines, FANOUT_NAME(insertion_index, lines), FANOUT_NAME(pick_seeds, lines), FANOUT_NAME(split, lines)}
+
+static const fanout_kernels specialised_kernels[] = {
+	FANOUT_KERNELS(FANOUT_LINES_SMALL),
+	FANOUT_KERNELS(FANOUT_LINES_MEDIUM),
+	FANOUT_KERNELS(FANOUT_LINES_LARGE),
+	FANOUT_KERNELS(FANOUT_LINES_PAGE)
+};
+
+static const fanout_kernels generic_kernels = {0, 0, sequential_get_insertion_index, pick_seeds_sequential, linear_split_sequential};
+
+
+// Returns the capacity a node needs to fill lines whole cache lines
+int cache_line_fanout(int lines) {
+	return LINE_FANOUT(lines);
+}
+
+
+// The specialised kernels for capacity, or the generic ones if there are none
+static const fanout_kernels *find_kernels(int capacity) {
+	int i;
+
+	for (i = 0; i < (int)(sizeof(specialised_kernels) / sizeof(fanout_kernels)); i++) {
+		if (specialised_kernels[i].capacity == capacity)
+			return &specialised_kernels[i];
+	}
+
+	return &generic_kernels;
+}
+
+
+// Creates an empty fanout_tree. With specialise, each level uses the specialised kernels for its capacity if there are
+// any, otherwise (or without specialise) it uses the generic ones
+fanout_tree *create_fanout_tree(int leaf_members, int internal_members, bool specialise) {
+	if (leaf_members < 2 || internal_members < 2) {
+		fprintf(stderr, "A fanout_tree needs room for at least 2 index_records in every node. Exiting program\n");
+		exit(1);
+	}
+
+	fanout_tree *ft = (fanout_tree *)malloc(sizeof(fanout_tree));
+
+	if (ft == NULL) {
+		fprintf(stderr, "Malloc failed in create_fanout_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	ft->root = initialize_rt(leaf_members);
+	ft->ops.leaf_members = leaf_members;
+	ft->ops.internal_members = internal_members;
+	ft->ops.leaf = specialise ? find_kernels(leaf_members) : &generic_kernels;
+	ft->ops.internal = specialise ? find_kernels(internal_members) : &generic_kernels;
+
+	return ft;
+}
+
+
+// Same as insert() with one thread
+void fanout_insert(fanout_tree *ft, index_record *ir) {
+	insertion_index_function insertion_index = ft->ops.internal->insertion_index;
+	r_tree_node *node = ft->root;
+	tree_path path;
+
+	path.depth = 0;
+
+	// Same descent as choose_leaf_sequential. Only internal nodes are ever asked for an insertion index
+	while (!is_leaf(node)) {
+		int index = insertion_index(node, ir);
+		push_path(&path, node, index);
+		node = node->index_records[index]->child;
+	}
+
+	push_path(&path, node, -1);
+	insert_at_node_with_ops(&path, ir, &ft->root, &ft->ops);
+}
+
+
+// Frees the tree, including the index_records inserted into it
+void free_fanout_tree(fanout_tree *ft) {
+	free_tree(ft->root);
+	free(ft);
+}
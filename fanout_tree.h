@@ -0,0 +1,82 @@
+#ifndef _fanout_tree_h
+#define _fanout_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* R-tree with separate leaf and internal node capacities, and node kernels specialised for them at build time.
+*
+* Leaves are created with room for leaf_members index_records and every other node with room for internal_members.
+* The per-node work of an insertion (picking the child to descend into, picking split seeds and handing out the rest
+* of a split node) is done through a fanout_kernels table per level. For the capacities at which a node block (the
+* r_tree_node together with its index_records array, see initialize_rt) fills FANOUT_LINES_* whole cache lines, the
+* kernels are compiled with the capacity as a constant (fanout_kernels.h is included once per size), so the split
+* loops have fixed trip counts, the MBRs are gathered into fixed-size arrays and nothing is called. Any other
+* capacity gets the generic kernels from choose_leaf.h, pick_seeds.h and linear_split.h.
+*
+* The kernels are chosen once, by create_fanout_tree, and both kinds of kernel build exactly the same tree
+*/
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Capacity that makes a node block exactly lines cache lines long
+#define LINE_FANOUT(lines) ((int)(((lines) * CACHE_LINE_SIZE - sizeof(r_tree_node)) / sizeof(index_record *)))
+
+// Node sizes, in cache lines, that get specialised kernels. 64 lines is a 4KB page
+#define FANOUT_LINES_SMALL 2
+#define FANOUT_LINES_MEDIUM 4
+#define FANOUT_LINES_LARGE 8
+#define FANOUT_LINES_PAGE 64
+
+
+typedef int (*insertion_index_function)(r_tree_node *rt, index_record *insertion_ir);
+typedef void (*pick_seeds_function)(index_record **irs, int num_index_records, double *biggest_waste, int *seed_indices);
+typedef void (*split_function)(index_record **irs, int num_index_records, index_record *ir1, index_record *ir2);
+
+
+// The kernels for nodes of one capacity, and the number of cache lines such a node fills. Both are 0 for the generic
+// kernels, which work with any capacity
+typedef struct fanout_kernels {
+	int capacity;
+	int lines;
+	insertion_index_function insertion_index;
+	pick_seeds_function pick_seeds;
+	split_function split;
+} fanout_kernels;
+
+
+typedef struct fanout_ops {
+	int leaf_members;
+	int internal_members;
+	const fanout_kernels *leaf;
+	const fanout_kernels *internal;
+} fanout_ops;
+
+
+typedef struct fanout_tree {
+	r_tree_node *root;
+	fanout_ops ops;
+} fanout_tree;
+
+
+// Returns the capacity a node needs to fill lines whole cache lines
+int cache_line_fanout(int lines);
+
+
+// Creates an empty fanout_tree. With specialise, each level uses the specialised kernels for its capacity if there are
+// any, otherwise (or without specialise) it uses the generic ones
+fanout_tree *create_fanout_tree(int leaf_members, int internal_members, bool specialise);
+
+
+// Same as insert() with one thread
+void fanout_insert(fanout_tree *ft, index_record *ir);
+
+
+// Frees the tree, including the index_records inserted into it
+void free_fanout_tree(fanout_tree *ft);
+
+
+#endif
@@ -0,0 +1,669 @@
+#include "r_tree.h"
+#include "math_utils.h"
+#include "bulk_load.h"
+#include "ingest.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+// Most fields on a line of any format
+#define MAX_FIELDS 7
+
+// Longest number handed to strtod
+#define MAX_NUMBER_LENGTH 128
+
+
+typedef struct ingest_queue {
+	void *items[INGEST_QUEUE_CAPACITY];
+	int head;
+	int count;
+
+	// Threads still pushing items. Once there are none and the queue is empty, pop_queue returns NULL
+	int producers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} ingest_queue;
+
+
+typedef struct ingest_chunk {
+	long start;
+	long end;
+} ingest_chunk;
+
+
+typedef struct ingest_batch {
+	index_record **records;
+	long num_records;
+	long num_skipped;
+} ingest_batch;
+
+
+typedef struct ingest_context {
+	const char *data;
+	long size;
+	ingest_format format;
+
+	// Level of the leaf rows of an INGEST_TREE_CSV file
+	int leaf_level;
+
+	ingest_queue chunks;
+	ingest_queue batches;
+	long num_chunks;
+} ingest_context;
+
+
+static void init_queue(ingest_queue *queue, int producers) {
+	queue->head = 0;
+	queue->count = 0;
+	queue->producers = producers;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+}
+
+
+static void destroy_queue(ingest_queue *queue) {
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_cond_destroy(&queue->not_full);
+}
+
+
+// Adds item to the queue, waiting for room if it is full
+static void push_queue(ingest_queue *queue, void *item) {
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->count == INGEST_QUEUE_CAPACITY)
+		pthread_cond_wait(&queue->not_full, &queue->lock);
+
+	queue->items[(queue->head + queue->count) % INGEST_QUEUE_CAPACITY] = item;
+	queue->count++;
+
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+
+// Takes the oldest item off the queue, waiting for one if it is empty. Returns NULL once the queue is empty for good
+static void *pop_queue(ingest_queue *queue) {
+	void *item = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->count == 0 && queue->producers > 0)
+		pthread_cond_wait(&queue->not_empty, &queue->lock);
+
+	if (queue->count > 0) {
+		item = queue->items[queue->head];
+		queue->head = (queue->head + 1) % INGEST_QUEUE_CAPACITY;
+		queue->count--;
+		pthread_cond_signal(&queue->not_full);
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return item;
+}
+
+
+// Called by each producer once it has pushed its last item
+static void finish_producing(ingest_queue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->producers--;
+
+	// Wakes every consumer, so they all see the queue has run dry
+	pthread_cond_broadcast(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+
+// Parses the number at *cursor (after any blanks), moving *cursor past it. Returns false if there is no number there
+static bool parse_number(const char **cursor, const char *end, double *value) {
+	const char *p = *cursor;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	const char *start = p;
+	bool negative = false;
+	bool any_digits = false;
+
+	// False once a non-zero digit had to be left out of the mantissa
+	bool exact = true;
+
+	uint64_t mantissa = 0;
+	int num_digits = 0;
+	int exponent = 0;
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+
+	for (; p < end && is_digit(*p); p++) {
+		any_digits = true;
+
+		if (num_digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			num_digits += mantissa != 0;
+		} else {
+			exponent++;
+			exact = exact && *p == '0';
+		}
+	}
+
+	if (p < end && *p == '.') {
+		for (p++; p < end && is_digit(*p); p++) {
+			any_digits = true;
+
+			if (num_digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				num_digits += mantissa != 0;
+				exponent--;
+			} else {
+				exact = exact && *p == '0';
+			}
+		}
+	}
+
+	if (!any_digits)
+		return false;
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		bool negative_exponent = false;
+		int written_exponent = 0;
+
+		p++;
+
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative_exponent = *p == '-';
+			p++;
+		}
+
+		if (p >= end || !is_digit(*p))
+			return false;
+
+		for (; p < end && is_digit(*p); p++) {
+			if (written_exponent < 100000)
+				written_exponent = written_exponent * 10 + (*p - '0');
+		}
+
+		exponent += negative_exponent ? -written_exponent : written_exponent;
+	}
+
+	// Both the mantissa and the power of ten are exact doubles, so one correctly rounded operation gives the
+	// correctly rounded result
+	if (exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+		*value = exponent < 0 ? mantissa / exact_powers_of_ten[-exponent] : mantissa * exact_powers_of_ten[exponent];
+
+		if (negative)
+			*value = -*value;
+	} else {
+		char number[MAX_NUMBER_LENGTH];
+
+		if (p - start >= MAX_NUMBER_LENGTH)
+			return false;
+
+		memcpy(number, start, p - start);
+		number[p - start] = '\0';
+		*value = strtod(number, NULL);
+	}
+
+	*cursor = p;
+	return true;
+}
+
+
+// Parses the comma-separated numbers of the line [line, end) into values. Returns how many there are, or -1 if the
+// line holds anything else
+static int parse_fields(const char *line, const char *end, double *values) {
+	const char *p = line;
+	int num_fields = 0;
+
+	while (true) {
+		if (num_fields == MAX_FIELDS || !parse_number(&p, end, &values[num_fields]))
+			return -1;
+
+		num_fields++;
+
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+
+		if (p == end)
+			return num_fields;
+
+		if (*p != ',')
+			return -1;
+
+		p++;
+	}
+}
+
+
+// Parses the last field of the line [line, end), which follows num_fields - 1 commas, as a whole number. Returns false
+// if it is not one (a fraction, an exponent) or does not fit in a record_id
+static bool parse_id(const char *line, const char *end, int num_fields, record_id *id) {
+	const char *p = line;
+	int commas = 0;
+
+	while (commas < num_fields - 1) {
+		if (*p++ == ',')
+			commas++;
+	}
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	bool negative = false;
+	uint64_t value = 0;
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+
+	if (p == end || !is_digit(*p))
+		return false;
+
+	// INT64_MIN has no positive counterpart, so negative ids may go one further
+	uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+
+	for (; p < end && is_digit(*p); p++) {
+		uint64_t digit = *p - '0';
+
+		if (value > (limit - digit) / 10)
+			return false;
+
+		value = value * 10 + digit;
+	}
+
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+
+	if (p != end)
+		return false;
+
+	*id = negative ? -(record_id)(value - 1) - 1 : (record_id)value;
+	return true;
+}
+
+
+// Writes the rectangle with the given corners to mbr, swapping any given the wrong way round
+static void set_corners(MBR *mbr, double x1, double y1, double x2, double y2) {
+	mbr->min_x = coord_floor(fmin(x1, x2));
+	mbr->min_y = coord_floor(fmin(y1, y2));
+	mbr->max_x = coord_ceil(fmax(x1, x2));
+	mbr->max_y = coord_ceil(fmax(y1, y2));
+}
+
+
+// Level of the row [line, end) of a tree dump, or -1 if it isn't one
+static int row_level(const char *line, const char *end) {
+	double values[MAX_FIELDS];
+
+	if (parse_fields(line, end, values) != 7)
+		return -1;
+
+	return (int)values[6];
+}
+
+
+// Finds the leaf level of a tree dump. In pre-order the rows go down one level at a time from the first root entry
+// to the first leaf, and the leaf level is where that first stops
+static int find_leaf_level(const char *data, long size) {
+	const char *p = data;
+	const char *end = data + size;
+	int level = -1;
+
+	while (p < end) {
+		const char *line_end = memchr(p, '\n', end - p);
+
+		if (line_end == NULL)
+			line_end = end;
+
+		int row = row_level(p, line_end);
+
+		if (row >= 0) {
+			if (row <= level)
+				return level;
+
+			level = row;
+		}
+
+		p = line_end + 1;
+	}
+
+	return level;
+}
+
+
+// Appends ir to batch, which has room for capacity records
+static void append_record(ingest_batch *batch, long *capacity, index_record *ir) {
+	if (batch->num_records == *capacity) {
+		*capacity *= 2;
+		batch->records = (index_record **)realloc(batch->records, sizeof(index_record *) * *capacity);
+
+		if (batch->records == NULL) {
+			fprintf(stderr, "Malloc failed in append_record(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	batch->records[batch->num_records++] = ir;
+}
+
+
+// Parses the lines of a CSV chunk
+static void parse_csv_chunk(ingest_context *context, ingest_chunk *chunk, ingest_batch *batch, long *capacity) {
+	const char *p = context->data + chunk->start;
+	const char *end = context->data + chunk->end;
+	double values[MAX_FIELDS];
+	MBR mbr;
+
+	while (p < end) {
+		const char *line_end = memchr(p, '\n', end - p);
+
+		if (line_end == NULL)
+			line_end = end;
+
+		long offset = p - context->data;
+		int num_fields = parse_fields(p, line_end, values);
+
+		if (context->format == INGEST_TREE_CSV) {
+			if (num_fields == 7 && (int)values[6] == context->leaf_level) {
+				set_corners(&mbr, values[2], values[3], values[4], values[5]);
+				append_record(batch, capacity, initialize_record(copy_mbr(&mbr), offset));
+			} else if (line_end > p) {
+				batch->num_skipped++;
+			}
+		} else {
+			record_id id = offset;
+
+			if (num_fields == 4 || (num_fields == 5 && parse_id(p, line_end, num_fields, &id))) {
+				set_corners(&mbr, values[0], values[1], values[2], values[3]);
+				append_record(batch, capacity, initialize_record(copy_mbr(&mbr), id));
+			} else if (line_end > p) {
+				batch->num_skipped++;
+			}
+		}
+
+		p = line_end + 1;
+	}
+}
+
+
+// Parses the records of a binary chunk
+static void parse_binary_chunk(ingest_context *context, ingest_chunk *chunk, ingest_batch *batch, long *capacity) {
+	long offset;
+	double corners[4];
+	MBR mbr;
+
+	for (offset = chunk->start; offset + (long)INGEST_BINARY_RECORD_SIZE <= chunk->end; offset += INGEST_BINARY_RECORD_SIZE) {
+		memcpy(corners, context->data + offset, INGEST_BINARY_RECORD_SIZE);
+		set_corners(&mbr, corners[0], corners[1], corners[2], corners[3]);
+		append_record(batch, capacity, initialize_record(copy_mbr(&mbr), offset / INGEST_BINARY_RECORD_SIZE));
+	}
+
+	// A partial record at the end of the file
+	if (offset < chunk->end)
+		batch->num_skipped++;
+}
+
+
+// Cuts the file into chunks ending at record boundaries
+static void *split_file(void *arg) {
+	ingest_context *context = (ingest_context *)arg;
+	long start = 0;
+
+	while (start < context->size) {
+		long end = start + INGEST_CHUNK_SIZE;
+
+		if (end >= context->size) {
+			end = context->size;
+		} else if (context->format == INGEST_BINARY) {
+			end -= end % INGEST_BINARY_RECORD_SIZE;
+		} else {
+			const char *newline = memchr(context->data + end, '\n', context->size - end);
+			end = newline == NULL ? context->size : newline - context->data + 1;
+		}
+
+		ingest_chunk *chunk = (ingest_chunk *)malloc(sizeof(ingest_chunk));
+
+		if (chunk == NULL) {
+			fprintf(stderr, "Malloc failed in split_file(). Exiting program\n");
+			exit(1);
+		}
+
+		chunk->start = start;
+		chunk->end = end;
+		context->num_chunks++;
+
+		push_queue(&context->chunks, chunk);
+		start = end;
+	}
+
+	finish_producing(&context->chunks);
+	return NULL;
+}
+
+
+// Lets the kernel drop the pages lying wholly inside a parsed chunk. The pages it shares with its neighbours are kept,
+// they may still be being parsed
+static void release_chunk(ingest_context *context, ingest_chunk *chunk) {
+	long page_size = sysconf(_SC_PAGESIZE);
+	long first = (chunk->start + page_size - 1) / page_size * page_size;
+	long last = chunk->end / page_size * page_size;
+
+	if (last > first)
+		madvise((void *)(context->data + first), last - first, MADV_DONTNEED);
+}
+
+
+// Turns chunks into batches until there are no chunks left
+static void *parse_chunks(void *arg) {
+	ingest_context *context = (ingest_context *)arg;
+	ingest_chunk *chunk;
+
+	while ((chunk = (ingest_chunk *)pop_queue(&context->chunks)) != NULL) {
+		ingest_batch *batch = (ingest_batch *)malloc(sizeof(ingest_batch));
+		long capacity = context->format == INGEST_BINARY ? (chunk->end - chunk->start) / INGEST_BINARY_RECORD_SIZE + 1 : 1024;
+
+		if (batch == NULL) {
+			fprintf(stderr, "Malloc failed in parse_chunks(). Exiting program\n");
+			exit(1);
+		}
+
+		batch->records = (index_record **)malloc(sizeof(index_record *) * capacity);
+		batch->num_records = 0;
+		batch->num_skipped = 0;
+
+		if (batch->records == NULL) {
+			fprintf(stderr, "Malloc failed in parse_chunks(). Exiting program\n");
+			exit(1);
+		}
+
+		if (context->format == INGEST_BINARY)
+			parse_binary_chunk(context, chunk, batch, &capacity);
+		else
+			parse_csv_chunk(context, chunk, batch, &capacity);
+
+		release_chunk(context, chunk);
+		free(chunk);
+
+		push_queue(&context->batches, batch);
+	}
+
+	finish_producing(&context->batches);
+	return NULL;
+}
+
+
+// Reads every record of the file at path into the tree rooted at *root, parsing on num_threads threads.
+// Returns false (leaving the tree alone) if the file can't be opened
+bool ingest_file(const char *path, ingest_format format, r_tree_node **root, ingest_mode mode, int num_threads, ingest_stats *stats) {
+	struct timespec start, end;
+	struct stat file_stat;
+	ingest_context context;
+	ingest_batch *batch;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &file_stat) != 0) {
+		close(fd);
+		return false;
+	}
+
+	memset(stats, 0, sizeof(ingest_stats));
+	stats->num_bytes = file_stat.st_size;
+
+	context.data = NULL;
+	context.size = file_stat.st_size;
+	context.format = format;
+	context.num_chunks = 0;
+
+	if (context.size > 0) {
+		void *data = mmap(NULL, context.size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+
+		madvise(data, context.size, MADV_SEQUENTIAL);
+		context.data = (const char *)data;
+	}
+
+	close(fd);
+
+	context.leaf_level = format == INGEST_TREE_CSV ? find_leaf_level(context.data, context.size) : 0;
+	init_queue(&context.chunks, 1);
+	init_queue(&context.batches, num_threads);
+
+	pthread_t splitter;
+	pthread_t *parsers = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+
+	if (parsers == NULL) {
+		fprintf(stderr, "Malloc failed in ingest_file(). Exiting program\n");
+		exit(1);
+	}
+
+	pthread_create(&splitter, NULL, split_file, &context);
+	for (i = 0; i < num_threads; i++)
+		pthread_create(&parsers[i], NULL, parse_chunks, &context);
+
+	bool bulk = mode == INGEST_BULK_LOAD && (*root)->num_members == 0;
+	index_record **records = NULL;
+	long num_records = 0;
+	long capacity = 0;
+
+	while ((batch = (ingest_batch *)pop_queue(&context.batches)) != NULL) {
+		long k;
+
+		if (bulk) {
+			if (num_records + batch->num_records > capacity) {
+				capacity = (num_records + batch->num_records) * 2;
+				records = (index_record **)realloc(records, sizeof(index_record *) * capacity);
+
+				if (records == NULL) {
+					fprintf(stderr, "Malloc failed in ingest_file(). Exiting program\n");
+					exit(1);
+				}
+			}
+
+			memcpy(records + num_records, batch->records, sizeof(index_record *) * batch->num_records);
+		} else {
+			for (k = 0; k < batch->num_records; k++)
+				insert(root, batch->records[k], 1);
+		}
+
+		num_records += batch->num_records;
+		stats->num_skipped += batch->num_skipped;
+
+		free(batch->records);
+		free(batch);
+	}
+
+	pthread_join(splitter, NULL);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(parsers[i], NULL);
+
+	if (bulk && num_records > 0) {
+		r_tree_node *loaded = bulk_load(records, num_records, (*root)->max_members);
+
+		free_tree(*root);
+		*root = loaded;
+	}
+
+	free(records);
+
+	if (context.data != NULL)
+		munmap((void *)context.data, context.size);
+
+	destroy_queue(&context.chunks);
+	destroy_queue(&context.batches);
+	free(parsers);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	stats->num_chunks = context.num_chunks;
+	stats->num_records = num_records;
+	stats->wall_seconds = seconds_between(&start, &end);
+
+	return true;
+}
+
+
+// Writes the MBRs of the leaf-level index_records below node to f
+static long write_leaves(FILE *f, r_tree_node *node) {
+	long count = 0;
+	int i;
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *ir = node->index_records[i];
+
+		if (is_leaf(node)) {
+			double corners[4] = {ir->mbr->min_x, ir->mbr->min_y, ir->mbr->max_x, ir->mbr->max_y};
+
+			fwrite(corners, sizeof(corners), 1, f);
+			count++;
+		} else {
+			count += write_leaves(f, ir->child);
+		}
+	}
+
+	return count;
+}
+
+
+// Writes the MBRs of the leaf-level index_records of the tree rooted at root to path as an INGEST_BINARY file.
+// Returns the number of records written, or -1 if the file can't be created
+long write_tree_to_binary(const char *path, r_tree_node *root) {
+	FILE *f = fopen(path, "wb");
+
+	if (f == NULL)
+		return -1;
+
+	long count = write_leaves(f, root);
+
+	fclose(f);
+	return count;
+}
@@ -0,0 +1,82 @@
+#ifndef _ingest_h
+#define _ingest_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Streaming ingestion of rectangle files.
+*
+* The file is memory-mapped and a splitter thread cuts it into chunks of about INGEST_CHUNK_SIZE bytes, moving each
+* cut forward to the next record boundary (the end of a line, or a whole number of binary records). Parser threads
+* turn chunks into batches of leaf-level index_records and the calling thread takes the batches in and either inserts
+* them into the tree or keeps them for one bulk_load at the end. Chunks go from the splitter to the parsers and batches
+* from the parsers to the calling thread through bounded queues, so however big the file, only a few chunks' worth of
+* it are being worked on at once. The pages of a parsed chunk are dropped again (MADV_DONTNEED), so the mapping does
+* not stay resident either.
+*
+* Numbers are parsed without strtod wherever the result is exact anyway: a decimal mantissa of at most 19 digits that
+* fits in 53 bits, scaled by an exactly representable power of ten. Anything else (very long or very large numbers)
+* goes through strtod, so every value is correctly rounded.
+*
+* Three formats are read:
+* - INGEST_CSV: min_x,min_y,max_x,max_y[,id] per line. Lines without an id get the byte offset of the line. The id
+*   has to be a whole number: a line whose id is a fraction or too large for a record_id is skipped
+* - INGEST_TREE_CSV: the output of write_tree_to_csv. Only rows at the leaf level (the deepest level of the file) are
+*   records, and their id is the byte offset of their row. This reloads a dumped tree
+* - INGEST_BINARY: packed records of four doubles (min_x, min_y, max_x, max_y) in host byte order, with no header.
+*   Record i gets id i
+* Lines that can't be parsed (such as a header) are skipped and counted. Corners given the wrong way round are swapped
+*/
+
+// Bytes per chunk, before moving the end to the next record boundary
+#define INGEST_CHUNK_SIZE (4L << 20)
+
+// Chunks and batches that can be waiting between two stages
+#define INGEST_QUEUE_CAPACITY 8
+
+// Bytes per record of an INGEST_BINARY file
+#define INGEST_BINARY_RECORD_SIZE (4 * sizeof(double))
+
+
+typedef enum ingest_format {
+	INGEST_CSV,
+	INGEST_TREE_CSV,
+	INGEST_BINARY
+} ingest_format;
+
+
+typedef enum ingest_mode {
+	// Inserts every batch into the tree as it arrives
+	INGEST_INSERT,
+
+	// Collects the records and bulk loads them once the file is read. Only used when the tree is empty, records read
+	// into a tree that already has some are inserted
+	INGEST_BULK_LOAD
+} ingest_mode;
+
+
+typedef struct ingest_stats {
+	long num_bytes;
+	long num_chunks;
+	long num_records;
+
+	// Lines that couldn't be parsed, and rows of a tree dump above the leaf level
+	long num_skipped;
+
+	double wall_seconds;
+} ingest_stats;
+
+
+// Reads every record of the file at path into the tree rooted at *root, parsing on num_threads threads.
+// Returns false (leaving the tree alone) if the file can't be opened
+bool ingest_file(const char *path, ingest_format format, r_tree_node **root, ingest_mode mode, int num_threads, ingest_stats *stats);
+
+
+// Writes the MBRs of the leaf-level index_records of the tree rooted at root to path as an INGEST_BINARY file.
+// Returns the number of records written, or -1 if the file can't be created
+long write_tree_to_binary(const char *path, r_tree_node *root);
+
+
+#endif
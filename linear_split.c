@@ -3,14 +3,14 @@
 
 
 /* args:
-* r: the r_tree_node being split
+* irs: the num_index_records index_records to hand out
 * ir1: an index_record pointing to an r_tree_node
 * ir2: an index_record pointing to an r_tree_node
-* ir1 and ir2 are meant to be inserted into the r_tree_node above r, while r->parent
-* will be removed
+* Every index_record in irs is added to either ir1->child or ir2->child, whichever MBR grows the least.
+* The MBRs of ir1 and ir2 are expanded to cover their new members
 */
 
-void linear_split_sequential(r_tree_node *rt, index_record *ir1, index_record *ir2) {
+void linear_split_sequential(index_record **irs, int num_index_records, index_record *ir1, index_record *ir2) {
 
 	int i;
 
@@ -18,14 +18,18 @@ void linear_split_sequential(r_tree_node *rt, index_record *ir1, index_record *i
 	r_tree_node *r2 = ir2->child;
 
 
-	for (i = 0; i < rt->num_members; i++) {
-		double enlargement_1 = get_area_increase(ir1->mbr, rt->index_records[i]->mbr);
-		double enlargement_2 = get_area_increase(ir2->mbr, rt->index_records[i]->mbr);
+	for (i = 0; i < num_index_records; i++) {
+		double enlargement_1 = get_area_increase(ir1->mbr, irs[i]->mbr);
+		double enlargement_2 = get_area_increase(ir2->mbr, irs[i]->mbr);
 
-		if (enlargement_1 < enlargement_2) {
-			add_member(r1, rt->index_records[i]);
+		// Ties (common with integer coordinates and duplicate rectangles) go to the emptier node
+		// so that neither node can end up with no members
+		if (enlargement_1 < enlargement_2 || (enlargement_1 == enlargement_2 && r1->num_members < r2->num_members)) {
+			add_member(r1, irs[i]);
+			expand_mbr(ir1->mbr, irs[i]->mbr);
 		} else {
-			add_member(r2, rt->index_records[i]);
+			add_member(r2, irs[i]);
+			expand_mbr(ir2->mbr, irs[i]->mbr);
 		}
 	}
 
@@ -34,7 +38,7 @@ void linear_split_sequential(r_tree_node *rt, index_record *ir1, index_record *i
 
 void *linear_split_subset(void *arg) {
 	param2 *params = (param2*)arg;
-	r_tree_node *rt = params->rt;
+	index_record **irs = params->irs;
 	index_record *ir_1 = params->ir_1;
 	index_record *ir_2 = params->ir_2;
 	int start_index = params->start_index;
@@ -46,17 +50,19 @@ void *linear_split_subset(void *arg) {
 	for (i = start_index; i < end_index; i++) {
 		// We put this here because in the thread initialization process, the last thread may be
 		// set up to search for index_records that are out of bounds
-		if (i >= rt->num_members)
+		if (i >= params->num_index_records)
 			break;
 
 
-		double enlargement_1 = get_area_increase(ir_1->mbr, rt->index_records[i]->mbr);
-		double enlargement_2 = get_area_increase(ir_2->mbr, rt->index_records[i]->mbr);
+		double enlargement_1 = get_area_increase(ir_1->mbr, irs[i]->mbr);
+		double enlargement_2 = get_area_increase(ir_2->mbr, irs[i]->mbr);
 
 		if (enlargement_1 < enlargement_2) {
-			split_nodes[i] = 0;
+			params->split_nodes[i] = 0;
+		} else if (enlargement_1 > enlargement_2) {
+			params->split_nodes[i] = 1;
 		} else {
-			split_nodes[i] = 1;
+			params->split_nodes[i] = 2;
 		}
 	}
 
@@ -64,42 +70,34 @@ void *linear_split_subset(void *arg) {
 }
 
 
-void linear_split_parallel(r_tree_node *rt, index_record *ir_1, index_record *ir_2, int num_threads) {
-
-	int index_records_per_thread = (int) ceil((float)rt->num_members / num_threads);
+void linear_split_parallel(index_record **irs, int num_index_records, index_record *ir_1, index_record *ir_2, int num_threads) {
 
-	// Allocated shared list
-	split_nodes = (int*)malloc(sizeof(int) * rt->num_members);
+	if (num_index_records == 0)
+		return;
 
-	param2 **param_objects = (param2**)malloc(sizeof(param2*) * num_threads);
+	int index_records_per_thread = (int) ceil((float)num_index_records / num_threads);
 
-	if (param_objects == NULL) {
-		fprintf(stderr, "Malloc failed, exiting program\n");
-		exit(1);
-	}
+	// The shared list and the thread parameters live on this stack frame
+	int split_nodes[num_index_records];
+	param2 param_objects[num_threads];
 
 	int i;
 
 	for (i = 0; i < num_threads; i++) {
-		param_objects[i] = (param2*)malloc(sizeof(param2));
-
-		if (param_objects[i] == NULL) {
-			fprintf(stderr, "Malloc failed, exiting program");
-			exit(1);
-		}
-
-		param_objects[i]->start_index = i * index_records_per_thread;
-		param_objects[i]->end_index = (i + 1) * index_records_per_thread;
-		param_objects[i]->rt = rt;
-		param_objects[i]->ir_1 = ir_1;
-		param_objects[i]->ir_2 = ir_2;
+		param_objects[i].start_index = i * index_records_per_thread;
+		param_objects[i].end_index = (i + 1) * index_records_per_thread;
+		param_objects[i].num_index_records = num_index_records;
+		param_objects[i].irs = irs;
+		param_objects[i].ir_1 = ir_1;
+		param_objects[i].ir_2 = ir_2;
+		param_objects[i].split_nodes = split_nodes;
 	}
 
 	pthread_t threads[num_threads];
 
 
 	for (i = 0; i < num_threads; i++) {
-		pthread_create(&threads[i], NULL, linear_split_subset, (void*)param_objects[i]);
+		pthread_create(&threads[i], NULL, linear_split_subset, (void*)&param_objects[i]);
 	}
 
 
@@ -108,20 +106,17 @@ void linear_split_parallel(r_tree_node *rt, index_record *ir_1, index_record *ir
 	}
 
 
-	for (i = 0; i < rt->num_members; i++) {
-		if (split_nodes[i] == 0)
-			add_member(ir_1->child, rt->index_records[i]);
-		else
-			add_member(ir_2->child, rt->index_records[i]);
-	}
+	for (i = 0; i < num_index_records; i++) {
+		// Ties are settled here, where the sizes of both nodes are known
+		if (split_nodes[i] == 2)
+			split_nodes[i] = ir_1->child->num_members < ir_2->child->num_members ? 0 : 1;
 
-
-	for (i = 0; i < num_threads; i++) {
-		free(param_objects[i]);
+		if (split_nodes[i] == 0) {
+			add_member(ir_1->child, irs[i]);
+			expand_mbr(ir_1->mbr, irs[i]->mbr);
+		} else {
+			add_member(ir_2->child, irs[i]);
+			expand_mbr(ir_2->mbr, irs[i]->mbr);
+		}
 	}
-
-	free(param_objects);
-
-	// Free up shared list
-	free(split_nodes);
 }
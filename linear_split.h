@@ -8,15 +8,11 @@
 #include <stdbool.h>
 #include <unistd.h>
 
-// binary list where if split_nodes[i] = 0, then the index_record at rt->index_records[i] will go to ir_1
-// during the split, and conversely, if split_nodes[i] = 1, then the index_record at rt->index_records[i]
-// will go to ir_2 during the split
-int *split_nodes;
 
 typedef struct param2 {
-	r_tree_node *rt;
+	// The index_records being handed out to either ir_1->child or ir_2->child
+	index_record **irs;
 
-	// rt is being split, so all of its index_records will go to either ir_1->child or ir_2->child
 	index_record *ir_1;
 	index_record *ir_2;
 
@@ -24,24 +20,30 @@ typedef struct param2 {
 	// to assign each index_record to one of the new r_tree_nodes
 	int start_index;
 	int end_index;
+	int num_index_records;
+
+	// binary list shared by all threads, where if split_nodes[i] = 0, then irs[i] will go to ir_1
+	// during the split, and conversely, if split_nodes[i] = 1, then irs[i] will go to ir_2 during the split.
+	// split_nodes[i] = 2 marks a tie that is settled once the thread results are merged
+	int *split_nodes;
 } param2;
 
 
 /* args:
-* r: the r_tree_node being split
+* irs: the num_index_records index_records to hand out
 * ir1: an index_record pointing to an r_tree_node
 * ir2: an index_record pointing to an r_tree_node
-* ir1 and ir2 are meant to be inserted into the r_tree_node above r, while r->parent
-* will be removed
+* Every index_record in irs is added to either ir1->child or ir2->child, whichever MBR grows the least.
+* The MBRs of ir1 and ir2 are expanded to cover their new members
 */
 
-void linear_split_sequential(r_tree_node *r, index_record *ir1, index_record *ir2);
+void linear_split_sequential(index_record **irs, int num_index_records, index_record *ir1, index_record *ir2);
 
 
 void *linear_split_subset(void *arg);
 
 
-void linear_split_parallel(r_tree_node *rt, index_record *ir_1, index_record *ir_2, int num_threads);
+void linear_split_parallel(index_record **irs, int num_index_records, index_record *ir_1, index_record *ir_2, int num_threads);
 
 
 #endif
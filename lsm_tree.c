@@ -0,0 +1,343 @@
+#include "r_tree.h"
+#include "bulk_load.h"
+#include "lsm_tree.h"
+
+
+static lsm_entry *allocate_buffer() {
+	lsm_entry *buffer = (lsm_entry *)malloc(sizeof(lsm_entry) * LSM_BUFFER_CAPACITY);
+
+	if (buffer == NULL) {
+		fprintf(stderr, "Malloc failed in allocate_buffer(). Exiting program\n");
+		exit(1);
+	}
+
+	return buffer;
+}
+
+
+static int compare_min_x(const void *a, const void *b) {
+	coord_t min_a = ((lsm_entry *)a)->mbr.min_x;
+	coord_t min_b = ((lsm_entry *)b)->mbr.min_x;
+	return (min_a > min_b) - (min_a < min_b);
+}
+
+
+// Swaps the frozen buffer for a copy sorted by min_x, so searches can look at just the entries that can reach their
+// window while it is being merged. Searches that took the unsorted one keep using it, and it is not reused before the
+// merge is over, which waits for them
+static void sort_frozen(lsm_tree *lt) {
+	double max_width = 0;
+	long i;
+
+	memcpy(lt->spare, lt->frozen, sizeof(lsm_entry) * lt->num_frozen);
+	qsort(lt->spare, lt->num_frozen, sizeof(lsm_entry), compare_min_x);
+
+	for (i = 0; i < lt->num_frozen; i++) {
+		double width = (double)lt->spare[i].mbr.max_x - lt->spare[i].mbr.min_x;
+
+		if (width > max_width)
+			max_width = width;
+	}
+
+	pthread_mutex_lock(&lt->buffer_lock);
+	lsm_entry *unsorted = lt->frozen;
+	lt->frozen = lt->spare;
+	lt->spare = unsorted;
+	lt->frozen_max_width = max_width;
+	lt->frozen_sorted = true;
+	pthread_mutex_unlock(&lt->buffer_lock);
+}
+
+
+// Merges the frozen buffer into the main tree. Only called from the merge thread
+static void merge_frozen(lsm_tree *lt) {
+	long num_records = lt->num_frozen;
+	long i;
+
+	// Nothing else changes the frozen buffer until num_frozen is reset below, so it can be read without buffer_lock
+	index_record **records = (index_record **)malloc(sizeof(index_record *) * num_records);
+
+	if (records == NULL) {
+		fprintf(stderr, "Malloc failed in merge_frozen(). Exiting program\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_records; i++)
+		records[i] = lt->frozen[i].ir;
+
+	sort_frozen(lt);
+
+	int height = tree_height(lt->root);
+
+	if (height == 1 || lt->num_tree_records <= num_records) {
+		// Small main tree: pack it together with the buffer into a fresh tree
+		records = (index_record **)realloc(records, sizeof(index_record *) * (num_records + lt->num_tree_records));
+
+		if (records == NULL) {
+			fprintf(stderr, "Realloc failed in merge_frozen(). Exiting program\n");
+			exit(1);
+		}
+
+		pthread_rwlock_wrlock(&lt->tree_lock);
+
+		long num_detached = detach_leaf_records(lt->root, records + num_records);
+		lt->root = bulk_load(records, num_records + num_detached, lt->max_members);
+	} else {
+		// Packing happens outside tree_lock, only the grafts hold up searches
+		long num_subtrees;
+		int subtree_height;
+		index_record **subtrees = bulk_load_subtrees(records, num_records, lt->max_members, height - 1, &num_subtrees, &subtree_height);
+
+		pthread_rwlock_wrlock(&lt->tree_lock);
+
+		for (i = 0; i < num_subtrees; i++)
+			insert_subtree(&lt->root, subtrees[i], subtree_height, 1);
+
+		lt->num_grafts += num_subtrees;
+		free(subtrees);
+	}
+
+	lt->num_tree_records += num_records;
+	lt->num_merges++;
+
+	// Emptying the frozen buffer while still holding tree_lock means no search can see the records twice or miss them
+	pthread_mutex_lock(&lt->buffer_lock);
+	lt->num_frozen = 0;
+	lt->frozen_sorted = false;
+	pthread_cond_broadcast(&lt->merged);
+	pthread_mutex_unlock(&lt->buffer_lock);
+
+	pthread_rwlock_unlock(&lt->tree_lock);
+
+	free(records);
+}
+
+
+static void *merge_thread(void *arg) {
+	lsm_tree *lt = (lsm_tree *)arg;
+
+	pthread_mutex_lock(&lt->buffer_lock);
+
+	while (true) {
+		while (lt->num_frozen == 0 && !lt->stop)
+			pthread_cond_wait(&lt->frozen_ready, &lt->buffer_lock);
+
+		if (lt->num_frozen == 0)
+			break;
+
+		pthread_mutex_unlock(&lt->buffer_lock);
+		merge_frozen(lt);
+		pthread_mutex_lock(&lt->buffer_lock);
+	}
+
+	pthread_mutex_unlock(&lt->buffer_lock);
+	pthread_exit(NULL);
+}
+
+
+// Hands the active buffer to the merge thread, once it is done with the previous one. Caller holds buffer_lock
+static void freeze_active(lsm_tree *lt) {
+	while (lt->num_frozen > 0)
+		pthread_cond_wait(&lt->merged, &lt->buffer_lock);
+
+	lsm_entry *buffer = lt->frozen;
+	lt->frozen = lt->active;
+	lt->active = buffer;
+	lt->num_frozen = lt->num_active;
+	lt->num_active = 0;
+
+	pthread_cond_signal(&lt->frozen_ready);
+}
+
+
+// Creates an empty lsm_tree whose nodes hold up to max_members index_records and starts its merge thread
+lsm_tree *create_lsm_tree(int max_members) {
+	lsm_tree *lt = (lsm_tree *)malloc(sizeof(lsm_tree));
+
+	if (lt == NULL) {
+		fprintf(stderr, "Malloc failed in create_lsm_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	lt->root = initialize_rt(max_members);
+	lt->num_tree_records = 0;
+	lt->max_members = max_members;
+	lt->active = allocate_buffer();
+	lt->frozen = allocate_buffer();
+	lt->spare = allocate_buffer();
+	lt->num_active = 0;
+	lt->num_frozen = 0;
+	lt->frozen_sorted = false;
+	lt->frozen_max_width = 0;
+	lt->stop = false;
+	lt->num_merges = 0;
+	lt->num_grafts = 0;
+
+	pthread_rwlock_init(&lt->tree_lock, NULL);
+	pthread_mutex_init(&lt->buffer_lock, NULL);
+	pthread_cond_init(&lt->frozen_ready, NULL);
+	pthread_cond_init(&lt->merged, NULL);
+
+	pthread_create(&lt->merger, NULL, merge_thread, (void *)lt);
+
+	return lt;
+}
+
+
+// Appends ir to the active buffer. Only waits if both buffers are full
+void lsm_insert(lsm_tree *lt, index_record *ir) {
+	pthread_mutex_lock(&lt->buffer_lock);
+
+	if (lt->num_active == LSM_BUFFER_CAPACITY)
+		freeze_active(lt);
+
+	lt->active[lt->num_active].mbr = *ir->mbr;
+	lt->active[lt->num_active].ir = ir;
+	lt->num_active++;
+
+	pthread_mutex_unlock(&lt->buffer_lock);
+}
+
+
+// Waits until every record inserted so far has been merged into the main tree
+void flush_lsm_tree(lsm_tree *lt) {
+	pthread_mutex_lock(&lt->buffer_lock);
+
+	if (lt->num_active > 0)
+		freeze_active(lt);
+
+	while (lt->num_frozen > 0)
+		pthread_cond_wait(&lt->merged, &lt->buffer_lock);
+
+	pthread_mutex_unlock(&lt->buffer_lock);
+}
+
+
+// Leaf-level index_records found by lsm_search, handed to its callback once every lock has been let go
+typedef struct found_list {
+	index_record **irs;
+	long num_irs;
+	long capacity;
+} found_list;
+
+
+static void add_found(index_record *ir, void *arg) {
+	found_list *list = (found_list *)arg;
+
+	if (list->num_irs == list->capacity) {
+		list->capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+		list->irs = (index_record **)realloc(list->irs, sizeof(index_record *) * list->capacity);
+
+		if (list->irs == NULL) {
+			fprintf(stderr, "Malloc failed in add_found(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	list->irs[list->num_irs++] = ir;
+}
+
+
+// Adds every record in buffer[start .. end) overlapping window to list (if not NULL). Returns how many there were
+static long scan_buffer(lsm_entry *buffer, long start, long end, MBR *window, found_list *list) {
+	long found = 0;
+	long i;
+
+	for (i = start; i < end; i++) {
+		if (!mbr_overlaps(&buffer[i].mbr, window))
+			continue;
+
+		if (list != NULL)
+			add_found(buffer[i].ir, list);
+		found++;
+	}
+
+	return found;
+}
+
+
+// Index of the first of the num_entries entries of a sorted buffer whose min_x is above (or, if inclusive, at or
+// above) min_x
+static long search_min_x(lsm_entry *buffer, long num_entries, double min_x, bool inclusive) {
+	long low = 0;
+	long high = num_entries;
+
+	while (low < high) {
+		long middle = low + (high - low) / 2;
+
+		if (buffer[middle].mbr.min_x < min_x || (!inclusive && buffer[middle].mbr.min_x == min_x))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+
+// Same as search() in r_tree.h, over the main tree and both buffers
+long lsm_search(lsm_tree *lt, MBR *window, search_callback callback, void *arg) {
+	found_list list = { NULL, 0, 0 };
+	found_list *collect = callback != NULL ? &list : NULL;
+	long i;
+
+	pthread_rwlock_rdlock(&lt->tree_lock);
+
+	long found = search(lt->root, window, collect != NULL ? add_found : NULL, collect);
+
+	// Appended entries never change, and neither buffer is reused before the merge that empties the frozen one has
+	// taken tree_lock, so the entries there now can be scanned without buffer_lock
+	pthread_mutex_lock(&lt->buffer_lock);
+	lsm_entry *active = lt->active;
+	lsm_entry *frozen = lt->frozen;
+	long num_active = lt->num_active;
+	long num_frozen = lt->num_frozen;
+	bool frozen_sorted = lt->frozen_sorted;
+	double max_width = lt->frozen_max_width;
+	pthread_mutex_unlock(&lt->buffer_lock);
+
+	if (frozen_sorted) {
+		// Only entries starting between window->min_x - max_width and window->max_x can reach the window
+		long start = search_min_x(frozen, num_frozen, (double)window->min_x - max_width, true);
+		long end = search_min_x(frozen, num_frozen, window->max_x, false);
+
+		found += scan_buffer(frozen, start, end, window, collect);
+	} else {
+		found += scan_buffer(frozen, 0, num_frozen, window, collect);
+	}
+
+	found += scan_buffer(active, 0, num_active, window, collect);
+
+	pthread_rwlock_unlock(&lt->tree_lock);
+
+	// The records stay in the tree until it is freed, so the callback can run with no lock held, and may insert
+	for (i = 0; i < list.num_irs; i++)
+		callback(list.irs[i], arg);
+
+	free(list.irs);
+	return found;
+}
+
+
+// Stops the merge thread and frees the tree (including the index_records inserted into it)
+void free_lsm_tree(lsm_tree *lt) {
+	flush_lsm_tree(lt);
+
+	pthread_mutex_lock(&lt->buffer_lock);
+	lt->stop = true;
+	pthread_cond_signal(&lt->frozen_ready);
+	pthread_mutex_unlock(&lt->buffer_lock);
+
+	pthread_join(lt->merger, NULL);
+
+	free_tree(lt->root);
+	free(lt->active);
+	free(lt->frozen);
+	free(lt->spare);
+
+	pthread_rwlock_destroy(&lt->tree_lock);
+	pthread_mutex_destroy(&lt->buffer_lock);
+	pthread_cond_destroy(&lt->frozen_ready);
+	pthread_cond_destroy(&lt->merged);
+	free(lt);
+}
@@ -0,0 +1,88 @@
+#ifndef _lsm_tree_h
+#define _lsm_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Log-structured r-tree.
+*
+* Insertions only append to an in-memory buffer, which keeps a copy of each MBR inline so a search can scan it
+* sequentially. When the buffer fills up it is frozen and handed to a background merge thread, and a second buffer
+* takes over. The merge thread packs the frozen buffer with bulk_load_subtrees and grafts the packed subtrees into the
+* main tree with insert_subtree, so the records never go through choose_leaf or a split one by one. While the main
+* tree is still smaller than a buffer it is simply rebuilt with bulk_load instead.
+*
+* Searches look at the main tree and both buffers. They share tree_lock with each other and are only held up while
+* the packed subtrees are being grafted. They only take buffer_lock to read how full the buffers are and scan them
+* after letting it go, so insertions don't wait for searches. While the frozen buffer is being merged, the merge
+* thread swaps in a copy sorted by min_x, and searches only scan the part of it that can reach their window. The
+* callback is only called once the search has let go of every lock, so it may insert
+*/
+
+// Records per buffer
+#define LSM_BUFFER_CAPACITY 65536
+
+
+typedef struct lsm_entry {
+	MBR mbr;
+	index_record *ir;
+} lsm_entry;
+
+
+typedef struct lsm_tree {
+	r_tree_node *root;
+	long num_tree_records;
+	int max_members;
+
+	// Held for reading by searches and for writing by the merge thread while it changes root
+	pthread_rwlock_t tree_lock;
+
+	// Insertions go to active, frozen is being merged (empty when num_frozen is 0). spare takes the unsorted frozen
+	// buffer once a sorted copy has replaced it
+	lsm_entry *active;
+	lsm_entry *frozen;
+	lsm_entry *spare;
+	long num_active;
+	long num_frozen;
+
+	// True once frozen has been sorted by min_x. max_width is then the widest of its MBRs
+	bool frozen_sorted;
+	double frozen_max_width;
+
+	// Guards the buffers. Taken after tree_lock when both are needed
+	pthread_mutex_t buffer_lock;
+	pthread_cond_t frozen_ready;
+	pthread_cond_t merged;
+
+	bool stop;
+	pthread_t merger;
+
+	// Merges done and subtrees grafted, for benchmarking
+	long num_merges;
+	long num_grafts;
+} lsm_tree;
+
+
+// Creates an empty lsm_tree whose nodes hold up to max_members index_records and starts its merge thread
+lsm_tree *create_lsm_tree(int max_members);
+
+
+// Appends ir to the active buffer. Only waits if both buffers are full
+void lsm_insert(lsm_tree *lt, index_record *ir);
+
+
+// Waits until every record inserted so far has been merged into the main tree
+void flush_lsm_tree(lsm_tree *lt);
+
+
+// Same as search() in r_tree.h, over the main tree and both buffers
+long lsm_search(lsm_tree *lt, MBR *window, search_callback callback, void *arg);
+
+
+// Stops the merge thread and frees the tree (including the index_records inserted into it)
+void free_lsm_tree(lsm_tree *lt);
+
+
+#endif
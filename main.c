@@ -1,6 +1,29 @@
 #include "r_tree.h"
+#include "math_utils.h"
 #include "choose_leaf.h"
 #include "pick_seeds.h"
+#include "qr_tree.h"
+#include "sharded_tree.h"
+#include "concurrent_tree.h"
+#include "versioned_tree.h"
+#include "lsm_tree.h"
+#include "buffer_tree.h"
+#include "paged_tree.h"
+#include "shared_tree.h"
+#include "spatial_join.h"
+#include "query_batch.h"
+#include "multi_query.h"
+#include "fanout_tree.h"
+#include "point_tree.h"
+#include "dataset.h"
+#include "trace.h"
+#include "bulk_load.h"
+#include "ingest.h"
+#include "query_cache.h"
+#include "tree_quality.h"
+#include "merge_tree.h"
+#include "async_engine.h"
+#include <sys/wait.h>
 
 // Slow and not recommended for large trees
 #define SAVE_TO_CSV true
@@ -8,32 +31,42 @@
 #define PRINT_TREE_SPECS true
 #define NUM_CORES 12
 
-struct timespec ts_begin, ts_end;
-double elapsed;
+#define NUM_BENCHMARK_QUERIES 10000
 
+// Reader threads searching the concurrent_tree in the concurrent benchmark
+#define NUM_CONCURRENT_READERS 2
 
-int main(int argc, char *argv[]) {
+// Worker processes querying the shared_tree in the shared benchmark, and the size of its segment (only the part the
+// tree uses is ever touched)
+#define NUM_SHARED_WORKERS 4
+#define SHARED_SEGMENT_SIZE (1L << 30)
 
-	if (argc != 3) {
-		fprintf(stderr, "Please provide 2 args: max_children (children per node), num_levels (number of levels in tree)\n");
-		exit(1);
-	}
+// Seed of the datasets and trees of the dataset benchmark
+#define DATASET_BENCHMARK_SEED 42
 
-	// Initialize randomness
-	srand(time(NULL));
+// File the trace benchmark records its workload to
+#define TRACE_BENCHMARK_FILE "workload.trace"
 
-	int i, j, k;
-	int index_records_per_node = atoi(argv[1]);
-	// TO DO: Account for this 1-off thing (works for now but messy fix)
-	int num_levels = atoi(argv[2]) - 1;
+// Memory budget of the query_cache in the cache benchmark, and the size of the cells it files windows under (about
+// the size of a tile)
+#define CACHE_BENCHMARK_BUDGET (1L << 20)
+#define CACHE_BENCHMARK_CELL_SIZE 2
 
-	if (num_levels < 0) {
-		fprintf(stderr, "Levels (third argument) should be greater than or equal to 1\n");
-		exit(1);
-	}
+// Room in the rings of the async benchmark's engine, and the most operations its engine threads run at once
+#define ASYNC_BENCHMARK_RING_SIZE 4096
+#define ASYNC_BENCHMARK_BATCH 64
 
+// Time budget of every step of the repacker in the repack benchmark, and how often it runs
+#define REPACK_BENCHMARK_BUDGET 0.005
+#define REPACK_BENCHMARK_INTERVAL 0.02
 
+struct timespec ts_begin, ts_end;
+double elapsed;
 
+
+// Times num_insertions random insertions for every thread count from 1 to NUM_CORES
+void benchmark_insertion(int index_records_per_node, int num_levels) {
+	int i, j, k;
 	struct timespec start;
 	struct timespec end;
 
@@ -78,10 +111,7 @@ int main(int argc, char *argv[]) {
 			free(insertion_mbrs);
 			free(insertion_irs);
 
-			double duration = end.tv_sec - start.tv_sec;
-			duration += (end.tv_nsec - start.tv_nsec) / 1000000000.0;
-
-			summed_time += duration;
+			summed_time += seconds_between(&start, &end);
 
 		}
 
@@ -90,6 +120,2078 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "Took an average of %lf seconds %d insertions in a tree with M=%d, levels=%d, and %d threads\n", average_duration, num_insertions, index_records_per_node, num_levels, num_threads);
 
 	}
+}
+
+
+// Compares window queries on a tree against the same queries on its quantised (QR-tree) internal levels
+void benchmark_qr(int index_records_per_node, int num_levels) {
+	int k;
+	struct timespec start;
+	struct timespec end;
+
+	r_tree_node *root = initialize_rt(index_records_per_node);
+	generate_random_tree(root, num_levels, 0);
+
+	qr_node *qr_root = compress_tree(root);
+
+	if (qr_root == NULL) {
+		fprintf(stderr, "The QR benchmark needs a tree with at least 2 levels\n");
+		free_tree(root);
+		return;
+	}
+
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	long plain_found = 0, qr_found = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		plain_found += search(root, windows[k], NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double plain_time = seconds_between(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		qr_found += qr_search(qr_root, windows[k], NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double qr_time = seconds_between(&start, &end);
+
+	long plain_size = internal_tree_size(root);
+	long qr_size = qr_tree_size(qr_root);
+
+	fprintf(stderr, "Internal levels: %ld bytes uncompressed, %ld bytes with %d-bit QR entries (%.2lfx smaller)\n", plain_size, qr_size, QR_BITS, (double)plain_size / qr_size);
+	fprintf(stderr, "%d queries: %lf seconds uncompressed, %lf seconds compressed\n", NUM_BENCHMARK_QUERIES, plain_time, qr_time);
+
+	if (plain_found != qr_found)
+		fprintf(stderr, "Result mismatch: %ld records uncompressed, %ld records compressed\n", plain_found, qr_found);
+	else
+		fprintf(stderr, "Both found %ld records\n", plain_found);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free_qr_tree(qr_root);
+	free_tree(root);
+}
+
+
+// Reports the memory and speed of the coordinate type this binary was built with (see make precision_benchmark)
+void benchmark_precision(int index_records_per_node, int num_levels) {
+	int k;
+	struct timespec start;
+	struct timespec end;
+	int num_insertions = 10000;
+
+	long size_before = current_tree_size();
+	r_tree_node *root = initialize_rt(index_records_per_node);
+	generate_random_tree(root, num_levels, 0);
+	long tree_size = current_tree_size() - size_before;
+
+	index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+
+	for (k = 0; k < num_insertions; k++)
+		insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k++)
+		insert(&root, insertion_irs[k], 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double insert_time = seconds_between(&start, &end);
+
+	long found = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		found += search(root, windows[k], NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double query_time = seconds_between(&start, &end);
+
+	fprintf(stderr, "Coordinate type %s: MBR is %zu bytes (%.2lfx smaller than double), generated tree is %ld bytes\n", COORD_NAME, sizeof(MBR), (4.0 * sizeof(double)) / sizeof(MBR), tree_size);
+	fprintf(stderr, "%d insertions took %lf seconds, %d queries took %lf seconds and found %ld records\n", num_insertions, insert_time, NUM_BENCHMARK_QUERIES, query_time, found);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free(insertion_irs);
+	free_tree(root);
+}
+
+
+// Counts the heap allocations made while inserting (the inserted records themselves are allocated beforehand)
+void benchmark_allocations(int index_records_per_node, int num_levels) {
+	int k, t;
+	int num_insertions = 10000;
+	int thread_counts[2] = {1, index_records_per_node < 4 ? index_records_per_node : 4};
+
+	for (t = 0; t < 2; t++) {
+		int num_threads = thread_counts[t];
+
+		r_tree_node *root = initialize_rt(index_records_per_node);
+		generate_random_tree(root, num_levels, 0);
+
+		index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+
+		for (k = 0; k < num_insertions; k++)
+			insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+
+		long start_allocations = num_allocations();
+		long start_splits = num_splits();
+		long non_split_allocations = 0;
+		long root_splits = 0;
+
+		for (k = 0; k < num_insertions; k++) {
+			long allocations_before = num_allocations();
+			long splits_before = num_splits();
+			r_tree_node *root_before = root;
+
+			insert(&root, insertion_irs[k], num_threads);
+
+			if (num_splits() == splits_before)
+				non_split_allocations += num_allocations() - allocations_before;
+			if (root != root_before)
+				root_splits++;
+		}
+
+		long allocations = num_allocations() - start_allocations;
+		long splits = num_splits() - start_splits;
+
+		// A new root costs the root node plus an index_record and MBR for the old root on top of the split itself
+		long split_allocations = allocations - non_split_allocations - 3 * root_splits;
+
+		fprintf(stderr, "%d threads: %d insertions, %ld splits (%ld of the root), %ld allocations\n", num_threads, num_insertions, splits, root_splits, allocations);
+		fprintf(stderr, "%ld allocations on insertions without a split, %.2lf allocations per split\n", non_split_allocations, splits > 0 ? (double)split_allocations / splits : 0.0);
+
+		free(insertion_irs);
+		free_tree(root);
+	}
+}
+
+
+// Compares insertion throughput of a single tree against the sharded tree with 1 to NUM_CORES shards
+void benchmark_sharded(int index_records_per_node) {
+	int k, num_shards;
+	int num_insertions = 200000;
+	struct timespec start;
+	struct timespec end;
+	MBR space = {0, 0, MAX_RAND_NUM, MAX_RAND_NUM};
+
+	index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+
+	for (k = 0; k < num_insertions; k++)
+		insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+
+	// The trees take ownership of the records they are given, so every run inserts its own copies
+	index_record **copies = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+
+	for (k = 0; k < num_insertions; k++)
+		copies[k] = initialize_ir(copy_mbr(insertion_irs[k]->mbr));
+
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k++)
+		insert(&root, copies[k], 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double single_time = seconds_between(&start, &end);
+	fprintf(stderr, "Single tree: %d insertions in %lf seconds (%.0lf per second)\n", num_insertions, single_time, num_insertions / single_time);
+	free_tree(root);
+
+	for (num_shards = 1; num_shards <= NUM_CORES; num_shards *= 2) {
+		for (k = 0; k < num_insertions; k++)
+			copies[k] = initialize_ir(copy_mbr(insertion_irs[k]->mbr));
+
+		sharded_tree *st = create_sharded_tree(num_shards, index_records_per_node, &space);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (k = 0; k < num_insertions; k++)
+			sharded_insert(st, copies[k]);
+		flush_sharded_tree(st);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double sharded_time = seconds_between(&start, &end);
+		long found = sharded_search(st, &space, NULL, NULL);
+
+		fprintf(stderr, "%d shards: %d insertions in %lf seconds (%.2lfx the single tree), %ld records found\n", num_shards, num_insertions, sharded_time, single_time / sharded_time, found);
+		free_sharded_tree(st);
+	}
+
+	for (k = 0; k < num_insertions; k++) {
+		free(insertion_irs[k]->mbr);
+		free(insertion_irs[k]);
+	}
+	free(insertion_irs);
+	free(copies);
+}
+
+
+typedef struct reader_args {
+	concurrent_tree *ct;
+	MBR **windows;
+	atomic_bool *stop;
+	long num_queries;
+} reader_args;
+
+
+// Runs the benchmark windows against the concurrent_tree in a loop until told to stop
+void *concurrent_reader(void *arg) {
+	reader_args *args = (reader_args *)arg;
+	int reader = register_reader(args->ct);
+	long k;
+
+	for (k = 0; !atomic_load_explicit(args->stop, memory_order_relaxed); k++)
+		concurrent_search(args->ct, reader, args->windows[k % NUM_BENCHMARK_QUERIES], NULL, NULL);
+
+	args->num_queries = k;
+	pthread_exit(NULL);
+}
+
+
+// Runs NUM_CONCURRENT_READERS readers against ct, while the calling thread inserts num_insertions records from irs
+// (or just sleeps for idle_seconds if irs is NULL). Returns the total number of queries per second
+double run_concurrent_readers(concurrent_tree *ct, MBR **windows, index_record **irs, int num_insertions, double idle_seconds, double *elapsed_seconds) {
+	pthread_t threads[NUM_CONCURRENT_READERS];
+	reader_args args[NUM_CONCURRENT_READERS];
+	atomic_bool stop;
+	struct timespec start;
+	struct timespec end;
+	long num_queries = 0;
+	int k;
+
+	atomic_init(&stop, false);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (k = 0; k < NUM_CONCURRENT_READERS; k++) {
+		args[k].ct = ct;
+		args[k].windows = windows;
+		args[k].stop = &stop;
+		pthread_create(&threads[k], NULL, concurrent_reader, (void *)&args[k]);
+	}
+
+	if (irs != NULL) {
+		for (k = 0; k < num_insertions; k++)
+			concurrent_insert(ct, irs[k], 1);
+	} else {
+		struct timespec idle = {(time_t)idle_seconds, (long)((idle_seconds - (time_t)idle_seconds) * 1000000000)};
+		nanosleep(&idle, NULL);
+	}
+
+	atomic_store(&stop, true);
+
+	for (k = 0; k < NUM_CONCURRENT_READERS; k++) {
+		pthread_join(threads[k], NULL);
+		num_queries += args[k].num_queries;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*elapsed_seconds = seconds_between(&start, &end);
+
+	return num_queries / *elapsed_seconds;
+}
+
+
+// Compares the read throughput of lock-free readers on a concurrent_tree with and without a writer inserting
+void benchmark_concurrent(int index_records_per_node) {
+	int k;
+	int num_preloaded = 100000;
+	int num_insertions = 100000;
+	MBR space = {0, 0, MAX_RAND_NUM, MAX_RAND_NUM};
+
+	concurrent_tree *ct = create_concurrent_tree(index_records_per_node);
+	index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+
+	for (k = 0; k < num_preloaded; k++)
+		concurrent_insert(ct, initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM)), 1);
+	for (k = 0; k < num_insertions; k++)
+		insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	double write_seconds, idle_seconds;
+	double loaded_rate = run_concurrent_readers(ct, windows, insertion_irs, num_insertions, 0, &write_seconds);
+	double idle_rate = run_concurrent_readers(ct, windows, NULL, 0, write_seconds, &idle_seconds);
+
+	fprintf(stderr, "%d readers: %.0lf queries per second alone, %.0lf queries per second while %d insertions ran (%.0lf per second)\n", NUM_CONCURRENT_READERS, idle_rate, loaded_rate, num_insertions, num_insertions / write_seconds);
+
+	long found = concurrent_search(ct, register_reader(ct), &space, NULL, NULL);
+
+	if (found != num_preloaded + num_insertions)
+		fprintf(stderr, "Result mismatch: %ld records found, %d inserted\n", found, num_preloaded + num_insertions);
+	else
+		fprintf(stderr, "All %ld records found\n", found);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free(insertion_irs);
+	free_concurrent_tree(ct);
+}
+
+
+typedef struct scan_args {
+	tree_snapshot *snap;
+	atomic_bool *stop;
+	long num_scans;
+	long num_inconsistent;
+} scan_args;
+
+
+// Scans the whole snapshot until told to stop, counting scans that did not see exactly the snapshot's records
+void *snapshot_scanner(void *arg) {
+	scan_args *args = (scan_args *)arg;
+	MBR space = {0, 0, MAX_RAND_NUM, MAX_RAND_NUM};
+	long expected = snapshot_search(args->snap, &space, NULL, NULL);
+
+	args->num_scans = 0;
+	args->num_inconsistent = 0;
+
+	while (!atomic_load_explicit(args->stop, memory_order_relaxed)) {
+		if (snapshot_search(args->snap, &space, NULL, NULL) != expected)
+			args->num_inconsistent++;
+		args->num_scans++;
+	}
+
+	pthread_exit(NULL);
+}
+
+
+// Measures copy-on-write insertion, the cost of taking a snapshot and the memory a snapshot keeps alive
+// while a long scan of it runs alongside further insertions
+void benchmark_snapshots(int index_records_per_node) {
+	int k;
+	int num_insertions = 100000;
+	struct timespec start;
+	struct timespec end;
+	MBR space = {0, 0, MAX_RAND_NUM, MAX_RAND_NUM};
+
+	versioned_tree *vt = create_versioned_tree(index_records_per_node);
+	index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * 2 * num_insertions);
+
+	for (k = 0; k < 2 * num_insertions; k++)
+		insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k++)
+		versioned_insert(vt, insertion_irs[k], 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double insert_time = seconds_between(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tree_snapshot *snap = take_snapshot(vt);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double snapshot_time = seconds_between(&start, &end);
+
+	long size_before = current_tree_size();
+	atomic_bool stop;
+	scan_args args;
+	pthread_t scanner;
+
+	atomic_init(&stop, false);
+	args.snap = snap;
+	args.stop = &stop;
+	pthread_create(&scanner, NULL, snapshot_scanner, (void *)&args);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = num_insertions; k < 2 * num_insertions; k++)
+		versioned_insert(vt, insertion_irs[k], 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double scanned_insert_time = seconds_between(&start, &end);
+
+	atomic_store(&stop, true);
+	pthread_join(scanner, NULL);
+
+	long size_with_snapshot = current_tree_size();
+	release_snapshot(vt, snap);
+	long size_after = current_tree_size();
+
+	fprintf(stderr, "%d copy-on-write insertions in %lf seconds, snapshot taken in %.0lf nanoseconds\n", num_insertions, insert_time, snapshot_time * 1000000000);
+	fprintf(stderr, "%d more insertions in %lf seconds alongside %ld scans of the snapshot (%ld inconsistent)\n", num_insertions, scanned_insert_time, args.num_scans, args.num_inconsistent);
+	fprintf(stderr, "Tree grew by %ld bytes with the snapshot alive, %ld bytes of it freed on release\n", size_with_snapshot - size_before, size_with_snapshot - size_after);
+
+	tree_snapshot *final_snap = take_snapshot(vt);
+	long found = snapshot_search(final_snap, &space, NULL, NULL);
+	release_snapshot(vt, final_snap);
+
+	if (found != 2 * num_insertions)
+		fprintf(stderr, "Result mismatch: %ld records found, %d inserted\n", found, 2 * num_insertions);
+	else
+		fprintf(stderr, "All %ld records found\n", found);
+
+	free(insertion_irs);
+	free_versioned_tree(vt);
+}
+
+
+// Compares absorbing a burst of insertions into the log-structured buffer against inserting them one by one,
+// and the query speed of the tree the merges build against the one built by insert()
+void benchmark_lsm(int index_records_per_node) {
+	int k;
+	int num_insertions = 500000;
+	struct timespec start;
+	struct timespec end;
+	MBR space = {0, 0, MAX_RAND_NUM, MAX_RAND_NUM};
+
+	index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	index_record **copies = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+
+	for (k = 0; k < num_insertions; k++) {
+		insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+		copies[k] = initialize_ir(copy_mbr(insertion_irs[k]->mbr));
+	}
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k++)
+		insert(&root, insertion_irs[k], 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double insert_time = seconds_between(&start, &end);
+
+	lsm_tree *lt = create_lsm_tree(index_records_per_node);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k++)
+		lsm_insert(lt, copies[k]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double burst_time = seconds_between(&start, &end);
+
+	flush_lsm_tree(lt);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double merged_time = seconds_between(&start, &end);
+
+	long plain_found = 0, lsm_found = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		plain_found += search(root, windows[k], NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double plain_query_time = seconds_between(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		lsm_found += lsm_search(lt, windows[k], NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double lsm_query_time = seconds_between(&start, &end);
+
+	fprintf(stderr, "%d insertions: %lf seconds with insert(), %lf seconds into the buffers, %lf seconds until merged\n", num_insertions, insert_time, burst_time, merged_time);
+	fprintf(stderr, "%ld merges grafted %ld packed subtrees\n", lt->num_merges, lt->num_grafts);
+	fprintf(stderr, "%d queries: %lf seconds on the inserted tree, %lf seconds on the merged tree\n", NUM_BENCHMARK_QUERIES, plain_query_time, lsm_query_time);
+
+	long found = lsm_search(lt, &space, NULL, NULL);
+
+	if (plain_found != lsm_found || found != num_insertions)
+		fprintf(stderr, "Result mismatch: %ld records inserted, %ld and %ld found by the queries, %ld in total\n", (long)num_insertions, plain_found, lsm_found, found);
+	else
+		fprintf(stderr, "Both found %ld records, all %ld records present\n", plain_found, found);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free(insertion_irs);
+	free(copies);
+	free_lsm_tree(lt);
+	free_tree(root);
+}
+
+
+// Compares lazy insertion through per-node buffers against insert(), and the two ways of querying with records
+// still buffered
+void benchmark_buffer_tree(int index_records_per_node) {
+	int k;
+	int num_insertions = 500000;
+	long buffer_size = 16 * index_records_per_node;
+	struct timespec start;
+	struct timespec end;
+	MBR space = {0, 0, MAX_RAND_NUM, MAX_RAND_NUM};
+
+	index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	index_record **copies = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+
+	for (k = 0; k < num_insertions; k++) {
+		insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+		copies[k] = initialize_ir(copy_mbr(insertion_irs[k]->mbr));
+	}
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k++)
+		insert(&root, insertion_irs[k], 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double insert_time = seconds_between(&start, &end);
+
+	buffer_tree *bt = create_buffer_tree(index_records_per_node, buffer_size);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k++)
+		buffer_tree_insert(bt, copies[k]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double buffered_time = seconds_between(&start, &end);
+	long still_buffered = bt->num_buffered;
+
+	long plain_found = 0, scan_found = 0, flush_found = 0;
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		plain_found += search(root, windows[k], NULL, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		scan_found += buffer_tree_search(bt, windows[k], false, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double scan_time = seconds_between(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		flush_found += buffer_tree_search(bt, windows[k], true, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double flush_query_time = seconds_between(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	flush_buffer_tree(bt);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double flush_time = seconds_between(&start, &end);
+
+	fprintf(stderr, "%d insertions: %lf seconds with insert(), %lf seconds buffered (%ld buffers of %ld emptied, %ld records left buffered)\n", num_insertions, insert_time, buffered_time, bt->num_flushes, buffer_size, still_buffered);
+	fprintf(stderr, "%d queries: %lf seconds scanning buffers, %lf seconds flushing them first. Final flush took %lf seconds\n", NUM_BENCHMARK_QUERIES, scan_time, flush_query_time, flush_time);
+
+	long found = buffer_tree_search(bt, &space, false, NULL, NULL);
+
+	if (plain_found != scan_found || plain_found != flush_found || found != num_insertions || bt->num_buffered != 0)
+		fprintf(stderr, "Result mismatch: %ld, %ld and %ld records found by the queries, %ld of %d in total\n", plain_found, scan_found, flush_found, found, num_insertions);
+	else
+		fprintf(stderr, "All queries found %ld records, all %ld records present\n", plain_found, found);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free(insertion_irs);
+	free(copies);
+	free_buffer_tree(bt);
+	free_tree(root);
+}
+
+
+// Builds the same paged_tree with a buffer pool big enough for every page and with one holding a small fraction of
+// them, and checks both against an in-memory tree
+void benchmark_paged(int index_records_per_node) {
+	int k, run;
+	int num_insertions = 200000;
+	int num_queries = 1000;
+	long budgets[2] = {1L << 28, 1L << 20};
+	struct timespec start;
+	struct timespec end;
+	MBR space = {0, 0, MAX_RAND_NUM, MAX_RAND_NUM};
+	char path[] = "/tmp/paged_tree_XXXXXX";
+
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		fprintf(stderr, "Could not create a temporary file for the paged tree\n");
+		exit(1);
+	}
+	close(fd);
+
+	index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * num_queries);
+
+	for (k = 0; k < num_insertions; k++)
+		insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+	for (k = 0; k < num_queries; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	for (k = 0; k < num_insertions; k++)
+		insert(&root, insertion_irs[k], 1);
+
+	long plain_found = 0;
+
+	for (k = 0; k < num_queries; k++)
+		plain_found += search(root, windows[k], NULL, NULL);
+
+	for (run = 0; run < 2; run++) {
+		paged_tree *pt = create_paged_tree(path, index_records_per_node, budgets[run]);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (k = 0; k < num_insertions; k++)
+			paged_insert(pt, insertion_irs[k]->mbr, k);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double insert_time = seconds_between(&start, &end);
+
+		long insert_reads = pt->pool->num_reads;
+		long insert_writes = pt->pool->num_writes;
+		long paged_found = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (k = 0; k < num_queries; k++)
+			paged_found += paged_search(pt, windows[k], NULL, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double query_time = seconds_between(&start, &end);
+
+		long found = paged_search(pt, &space, NULL, NULL);
+
+		fprintf(stderr, "%ld byte budget (%ld of %ld pages cached): %d insertions in %lf seconds (%ld page reads, %ld writes)\n", budgets[run], pt->pool->num_frames < pt->pool->num_pages ? pt->pool->num_frames : pt->pool->num_pages, pt->pool->num_pages, num_insertions, insert_time, insert_reads, insert_writes);
+		fprintf(stderr, "%d queries in %lf seconds (%ld page reads, %ld prefetched)\n", num_queries, query_time, pt->pool->num_reads - insert_reads, pt->pool->num_prefetches);
+
+		if (paged_found != plain_found || found != num_insertions)
+			fprintf(stderr, "Result mismatch: %ld records found by the queries on the paged tree and %ld in memory, %ld of %d in total\n", paged_found, plain_found, found, num_insertions);
+		else
+			fprintf(stderr, "Both found %ld records, all %ld records present\n", paged_found, found);
+
+		free_paged_tree(pt);
+	}
+
+	unlink(path);
+
+	for (k = 0; k < num_queries; k++)
+		free(windows[k]);
+	free(windows);
+	free(insertion_irs);
+	free_tree(root);
+}
+
+
+// What each worker process of the shared benchmark reports back through its pipe
+typedef struct shared_worker_result {
+	long found;
+	double seconds;
+} shared_worker_result;
+
+
+// Builds a shared_tree, then has NUM_SHARED_WORKERS processes attach to it and query it while this process keeps
+// inserting (outside the query windows, so the counts can be checked against an in-memory tree)
+void benchmark_shared(int index_records_per_node) {
+	int k, w;
+	int num_insertions = 200000;
+	int num_extra = 50000;
+	int num_queries = 2000;
+	struct timespec start;
+	struct timespec end;
+	char name[64];
+	int pipes[NUM_SHARED_WORKERS][2];
+	pid_t workers[NUM_SHARED_WORKERS];
+
+	snprintf(name, sizeof(name), "/r_tree_shared_%d", (int)getpid());
+
+	index_record **insertion_irs = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * num_queries);
+
+	for (k = 0; k < num_queries; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	// The private copy counts the records too, since the shared tree keeps their MBRs in its leaves
+	long size_before = current_tree_size();
+
+	for (k = 0; k < num_insertions; k++)
+		insertion_irs[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	for (k = 0; k < num_insertions; k++)
+		insert(&root, insertion_irs[k], 1);
+
+	long private_size = current_tree_size() - size_before;
+	long plain_found = 0;
+
+	for (k = 0; k < num_queries; k++)
+		plain_found += search(root, windows[k], NULL, NULL);
+
+	shared_tree *st = create_shared_tree(name, index_records_per_node, SHARED_SEGMENT_SIZE);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k++)
+		shared_insert(st, insertion_irs[k]->mbr, k);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double insert_time = seconds_between(&start, &end);
+
+	for (w = 0; w < NUM_SHARED_WORKERS; w++) {
+		if (pipe(pipes[w]) != 0) {
+			fprintf(stderr, "Could not create a pipe for worker %d\n", w);
+			exit(1);
+		}
+
+		workers[w] = fork();
+
+		if (workers[w] == 0) {
+			// Attached by name like an unrelated process would, rather than through the inherited mapping
+			shared_tree *view = attach_shared_tree(name);
+			shared_worker_result result = {0, 0};
+			struct timespec worker_start, worker_end;
+
+			clock_gettime(CLOCK_MONOTONIC, &worker_start);
+			for (k = 0; k < num_queries; k++)
+				result.found += shared_search(view, windows[k], NULL, NULL);
+			clock_gettime(CLOCK_MONOTONIC, &worker_end);
+			result.seconds = seconds_between(&worker_start, &worker_end);
+
+			detach_shared_tree(view);
+
+			if (write(pipes[w][1], &result, sizeof(result)) != sizeof(result))
+				_exit(1);
+			_exit(0);
+		}
+
+		close(pipes[w][1]);
+	}
+
+	// Inserted while the workers search, to the right of every query window
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_extra; k++) {
+		MBR *mbr = random_small_mbr(MAX_RAND_NUM + 2, 0, 2 * MAX_RAND_NUM, MAX_RAND_NUM);
+		shared_insert(st, mbr, num_insertions + k);
+		free(mbr);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double extra_time = seconds_between(&start, &end);
+
+	bool mismatch = false;
+
+	fprintf(stderr, "%d insertions into the shared tree: %lf seconds, then %d more in %lf seconds while %d processes queried it\n", num_insertions, insert_time, num_extra, extra_time, NUM_SHARED_WORKERS);
+
+	for (w = 0; w < NUM_SHARED_WORKERS; w++) {
+		shared_worker_result result = {-1, 0};
+		int status;
+
+		if (read(pipes[w][0], &result, sizeof(result)) != sizeof(result))
+			result.found = -1;
+
+		close(pipes[w][0]);
+		waitpid(workers[w], &status, 0);
+
+		fprintf(stderr, "Worker %d: %d queries in %lf seconds, %ld records found\n", w, num_queries, result.seconds, result.found);
+		mismatch = mismatch || result.found != plain_found;
+	}
+
+	MBR space = {0, 0, 2 * MAX_RAND_NUM, MAX_RAND_NUM};
+	long found = shared_search(st, &space, NULL, NULL);
+
+	fprintf(stderr, "Shared segment uses %zu bytes for %ld records, a private copy of the first %d takes %ld bytes in each process\n", st->header->used, st->header->num_records, num_insertions, private_size);
+
+	if (mismatch || found != num_insertions + num_extra)
+		fprintf(stderr, "Result mismatch: %ld records found by the in-memory queries, %ld of %d in total\n", plain_found, found, num_insertions + num_extra);
+	else
+		fprintf(stderr, "All workers found %ld records, all %ld records present\n", plain_found, found);
+
+	detach_shared_tree(st);
+	destroy_shared_tree(name);
+
+	for (k = 0; k < num_queries; k++)
+		free(windows[k]);
+	free(windows);
+	free(insertion_irs);
+	free_tree(root);
+}
+
+
+// Compares the spatial join of two trees, on 1 to NUM_CORES workers, against one search of the first tree per record of
+// the second
+void benchmark_join(int index_records_per_node) {
+	int k, num_threads;
+	int num_records = 100000;
+	struct timespec start;
+	struct timespec end;
+
+	index_record **records_b = (index_record**)malloc(sizeof(index_record*) * num_records);
+	r_tree_node *root_a = initialize_rt(index_records_per_node);
+	r_tree_node *root_b = initialize_rt(index_records_per_node);
+
+	for (k = 0; k < num_records; k++) {
+		insert(&root_a, initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM)), 1);
+
+		records_b[k] = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+		insert(&root_b, records_b[k], 1);
+	}
+
+	long nested_found = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_records; k++)
+		nested_found += search(root_a, records_b[k]->mbr, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "Nested loop of %d searches: %lf seconds, %ld pairs\n", num_records, seconds_between(&start, &end), nested_found);
+
+	for (num_threads = 1; num_threads <= NUM_CORES; num_threads++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		long join_found = spatial_join(root_a, root_b, num_threads, NULL, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		fprintf(stderr, "Join on %d workers: %lf seconds, %ld pairs\n", num_threads, seconds_between(&start, &end), join_found);
+
+		if (join_found != nested_found)
+			fprintf(stderr, "Result mismatch: %ld pairs from the nested loop, %ld from the join\n", nested_found, join_found);
+	}
+
+	free(records_b);
+	free_tree(root_a);
+	free_tree(root_b);
+}
+
+
+// Prints the utilisation and latency percentiles of a finished batch and checks every query's result count against
+// expected. Returns true if they all match. Latency counts from the start of the batch, response time from when the
+// query was handed out
+bool report_query_batch(const char *executor, query_batch *qb, long *expected) {
+	double latencies[qb->num_queries];
+	double responses[qb->num_queries];
+	double busy = 0;
+	long steals = 0;
+	bool matches = true;
+	int k;
+
+	for (k = 0; k < qb->num_queries; k++) {
+		latencies[k] = qb->results[k].latency;
+		responses[k] = qb->results[k].latency - qb->results[k].started;
+		matches = matches && qb->results[k].num_records == expected[k];
+	}
+	for (k = 0; k < qb->num_workers; k++) {
+		busy += qb->busy_seconds[k];
+		steals += qb->steals[k];
+	}
+
+	qsort(latencies, qb->num_queries, sizeof(double), compare_doubles);
+	qsort(responses, qb->num_queries, sizeof(double), compare_doubles);
+
+	fprintf(stderr, "%s on %d workers: %lf seconds, %.1lf%% utilisation, latency p50 %lf p99 %lf max %lf seconds, %ld steals\n", executor, qb->num_workers, qb->wall_seconds, 100 * busy / (qb->wall_seconds * qb->num_workers), percentile(latencies, qb->num_queries, 0.5), percentile(latencies, qb->num_queries, 0.99), percentile(latencies, qb->num_queries, 1), steals);
+	fprintf(stderr, "    response time p50 %lf p99 %lf p99.9 %lf max %lf seconds\n", percentile(responses, qb->num_queries, 0.5), percentile(responses, qb->num_queries, 0.99), percentile(responses, qb->num_queries, 0.999), percentile(responses, qb->num_queries, 1));
+
+	return matches;
+}
+
+
+// Runs a batch of mostly small queries, whose last few are big ones reaching most of the tree, with the work-stealing
+// executor and with a static split of the queries between threads
+void benchmark_query_batch(int index_records_per_node) {
+	int k, num_threads;
+	int num_insertions = 200000;
+	int num_queries = NUM_BENCHMARK_QUERIES;
+	int num_big_queries = num_queries / 50;
+
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * num_queries);
+	long *expected = (long*)malloc(sizeof(long) * num_queries);
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	for (k = 0; k < num_insertions; k++)
+		insert(&root, initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM)), 1);
+
+	// The big queries all arrive together at the end of the batch, like a dashboard zooming out
+	for (k = 0; k < num_queries; k++) {
+		if (k < num_queries - num_big_queries)
+			windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+		else
+			windows[k] = random_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+		expected[k] = search(root, windows[k], NULL, NULL);
+	}
+
+	for (num_threads = 1; num_threads <= NUM_CORES; num_threads *= 2) {
+		query_batch *stealing = run_query_batch(root, windows, num_queries, num_threads);
+		query_batch *split = run_query_batch_static(root, windows, num_queries, num_threads);
+
+		bool matches = report_query_batch("Work stealing", stealing, expected);
+		matches = report_query_batch("Static split", split, expected) && matches;
+
+		if (!matches)
+			fprintf(stderr, "Result mismatch: a query found a different number of records than search()\n");
+
+		free_query_batch(stealing);
+		free_query_batch(split);
+	}
+
+	for (k = 0; k < num_queries; k++)
+		free(windows[k]);
+	free(windows);
+	free(expected);
+	free_tree(root);
+}
+
+
+// Compares one search() per window against multi_query_search, for viewport-like windows crowded around a few hot spots
+void benchmark_multi_query(int index_records_per_node) {
+	int k;
+	int num_insertions = 500000;
+	int num_hot_spots = 16;
+	struct timespec start;
+	struct timespec end;
+
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+	long *counts = (long*)malloc(sizeof(long) * NUM_BENCHMARK_QUERIES);
+	MBR *hot_spots[num_hot_spots];
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	for (k = 0; k < num_insertions; k++)
+		insert(&root, initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM)), 1);
+
+	for (k = 0; k < num_hot_spots; k++)
+		hot_spots[k] = random_small_mbr(5, 5, MAX_RAND_NUM - 5, MAX_RAND_NUM - 5);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++) {
+		MBR *spot = hot_spots[rand() % num_hot_spots];
+		windows[k] = random_mbr(spot->min_x - 4, spot->min_y - 4, spot->min_x + 4, spot->min_y + 4);
+	}
+
+	long plain_found = 0;
+	bool counts_match = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		plain_found += search(root, windows[k], NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double plain_time = seconds_between(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long multi_found = multi_query_search(root, windows, NUM_BENCHMARK_QUERIES, NULL, NULL, counts);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double multi_time = seconds_between(&start, &end);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		counts_match = counts_match && counts[k] == search(root, windows[k], NULL, NULL);
+
+	fprintf(stderr, "%d viewport queries: %lf seconds one at a time, %lf seconds in groups of %d\n", NUM_BENCHMARK_QUERIES, plain_time, multi_time, QUERY_GROUP_SIZE);
+
+	if (plain_found != multi_found || !counts_match)
+		fprintf(stderr, "Result mismatch: %ld records found one at a time, %ld in groups\n", plain_found, multi_found);
+	else
+		fprintf(stderr, "Both found %ld records\n", plain_found);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	for (k = 0; k < num_hot_spots; k++)
+		free(hot_spots[k]);
+	free(windows);
+	free(counts);
+	free_tree(root);
+}
+
+
+// search() callback adding up the weights of the records found
+static void sum_weights(index_record *ir, void *arg) {
+	*(double *)arg += ir->agg.sum;
+}
+
+
+// Compares counting (and summing the weights of) the records in each window with search() against range_count
+void benchmark_range_count(int index_records_per_node) {
+	int k;
+	int num_insertions = 500000;
+	int num_queries = 1000;
+	struct timespec start;
+	struct timespec end;
+
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * num_queries);
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	for (k = 0; k < num_insertions; k++) {
+		index_record *ir = initialize_ir(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM));
+		set_weight(ir, (double)rand() / RAND_MAX);
+		insert(&root, ir, 1);
+	}
+
+	for (k = 0; k < num_queries; k++)
+		windows[k] = random_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	long search_count = 0;
+	double search_sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_queries; k++)
+		search_count += search(root, windows[k], sum_weights, &search_sum);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double search_time = seconds_between(&start, &end);
+
+	aggregate total = {0, 0};
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_queries; k++) {
+		aggregate window_total;
+		range_count(root, windows[k], &window_total);
+		add_aggregate(&total, &window_total);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double count_time = seconds_between(&start, &end);
+
+	fprintf(stderr, "%d window counts over %d records: %lf seconds with search, %lf seconds with range_count\n", num_queries, num_insertions, search_time, count_time);
+
+	// The weights are added up in a different order, so the sums only agree up to rounding
+	if (search_count != total.count || fabs(search_sum - total.sum) > 1e-9 * search_sum)
+		fprintf(stderr, "Result mismatch: search found %ld records weighing %lf, range_count %ld weighing %lf\n", search_count, search_sum, total.count, total.sum);
+	else
+		fprintf(stderr, "Both found %ld records weighing %lf\n", search_count, search_sum);
+
+	for (k = 0; k < num_queries; k++)
+		free(windows[k]);
+	free(windows);
+	free_tree(root);
+}
+
+
+// Builds trees with leaf and internal nodes sized to whole cache lines, once with the generic node kernels and once
+// with the ones specialised for the capacities, and compares the insertion times
+void benchmark_fanout(int index_records_per_node) {
+	int k, c;
+	int num_insertions = 300000;
+	int num_queries = 1000;
+	struct timespec start;
+	struct timespec end;
+
+	// Node sizes in cache lines, leaf first
+	int configs[][2] = {
+		{FANOUT_LINES_SMALL, FANOUT_LINES_SMALL},
+		{FANOUT_LINES_MEDIUM, FANOUT_LINES_MEDIUM},
+		{FANOUT_LINES_LARGE, FANOUT_LINES_MEDIUM},
+		{FANOUT_LINES_LARGE, FANOUT_LINES_LARGE},
+		{FANOUT_LINES_PAGE, FANOUT_LINES_LARGE}
+	};
+	int num_configs = sizeof(configs) / sizeof(configs[0]);
+
+	MBR **mbrs = (MBR**)malloc(sizeof(MBR*) * num_insertions);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * num_queries);
+
+	for (k = 0; k < num_insertions; k++)
+		mbrs[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+	for (k = 0; k < num_queries; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	for (c = 0; c < num_configs; c++) {
+		int leaf_members = cache_line_fanout(configs[c][0]);
+		int internal_members = cache_line_fanout(configs[c][1]);
+		fanout_tree *generic = create_fanout_tree(leaf_members, internal_members, false);
+		fanout_tree *specialised = create_fanout_tree(leaf_members, internal_members, true);
+
+		long splits_before = num_splits();
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (k = 0; k < num_insertions; k++)
+			fanout_insert(generic, initialize_ir(copy_mbr(mbrs[k])));
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double generic_time = seconds_between(&start, &end);
+		long generic_splits = num_splits() - splits_before;
+
+		splits_before = num_splits();
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (k = 0; k < num_insertions; k++)
+			fanout_insert(specialised, initialize_ir(copy_mbr(mbrs[k])));
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double specialised_time = seconds_between(&start, &end);
+		long specialised_splits = num_splits() - splits_before;
+
+		// The kernels make the same choices, so both trees have to come out the same
+		bool same_results = generic_splits == specialised_splits;
+
+		for (k = 0; k < num_queries; k++)
+			same_results = same_results && search(generic->root, windows[k], NULL, NULL) == search(specialised->root, windows[k], NULL, NULL);
+
+		fprintf(stderr, "Leaves of %d (%d lines), internal nodes of %d (%d lines): %d insertions took %lf seconds generic, %lf seconds specialised\n",
+			leaf_members, configs[c][0], internal_members, configs[c][1], num_insertions, generic_time, specialised_time);
+
+		if (!same_results)
+			fprintf(stderr, "Trees differ: %ld splits generic, %ld specialised\n", generic_splits, specialised_splits);
+
+		free_fanout_tree(generic);
+		free_fanout_tree(specialised);
+	}
+
+	for (k = 0; k < num_insertions; k++)
+		free(mbrs[k]);
+	for (k = 0; k < num_queries; k++)
+		free(windows[k]);
+	free(mbrs);
+	free(windows);
+}
+
+
+// Compares an r-tree of zero-size MBRs with a point_tree holding the same points, in memory and search time
+void benchmark_points(int index_records_per_node) {
+	int k;
+	int num_points = 500000;
+	struct timespec start;
+	struct timespec end;
+
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+	r_tree_node *root = initialize_rt(index_records_per_node);
+	point_tree *pt = create_point_tree(index_records_per_node, index_records_per_node);
+
+	long size_before = current_tree_size();
+
+	for (k = 0; k < num_points; k++) {
+		MBR *mbr = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+		mbr->max_x = mbr->min_x;
+		mbr->max_y = mbr->min_y;
+		insert(&root, initialize_ir(mbr), 1);
+		point_insert(pt, mbr->min_x, mbr->min_y);
+	}
+
+	long tree_bytes = current_tree_size() - size_before;
+	long point_bytes = pt->leaf_bytes + pt->node_bytes;
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	long tree_found = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		tree_found += search(root, windows[k], NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double tree_time = seconds_between(&start, &end);
+
+	long point_found = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		point_found += point_search(pt, windows[k], NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double point_time = seconds_between(&start, &end);
+
+	fprintf(stderr, "%d points: r-tree of MBRs uses %ld bytes (%.1lf per point), point_tree %ld bytes (%.1lf per point, %ld of them in leaves)\n",
+		num_points, tree_bytes, (double)tree_bytes / num_points, point_bytes, (double)point_bytes / num_points, pt->leaf_bytes);
+	fprintf(stderr, "%d queries: %lf seconds on the r-tree, %lf seconds on the point_tree\n", NUM_BENCHMARK_QUERIES, tree_time, point_time);
+
+	if (tree_found != point_found)
+		fprintf(stderr, "Result mismatch: %ld points found in the r-tree, %ld in the point_tree\n", tree_found, point_found);
+	else
+		fprintf(stderr, "Both found %ld points\n", tree_found);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free_tree(root);
+	free_point_tree(pt);
+}
+
+
+// Side map from index_record pointers to row ids, the way callers had to attach ids before index_records carried them
+typedef struct id_map {
+	index_record **keys;
+	record_id *values;
+	long capacity;
+} id_map;
+
+
+static long id_map_slot(id_map *map, index_record *key) {
+	long slot = (long)(((uintptr_t)key >> 4) * 0x9E3779B97F4A7C15ULL % map->capacity);
+
+	while (map->keys[slot] != NULL && map->keys[slot] != key)
+		slot = (slot + 1) % map->capacity;
+
+	return slot;
+}
+
+
+// search() callbacks adding up the ids of the records found, through the side map or from the records themselves
+typedef struct id_sum {
+	id_map *map;
+	record_id sum;
+} id_sum;
+
+
+static void sum_mapped_ids(index_record *ir, void *arg) {
+	id_sum *ids = (id_sum *)arg;
+	ids->sum += ids->map->values[id_map_slot(ids->map, ir)];
+}
+
+
+static void sum_inline_ids(index_record *ir, void *arg) {
+	((id_sum *)arg)->sum += ir->id;
+}
+
+
+// Compares reading the ids of search results through a side map with reading the ids stored in the records, then
+// deletes half of the records by id
+void benchmark_record_ids(int index_records_per_node) {
+	int k;
+	int num_insertions = 300000;
+	struct timespec start;
+	struct timespec end;
+
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+	index_record **records = (index_record**)malloc(sizeof(index_record*) * num_insertions);
+	r_tree_node *root = initialize_rt(index_records_per_node);
+	id_map map;
+
+	map.capacity = num_insertions * 2;
+	map.keys = (index_record**)calloc(map.capacity, sizeof(index_record*));
+	map.values = (record_id*)malloc(sizeof(record_id) * map.capacity);
+
+	for (k = 0; k < num_insertions; k++) {
+		record_id id = (record_id)k * 7 + 1;
+
+		records[k] = initialize_record(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM), id);
+		insert(&root, records[k], 1);
+
+		long slot = id_map_slot(&map, records[k]);
+		map.keys[slot] = records[k];
+		map.values[slot] = id;
+	}
+
+	// Windows of up to 10 by 10, so each query returns enough records for the id lookups to matter
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++) {
+		MBR *corner = random_small_mbr(0, 0, MAX_RAND_NUM - 10, MAX_RAND_NUM - 10);
+		windows[k] = random_mbr(corner->min_x, corner->min_y, corner->min_x + 10, corner->min_y + 10);
+		free(corner);
+	}
+
+	id_sum mapped = {&map, 0};
+	id_sum inline_ids = {NULL, 0};
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		search(root, windows[k], sum_mapped_ids, &mapped);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double mapped_time = seconds_between(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		search(root, windows[k], sum_inline_ids, &inline_ids);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double inline_time = seconds_between(&start, &end);
+
+	fprintf(stderr, "%d queries: %lf seconds looking ids up in a side map, %lf seconds reading them from the records\n", NUM_BENCHMARK_QUERIES, mapped_time, inline_time);
+
+	if (mapped.sum != inline_ids.sum)
+		fprintf(stderr, "Id mismatch: %ld through the side map, %ld from the records\n", (long)mapped.sum, (long)inline_ids.sum);
+
+	// Delete every other record, by its MBR and id
+	long num_deleted = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_insertions; k += 2) {
+		index_record *deleted = delete_record(&root, records[k]->mbr, records[k]->id);
+
+		if (deleted == records[k]) {
+			free_entry(deleted);
+			records[k] = NULL;
+			num_deleted++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	long num_left = 0;
+	aggregate total;
+
+	for (k = 1; k < num_insertions; k += 2)
+		num_left += search(root, records[k]->mbr, NULL, NULL) > 0;
+
+	sum_members(root, &total);
+
+	fprintf(stderr, "Deleted %ld records by id in %lf seconds\n", num_deleted, seconds_between(&start, &end));
+
+	if (num_deleted != (num_insertions + 1) / 2 || num_left != num_insertions / 2 || total.count != num_insertions / 2)
+		fprintf(stderr, "Deletion mismatch: %ld deleted, %ld of the rest found, %ld counted in the tree\n", num_deleted, num_left, total.count);
+	else
+		fprintf(stderr, "All %ld remaining records found\n", num_left);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free(records);
+	free(map.keys);
+	free(map.values);
+	free_tree(root);
+}
+
+
+// Times generate_seeded_tree and generate_records on more and more threads, checking that every thread count gives
+// exactly the same output, and shows how each distribution spreads its records over the box
+void benchmark_datasets(int index_records_per_node, int num_levels) {
+	int thread_counts[] = {1, 2, 4, NUM_CORES};
+	int num_thread_counts = sizeof(thread_counts) / sizeof(int);
+	const char *distribution_names[] = {"uniform", "clustered", "skewed"};
+	long num_records = 1000000;
+	struct timespec start;
+	struct timespec end;
+	int d, t;
+	long k;
+
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	generate_random_tree(root, num_levels, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "generate_random_tree: %lf seconds\n", seconds_between(&start, &end));
+	free_tree(root);
+
+	uint64_t first_fingerprint = 0;
+
+	for (t = 0; t < num_thread_counts; t++) {
+		root = initialize_rt(index_records_per_node);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		generate_seeded_tree(root, num_levels, DATASET_BENCHMARK_SEED, thread_counts[t]);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		uint64_t fingerprint = tree_fingerprint(root);
+
+		if (t == 0)
+			first_fingerprint = fingerprint;
+
+		fprintf(stderr, "generate_seeded_tree on %d threads: %lf seconds, fingerprint %016llx%s\n", thread_counts[t],
+			seconds_between(&start, &end), (unsigned long long)fingerprint, fingerprint == first_fingerprint ? "" : " (MISMATCH)");
+		free_tree(root);
+	}
+
+	for (d = DATASET_UNIFORM; d <= DATASET_SKEWED; d++) {
+		dataset_spec spec;
+
+		initialize_dataset_spec(&spec, DATASET_BENCHMARK_SEED, (dataset_distribution)d);
+
+		for (t = 0; t < num_thread_counts; t++) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			index_record **records = generate_records(&spec, num_records, thread_counts[t]);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			uint64_t fingerprint = records_fingerprint(records, num_records);
+
+			if (t == 0) {
+				first_fingerprint = fingerprint;
+
+				// Share of the records in the lower-left quarter of the box, a quarter for uniform data
+				long lower_left = 0;
+
+				for (k = 0; k < num_records; k++) {
+					if (records[k]->mbr->max_x <= MAX_RAND_NUM / 2 && records[k]->mbr->max_y <= MAX_RAND_NUM / 2)
+						lower_left++;
+				}
+
+				fprintf(stderr, "%s: %.1lf%% of the records in the lower-left quarter\n", distribution_names[d], 100.0 * lower_left / num_records);
+			}
+
+			fprintf(stderr, "%ld %s records on %d threads: %lf seconds, fingerprint %016llx%s\n", num_records, distribution_names[d],
+				thread_counts[t], seconds_between(&start, &end), (unsigned long long)fingerprint, fingerprint == first_fingerprint ? "" : " (MISMATCH)");
+
+			for (k = 0; k < num_records; k++)
+				free_index_record(records[k]);
+			free(records);
+		}
+	}
+}
+
+
+// Prints the throughput and latency percentiles of a replay
+void report_replay(replay_stats *stats) {
+	long num_ops = stats->num_ops[TRACE_INSERT] + stats->num_ops[TRACE_SEARCH] + stats->num_ops[TRACE_DELETE];
+
+	fprintf(stderr, "%s replay on %d threads: %ld operations (%ld inserts, %ld searches, %ld deletes) in %lf seconds, %.0lf operations per second\n",
+		stats->paced ? "Paced" : "Full speed", stats->num_threads, num_ops, stats->num_ops[TRACE_INSERT], stats->num_ops[TRACE_SEARCH],
+		stats->num_ops[TRACE_DELETE], stats->wall_seconds, num_ops / stats->wall_seconds);
+	fprintf(stderr, "    latency p50 %lf p90 %lf p99 %lf p99.9 %lf max %lf seconds, %ld records found\n",
+		stats->p50, stats->p90, stats->p99, stats->p999, stats->max, stats->records_found);
+}
+
+
+// Replays the trace file at path onto a fresh tree
+void benchmark_replay(int index_records_per_node, char *path, int num_threads, bool paced) {
+	trace *t = load_trace(path);
+	replay_stats stats;
+
+	if (t == NULL) {
+		fprintf(stderr, "Could not read a trace from %s\n", path);
+		exit(1);
+	}
+
+	r_tree_node *root = initialize_rt(index_records_per_node);
+
+	replay_trace(t, &root, num_threads, paced, &stats);
+	report_replay(&stats);
+
+	free_tree(root);
+	free_trace(t);
+}
+
+
+// Records a workload of inserts, searches and deletes to TRACE_BENCHMARK_FILE, then replays it at full speed on more
+// and more threads and once at its original pacing. The single-threaded replays find exactly what the workload did
+void benchmark_trace(int index_records_per_node) {
+	int num_ops = 200000;
+	int num_threads;
+	long num_inserted = 0;
+	long found = 0;
+	int k;
+
+	index_record **inserted = (index_record**)malloc(sizeof(index_record*) * num_ops);
+	r_tree_node *root = initialize_rt(index_records_per_node);
+	trace_recorder *recorder = open_trace_recorder(TRACE_BENCHMARK_FILE);
+
+	if (recorder == NULL) {
+		fprintf(stderr, "Could not create %s\n", TRACE_BENCHMARK_FILE);
+		exit(1);
+	}
+
+	// Six inserts to three searches and one delete of a record inserted earlier
+	for (k = 0; k < num_ops; k++) {
+		int kind = rand() % 10;
+
+		if (kind < 6 || num_inserted == 0) {
+			index_record *ir = initialize_record(random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM), k);
+
+			traced_insert(recorder, &root, ir, 1);
+			inserted[num_inserted++] = ir;
+		} else if (kind < 9) {
+			MBR *window = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+			found += traced_search(recorder, root, window, NULL, NULL);
+			free(window);
+		} else {
+			long victim = rand() % num_inserted;
+			index_record *ir = inserted[victim];
+
+			inserted[victim] = inserted[--num_inserted];
+			free_entry(traced_delete(recorder, &root, ir->mbr, ir->id));
+		}
+	}
+
+	close_trace_recorder(recorder);
+	free_tree(root);
+	free(inserted);
+
+	fprintf(stderr, "Recorded %d operations to %s, %ld records found\n", num_ops, TRACE_BENCHMARK_FILE, found);
+
+	for (num_threads = 1; num_threads <= NUM_CORES; num_threads *= 2)
+		benchmark_replay(index_records_per_node, TRACE_BENCHMARK_FILE, num_threads, false);
+
+	benchmark_replay(index_records_per_node, TRACE_BENCHMARK_FILE, 1, true);
+}
+
+
+// Reads path back into a fresh tree and checks it holds expected records and finds what the original tree does
+void check_ingest(char *name, char *path, ingest_format format, ingest_mode mode, int index_records_per_node, int num_threads, long expected, MBR **windows, long *found) {
+	r_tree_node *root = initialize_rt(index_records_per_node);
+	ingest_stats stats;
+	long mismatches = 0;
+	int k;
+
+	if (!ingest_file(path, format, &root, mode, num_threads, &stats)) {
+		fprintf(stderr, "Could not read %s\n", path);
+		exit(1);
+	}
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		mismatches += search(root, windows[k], NULL, NULL) != found[k];
+
+	fprintf(stderr, "%s, %s on %d threads: %ld records (%ld lines skipped) from %ld chunks in %lf seconds, %.0lf MB/s%s, %ld of %d queries find something else\n",
+		name, mode == INGEST_BULK_LOAD ? "bulk loaded" : "inserted", num_threads, stats.num_records, stats.num_skipped, stats.num_chunks,
+		stats.wall_seconds, stats.num_bytes / stats.wall_seconds / (1 << 20), stats.num_records == expected ? "" : " (WRONG COUNT)", mismatches, NUM_BENCHMARK_QUERIES);
+
+	free_tree(root);
+}
+
+
+// Dumps a tree with write_tree_to_csv and write_tree_to_binary and reads it back with ingest_file on more and more
+// threads. The CSV dump rounds coordinates to 6 decimals, so a few queries can find different records in its reload
+void benchmark_ingest(int index_records_per_node) {
+	int thread_counts[] = {1, 2, 4, NUM_CORES};
+	int num_thread_counts = sizeof(thread_counts) / sizeof(int);
+	long num_records = 1000000;
+	dataset_spec spec;
+	int k, t;
+
+	// write_tree_to_csv wants a .csv file, so the suffix is kept out of the random part
+	char csv_path[] = "/tmp/ingest_tree_XXXXXX.csv";
+	char binary_path[] = "/tmp/ingest_rects_XXXXXX";
+	int csv_fd = mkstemps(csv_path, 4);
+	int binary_fd = mkstemp(binary_path);
+
+	if (csv_fd < 0 || binary_fd < 0) {
+		fprintf(stderr, "Could not create temporary files for the ingest benchmark\n");
+		exit(1);
+	}
+	close(csv_fd);
+	close(binary_fd);
+
+	initialize_dataset_spec(&spec, DATASET_BENCHMARK_SEED, DATASET_UNIFORM);
+
+	index_record **records = generate_records(&spec, num_records, NUM_CORES);
+	r_tree_node *root = bulk_load(records, num_records, index_records_per_node);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+	long *found = (long*)malloc(sizeof(long) * NUM_BENCHMARK_QUERIES);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++) {
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+		found[k] = search(root, windows[k], NULL, NULL);
+	}
+
+	write_tree_to_csv(csv_path, root);
+	write_tree_to_binary(binary_path, root);
+	free_tree(root);
+	free(records);
+
+	for (t = 0; t < num_thread_counts; t++)
+		check_ingest("Tree CSV", csv_path, INGEST_TREE_CSV, INGEST_BULK_LOAD, index_records_per_node, thread_counts[t], num_records, windows, found);
+
+	for (t = 0; t < num_thread_counts; t++)
+		check_ingest("Binary", binary_path, INGEST_BINARY, INGEST_BULK_LOAD, index_records_per_node, thread_counts[t], num_records, windows, found);
+
+	check_ingest("Binary", binary_path, INGEST_BINARY, INGEST_INSERT, index_records_per_node, NUM_CORES, num_records, windows, found);
+
+	unlink(csv_path);
+	unlink(binary_path);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free(found);
+}
+
+
+static record_id sum_ids(record_id *ids, long num_ids) {
+	record_id sum = 0;
+	long k;
+
+	for (k = 0; k < num_ids; k++)
+		sum += ids[k];
+
+	return sum;
+}
+
+
+typedef struct cache_reader_args {
+	query_cache *qc;
+	r_tree_node *root;
+	MBR **tiles;
+	long *expected;
+	int *sequence;
+	int first_query;
+	int num_queries;
+	long num_wrong;
+} cache_reader_args;
+
+
+// Runs cached searches of the tiles of its share of the sequence, counting results that don't have the expected
+// number of ids
+void *cache_reader(void *arg) {
+	cache_reader_args *args = (cache_reader_args *)arg;
+	int k;
+
+	for (k = args->first_query; k < args->first_query + args->num_queries; k++) {
+		int tile = args->sequence[k];
+		long num_ids;
+		record_id *ids = cached_search(args->qc, args->root, args->tiles[tile], &num_ids);
+
+		args->num_wrong += num_ids != args->expected[tile];
+		free(ids);
+	}
+
+	pthread_exit(NULL);
+}
+
+
+// Replays a map-tile workload (the same windows over and over, mostly a few hot ones, with a record inserted every
+// 100 queries) with and without a query_cache, checking both give the same results, then has NUM_CONCURRENT_READERS
+// threads share the cache
+void benchmark_query_cache(int index_records_per_node) {
+	int num_records = 200000;
+	int num_tiles = 2000;
+	int num_hot_tiles = 100;
+	int num_queries = 200000;
+	int insert_every = 100;
+	struct timespec start;
+	struct timespec end;
+	dataset_spec spec, insert_spec;
+	int k;
+
+	initialize_dataset_spec(&spec, DATASET_BENCHMARK_SEED, DATASET_UNIFORM);
+	initialize_dataset_spec(&insert_spec, DATASET_BENCHMARK_SEED + 1, DATASET_UNIFORM);
+
+	index_record **records = generate_records(&spec, num_records, 1);
+	r_tree_node *plain_root = bulk_load(records, num_records, index_records_per_node);
+	free(records);
+	records = generate_records(&spec, num_records, 1);
+	r_tree_node *cached_root = bulk_load(records, num_records, index_records_per_node);
+	free(records);
+
+	index_record **plain_inserts = generate_records(&insert_spec, num_queries / insert_every, 1);
+	index_record **cached_inserts = generate_records(&insert_spec, num_queries / insert_every, 1);
+
+	MBR **tiles = (MBR**)malloc(sizeof(MBR*) * num_tiles);
+	int *sequence = (int*)malloc(sizeof(int) * num_queries);
+
+	for (k = 0; k < num_tiles; k++) {
+		double x = (double)rand() / RAND_MAX * (MAX_RAND_NUM - 2);
+		double y = (double)rand() / RAND_MAX * (MAX_RAND_NUM - 2);
+
+		tiles[k] = create_mbr(0, 0, 0, 0);
+		tiles[k]->min_x = coord_floor(x);
+		tiles[k]->min_y = coord_floor(y);
+		tiles[k]->max_x = coord_ceil(x + 2);
+		tiles[k]->max_y = coord_ceil(y + 2);
+	}
+
+	// Nine in ten queries go to the hot tiles
+	for (k = 0; k < num_queries; k++)
+		sequence[k] = rand() % 10 < 9 ? rand() % num_hot_tiles : rand() % num_tiles;
+
+	record_id plain_checksum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_queries; k++) {
+		id_list list = {(record_id *)malloc(sizeof(record_id) * 16), 0, 16};
+
+		if (k % insert_every == 0)
+			insert(&plain_root, plain_inserts[k / insert_every], 1);
+
+		search(plain_root, tiles[sequence[k]], collect_id, &list);
+		plain_checksum += list.num_ids * 31 + sum_ids(list.ids, list.num_ids);
+		free(list.ids);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double plain_time = seconds_between(&start, &end);
+
+	query_cache *qc = create_query_cache(CACHE_BENCHMARK_BUDGET, CACHE_BENCHMARK_CELL_SIZE);
+	record_id cached_checksum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_queries; k++) {
+		long num_ids;
+
+		if (k % insert_every == 0)
+			cached_insert(qc, &cached_root, cached_inserts[k / insert_every], 1);
+
+		record_id *ids = cached_search(qc, cached_root, tiles[sequence[k]], &num_ids);
+		cached_checksum += num_ids * 31 + sum_ids(ids, num_ids);
+		free(ids);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double cached_time = seconds_between(&start, &end);
+
+	long hits = atomic_load(&qc->hits);
+	long misses = atomic_load(&qc->misses);
+
+	fprintf(stderr, "%d queries and %d insertions: %lf seconds without the cache, %lf seconds with it\n", num_queries, num_queries / insert_every, plain_time, cached_time);
+	fprintf(stderr, "%.1lf%% hits, %ld evictions, %ld entries invalidated of %ld checked, %ld entries in %ld bytes\n", 100.0 * hits / (hits + misses),
+		atomic_load(&qc->evictions), atomic_load(&qc->invalidations), atomic_load(&qc->checked), query_cache_entries(qc), query_cache_bytes(qc));
+
+	if (plain_checksum != cached_checksum)
+		fprintf(stderr, "Result mismatch: the cached searches found different records\n");
+	else
+		fprintf(stderr, "Cached and uncached searches found the same records\n");
+
+	pthread_t threads[NUM_CONCURRENT_READERS];
+	cache_reader_args args[NUM_CONCURRENT_READERS];
+	long *expected = (long*)malloc(sizeof(long) * num_tiles);
+	long num_wrong = 0;
+
+	for (k = 0; k < num_tiles; k++)
+		expected[k] = search(cached_root, tiles[k], NULL, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < NUM_CONCURRENT_READERS; k++) {
+		int share = num_queries / NUM_CONCURRENT_READERS;
+
+		args[k] = (cache_reader_args){qc, cached_root, tiles, expected, sequence, k * share, share, 0};
+		pthread_create(&threads[k], NULL, cache_reader, &args[k]);
+	}
+	for (k = 0; k < NUM_CONCURRENT_READERS; k++) {
+		pthread_join(threads[k], NULL);
+		num_wrong += args[k].num_wrong;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "%d readers sharing the cache: %d queries in %lf seconds, %ld wrong results\n", NUM_CONCURRENT_READERS, num_queries, seconds_between(&start, &end), num_wrong);
+
+	for (k = 0; k < num_tiles; k++)
+		free(tiles[k]);
+	free(tiles);
+	free(sequence);
+	free(expected);
+	free(plain_inserts);
+	free(cached_inserts);
+	free_query_cache(qc);
+	free_tree(plain_root);
+	free_tree(cached_root);
+}
+
+
+static int compare_min_x(const void *a, const void *b) {
+	coord_t min_a = (*(index_record **)a)->mbr->min_x;
+	coord_t min_b = (*(index_record **)b)->mbr->min_x;
+	return (min_a > min_b) - (min_a < min_b);
+}
+
+
+// Average number of nodes visited by search() over the benchmark windows
+double average_node_visits(r_tree_node *root, MBR **windows) {
+	long visits = 0;
+	int k;
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		visits += count_node_visits(root, windows[k]);
+
+	return (double)visits / NUM_BENCHMARK_QUERIES;
+}
+
+
+// Degrades a concurrent_tree by inserting clustered records in order of x, then lets a repacker reorganise it in the
+// background while more records are inserted and lock-free readers search it, and compares the tree before and after
+void benchmark_repack(int index_records_per_node) {
+	int num_preloaded = 100000;
+	int num_insertions = 50000;
+	MBR space = {0, 0, MAX_RAND_NUM, MAX_RAND_NUM};
+	tree_metrics metrics;
+	dataset_spec spec;
+	int k;
+
+	initialize_dataset_spec(&spec, DATASET_BENCHMARK_SEED, DATASET_CLUSTERED);
+
+	concurrent_tree *ct = create_concurrent_tree(index_records_per_node);
+	index_record **records = generate_records(&spec, num_preloaded + num_insertions, 1);
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	// Sweeping across the space is about the worst order for choose_leaf
+	qsort(records, num_preloaded, sizeof(index_record *), compare_min_x);
+
+	for (k = 0; k < num_preloaded; k++)
+		concurrent_insert(ct, records[k], 1);
+
+	r_tree_node *root = atomic_load(&ct->root);
+	measure_tree(root, &metrics);
+	print_tree_metrics("Before", &metrics);
+	fprintf(stderr, "%.1lf nodes visited per query\n", average_node_visits(root, windows));
+
+	repack_options options = {2, REPACK_DEFAULT_THRESHOLD, REPACK_BENCHMARK_BUDGET, REPACK_BENCHMARK_INTERVAL};
+	repacker *rp = start_repacker(ct, &options);
+	double write_seconds;
+	double rate = run_concurrent_readers(ct, windows, records + num_preloaded, num_insertions, 0, &write_seconds);
+
+	fprintf(stderr, "%d readers: %.0lf queries per second while %d insertions ran (%.0lf per second)\n", NUM_CONCURRENT_READERS, rate, num_insertions, num_insertions / write_seconds);
+	fprintf(stderr, "%ld subtrees repacked in %ld steps\n", atomic_load(&rp->num_repacked), atomic_load(&rp->num_steps));
+	stop_repacker(rp);
+
+	root = atomic_load(&ct->root);
+	measure_tree(root, &metrics);
+	print_tree_metrics("After", &metrics);
+	fprintf(stderr, "%.1lf nodes visited per query\n", average_node_visits(root, windows));
+
+	// One unbounded step over taller subtrees, for comparison
+	repack_options full = {3, REPACK_DEFAULT_THRESHOLD, 1e9, 0};
+	fprintf(stderr, "%ld subtrees of height 3 repacked in one step\n", repack_step(ct, &full, NULL));
+
+	root = atomic_load(&ct->root);
+	measure_tree(root, &metrics);
+	print_tree_metrics("Height 3 repacked", &metrics);
+	fprintf(stderr, "%.1lf nodes visited per query\n", average_node_visits(root, windows));
+
+	long found = concurrent_search(ct, register_reader(ct), &space, NULL, NULL);
+
+	if (found != num_preloaded + num_insertions)
+		fprintf(stderr, "Result mismatch: %ld records found, %d inserted\n", found, num_preloaded + num_insertions);
+	else
+		fprintf(stderr, "All %ld records found\n", found);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free(records);
+	free_concurrent_tree(ct);
+}
+
+
+// Builds the batch the merge benchmark loads: num_records records, all but one in ten moved over to the right of the
+// space the main tree covers
+index_record **generate_batch(dataset_spec *spec, int num_records) {
+	index_record **records = generate_records(spec, num_records, 1);
+	int k;
+
+	for (k = 0; k < num_records; k++) {
+		if (k % 10 == 0)
+			continue;
+
+		records[k]->mbr->min_x += MAX_RAND_NUM;
+		records[k]->mbr->max_x += MAX_RAND_NUM;
+	}
+
+	return records;
+}
+
+
+// Compares inserting a separately built batch into a tree record by record with merging it in with merge_tree, and
+// checks both trees find the same records
+void benchmark_merge(int index_records_per_node) {
+	int num_records = 500000;
+	int num_batch = 100000;
+	struct timespec start;
+	struct timespec end;
+	dataset_spec spec, batch_spec;
+	merge_stats stats;
+	long num_wrong = 0;
+	int k;
+
+	initialize_dataset_spec(&spec, DATASET_BENCHMARK_SEED, DATASET_UNIFORM);
+	initialize_dataset_spec(&batch_spec, DATASET_BENCHMARK_SEED + 1, DATASET_UNIFORM);
+
+	index_record **records = generate_records(&spec, num_records, 1);
+	r_tree_node *inserted_root = bulk_load(records, num_records, index_records_per_node);
+	free(records);
+	records = generate_records(&spec, num_records, 1);
+	r_tree_node *merged_root = bulk_load(records, num_records, index_records_per_node);
+	free(records);
+
+	records = generate_batch(&batch_spec, num_batch);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_batch; k++)
+		insert(&inserted_root, records[k], 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double insert_time = seconds_between(&start, &end);
+	free(records);
+
+	// The batch tree is built separately, as it would be ahead of the merge
+	records = generate_batch(&batch_spec, num_batch);
+	r_tree_node *batch_root = bulk_load(records, num_batch, index_records_per_node);
+	free(records);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	merge_tree(&merged_root, batch_root, 1, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double merge_time = seconds_between(&start, &end);
+
+	fprintf(stderr, "%d records into a tree of %d: %lf seconds inserting them, %lf seconds merging a tree of them\n", num_batch, num_records, insert_time, merge_time);
+	fprintf(stderr, "%ld subtrees grafted (%ld records), %ld records inserted one by one\n", stats.num_grafted, stats.num_grafted_records, stats.num_inserted);
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++) {
+		MBR *window = random_small_mbr(0, 0, 2 * MAX_RAND_NUM, MAX_RAND_NUM);
+
+		if (search(inserted_root, window, NULL, NULL) != search(merged_root, window, NULL, NULL))
+			num_wrong++;
+
+		free(window);
+	}
+
+	MBR space = {0, 0, 2 * MAX_RAND_NUM, MAX_RAND_NUM};
+	long found = search(merged_root, &space, NULL, NULL);
+
+	fprintf(stderr, "%ld of %d records found in the merged tree, %ld of %d queries found different records\n", found, num_records + num_batch, num_wrong, NUM_BENCHMARK_QUERIES);
+
+	free_tree(inserted_root);
+	free_tree(merged_root);
+}
+
+
+// Pops every operation the engine has completed so far, returning how many there were
+long drain_completions(async_engine *engine) {
+	long num_completed = 0;
+
+	while (async_poll(engine) != NULL)
+		num_completed++;
+
+	// Nothing ready yet, so let the engine threads run
+	if (num_completed == 0)
+		sched_yield();
+
+	return num_completed;
+}
+
+
+// Submits num_ops operations, one in five an insertion of a new record and the others searches, to an engine of
+// num_threads threads running batches of batch_size, from the calling thread, which also collects the completions.
+// The tree starts out as num_records records of spec. Returns the time taken and leaves the tree in *root
+double run_async_engine(int index_records_per_node, r_tree_node **root, dataset_spec *spec, int num_records, dataset_spec *insert_spec, MBR **windows, int num_ops, int num_threads, int batch_size, long *num_batches) {
+	struct timespec start;
+	struct timespec end;
+	long num_completed = 0;
+	int k;
+
+	index_record **records = generate_records(spec, num_records, 1);
+	*root = bulk_load(records, num_records, index_records_per_node);
+	free(records);
+
+	index_record **inserts = generate_records(insert_spec, num_ops / 5, 1);
+	async_op *ops = (async_op *)calloc(num_ops, sizeof(async_op));
+
+	for (k = 0; k < num_ops; k++) {
+		if (k % 5 == 0) {
+			ops[k].type = ASYNC_INSERT;
+			ops[k].ir = inserts[k / 5];
+		} else {
+			ops[k].type = ASYNC_SEARCH;
+			ops[k].window = *windows[k % NUM_BENCHMARK_QUERIES];
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	async_engine *engine = start_async_engine(root, num_threads, batch_size, ASYNC_BENCHMARK_RING_SIZE);
+
+	for (k = 0; k < num_ops; k++) {
+		while (!async_submit(engine, &ops[k]))
+			num_completed += drain_completions(engine);
+	}
+
+	while (num_completed < num_ops)
+		num_completed += drain_completions(engine);
+
+	*num_batches = atomic_load(&engine->num_batches);
+	stop_async_engine(engine);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	free(inserts);
+	free(ops);
+	return seconds_between(&start, &end);
+}
+
+
+// Runs a mix of insertions and searches through async engines of different numbers of threads and batch sizes, and
+// compares them with running the same operations directly
+void benchmark_async(int index_records_per_node) {
+	int num_ops = 200000;
+	int num_records = 200000;
+	int thread_counts[] = {1, 2, 4};
+	int batch_sizes[] = {1, ASYNC_BENCHMARK_BATCH};
+	struct timespec start;
+	struct timespec end;
+	dataset_spec spec, insert_spec;
+	int k, t, b;
+
+	initialize_dataset_spec(&spec, DATASET_BENCHMARK_SEED, DATASET_UNIFORM);
+	initialize_dataset_spec(&insert_spec, DATASET_BENCHMARK_SEED + 1, DATASET_UNIFORM);
+
+	MBR **windows = (MBR**)malloc(sizeof(MBR*) * NUM_BENCHMARK_QUERIES);
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		windows[k] = random_small_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
+
+	index_record **records = generate_records(&spec, num_records, 1);
+	r_tree_node *direct_root = bulk_load(records, num_records, index_records_per_node);
+	free(records);
+
+	index_record **inserts = generate_records(&insert_spec, num_ops / 5, 1);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k = 0; k < num_ops; k++) {
+		if (k % 5 == 0)
+			insert(&direct_root, inserts[k / 5], 1);
+		else
+			search(direct_root, windows[k % NUM_BENCHMARK_QUERIES], NULL, NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(inserts);
+
+	fprintf(stderr, "%d operations (one in five an insertion) run directly: %lf seconds\n", num_ops, seconds_between(&start, &end));
+
+	for (t = 0; t < 3; t++) {
+		for (b = 0; b < 2; b++) {
+			r_tree_node *root;
+			long num_batches;
+			long num_wrong = 0;
+
+			double seconds = run_async_engine(index_records_per_node, &root, &spec, num_records, &insert_spec, windows, num_ops, thread_counts[t], batch_sizes[b], &num_batches);
+
+			for (k = 0; k < NUM_BENCHMARK_QUERIES; k++) {
+				if (search(root, windows[k], NULL, NULL) != search(direct_root, windows[k], NULL, NULL))
+					num_wrong++;
+			}
+
+			fprintf(stderr, "%d engine threads, batches of up to %d: %lf seconds, %ld batches, %ld queries disagree with the direct tree afterwards\n",
+				thread_counts[t], batch_sizes[b], seconds, num_batches, num_wrong);
+
+			free_tree(root);
+		}
+	}
+
+	for (k = 0; k < NUM_BENCHMARK_QUERIES; k++)
+		free(windows[k]);
+	free(windows);
+	free_tree(direct_root);
+}
+
+
+int main(int argc, char *argv[]) {
+
+	bool replaying = argc >= 5 && strcmp(argv[3], "replay") == 0;
+
+	if (argc != 3 && argc != 4 && !(replaying && argc <= 7)) {
+		fprintf(stderr, "Please provide 2 args: max_children (children per node), num_levels (number of levels in tree)\n");
+		fprintf(stderr, "and optionally a benchmark to run: insert (default), qr, precision, alloc, sharded, concurrent, snapshot, lsm, buffer, paged, shared, join, batch, multi, count, fanout, points, ids, dataset, trace, ingest, cache, repack, merge or async\n");
+		fprintf(stderr, "or replay followed by a trace file, and optionally a number of threads (default 1) and paced\n");
+		exit(1);
+	}
+
+	// Initialize randomness
+	srand(time(NULL));
+
+	int index_records_per_node = atoi(argv[1]);
+	// TO DO: Account for this 1-off thing (works for now but messy fix)
+	int num_levels = atoi(argv[2]) - 1;
+
+	if (num_levels < 0) {
+		fprintf(stderr, "Levels (third argument) should be greater than or equal to 1\n");
+		exit(1);
+	}
+
+	char *benchmark = argc >= 4 ? argv[3] : "insert";
+
+	if (strcmp(benchmark, "insert") == 0) {
+		benchmark_insertion(index_records_per_node, num_levels);
+	} else if (strcmp(benchmark, "qr") == 0) {
+		benchmark_qr(index_records_per_node, num_levels);
+	} else if (strcmp(benchmark, "precision") == 0) {
+		benchmark_precision(index_records_per_node, num_levels);
+	} else if (strcmp(benchmark, "alloc") == 0) {
+		benchmark_allocations(index_records_per_node, num_levels);
+	} else if (strcmp(benchmark, "sharded") == 0) {
+		benchmark_sharded(index_records_per_node);
+	} else if (strcmp(benchmark, "concurrent") == 0) {
+		benchmark_concurrent(index_records_per_node);
+	} else if (strcmp(benchmark, "snapshot") == 0) {
+		benchmark_snapshots(index_records_per_node);
+	} else if (strcmp(benchmark, "lsm") == 0) {
+		benchmark_lsm(index_records_per_node);
+	} else if (strcmp(benchmark, "buffer") == 0) {
+		benchmark_buffer_tree(index_records_per_node);
+	} else if (strcmp(benchmark, "paged") == 0) {
+		benchmark_paged(index_records_per_node);
+	} else if (strcmp(benchmark, "shared") == 0) {
+		benchmark_shared(index_records_per_node);
+	} else if (strcmp(benchmark, "join") == 0) {
+		benchmark_join(index_records_per_node);
+	} else if (strcmp(benchmark, "batch") == 0) {
+		benchmark_query_batch(index_records_per_node);
+	} else if (strcmp(benchmark, "multi") == 0) {
+		benchmark_multi_query(index_records_per_node);
+	} else if (strcmp(benchmark, "count") == 0) {
+		benchmark_range_count(index_records_per_node);
+	} else if (strcmp(benchmark, "fanout") == 0) {
+		benchmark_fanout(index_records_per_node);
+	} else if (strcmp(benchmark, "points") == 0) {
+		benchmark_points(index_records_per_node);
+	} else if (strcmp(benchmark, "ids") == 0) {
+		benchmark_record_ids(index_records_per_node);
+	} else if (strcmp(benchmark, "dataset") == 0) {
+		benchmark_datasets(index_records_per_node, num_levels);
+	} else if (strcmp(benchmark, "ingest") == 0) {
+		benchmark_ingest(index_records_per_node);
+	} else if (strcmp(benchmark, "cache") == 0) {
+		benchmark_query_cache(index_records_per_node);
+	} else if (strcmp(benchmark, "repack") == 0) {
+		benchmark_repack(index_records_per_node);
+	} else if (strcmp(benchmark, "merge") == 0) {
+		benchmark_merge(index_records_per_node);
+	} else if (strcmp(benchmark, "async") == 0) {
+		benchmark_async(index_records_per_node);
+	} else if (strcmp(benchmark, "trace") == 0) {
+		benchmark_trace(index_records_per_node);
+	} else if (replaying) {
+		benchmark_replay(index_records_per_node, argv[4], argc >= 6 ? atoi(argv[5]) : 1, argc == 7 && strcmp(argv[6], "paced") == 0);
+	} else {
+		fprintf(stderr, "Unknown benchmark %s\n", benchmark);
+		exit(1);
+	}
 
 	return 0;
 }
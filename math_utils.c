@@ -9,3 +9,51 @@ double random_within_range(double min, double max) {
 	return rand_val;
 }
 
+
+// qsort() comparison putting doubles in ascending order
+int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+// Value at fraction (0 to 1) of the way through the num_values values of sorted, which is in ascending order. A
+// fraction of 1 gives the largest
+double percentile(double *sorted, long num_values, double fraction) {
+	long index = (long)(num_values * fraction);
+
+	return sorted[index < num_values ? index : num_values - 1];
+}
+
+
+// SplitMix64 finalizer
+uint64_t mix64(uint64_t z) {
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+
+// Folds value into hash
+uint64_t fold_hash(uint64_t hash, uint64_t value) {
+	return mix64(hash ^ value) + GOLDEN_GAMMA;
+}
+
+
+// Seconds elapsed between two clock_gettime() readings
+double seconds_between(struct timespec *start, struct timespec *end) {
+	double duration = end->tv_sec - start->tv_sec;
+	duration += (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+	return duration;
+}
+
+
+// Seconds elapsed since start, a CLOCK_MONOTONIC reading
+double seconds_since(struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return seconds_between(start, &now);
+}
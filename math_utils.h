@@ -4,9 +4,14 @@
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
+#include <time.h>
+#include <stdint.h>
 
 #define MAX_RAND_NUM 100
 
+// Increment of the SplitMix64 generator
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+
 
 
 // Generate a random double value that is less than min and greater than max
@@ -14,4 +19,29 @@
 double random_within_range(double min, double max);
 
 
+// qsort() comparison putting doubles in ascending order
+int compare_doubles(const void *a, const void *b);
+
+
+// Value at fraction (0 to 1) of the way through the num_values values of sorted, which is in ascending order. A
+// fraction of 1 gives the largest
+double percentile(double *sorted, long num_values, double fraction);
+
+
+// SplitMix64 finalizer
+uint64_t mix64(uint64_t z);
+
+
+// Folds value into hash
+uint64_t fold_hash(uint64_t hash, uint64_t value);
+
+
+// Seconds elapsed between two clock_gettime() readings
+double seconds_between(struct timespec *start, struct timespec *end);
+
+
+// Seconds elapsed since start, a CLOCK_MONOTONIC reading
+double seconds_since(struct timespec *start);
+
+
 #endif
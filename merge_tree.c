@@ -0,0 +1,113 @@
+#include "r_tree.h"
+#include "choose_leaf.h"
+#include "merge_tree.h"
+
+
+// Moves entry, the index_record pointing to a subtree of src height levels tall (0 being a leaf-level index_record),
+// into the tree rooted at *root, grafting it whole if it fits well enough and taking it apart otherwise
+static void merge_entry(r_tree_node **root, index_record *entry, int height, int num_threads, merge_stats *stats) {
+	if (height == 0) {
+		insert(root, entry, num_threads);
+		stats->num_inserted++;
+		return;
+	}
+
+	r_tree_node *subtree = entry->child;
+	tree_path path;
+	int i;
+
+	if (subtree->num_members >= MERGE_MIN_FILL * subtree->max_members) {
+		if (num_threads > 1)
+			choose_leaf_parallel(*root, entry, num_threads, &path);
+		else
+			choose_leaf_sequential(*root, entry, &path);
+
+		// Same as insert_subtree, stop at the node whose children are height levels tall
+		path.depth = tree_height(*root) - height;
+		path.indices[path.depth - 1] = -1;
+
+		r_tree_node *target = path.nodes[path.depth - 1];
+		double area = get_area(entry->mbr);
+		double overlap = 0;
+
+		for (i = 0; i < target->num_members; i++)
+			overlap += get_overlapping_area(entry->mbr, target->index_records[i]->mbr);
+
+		if (overlap <= MERGE_MAX_OVERLAP * area) {
+			insert_at_node(&path, entry, root, num_threads);
+			stats->num_grafted++;
+			stats->num_grafted_records += entry->agg.count;
+			return;
+		}
+	}
+
+	for (i = 0; i < subtree->num_members; i++)
+		merge_entry(root, subtree->index_records[i], height - 1, num_threads, stats);
+
+	// The members have all moved, only the node and the entry pointing to it are left
+	if (!subtree->embeds_entry)
+		free_entry(entry);
+	free_node(subtree);
+}
+
+
+// Moves every record of the tree rooted at src into the tree rooted at *dst, reusing as many of src's nodes as it can.
+// src is consumed. If src is taller than *dst the two swap roles, so *dst may change. Both trees need the same
+// max_members. stats may be NULL
+void merge_tree(r_tree_node **dst, r_tree_node *src, int num_threads, merge_stats *stats) {
+	merge_stats unused;
+	int i;
+
+	if (stats == NULL)
+		stats = &unused;
+
+	memset(stats, 0, sizeof(merge_stats));
+
+	if (src->max_members != (*dst)->max_members) {
+		fprintf(stderr, "Cannot merge a tree of %d max_members into one of %d\n", src->max_members, (*dst)->max_members);
+		exit(1);
+	}
+
+	if (src->num_members == 0) {
+		free_tree(src);
+		return;
+	}
+
+	if ((*dst)->num_members == 0) {
+		free_tree(*dst);
+		*dst = src;
+		return;
+	}
+
+	int src_height = tree_height(src);
+	int dst_height = tree_height(*dst);
+
+	// Graft the shorter tree into the taller one
+	if (src_height > dst_height) {
+		r_tree_node *taller = src;
+		src = *dst;
+		*dst = taller;
+		src_height = dst_height;
+	}
+
+	if (src_height < tree_height(*dst)) {
+		// The root of src has no index_record pointing to it, so it gets one to be grafted with
+		index_record *src_ir = initialize_ir(copy_mbr(src->index_records[0]->mbr));
+
+		for (i = 1; i < src->num_members; i++)
+			expand_mbr(src_ir->mbr, src->index_records[i]->mbr);
+
+		src_ir->child = src;
+		sum_members(src, &src_ir->agg);
+#if BACK_POINTERS
+		src->parent = src_ir;
+#endif
+		merge_entry(dst, src_ir, src_height, num_threads, stats);
+	} else {
+		// Same height, so only the root's children can fit
+		for (i = 0; i < src->num_members; i++)
+			merge_entry(dst, src->index_records[i], src_height - 1, num_threads, stats);
+
+		free_node(src);
+	}
+}
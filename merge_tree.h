@@ -0,0 +1,43 @@
+#ifndef _merge_tree_h
+#define _merge_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Merging a whole tree into another by grafting its subtrees.
+*
+* merge_tree walks the source tree from the top and tries to graft every subtree whole, the way insert_subtree does:
+* it descends the destination with the same choose_leaf logic as an insertion, stops at the node whose children are as
+* tall as the subtree, and adds the subtree there, splitting and adjusting on the way back up like any insertion.
+* A subtree is only grafted if its root is at least MERGE_MIN_FILL full and its MBR doesn't overlap the entries it
+* would sit next to by more than MERGE_MAX_OVERLAP of its own area. Otherwise it is taken apart and each of its
+* children gets the same treatment one level down, down to the leaf-level index_records, which are inserted one by one.
+* A small source tree is mostly underfull nodes, so it ends up inserted record by record, while a large one over a
+* region the destination barely covers goes in a few subtrees at a time
+*/
+
+// Fraction of max_members a subtree root needs to hold to be grafted
+#define MERGE_MIN_FILL 0.5
+
+// Largest overlap, relative to its own area, a grafted subtree may have with its new siblings
+#define MERGE_MAX_OVERLAP 0.25
+
+
+typedef struct merge_stats {
+	// Subtrees grafted whole, and leaf-level index_records inserted one by one
+	long num_grafted;
+	long num_inserted;
+
+	// Records that came in as part of a grafted subtree
+	long num_grafted_records;
+} merge_stats;
+
+
+// Moves every record of the tree rooted at src into the tree rooted at *dst, reusing as many of src's nodes as it can.
+// src is consumed. If src is taller than *dst the two swap roles, so *dst may change. Both trees need the same
+// max_members. stats may be NULL
+void merge_tree(r_tree_node **dst, r_tree_node *src, int num_threads, merge_stats *stats);
+
+
+#endif
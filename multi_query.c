@@ -0,0 +1,174 @@
+#include "r_tree.h"
+#include "multi_query.h"
+
+
+// One coordinate of every window in a group, and the lane masks comparing them produces
+typedef coord_t coord_vec __attribute__((vector_size(QUERY_GROUP_SIZE * sizeof(coord_t))));
+
+#if defined(COORD_FLOAT) || defined(COORD_INT32)
+typedef int32_t lane_t;
+#else
+typedef int64_t lane_t;
+#endif
+
+typedef lane_t lane_vec __attribute__((vector_size(QUERY_GROUP_SIZE * sizeof(lane_t))));
+
+
+typedef struct query_group {
+	coord_vec min_x;
+	coord_vec min_y;
+	coord_vec max_x;
+	coord_vec max_y;
+
+	// Index (into the caller's windows) of the window in each lane
+	int queries[QUERY_GROUP_SIZE];
+	int size;
+} query_group;
+
+
+typedef struct query_order {
+	uint32_t code;
+	int query;
+} query_order;
+
+
+// Spreads the low 16 bits of v out to the even bits
+static uint32_t spread_bits(uint32_t v) {
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+
+static int compare_codes(const void *a, const void *b) {
+	uint32_t code_a = ((query_order *)a)->code;
+	uint32_t code_b = ((query_order *)b)->code;
+
+	return (code_a > code_b) - (code_a < code_b);
+}
+
+
+// Fills order with the queries sorted by the Morton code of their window centres
+static void order_queries(MBR **windows, int num_queries, query_order *order) {
+	double min_x = DBL_MAX, min_y = DBL_MAX, max_x = -DBL_MAX, max_y = -DBL_MAX;
+	int k;
+
+	for (k = 0; k < num_queries; k++) {
+		double x = ((double)windows[k]->min_x + windows[k]->max_x) / 2;
+		double y = ((double)windows[k]->min_y + windows[k]->max_y) / 2;
+
+		min_x = fmin(min_x, x);
+		min_y = fmin(min_y, y);
+		max_x = fmax(max_x, x);
+		max_y = fmax(max_y, y);
+	}
+
+	double scale_x = max_x > min_x ? 65535 / (max_x - min_x) : 0;
+	double scale_y = max_y > min_y ? 65535 / (max_y - min_y) : 0;
+
+	for (k = 0; k < num_queries; k++) {
+		double x = ((double)windows[k]->min_x + windows[k]->max_x) / 2;
+		double y = ((double)windows[k]->min_y + windows[k]->max_y) / 2;
+
+		order[k].code = spread_bits((uint32_t)((x - min_x) * scale_x)) | (spread_bits((uint32_t)((y - min_y) * scale_y)) << 1);
+		order[k].query = k;
+	}
+
+	qsort(order, num_queries, sizeof(query_order), compare_codes);
+}
+
+
+// Returns a bit per window of the group that mbr overlaps
+static unsigned int overlap_mask(query_group *group, MBR *mbr) {
+	lane_vec hits = (mbr->min_x <= group->max_x) & (group->min_x <= mbr->max_x) &
+		(mbr->min_y <= group->max_y) & (group->min_y <= mbr->max_y);
+	unsigned int mask = 0;
+	int lane;
+
+	for (lane = 0; lane < QUERY_GROUP_SIZE; lane++) {
+		if (hits[lane])
+			mask |= 1u << lane;
+	}
+
+	return mask;
+}
+
+
+// Searches below node for the windows of group whose bits are set in active
+static long search_group(r_tree_node *node, query_group *group, unsigned int active, multi_query_callback callback, void *arg, long *counts) {
+	bool leaf = is_leaf(node);
+	long found = 0;
+	int i;
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *curr_ir = node->index_records[i];
+		unsigned int mask = overlap_mask(group, curr_ir->mbr) & active;
+
+		if (mask == 0)
+			continue;
+
+		if (!leaf) {
+			found += search_group(curr_ir->child, group, mask, callback, arg, counts);
+			continue;
+		}
+
+		while (mask != 0) {
+			int query = group->queries[__builtin_ctz(mask)];
+			mask &= mask - 1;
+
+			if (callback != NULL)
+				callback(curr_ir, query, arg);
+			if (counts != NULL)
+				counts[query]++;
+			found++;
+		}
+	}
+
+	return found;
+}
+
+
+// Same as running search() for each of the num_queries windows, with the number of records each one found written to
+// counts (which may be NULL). callback may be NULL too. Returns the total number found
+long multi_query_search(r_tree_node *root, MBR **windows, int num_queries, multi_query_callback callback, void *arg, long *counts) {
+	query_order *order = (query_order *)malloc(sizeof(query_order) * (num_queries > 0 ? num_queries : 1));
+	long found = 0;
+	int k, lane;
+
+	if (order == NULL) {
+		fprintf(stderr, "Malloc failed in multi_query_search(). Exiting program\n");
+		exit(1);
+	}
+
+	if (counts != NULL)
+		memset(counts, 0, sizeof(long) * num_queries);
+
+	order_queries(windows, num_queries, order);
+
+	for (k = 0; k < num_queries; k += QUERY_GROUP_SIZE) {
+		query_group group;
+
+		// Lanes past the last window stay zeroed and are left out of the active mask
+		memset(&group, 0, sizeof(group));
+		group.size = num_queries - k < QUERY_GROUP_SIZE ? num_queries - k : QUERY_GROUP_SIZE;
+
+		for (lane = 0; lane < group.size; lane++) {
+			MBR *window = windows[order[k + lane].query];
+
+			group.min_x[lane] = window->min_x;
+			group.min_y[lane] = window->min_y;
+			group.max_x[lane] = window->max_x;
+			group.max_y[lane] = window->max_y;
+			group.queries[lane] = order[k + lane].query;
+		}
+
+		found += search_group(root, &group, (1u << group.size) - 1, callback, arg, counts);
+	}
+
+	free(order);
+
+	return found;
+}
@@ -0,0 +1,31 @@
+#ifndef _multi_query_h
+#define _multi_query_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Batched window queries that share node visits.
+*
+* The windows are sorted by the Morton (Z-order) code of their centres and cut into groups of QUERY_GROUP_SIZE, so
+* the windows of a group lie close together and tend to reach the same nodes. Each group descends the tree once,
+* carrying a bit mask of the windows still in play: every member MBR a node holds is loaded once and tested against
+* all the windows of the group in one go, with the group's coordinates laid out as one vector per side (GCC vector
+* extensions, which become SSE/AVX/NEON compares for every coord_t). Only the bits that survive follow the member
+* down, and a leaf hands each surviving record to the callback once per window it overlaps
+*/
+
+// Windows tested together. 8 fills an AVX register with float or int32 coordinates, and two with doubles
+#define QUERY_GROUP_SIZE 8
+
+
+// Called once for every leaf-level index_record overlapping windows[query]
+typedef void (*multi_query_callback)(index_record *ir, int query, void *arg);
+
+
+// Same as running search() for each of the num_queries windows, with the number of records each one found written to
+// counts (which may be NULL). callback may be NULL too. Returns the total number found
+long multi_query_search(r_tree_node *root, MBR **windows, int num_queries, multi_query_callback callback, void *arg, long *counts);
+
+
+#endif
@@ -0,0 +1,271 @@
+#include "r_tree.h"
+#include "pick_seeds.h"
+#include "paged_tree.h"
+
+
+// Same choice as sequential_get_insertion_index, over the entries of an internal page
+int page_insertion_index(tree_page *page, MBR *mbr) {
+	double min_enlargement = get_area_increase(&page->entries[0].mbr, mbr);
+	int curr_index = 0;
+	int i;
+
+	for (i = 1; i < page->num_members; i++) {
+		double enlargement = get_area_increase(&page->entries[i].mbr, mbr);
+
+		if (enlargement < min_enlargement) {
+			min_enlargement = enlargement;
+			curr_index = i;
+		}
+	}
+
+	return curr_index;
+}
+
+
+// Splits the full page while adding entry to it, moving one group of entries into the empty page sibling. The MBRs of
+// the two groups are written to page_mbr and sibling_mbr. Seeds are picked by pick_seeds_sequential and the rest are
+// handed out like linear_split_sequential does
+void split_tree_page(tree_page *page, tree_page *sibling, page_entry *entry, MBR *page_mbr, MBR *sibling_mbr) {
+	int num_entries = page->num_members + 1;
+	int seed_indices[2];
+	double biggest_waste;
+	int i;
+
+	// pick_seeds_sequential only looks at the MBRs, so stack index_records pointing into entries are enough
+	page_entry entries[num_entries];
+	index_record irs[num_entries];
+	index_record *ir_ptrs[num_entries];
+
+	memcpy(entries, page->entries, sizeof(page_entry) * page->num_members);
+	entries[num_entries - 1] = *entry;
+
+	for (i = 0; i < num_entries; i++) {
+		irs[i].mbr = &entries[i].mbr;
+		ir_ptrs[i] = &irs[i];
+	}
+
+	pick_seeds_sequential(ir_ptrs, num_entries, &biggest_waste, seed_indices);
+
+	sibling->leaf = page->leaf;
+	sibling->num_members = 0;
+	sibling->entries[sibling->num_members++] = entries[seed_indices[1]];
+	*sibling_mbr = entries[seed_indices[1]].mbr;
+
+	page->num_members = 0;
+	page->entries[page->num_members++] = entries[seed_indices[0]];
+	*page_mbr = entries[seed_indices[0]].mbr;
+
+	// Ties go to the emptier page
+	for (i = 0; i < num_entries; i++) {
+		if (i == seed_indices[0] || i == seed_indices[1])
+			continue;
+
+		double enlargement_1 = get_area_increase(page_mbr, &entries[i].mbr);
+		double enlargement_2 = get_area_increase(sibling_mbr, &entries[i].mbr);
+
+		if (enlargement_1 < enlargement_2 || (enlargement_1 == enlargement_2 && page->num_members < sibling->num_members)) {
+			page->entries[page->num_members++] = entries[i];
+			expand_mbr(page_mbr, &entries[i].mbr);
+		} else {
+			sibling->entries[sibling->num_members++] = entries[i];
+			expand_mbr(sibling_mbr, &entries[i].mbr);
+		}
+	}
+
+	count_split();
+}
+
+
+// Adds a record with the given MBR and id to the tree of pages of up to max_members members whose root is *root_page,
+// the same way insert() does. If the root splits, *root_page is set to the new root and true is returned
+bool insert_into_pages(const page_ops *ops, void *arg, long *root_page, int max_members, MBR *mbr, long record_id) {
+	long page_ids[MAX_TREE_HEIGHT];
+	tree_page *pages[MAX_TREE_HEIGHT];
+	int indices[MAX_TREE_HEIGHT];
+	bool dirty[MAX_TREE_HEIGHT];
+	bool root_split = false;
+	int depth = 0;
+	int i;
+
+	long page_id = *root_page;
+
+	// Choose the leaf, holding on to every page on the way so the path stays in place until the insertion is done
+	while (true) {
+		tree_page *page = ops->get_page(arg, page_id);
+
+		page_ids[depth] = page_id;
+		pages[depth] = page;
+		dirty[depth] = false;
+
+		if (page->leaf)
+			break;
+
+		indices[depth] = page_insertion_index(page, mbr);
+		page_id = page->entries[indices[depth]].child;
+		depth++;
+	}
+
+	// Same as adjust_tree
+	for (i = depth - 1; i >= 0; i--) {
+		MBR *parent_mbr = &pages[i]->entries[indices[i]].mbr;
+
+		if (fully_contains(parent_mbr, mbr))
+			break;
+
+		expand_mbr(parent_mbr, mbr);
+		dirty[i] = true;
+	}
+
+	page_entry entry = {*mbr, record_id};
+	int level = depth;
+
+	// Same as insert_at_node: split up the path until a page has room
+	while (true) {
+		tree_page *page = pages[level];
+		dirty[level] = true;
+
+		if (page->num_members < max_members) {
+			page->entries[page->num_members++] = entry;
+			break;
+		}
+
+		MBR page_mbr;
+		page_entry sibling_entry;
+		tree_page *sibling = ops->new_page(arg, &sibling_entry.child);
+
+		split_tree_page(page, sibling, &entry, &page_mbr, &sibling_entry.mbr);
+		ops->put_page(arg, sibling_entry.child, true);
+
+		if (level > 0) {
+			pages[level - 1]->entries[indices[level - 1]].mbr = page_mbr;
+			entry = sibling_entry;
+			level--;
+			continue;
+		}
+
+		// The root split, so the tree grows by one level
+		long root_id;
+		tree_page *root = ops->new_page(arg, &root_id);
+
+		root->leaf = false;
+		root->entries[0].mbr = page_mbr;
+		root->entries[0].child = *root_page;
+		root->entries[1] = sibling_entry;
+		root->num_members = 2;
+
+		ops->put_page(arg, root_id, true);
+		*root_page = root_id;
+		root_split = true;
+		break;
+	}
+
+	for (i = 0; i <= depth; i++)
+		ops->put_page(arg, page_ids[i], dirty[i]);
+
+	return root_split;
+}
+
+
+// Pages of a paged_tree live in its buffer_pool, and are pinned while insert_into_pages uses them
+static tree_page *get_pool_page(void *arg, long page_id) {
+	return (tree_page *)pin_page(((paged_tree *)arg)->pool, page_id);
+}
+
+
+static void put_pool_page(void *arg, long page_id, bool dirty) {
+	unpin_page(((paged_tree *)arg)->pool, page_id, dirty);
+}
+
+
+static tree_page *new_pool_page(void *arg, long *page_id) {
+	return (tree_page *)allocate_page(((paged_tree *)arg)->pool, page_id);
+}
+
+
+static const page_ops pool_page_ops = {get_pool_page, put_pool_page, new_pool_page};
+
+
+// Creates an empty paged_tree whose pages hold up to max_members members, stored in a new file at path and cached in
+// at most memory_budget bytes
+paged_tree *create_paged_tree(const char *path, int max_members, long memory_budget) {
+	if (max_members < 2 || max_members > PAGE_MAX_MEMBERS) {
+		fprintf(stderr, "Pages hold between 2 and %d members, not %d. Exiting program\n", PAGE_MAX_MEMBERS, max_members);
+		exit(1);
+	}
+
+	paged_tree *pt = (paged_tree *)malloc(sizeof(paged_tree));
+
+	if (pt == NULL) {
+		fprintf(stderr, "Malloc failed in create_paged_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	pt->pool = create_buffer_pool(path, memory_budget);
+	pt->max_members = max_members;
+	pt->height = 1;
+	pt->num_records = 0;
+
+	tree_page *root = (tree_page *)allocate_page(pt->pool, &pt->root_page);
+	root->leaf = true;
+	unpin_page(pt->pool, pt->root_page, true);
+
+	return pt;
+}
+
+
+// Adds a record with the given MBR and id
+void paged_insert(paged_tree *pt, MBR *mbr, long record_id) {
+	if (insert_into_pages(&pool_page_ops, pt, &pt->root_page, pt->max_members, mbr, record_id))
+		pt->height++;
+
+	pt->num_records++;
+}
+
+
+// Recursive part of paged_search
+static long search_page(paged_tree *pt, long page_id, MBR *window, paged_search_callback callback, void *arg) {
+	tree_page *page = (tree_page *)pin_page(pt->pool, page_id);
+	long found = 0;
+	int i;
+
+	if (page->leaf) {
+		for (i = 0; i < page->num_members; i++) {
+			if (!mbr_overlaps(&page->entries[i].mbr, window))
+				continue;
+
+			if (callback != NULL)
+				callback(&page->entries[i].mbr, page->entries[i].child, arg);
+			found++;
+		}
+
+		unpin_page(pt->pool, page_id, false);
+		return found;
+	}
+
+	// Every child the search will visit is requested up front, so their reads overlap with the first descent
+	for (i = 0; i < page->num_members; i++) {
+		if (mbr_overlaps(&page->entries[i].mbr, window))
+			prefetch_page(pt->pool, page->entries[i].child);
+	}
+
+	for (i = 0; i < page->num_members; i++) {
+		if (mbr_overlaps(&page->entries[i].mbr, window))
+			found += search_page(pt, page->entries[i].child, window, callback, arg);
+	}
+
+	unpin_page(pt->pool, page_id, false);
+	return found;
+}
+
+
+// Same as search() in r_tree.h, passing callback the MBR and id of every record found
+long paged_search(paged_tree *pt, MBR *window, paged_search_callback callback, void *arg) {
+	return search_page(pt, pt->root_page, window, callback, arg);
+}
+
+
+// Writes the tree out and frees it. The file stays in place
+void free_paged_tree(paged_tree *pt) {
+	free_buffer_pool(pt->pool);
+	free(pt);
+}
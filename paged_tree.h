@@ -0,0 +1,96 @@
+#ifndef _paged_tree_h
+#define _paged_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "buffer_pool.h"
+
+/* Out-of-core r-tree.
+*
+* Every node is one fixed-size page of a buffer_pool, holding the MBRs of its members inline along with either the
+* page id of the child (internal pages) or the caller's record id (leaf pages). Only the pages the pool has room for
+* are in memory, so instead of running into MAX_TREE_SIZE the tree is bounded by memory_budget and spills to disk.
+*
+* Insertion works like insert(): the path chosen by least enlargement stays pinned until the MBRs above the leaf
+* have been expanded and any splits (seeds picked by pick_seeds_sequential, the rest handed out like
+* linear_split_sequential does) have propagated up it. Searches prefetch every child page they are going to visit
+* before reading the first of them
+*/
+
+typedef struct page_entry {
+	MBR mbr;
+
+	// Page id of the child in internal pages, record id in leaf pages
+	long child;
+} page_entry;
+
+
+typedef struct tree_page {
+	int num_members;
+	bool leaf;
+	page_entry entries[];
+} tree_page;
+
+
+// Most members a page can hold
+#define PAGE_MAX_MEMBERS ((int)((POOL_PAGE_SIZE - sizeof(tree_page)) / sizeof(page_entry)))
+
+
+typedef struct paged_tree {
+	buffer_pool *pool;
+	long root_page;
+	int height;
+	int max_members;
+	long num_records;
+} paged_tree;
+
+
+// Called by paged_search() once for every record whose MBR overlaps the search window
+typedef void (*paged_search_callback)(MBR *mbr, long record_id, void *arg);
+
+
+// How insert_into_pages gets at the pages of a tree, each call being passed the same arg. A page returned by get_page
+// or new_page stays where it is until it is handed back to put_page, with dirty set if it was changed
+typedef struct page_ops {
+	tree_page *(*get_page)(void *arg, long page_id);
+	void (*put_page)(void *arg, long page_id, bool dirty);
+
+	// Returns a new page with no members, writing its id to *page_id
+	tree_page *(*new_page)(void *arg, long *page_id);
+} page_ops;
+
+
+// Same choice as sequential_get_insertion_index, over the entries of an internal page
+int page_insertion_index(tree_page *page, MBR *mbr);
+
+
+// Splits the full page while adding entry to it, moving one group of entries into the empty page sibling. The MBRs of
+// the two groups are written to page_mbr and sibling_mbr. Seeds are picked by pick_seeds_sequential and the rest are
+// handed out like linear_split_sequential does
+void split_tree_page(tree_page *page, tree_page *sibling, page_entry *entry, MBR *page_mbr, MBR *sibling_mbr);
+
+
+// Adds a record with the given MBR and id to the tree of pages of up to max_members members whose root is *root_page,
+// the same way insert() does. If the root splits, *root_page is set to the new root and true is returned
+bool insert_into_pages(const page_ops *ops, void *arg, long *root_page, int max_members, MBR *mbr, long record_id);
+
+
+// Creates an empty paged_tree whose pages hold up to max_members members, stored in a new file at path and cached in
+// at most memory_budget bytes
+paged_tree *create_paged_tree(const char *path, int max_members, long memory_budget);
+
+
+// Adds a record with the given MBR and id
+void paged_insert(paged_tree *pt, MBR *mbr, long record_id);
+
+
+// Same as search() in r_tree.h, passing callback the MBR and id of every record found
+long paged_search(paged_tree *pt, MBR *window, paged_search_callback callback, void *arg);
+
+
+// Writes the tree out and frees it. The file stays in place
+void free_paged_tree(paged_tree *pt);
+
+
+#endif
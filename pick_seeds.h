@@ -6,23 +6,26 @@
 #include <math.h>
 #include <pthread.h>
 
-// To be written to by threads
-double greatest_wastes[NUM_CORES];
-int *seed_indices_list[NUM_CORES];
-
 
 typedef struct param1 {
-	r_tree_node *rt;
+	index_record **irs;
+	int num_index_records;
 	int start_index;
 	int end_index;
+
+	// Written by the thread: the most wasteful pair it found and how much area that pair wastes
+	double greatest_waste;
+	int seed_indices[2];
 } param1;
 
 
-int *pick_seeds_sequential(index_record **irs, int num_index_records, double *biggest_waste);
+// Finds the two index_records that would waste the most area if they were put in the same node.
+// Their indices are written to seed_indices[0] and seed_indices[1]
+void pick_seeds_sequential(index_record **irs, int num_index_records, double *biggest_waste, int *seed_indices);
 
 void *pick_seeds_subset(void *arg);
 
-int *pick_seeds_parallel(r_tree_node *rt, index_record *insertion_ir, int num_threads);
+void pick_seeds_parallel(index_record **irs, int num_index_records, int *seed_indices, int num_threads);
 
 
 #endif
@@ -0,0 +1,392 @@
+#include "r_tree.h"
+#include "pick_seeds.h"
+#include "point_tree.h"
+
+
+// How much mbr grows, in area and in half perimeter, to take in the rectangle from (min_x, min_y) to (max_x, max_y)
+static void growth(MBR *mbr, coord_t min_x, coord_t min_y, coord_t max_x, coord_t max_y, double *area, double *margin) {
+	span_t width = (span_t)mbr->max_x - mbr->min_x;
+	span_t height = (span_t)mbr->max_y - mbr->min_y;
+	span_t new_width = (span_t)coord_max(mbr->max_x, max_x) - coord_min(mbr->min_x, min_x);
+	span_t new_height = (span_t)coord_max(mbr->max_y, max_y) - coord_min(mbr->min_y, min_y);
+
+	*area = (double)new_width * new_height - (double)width * height;
+	*margin = (double)(new_width - width) + (double)(new_height - height);
+}
+
+
+// True if growing by area_1 and margin_1 is cheaper than growing by area_2 and margin_2. Points often sit on a line
+// (or on top of each other), where every area is 0, so the perimeter settles ties
+static bool cheaper(double area_1, double margin_1, double area_2, double margin_2) {
+	return area_1 < area_2 || (area_1 == area_2 && margin_1 < margin_2);
+}
+
+
+static void point_mbr(MBR *mbr, point *p) {
+	mbr->min_x = p->x;
+	mbr->min_y = p->y;
+	mbr->max_x = p->x;
+	mbr->max_y = p->y;
+}
+
+
+static void expand_to_point(MBR *mbr, point *p) {
+	mbr->min_x = coord_min(mbr->min_x, p->x);
+	mbr->min_y = coord_min(mbr->min_y, p->y);
+	mbr->max_x = coord_max(mbr->max_x, p->x);
+	mbr->max_y = coord_max(mbr->max_y, p->y);
+}
+
+
+static bool contains_point(MBR *mbr, point *p) {
+	return mbr->min_x <= p->x && p->x <= mbr->max_x && mbr->min_y <= p->y && p->y <= mbr->max_y;
+}
+
+
+static point_leaf *allocate_leaf(point_tree *pt) {
+	size_t size = sizeof(point_leaf) + sizeof(point) * pt->leaf_capacity;
+	point_leaf *leaf = (point_leaf *)malloc(size);
+	count_allocation();
+
+	if (leaf == NULL) {
+		fprintf(stderr, "Malloc failed in allocate_leaf(). Exiting program\n");
+		exit(1);
+	}
+
+	leaf->num_points = 0;
+	pt->leaf_bytes += size;
+
+	return leaf;
+}
+
+
+static point_node *allocate_node(point_tree *pt, bool leaves_below) {
+	size_t size = sizeof(point_node) + sizeof(point_entry) * pt->node_capacity;
+	point_node *node = (point_node *)malloc(size);
+	count_allocation();
+
+	if (node == NULL) {
+		fprintf(stderr, "Malloc failed in allocate_node(). Exiting program\n");
+		exit(1);
+	}
+
+	node->num_members = 0;
+	node->leaves_below = leaves_below;
+	pt->node_bytes += size;
+
+	return node;
+}
+
+
+// Least enlargement to take in p, over the entries of node
+static int point_insertion_index(point_node *node, point *p) {
+	double min_area, min_margin;
+	int curr_index = 0;
+	int i;
+
+	growth(&node->entries[0].mbr, p->x, p->y, p->x, p->y, &min_area, &min_margin);
+
+	for (i = 1; i < node->num_members; i++) {
+		double area, margin;
+
+		growth(&node->entries[i].mbr, p->x, p->y, p->x, p->y, &area, &margin);
+
+		if (cheaper(area, margin, min_area, min_margin)) {
+			min_area = area;
+			min_margin = margin;
+			curr_index = i;
+		}
+	}
+
+	return curr_index;
+}
+
+
+// Splits the full leaf while adding p to it. The points spanning the largest rectangle (or, if they all sit on one
+// line, the longest perimeter) seed the two groups and the rest go where they grow the group least, ties going to
+// the emptier one. leaf's new MBR is written to leaf_mbr, and the entry for the new sibling to sibling_entry
+static void split_leaf(point_tree *pt, point_leaf *leaf, point *p, MBR *leaf_mbr, point_entry *sibling_entry) {
+	int num_points = leaf->num_points + 1;
+	int seed_1 = 0, seed_2 = 1;
+	double biggest_area = -1, biggest_margin = -1;
+	int i, j;
+
+	point points[num_points];
+
+	memcpy(points, leaf->points, sizeof(point) * leaf->num_points);
+	points[num_points - 1] = *p;
+
+	for (i = 0; i < num_points; i++) {
+		for (j = i + 1; j < num_points; j++) {
+			span_t width = points[i].x > points[j].x ? (span_t)points[i].x - points[j].x : (span_t)points[j].x - points[i].x;
+			span_t height = points[i].y > points[j].y ? (span_t)points[i].y - points[j].y : (span_t)points[j].y - points[i].y;
+			double area = (double)width * height;
+			double margin = (double)width + (double)height;
+
+			if (cheaper(biggest_area, biggest_margin, area, margin)) {
+				biggest_area = area;
+				biggest_margin = margin;
+				seed_1 = i;
+				seed_2 = j;
+			}
+		}
+	}
+
+	point_leaf *sibling = allocate_leaf(pt);
+	MBR *sibling_mbr = &sibling_entry->mbr;
+
+	sibling_entry->child = sibling;
+
+	leaf->num_points = 0;
+	leaf->points[leaf->num_points++] = points[seed_1];
+	sibling->points[sibling->num_points++] = points[seed_2];
+	point_mbr(leaf_mbr, &points[seed_1]);
+	point_mbr(sibling_mbr, &points[seed_2]);
+
+	for (i = 0; i < num_points; i++) {
+		if (i == seed_1 || i == seed_2)
+			continue;
+
+		double area_1, margin_1, area_2, margin_2;
+
+		growth(leaf_mbr, points[i].x, points[i].y, points[i].x, points[i].y, &area_1, &margin_1);
+		growth(sibling_mbr, points[i].x, points[i].y, points[i].x, points[i].y, &area_2, &margin_2);
+
+		bool tie = area_1 == area_2 && margin_1 == margin_2;
+
+		if (cheaper(area_1, margin_1, area_2, margin_2) || (tie && leaf->num_points < sibling->num_points)) {
+			leaf->points[leaf->num_points++] = points[i];
+			expand_to_point(leaf_mbr, &points[i]);
+		} else {
+			sibling->points[sibling->num_points++] = points[i];
+			expand_to_point(sibling_mbr, &points[i]);
+		}
+	}
+
+	count_split();
+}
+
+
+// Splits the full node while adding entry to it, the same way split_node would. node's new MBR is written to
+// node_mbr, and the entry for the new sibling to sibling_entry
+static void split_point_node(point_tree *pt, point_node *node, point_entry *entry, MBR *node_mbr, point_entry *sibling_entry) {
+	int num_entries = node->num_members + 1;
+	int seed_indices[2];
+	double biggest_waste;
+	int i;
+
+	// pick_seeds_sequential only looks at the MBRs, so stack index_records pointing into entries are enough
+	point_entry entries[num_entries];
+	index_record irs[num_entries];
+	index_record *ir_ptrs[num_entries];
+
+	memcpy(entries, node->entries, sizeof(point_entry) * node->num_members);
+	entries[num_entries - 1] = *entry;
+
+	for (i = 0; i < num_entries; i++) {
+		irs[i].mbr = &entries[i].mbr;
+		ir_ptrs[i] = &irs[i];
+	}
+
+	pick_seeds_sequential(ir_ptrs, num_entries, &biggest_waste, seed_indices);
+
+	point_node *sibling = allocate_node(pt, node->leaves_below);
+	MBR *sibling_mbr = &sibling_entry->mbr;
+
+	sibling_entry->child = sibling;
+
+	node->num_members = 0;
+	node->entries[node->num_members++] = entries[seed_indices[0]];
+	sibling->entries[sibling->num_members++] = entries[seed_indices[1]];
+	*node_mbr = entries[seed_indices[0]].mbr;
+	*sibling_mbr = entries[seed_indices[1]].mbr;
+
+	// Ties go to the emptier node
+	for (i = 0; i < num_entries; i++) {
+		if (i == seed_indices[0] || i == seed_indices[1])
+			continue;
+
+		double enlargement_1 = get_area_increase(node_mbr, &entries[i].mbr);
+		double enlargement_2 = get_area_increase(sibling_mbr, &entries[i].mbr);
+
+		if (enlargement_1 < enlargement_2 || (enlargement_1 == enlargement_2 && node->num_members < sibling->num_members)) {
+			node->entries[node->num_members++] = entries[i];
+			expand_mbr(node_mbr, &entries[i].mbr);
+		} else {
+			sibling->entries[sibling->num_members++] = entries[i];
+			expand_mbr(sibling_mbr, &entries[i].mbr);
+		}
+	}
+
+	count_split();
+}
+
+
+// Creates an empty point_tree whose leaves hold up to leaf_capacity points and whose other nodes hold up to
+// node_capacity children
+point_tree *create_point_tree(int leaf_capacity, int node_capacity) {
+	if (leaf_capacity < 2 || node_capacity < 2) {
+		fprintf(stderr, "A point_tree needs room for at least 2 members in every node. Exiting program\n");
+		exit(1);
+	}
+
+	point_tree *pt = (point_tree *)malloc(sizeof(point_tree));
+
+	if (pt == NULL) {
+		fprintf(stderr, "Malloc failed in create_point_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	pt->leaf_capacity = leaf_capacity;
+	pt->node_capacity = node_capacity;
+	pt->height = 1;
+	pt->num_points = 0;
+	pt->leaf_bytes = 0;
+	pt->node_bytes = 0;
+	pt->root = allocate_leaf(pt);
+
+	return pt;
+}
+
+
+void point_insert(point_tree *pt, coord_t x, coord_t y) {
+	point_node *nodes[MAX_TREE_HEIGHT];
+	int indices[MAX_TREE_HEIGHT];
+	point p = {x, y};
+	int depth = 0;
+	int i;
+
+	void *child = pt->root;
+
+	// Choose the leaf. nodes[depth] is the node above the leaf once the loop is done
+	for (i = 1; i < pt->height; i++) {
+		point_node *node = (point_node *)child;
+
+		nodes[depth] = node;
+		indices[depth] = point_insertion_index(node, &p);
+		child = node->entries[indices[depth]].child;
+		depth++;
+	}
+
+	point_leaf *leaf = (point_leaf *)child;
+
+	// Same as adjust_tree
+	for (i = depth - 1; i >= 0; i--) {
+		MBR *parent_mbr = &nodes[i]->entries[indices[i]].mbr;
+
+		if (contains_point(parent_mbr, &p))
+			break;
+
+		expand_to_point(parent_mbr, &p);
+	}
+
+	pt->num_points++;
+
+	if (leaf->num_points < pt->leaf_capacity) {
+		leaf->points[leaf->num_points++] = p;
+		return;
+	}
+
+	MBR child_mbr;
+	point_entry entry;
+
+	split_leaf(pt, leaf, &p, &child_mbr, &entry);
+
+	// Same as insert_at_node: split up the path until a node has room
+	while (depth > 0) {
+		point_node *node = nodes[depth - 1];
+
+		node->entries[indices[depth - 1]].mbr = child_mbr;
+
+		if (node->num_members < pt->node_capacity) {
+			node->entries[node->num_members++] = entry;
+			return;
+		}
+
+		point_entry sibling_entry;
+
+		split_point_node(pt, node, &entry, &child_mbr, &sibling_entry);
+		entry = sibling_entry;
+		depth--;
+	}
+
+	// The root split, so the tree grows by one level
+	point_node *root = allocate_node(pt, pt->height == 1);
+
+	root->entries[0].mbr = child_mbr;
+	root->entries[0].child = pt->root;
+	root->entries[1] = entry;
+	root->num_members = 2;
+
+	pt->root = root;
+	pt->height++;
+}
+
+
+// Scans the points of leaf in one pass
+static long search_leaf(point_leaf *leaf, MBR *window, point_search_callback callback, void *arg) {
+	long found = 0;
+	int i;
+
+	// Only counting, so the test for every point is folded into the count without a branch
+	if (callback == NULL) {
+		for (i = 0; i < leaf->num_points; i++)
+			found += contains_point(window, &leaf->points[i]);
+
+		return found;
+	}
+
+	for (i = 0; i < leaf->num_points; i++) {
+		if (contains_point(window, &leaf->points[i])) {
+			callback(&leaf->points[i], arg);
+			found++;
+		}
+	}
+
+	return found;
+}
+
+
+// Recursive part of point_search. height counts the levels of child, with the leaves at 1
+static long search_child(void *child, int height, MBR *window, point_search_callback callback, void *arg) {
+	if (height == 1)
+		return search_leaf((point_leaf *)child, window, callback, arg);
+
+	point_node *node = (point_node *)child;
+	long found = 0;
+	int i;
+
+	for (i = 0; i < node->num_members; i++) {
+		if (mbr_overlaps(&node->entries[i].mbr, window))
+			found += search_child(node->entries[i].child, height - 1, window, callback, arg);
+	}
+
+	return found;
+}
+
+
+// Finds every point inside window (points on its edges included) and passes it to callback (which may be NULL).
+// Returns the number of points found, the same as search() would for an MBR of zero size around each point
+long point_search(point_tree *pt, MBR *window, point_search_callback callback, void *arg) {
+	return search_child(pt->root, pt->height, window, callback, arg);
+}
+
+
+static void free_child(void *child, int height) {
+	int i;
+
+	if (height > 1) {
+		point_node *node = (point_node *)child;
+
+		for (i = 0; i < node->num_members; i++)
+			free_child(node->entries[i].child, height - 1);
+	}
+
+	free(child);
+}
+
+
+void free_point_tree(point_tree *pt) {
+	free_child(pt->root, pt->height);
+	free(pt);
+}
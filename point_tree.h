@@ -0,0 +1,80 @@
+#ifndef _point_tree_h
+#define _point_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* R-tree for point data.
+*
+* A leaf is one allocation holding its points as contiguous (x, y) pairs, with no MBR and no index_record per point.
+* The nodes above hold the MBRs of their children inline, like the pages of a paged_tree. Because every object is a
+* point, insertion measures how much an MBR has to grow to take in a point (ties going to the one whose perimeter
+* grows least), leaf splits seed on the two points spanning the largest rectangle and searches test the points of a
+* leaf for containment in the window in one pass over the array. Splits of the nodes above work like split_node
+*/
+
+typedef struct point {
+	coord_t x;
+	coord_t y;
+} point;
+
+
+typedef struct point_leaf {
+	int num_points;
+	point points[];
+} point_leaf;
+
+
+typedef struct point_entry {
+	MBR mbr;
+
+	// A point_leaf in nodes just above the leaves, otherwise a point_node
+	void *child;
+} point_entry;
+
+
+typedef struct point_node {
+	int num_members;
+	bool leaves_below;
+	point_entry entries[];
+} point_node;
+
+
+typedef struct point_tree {
+	// A point_leaf while height is 1, otherwise a point_node
+	void *root;
+	int height;
+
+	int leaf_capacity;
+	int node_capacity;
+
+	long num_points;
+
+	// Bytes allocated for leaves and nodes
+	long leaf_bytes;
+	long node_bytes;
+} point_tree;
+
+
+// Called by point_search() once for every point inside the search window
+typedef void (*point_search_callback)(point *p, void *arg);
+
+
+// Creates an empty point_tree whose leaves hold up to leaf_capacity points and whose other nodes hold up to
+// node_capacity children
+point_tree *create_point_tree(int leaf_capacity, int node_capacity);
+
+
+void point_insert(point_tree *pt, coord_t x, coord_t y);
+
+
+// Finds every point inside window (points on its edges included) and passes it to callback (which may be NULL).
+// Returns the number of points found, the same as search() would for an MBR of zero size around each point
+long point_search(point_tree *pt, MBR *window, point_search_callback callback, void *arg);
+
+
+void free_point_tree(point_tree *pt);
+
+
+#endif
@@ -0,0 +1,161 @@
+#include "r_tree.h"
+#include "qr_tree.h"
+
+
+// Rounds the range [min, max] outwards onto the quantisation grid of bounds along one axis
+void quantise_range(double bounds_min, double bounds_max, double min, double max, qr_coord *q_min, qr_coord *q_max) {
+	double width = bounds_max - bounds_min;
+
+	// Degenerate (zero-width) node: every child covers the whole grid
+	if (width <= 0) {
+		*q_min = 0;
+		*q_max = QR_MAX_COORD;
+		return;
+	}
+
+	double scale = QR_MAX_COORD / width;
+
+	// Both ends go through the same monotonic mapping, so lower bounds rounded down and upper bounds rounded up
+	// can only ever make a rectangle grow
+	double low = floor((min - bounds_min) * scale);
+	double high = ceil((max - bounds_min) * scale);
+
+	*q_min = (qr_coord) fmax(0, fmin(low, QR_MAX_COORD));
+	*q_max = (qr_coord) fmax(0, fmin(high, QR_MAX_COORD));
+}
+
+
+// Allocates a qr_node with room for num_members entries and children in a single block
+static qr_node *initialize_qr_node(int num_members) {
+	size_t size = sizeof(qr_node) + num_members * (sizeof(void *) + sizeof(qr_entry));
+	qr_node *node = (qr_node *)malloc(size);
+
+	if (node == NULL) {
+		fprintf(stderr, "Malloc failed in initialize_qr_node(). Exiting program\n");
+		exit(1);
+	}
+
+	node->num_members = num_members;
+	node->children = (void **)(node + 1);
+	node->entries = (qr_entry *)(node->children + num_members);
+
+	return node;
+}
+
+
+// Compresses node, whose exact MBR is bounds
+static qr_node *compress_node(r_tree_node *node, MBR *bounds) {
+	qr_node *qr = initialize_qr_node(node->num_members);
+	int i;
+
+	qr->bounds = *bounds;
+	qr->children_are_leaves = is_leaf(node->index_records[0]->child);
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *curr_ir = node->index_records[i];
+		qr_entry *entry = &qr->entries[i];
+
+		quantise_range(bounds->min_x, bounds->max_x, curr_ir->mbr->min_x, curr_ir->mbr->max_x, &entry->min_x, &entry->max_x);
+		quantise_range(bounds->min_y, bounds->max_y, curr_ir->mbr->min_y, curr_ir->mbr->max_y, &entry->min_y, &entry->max_y);
+
+		if (qr->children_are_leaves)
+			qr->children[i] = curr_ir->child;
+		else
+			qr->children[i] = compress_node(curr_ir->child, curr_ir->mbr);
+	}
+
+	return qr;
+}
+
+
+// Builds a compressed copy of every internal level of the tree rooted at root.
+// Returns NULL if root is itself a leaf (there is nothing to compress)
+qr_node *compress_tree(r_tree_node *root) {
+	if (root->num_members == 0 || is_leaf(root))
+		return NULL;
+
+	// The root has no parent index_record, so its frame is the union of its children
+	MBR bounds = *root->index_records[0]->mbr;
+	int i;
+
+	for (i = 1; i < root->num_members; i++)
+		expand_mbr(&bounds, root->index_records[i]->mbr);
+
+	return compress_node(root, &bounds);
+}
+
+
+// Same as search() in r_tree.h, but descends through the compressed internal levels.
+// Returns exactly the same index_records as search() on the original tree
+long qr_search(qr_node *node, MBR *window, search_callback callback, void *arg) {
+	long found = 0;
+	int i;
+
+	if (!mbr_overlaps(&node->bounds, window))
+		return 0;
+
+	// Quantise the window into this node's frame once, then every entry test is a handful of integer compares
+	qr_entry q_window;
+
+	quantise_range(node->bounds.min_x, node->bounds.max_x, window->min_x, window->max_x, &q_window.min_x, &q_window.max_x);
+	quantise_range(node->bounds.min_y, node->bounds.max_y, window->min_y, window->max_y, &q_window.min_y, &q_window.max_y);
+
+	for (i = 0; i < node->num_members; i++) {
+		qr_entry *entry = &node->entries[i];
+
+		if (entry->min_x > q_window.max_x || entry->max_x < q_window.min_x ||
+			entry->min_y > q_window.max_y || entry->max_y < q_window.min_y)
+			continue;
+
+		if (node->children_are_leaves)
+			found += search((r_tree_node *)node->children[i], window, callback, arg);
+		else
+			found += qr_search((qr_node *)node->children[i], window, callback, arg);
+	}
+
+	return found;
+}
+
+
+// Number of bytes used by the compressed internal levels (the shared leaf r_tree_nodes are not counted)
+long qr_tree_size(qr_node *node) {
+	long size = sizeof(qr_node) + node->num_members * (sizeof(void *) + sizeof(qr_entry));
+	int i;
+
+	if (!node->children_are_leaves) {
+		for (i = 0; i < node->num_members; i++)
+			size += qr_tree_size((qr_node *)node->children[i]);
+	}
+
+	return size;
+}
+
+
+// Number of bytes the uncompressed internal levels of the tree rooted at node use
+long internal_tree_size(r_tree_node *node) {
+	if (node->num_members == 0 || is_leaf(node))
+		return 0;
+
+	long size = sizeof(r_tree_node) + node->max_members * sizeof(index_record *);
+	int i;
+
+	for (i = 0; i < node->num_members; i++) {
+		size += sizeof(index_record) + sizeof(MBR);
+		size += internal_tree_size(node->index_records[i]->child);
+	}
+
+	return size;
+}
+
+
+// Frees the compressed levels only. The original tree (and its leaves) are left untouched
+void free_qr_tree(qr_node *node) {
+	int i;
+
+	if (!node->children_are_leaves) {
+		for (i = 0; i < node->num_members; i++)
+			free_qr_tree((qr_node *)node->children[i]);
+	}
+
+	free(node);
+}
@@ -0,0 +1,84 @@
+#ifndef _qr_tree_h
+#define _qr_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+/* Compressed (QR-tree style) copy of the internal levels of an r-tree.
+*
+* Every child rectangle of a qr_node is stored as QR_BITS-bit offsets relative to the node's own MBR instead
+* of as a separately malloc'd MBR + index_record pair. Lower bounds are rounded down and upper bounds are rounded up,
+* so a quantised rectangle can only be bigger than the real one and a search can never miss a record.
+* The bottom qr_node level points straight at the original leaf r_tree_nodes, so exact coordinates are kept at the leaves.
+*
+* A qr_tree is a read-only snapshot: rebuild it with compress_tree() after inserting into the original tree
+*/
+
+// Either 8 or 16. 8 bits gives the smallest nodes, 16 bits gives tighter rectangles (fewer wasted descents)
+#ifndef QR_BITS
+#define QR_BITS 8
+#endif
+
+#if QR_BITS == 8
+typedef uint8_t qr_coord;
+#define QR_MAX_COORD UINT8_MAX
+#elif QR_BITS == 16
+typedef uint16_t qr_coord;
+#define QR_MAX_COORD UINT16_MAX
+#else
+#error "QR_BITS must be 8 or 16"
+#endif
+
+
+// A child rectangle quantised relative to the MBR of the qr_node that holds it
+typedef struct qr_entry {
+	qr_coord min_x;
+	qr_coord min_y;
+	qr_coord max_x;
+	qr_coord max_y;
+} qr_entry;
+
+
+typedef struct qr_node {
+	// Exact MBR of everything below this node. Every qr_entry in the node is relative to it
+	MBR bounds;
+	int num_members;
+
+	// If true, children[i] is an original leaf r_tree_node, otherwise it is another qr_node
+	bool children_are_leaves;
+
+	qr_entry *entries;
+	void **children;
+} qr_node;
+
+
+// Rounds the range [min, max] outwards onto the quantisation grid of bounds along one axis
+void quantise_range(double bounds_min, double bounds_max, double min, double max, qr_coord *q_min, qr_coord *q_max);
+
+
+// Builds a compressed copy of every internal level of the tree rooted at root.
+// Returns NULL if root is itself a leaf (there is nothing to compress)
+qr_node *compress_tree(r_tree_node *root);
+
+
+// Same as search() in r_tree.h, but descends through the compressed internal levels.
+// Returns exactly the same index_records as search() on the original tree
+long qr_search(qr_node *node, MBR *window, search_callback callback, void *arg);
+
+
+// Number of bytes used by the compressed internal levels (the shared leaf r_tree_nodes are not counted)
+long qr_tree_size(qr_node *node);
+
+
+// Number of bytes the uncompressed internal levels of the tree rooted at node use
+long internal_tree_size(r_tree_node *node);
+
+
+// Frees the compressed levels only. The original tree (and its leaves) are left untouched
+void free_qr_tree(qr_node *node);
+
+
+#endif
@@ -0,0 +1,313 @@
+#include "r_tree.h"
+#include "math_utils.h"
+#include "query_batch.h"
+
+
+typedef struct batch_hit {
+	long query;
+	index_record *ir;
+} batch_hit;
+
+
+// Every worker collects the records it finds for any query into its own buffer, on its own cache line
+typedef struct hit_buffer {
+	_Alignas(CACHE_LINE_SIZE) batch_hit *hits;
+	long num_hits;
+	long capacity;
+} hit_buffer;
+
+
+typedef struct batch_context {
+	r_tree_node *root;
+	int height;
+	MBR **windows;
+	query_batch *qb;
+	hit_buffer *buffers;
+	struct timespec start;
+
+	// Next query for the source to hand out, and the number of unfinished tasks of each query handed out so far
+	atomic_long next_query;
+	atomic_long *outstanding;
+} batch_context;
+
+
+// Passed to search() as its callback argument
+typedef struct hit_collector {
+	hit_buffer *buffer;
+	long query;
+} hit_collector;
+
+
+// A task's id holds the query and the height of its node
+#define batch_task_id(query, height) (((long)(query) << 8) | (height))
+
+
+static void collect_hit(index_record *ir, void *arg) {
+	hit_collector *collector = (hit_collector *)arg;
+	hit_buffer *buffer = collector->buffer;
+
+	if (buffer->num_hits == buffer->capacity) {
+		buffer->capacity = buffer->capacity == 0 ? 1024 : buffer->capacity * 2;
+		buffer->hits = (batch_hit *)realloc(buffer->hits, sizeof(batch_hit) * buffer->capacity);
+
+		if (buffer->hits == NULL) {
+			fprintf(stderr, "Realloc failed in collect_hit(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	buffer->hits[buffer->num_hits].query = collector->query;
+	buffer->hits[buffer->num_hits].ir = ir;
+	buffer->num_hits++;
+}
+
+
+static query_batch *create_query_batch(int num_queries, int num_workers) {
+	query_batch *qb = (query_batch *)malloc(sizeof(query_batch));
+
+	if (qb == NULL) {
+		fprintf(stderr, "Malloc failed in create_query_batch(). Exiting program\n");
+		exit(1);
+	}
+
+	qb->num_queries = num_queries;
+	qb->num_workers = num_workers;
+	qb->results = (query_result *)calloc(num_queries > 0 ? num_queries : 1, sizeof(query_result));
+	qb->busy_seconds = (double *)calloc(num_workers, sizeof(double));
+	qb->steals = (long *)calloc(num_workers, sizeof(long));
+	qb->records = NULL;
+
+	if (qb->results == NULL || qb->busy_seconds == NULL || qb->steals == NULL) {
+		fprintf(stderr, "Malloc failed in create_query_batch(). Exiting program\n");
+		exit(1);
+	}
+
+	return qb;
+}
+
+
+static hit_buffer *create_hit_buffers(int num_workers) {
+	hit_buffer *buffers = (hit_buffer *)aligned_alloc(CACHE_LINE_SIZE, sizeof(hit_buffer) * num_workers);
+	int i;
+
+	if (buffers == NULL) {
+		fprintf(stderr, "Malloc failed in create_hit_buffers(). Exiting program\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		buffers[i].hits = NULL;
+		buffers[i].num_hits = 0;
+		buffers[i].capacity = 0;
+	}
+
+	return buffers;
+}
+
+
+// Sorts the hits of every worker into one contiguous result set per query, then frees the buffers
+static void gather_results(query_batch *qb, hit_buffer *buffers) {
+	long total = 0;
+	long i, q;
+	int w;
+
+	for (w = 0; w < qb->num_workers; w++) {
+		for (i = 0; i < buffers[w].num_hits; i++)
+			qb->results[buffers[w].hits[i].query].num_records++;
+
+		total += buffers[w].num_hits;
+	}
+
+	qb->records = (index_record **)malloc(sizeof(index_record *) * (total > 0 ? total : 1));
+
+	if (qb->records == NULL) {
+		fprintf(stderr, "Malloc failed in gather_results(). Exiting program\n");
+		exit(1);
+	}
+
+	// num_records is used as each query's fill count while the records are copied in
+	for (q = 0, total = 0; q < qb->num_queries; q++) {
+		qb->results[q].records = qb->records + total;
+		total += qb->results[q].num_records;
+		qb->results[q].num_records = 0;
+	}
+
+	for (w = 0; w < qb->num_workers; w++) {
+		for (i = 0; i < buffers[w].num_hits; i++) {
+			query_result *result = &qb->results[buffers[w].hits[i].query];
+			result->records[result->num_records++] = buffers[w].hits[i].ir;
+		}
+
+		free(buffers[w].hits);
+	}
+
+	free(buffers);
+}
+
+
+// Called at the end of every task. Whoever finishes a query's last task records its latency
+static void finish_query_task(batch_context *context, long query) {
+	if (atomic_fetch_sub(&context->outstanding[query], 1) == 1)
+		context->qb->results[query].latency = seconds_since(&context->start);
+}
+
+
+// Searches the node in task for its query, either whole or by submitting a task for every overlapping child
+static void query_task(work_pool *pool, int worker, work_task *task) {
+	batch_context *context = (batch_context *)pool->context;
+	r_tree_node *node = (r_tree_node *)task->first;
+	long query = task->id >> 8;
+	int height = (int)(task->id & 0xff);
+	MBR *window = context->windows[query];
+	int i;
+
+	if (height <= BATCH_INLINE_HEIGHT) {
+		hit_collector collector = {&context->buffers[worker], query};
+		search(node, window, collect_hit, &collector);
+	} else {
+		for (i = 0; i < node->num_members; i++) {
+			index_record *child_ir = node->index_records[i];
+
+			if (!mbr_overlaps(child_ir->mbr, window))
+				continue;
+
+			// Counted before it is submitted, since it may be stolen and finished straight away
+			atomic_fetch_add(&context->outstanding[query], 1);
+
+			work_task child_task = {child_ir->child, NULL, batch_task_id(query, height - 1)};
+			submit_task(pool, worker, &child_task);
+		}
+	}
+
+	finish_query_task(context, query);
+}
+
+
+// Hands out the next query as a task at the root
+static bool next_query(work_pool *pool, int worker, work_task *task) {
+	batch_context *context = (batch_context *)pool->context;
+	long query = atomic_fetch_add(&context->next_query, 1);
+
+	if (query >= context->qb->num_queries)
+		return false;
+
+	atomic_store(&context->outstanding[query], 1);
+	context->qb->results[query].started = seconds_since(&context->start);
+
+	task->first = context->root;
+	task->second = NULL;
+	task->id = batch_task_id(query, context->height);
+
+	return true;
+}
+
+
+// Runs a search of the tree rooted at root for every window, on num_threads work-stealing workers
+query_batch *run_query_batch(r_tree_node *root, MBR **windows, int num_queries, int num_threads) {
+	query_batch *qb = create_query_batch(num_queries, num_threads);
+	batch_context context;
+	int w;
+
+	context.root = root;
+	context.height = tree_height(root);
+	context.windows = windows;
+	context.qb = qb;
+	context.buffers = create_hit_buffers(num_threads);
+	context.outstanding = (atomic_long *)malloc(sizeof(atomic_long) * (num_queries > 0 ? num_queries : 1));
+	atomic_init(&context.next_query, 0);
+
+	if (context.outstanding == NULL) {
+		fprintf(stderr, "Malloc failed in run_query_batch(). Exiting program\n");
+		exit(1);
+	}
+
+	work_pool *pool = create_work_pool(num_threads, query_task, &context);
+	pool->source = next_query;
+
+	clock_gettime(CLOCK_MONOTONIC, &context.start);
+	run_work_pool(pool);
+	qb->wall_seconds = seconds_since(&context.start);
+
+	for (w = 0; w < num_threads; w++) {
+		qb->busy_seconds[w] = qb->wall_seconds - pool->deques[w].idle_seconds;
+		qb->steals[w] = pool->deques[w].steals;
+	}
+
+	gather_results(qb, context.buffers);
+	free_work_pool(pool);
+	free(context.outstanding);
+
+	return qb;
+}
+
+
+typedef struct static_share {
+	batch_context *context;
+	int worker;
+	int first_query;
+	int end_query;
+} static_share;
+
+
+static void *run_static_share(void *arg) {
+	static_share *share = (static_share *)arg;
+	batch_context *context = share->context;
+	struct timespec start;
+	int q;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (q = share->first_query; q < share->end_query; q++) {
+		hit_collector collector = {&context->buffers[share->worker], q};
+
+		context->qb->results[q].started = seconds_since(&context->start);
+		search(context->root, context->windows[q], collect_hit, &collector);
+		context->qb->results[q].latency = seconds_since(&context->start);
+	}
+
+	context->qb->busy_seconds[share->worker] = seconds_since(&start);
+	pthread_exit(NULL);
+}
+
+
+// Runs the same searches with every thread taking an equal contiguous share of the windows
+query_batch *run_query_batch_static(r_tree_node *root, MBR **windows, int num_queries, int num_threads) {
+	query_batch *qb = create_query_batch(num_queries, num_threads);
+	pthread_t thread_ids[num_threads];
+	static_share shares[num_threads];
+	batch_context context;
+	int w;
+
+	context.root = root;
+	context.windows = windows;
+	context.qb = qb;
+	context.buffers = create_hit_buffers(num_threads);
+
+	clock_gettime(CLOCK_MONOTONIC, &context.start);
+
+	for (w = 0; w < num_threads; w++) {
+		shares[w].context = &context;
+		shares[w].worker = w;
+		shares[w].first_query = (int)((long)num_queries * w / num_threads);
+		shares[w].end_query = (int)((long)num_queries * (w + 1) / num_threads);
+		pthread_create(&thread_ids[w], NULL, run_static_share, (void *)&shares[w]);
+	}
+
+	for (w = 0; w < num_threads; w++)
+		pthread_join(thread_ids[w], NULL);
+
+	qb->wall_seconds = seconds_since(&context.start);
+
+	gather_results(qb, context.buffers);
+
+	return qb;
+}
+
+
+void free_query_batch(query_batch *qb) {
+	free(qb->results);
+	free(qb->records);
+	free(qb->busy_seconds);
+	free(qb->steals);
+	free(qb);
+}
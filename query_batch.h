@@ -0,0 +1,61 @@
+#ifndef _query_batch_h
+#define _query_batch_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "work_pool.h"
+
+/* Parallel execution of a batch of window queries.
+*
+* run_query_batch hands the queries out one at a time from a work_pool source. A query starts as one task at the root,
+* and every node it reaches more than BATCH_INLINE_HEIGHT levels above the leaves submits one task per overlapping
+* child, so a query touching thousands of nodes spreads over every idle worker through stealing, while one touching
+* three stays on its worker. Subtrees at or below BATCH_INLINE_HEIGHT are finished with a plain search().
+*
+* run_query_batch_static does the same queries with each thread taking a fixed, contiguous share of them, for
+* comparison. Both fill in the same query_batch: a result set per query, when each query started and finished, and how
+* long each worker spent working
+*/
+
+// Subtrees this many levels tall (counting the leaves) are searched by a single task
+#define BATCH_INLINE_HEIGHT 2
+
+
+typedef struct query_result {
+	// Points into the query_batch's records array
+	index_record **records;
+	long num_records;
+
+	// Seconds from the start of the batch until the query was handed out, and until its last task finished
+	double started;
+	double latency;
+} query_result;
+
+
+typedef struct query_batch {
+	int num_queries;
+	query_result *results;
+	index_record **records;
+
+	int num_workers;
+	double wall_seconds;
+
+	// Seconds each worker spent running queries rather than waiting for work
+	double *busy_seconds;
+	long *steals;
+} query_batch;
+
+
+// Runs a search of the tree rooted at root for every window, on num_threads work-stealing workers
+query_batch *run_query_batch(r_tree_node *root, MBR **windows, int num_queries, int num_threads);
+
+
+// Runs the same searches with every thread taking an equal contiguous share of the windows
+query_batch *run_query_batch_static(r_tree_node *root, MBR **windows, int num_queries, int num_threads);
+
+
+void free_query_batch(query_batch *qb);
+
+
+#endif
@@ -0,0 +1,534 @@
+#include "r_tree.h"
+#include "math_utils.h"
+#include "query_cache.h"
+
+
+// Bytes an entry holding num_ids ids counts for
+static long entry_bytes(long num_ids) {
+	return sizeof(cache_entry) + sizeof(record_id) * num_ids;
+}
+
+
+static uint64_t hash_window(MBR *window) {
+	double coords[4] = {window->min_x, window->min_y, window->max_x, window->max_y};
+	uint64_t hash = 0;
+	uint64_t bits;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		memcpy(&bits, &coords[i], sizeof(bits));
+		hash = fold_hash(hash, bits);
+	}
+
+	return hash;
+}
+
+
+// Column or row of the cell holding coord. Clamped, so that far out coordinates still fit in a long
+static long cell_of(query_cache *qc, double coord) {
+	double cell = floor(coord / qc->cell_size);
+
+	return (long)fmax(fmin(cell, 1e15), -1e15);
+}
+
+
+static long cell_region(long column, long row) {
+	uint64_t hash = fold_hash(fold_hash(0, (uint64_t)column), (uint64_t)row);
+
+	return 1 + (long)(hash % (QUERY_CACHE_REGIONS - 1));
+}
+
+
+// Region window is filed under
+static long window_region(query_cache *qc, MBR *window) {
+	long min_column = cell_of(qc, window->min_x);
+	long min_row = cell_of(qc, window->min_y);
+
+	if (cell_of(qc, window->max_x) - min_column > QUERY_CACHE_MAX_SPAN || cell_of(qc, window->max_y) - min_row > QUERY_CACHE_MAX_SPAN)
+		return QUERY_CACHE_WIDE_REGION;
+
+	return cell_region(min_column, min_row);
+}
+
+
+static bool same_window(MBR *a, MBR *b) {
+	return a->min_x == b->min_x && a->min_y == b->min_y && a->max_x == b->max_x && a->max_y == b->max_y;
+}
+
+
+static cache_shard *shard_for(query_cache *qc, long region) {
+	return &qc->shards[region % QUERY_CACHE_SHARDS];
+}
+
+
+static cache_entry **region_head(cache_shard *shard, long region) {
+	return &shard->regions[region / QUERY_CACHE_SHARDS];
+}
+
+
+static long bucket_for(cache_shard *shard, uint64_t hash) {
+	return (long)(hash & (shard->num_buckets - 1));
+}
+
+
+static cache_entry **allocate_buckets(long num_buckets) {
+	cache_entry **buckets = (cache_entry **)calloc(num_buckets, sizeof(cache_entry *));
+
+	if (buckets == NULL) {
+		fprintf(stderr, "Malloc failed in allocate_buckets(). Exiting program\n");
+		exit(1);
+	}
+
+	return buckets;
+}
+
+
+// Creates an empty cache whose entries take up at most about memory_budget bytes, over a grid of cells cell_size across
+query_cache *create_query_cache(long memory_budget, double cell_size) {
+	query_cache *qc = (query_cache *)malloc(sizeof(query_cache));
+	int i;
+
+	if (qc == NULL) {
+		fprintf(stderr, "Malloc failed in create_query_cache(). Exiting program\n");
+		exit(1);
+	}
+
+	for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+		cache_shard *shard = &qc->shards[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->buckets = allocate_buckets(QUERY_CACHE_INITIAL_BUCKETS);
+		shard->num_buckets = QUERY_CACHE_INITIAL_BUCKETS;
+		shard->num_entries = 0;
+		shard->newest = NULL;
+		shard->oldest = NULL;
+		shard->bytes = 0;
+		memset(shard->regions, 0, sizeof(shard->regions));
+	}
+
+	for (i = 0; i < QUERY_CACHE_REGIONS; i++)
+		atomic_init(&qc->versions[i], 0);
+
+	qc->shard_budget = memory_budget / QUERY_CACHE_SHARDS;
+	qc->cell_size = cell_size;
+	atomic_init(&qc->hits, 0);
+	atomic_init(&qc->misses, 0);
+	atomic_init(&qc->evictions, 0);
+	atomic_init(&qc->invalidations, 0);
+	atomic_init(&qc->checked, 0);
+
+	return qc;
+}
+
+
+static void unlink_used(cache_shard *shard, cache_entry *entry) {
+	if (entry->prev_used != NULL)
+		entry->prev_used->next_used = entry->next_used;
+	else
+		shard->newest = entry->next_used;
+
+	if (entry->next_used != NULL)
+		entry->next_used->prev_used = entry->prev_used;
+	else
+		shard->oldest = entry->prev_used;
+}
+
+
+static void link_newest(cache_shard *shard, cache_entry *entry) {
+	entry->prev_used = NULL;
+	entry->next_used = shard->newest;
+
+	if (shard->newest != NULL)
+		shard->newest->prev_used = entry;
+	else
+		shard->oldest = entry;
+
+	shard->newest = entry;
+}
+
+
+// Returns the entry for window in shard, or NULL. Must hold the shard's lock
+static cache_entry *find_entry(cache_shard *shard, MBR *window, uint64_t hash) {
+	cache_entry *entry;
+
+	for (entry = shard->buckets[bucket_for(shard, hash)]; entry != NULL; entry = entry->next) {
+		if (entry->hash == hash && same_window(&entry->window, window))
+			return entry;
+	}
+
+	return NULL;
+}
+
+
+// Takes entry out of shard and frees it. Must hold the shard's lock
+static void remove_entry(cache_shard *shard, cache_entry *entry) {
+	cache_entry **link = &shard->buckets[bucket_for(shard, entry->hash)];
+
+	while (*link != entry)
+		link = &(*link)->next;
+
+	*link = entry->next;
+	unlink_used(shard, entry);
+
+	if (entry->prev_in_region != NULL)
+		entry->prev_in_region->next_in_region = entry->next_in_region;
+	else
+		*region_head(shard, entry->region) = entry->next_in_region;
+
+	if (entry->next_in_region != NULL)
+		entry->next_in_region->prev_in_region = entry->prev_in_region;
+
+	shard->num_entries--;
+	shard->bytes -= entry_bytes(entry->num_ids);
+
+	free(entry->ids);
+	free(entry);
+}
+
+
+// Doubles the buckets of shard. Must hold the shard's lock
+static void grow_buckets(cache_shard *shard) {
+	cache_entry **old_buckets = shard->buckets;
+	long old_num_buckets = shard->num_buckets;
+	long i;
+
+	shard->num_buckets *= 2;
+	shard->buckets = allocate_buckets(shard->num_buckets);
+
+	for (i = 0; i < old_num_buckets; i++) {
+		cache_entry *entry = old_buckets[i];
+
+		while (entry != NULL) {
+			cache_entry *next = entry->next;
+			long bucket = bucket_for(shard, entry->hash);
+
+			entry->next = shard->buckets[bucket];
+			shard->buckets[bucket] = entry;
+			entry = next;
+		}
+	}
+
+	free(old_buckets);
+}
+
+
+// If window's results are cached, returns a malloc'd copy of their ids (their number in *num_ids) and marks the entry
+// as the most recently used. Returns NULL otherwise
+record_id *query_cache_lookup(query_cache *qc, MBR *window, long *num_ids) {
+	uint64_t hash = hash_window(window);
+	cache_shard *shard = shard_for(qc, window_region(qc, window));
+	record_id *ids = NULL;
+
+	pthread_mutex_lock(&shard->lock);
+
+	cache_entry *entry = find_entry(shard, window, hash);
+
+	if (entry != NULL) {
+		ids = (record_id *)malloc(sizeof(record_id) * (entry->num_ids > 0 ? entry->num_ids : 1));
+
+		if (ids == NULL) {
+			fprintf(stderr, "Malloc failed in query_cache_lookup(). Exiting program\n");
+			exit(1);
+		}
+
+		memcpy(ids, entry->ids, sizeof(record_id) * entry->num_ids);
+		*num_ids = entry->num_ids;
+
+		unlink_used(shard, entry);
+		link_newest(shard, entry);
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	atomic_fetch_add(ids != NULL ? &qc->hits : &qc->misses, 1);
+
+	return ids;
+}
+
+
+// Current version of window's region, to be read before the search whose result is passed to query_cache_store
+unsigned long query_cache_version(query_cache *qc, MBR *window) {
+	return atomic_load(&qc->versions[window_region(qc, window)]);
+}
+
+
+// Caches a copy of the num_ids ids found in window, unless window's region has been invalidated since version.
+// Replaces any entry for window already there
+void query_cache_store(query_cache *qc, MBR *window, record_id *ids, long num_ids, unsigned long version) {
+	uint64_t hash = hash_window(window);
+	long region = window_region(qc, window);
+	cache_shard *shard = shard_for(qc, region);
+	long bytes = entry_bytes(num_ids);
+
+	// Too big to ever fit
+	if (bytes > qc->shard_budget)
+		return;
+
+	cache_entry *entry = (cache_entry *)malloc(sizeof(cache_entry));
+	record_id *copy = (record_id *)malloc(sizeof(record_id) * (num_ids > 0 ? num_ids : 1));
+
+	if (entry == NULL || copy == NULL) {
+		fprintf(stderr, "Malloc failed in query_cache_store(). Exiting program\n");
+		exit(1);
+	}
+
+	memcpy(copy, ids, sizeof(record_id) * num_ids);
+	entry->window = *window;
+	entry->hash = hash;
+	entry->region = region;
+	entry->ids = copy;
+	entry->num_ids = num_ids;
+
+	pthread_mutex_lock(&shard->lock);
+
+	// Checked under the lock: an invalidation bumps the region's version before it takes the shard's lock, so either
+	// this sees the new version or the invalidation sees the new entry
+	if (atomic_load(&qc->versions[region]) != version) {
+		pthread_mutex_unlock(&shard->lock);
+		free(copy);
+		free(entry);
+		return;
+	}
+
+	cache_entry *old = find_entry(shard, window, hash);
+
+	if (old != NULL)
+		remove_entry(shard, old);
+
+	while (shard->bytes + bytes > qc->shard_budget) {
+		remove_entry(shard, shard->oldest);
+		atomic_fetch_add(&qc->evictions, 1);
+	}
+
+	if (shard->num_entries >= shard->num_buckets * 2)
+		grow_buckets(shard);
+
+	long bucket = bucket_for(shard, hash);
+
+	entry->next = shard->buckets[bucket];
+	shard->buckets[bucket] = entry;
+	link_newest(shard, entry);
+
+	cache_entry **head = region_head(shard, region);
+
+	entry->prev_in_region = NULL;
+	entry->next_in_region = *head;
+
+	if (*head != NULL)
+		(*head)->prev_in_region = entry;
+	*head = entry;
+
+	shard->num_entries++;
+	shard->bytes += bytes;
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+
+// Drops the entries of region whose window overlaps changed. The region's version has to have been bumped already
+static void invalidate_region(query_cache *qc, long region, MBR *changed) {
+	cache_shard *shard = shard_for(qc, region);
+	long checked = 0;
+
+	pthread_mutex_lock(&shard->lock);
+
+	cache_entry *entry = *region_head(shard, region);
+
+	while (entry != NULL) {
+		cache_entry *next = entry->next_in_region;
+
+		if (mbr_overlaps(&entry->window, changed)) {
+			remove_entry(shard, entry);
+			atomic_fetch_add(&qc->invalidations, 1);
+		}
+
+		checked++;
+		entry = next;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	atomic_fetch_add(&qc->checked, checked);
+}
+
+
+// Same as invalidate_region over every region at once, for a changed MBR covering too many cells to list
+static void invalidate_everywhere(query_cache *qc, MBR *changed) {
+	long checked = 0;
+	int i;
+
+	for (i = 0; i < QUERY_CACHE_REGIONS; i++)
+		atomic_fetch_add(&qc->versions[i], 1);
+
+	for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+		cache_shard *shard = &qc->shards[i];
+		cache_entry *entry;
+
+		pthread_mutex_lock(&shard->lock);
+
+		entry = shard->newest;
+
+		while (entry != NULL) {
+			cache_entry *next = entry->next_used;
+
+			if (mbr_overlaps(&entry->window, changed)) {
+				remove_entry(shard, entry);
+				atomic_fetch_add(&qc->invalidations, 1);
+			}
+
+			checked++;
+			entry = next;
+		}
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	atomic_fetch_add(&qc->checked, checked);
+}
+
+
+// Drops every entry whose window overlaps changed, the MBR of a record just inserted or deleted
+void query_cache_invalidate(query_cache *qc, MBR *changed) {
+	long regions[QUERY_CACHE_MAX_INVALIDATED_CELLS + 1];
+	int num_regions = 0;
+	long column, row;
+	int i;
+
+	// Only windows with their min corner up to QUERY_CACHE_MAX_SPAN cells left of and below changed can reach it
+	long first_column = cell_of(qc, changed->min_x) - QUERY_CACHE_MAX_SPAN;
+	long first_row = cell_of(qc, changed->min_y) - QUERY_CACHE_MAX_SPAN;
+	long last_column = cell_of(qc, changed->max_x);
+	long last_row = cell_of(qc, changed->max_y);
+
+	if ((double)(last_column - first_column + 1) * (last_row - first_row + 1) > QUERY_CACHE_MAX_INVALIDATED_CELLS) {
+		invalidate_everywhere(qc, changed);
+		return;
+	}
+
+	regions[num_regions++] = QUERY_CACHE_WIDE_REGION;
+
+	for (column = first_column; column <= last_column; column++) {
+		for (row = first_row; row <= last_row; row++) {
+			long region = cell_region(column, row);
+
+			// Cells hashing to a region already listed would only walk it twice
+			for (i = 0; i < num_regions && regions[i] != region; i++)
+				;
+
+			if (i == num_regions)
+				regions[num_regions++] = region;
+		}
+	}
+
+	for (i = 0; i < num_regions; i++)
+		atomic_fetch_add(&qc->versions[regions[i]], 1);
+
+	for (i = 0; i < num_regions; i++)
+		invalidate_region(qc, regions[i], changed);
+}
+
+
+// Bytes and number of entries in the cache
+long query_cache_bytes(query_cache *qc) {
+	long bytes = 0;
+	int i;
+
+	for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&qc->shards[i].lock);
+		bytes += qc->shards[i].bytes;
+		pthread_mutex_unlock(&qc->shards[i].lock);
+	}
+
+	return bytes;
+}
+
+
+long query_cache_entries(query_cache *qc) {
+	long entries = 0;
+	int i;
+
+	for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&qc->shards[i].lock);
+		entries += qc->shards[i].num_entries;
+		pthread_mutex_unlock(&qc->shards[i].lock);
+	}
+
+	return entries;
+}
+
+
+void free_query_cache(query_cache *qc) {
+	int i;
+
+	for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+		cache_shard *shard = &qc->shards[i];
+
+		while (shard->oldest != NULL)
+			remove_entry(shard, shard->oldest);
+
+		free(shard->buckets);
+		pthread_mutex_destroy(&shard->lock);
+	}
+
+	free(qc);
+}
+
+
+// search() callback collecting the ids of the records found into the id_list arg
+void collect_id(index_record *ir, void *arg) {
+	id_list *list = (id_list *)arg;
+
+	if (list->num_ids == list->capacity) {
+		list->capacity *= 2;
+		list->ids = (record_id *)realloc(list->ids, sizeof(record_id) * list->capacity);
+
+		if (list->ids == NULL) {
+			fprintf(stderr, "Malloc failed in collect_id(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	list->ids[list->num_ids++] = ir->id;
+}
+
+
+// Returns a malloc'd array of the ids of the records in the tree rooted at root that overlap window, and their number
+// in *num_ids, from the cache if it can
+record_id *cached_search(query_cache *qc, r_tree_node *root, MBR *window, long *num_ids) {
+	record_id *ids = query_cache_lookup(qc, window, num_ids);
+
+	if (ids != NULL)
+		return ids;
+
+	unsigned long version = query_cache_version(qc, window);
+	id_list list = {(record_id *)malloc(sizeof(record_id) * 16), 0, 16};
+
+	if (list.ids == NULL) {
+		fprintf(stderr, "Malloc failed in cached_search(). Exiting program\n");
+		exit(1);
+	}
+
+	search(root, window, collect_id, &list);
+	query_cache_store(qc, window, list.ids, list.num_ids, version);
+
+	*num_ids = list.num_ids;
+	return list.ids;
+}
+
+
+// Same as insert, invalidating the entries the new record affects
+void cached_insert(query_cache *qc, r_tree_node **root, index_record *ir, int num_threads) {
+	insert(root, ir, num_threads);
+
+	// After the insertion, so that a search that started before it can't store its result after the invalidation
+	query_cache_invalidate(qc, ir->mbr);
+}
+
+
+// Same as delete_record, invalidating the entries the deleted record affected
+index_record *cached_delete(query_cache *qc, r_tree_node **root, MBR *mbr, record_id id) {
+	index_record *ir = delete_record(root, mbr, id);
+
+	query_cache_invalidate(qc, mbr);
+	return ir;
+}
@@ -0,0 +1,162 @@
+#ifndef _query_cache_h
+#define _query_cache_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* Cache of window query results, kept correct by invalidating on writes.
+*
+* An entry maps a search window (matched exactly) to the ids of the records search() found in it. Whenever a record is
+* inserted or deleted, every entry whose window overlaps the record's MBR (mbr_overlaps, the same test search() makes)
+* is dropped, and every other entry stays valid, since the change can't affect what its window finds.
+*
+* Space is cut into a grid of square cells cell_size across, and every entry is filed under one of QUERY_CACHE_REGIONS
+* regions: the one the cell holding its window's min corner hashes to, or the wide region if the window spans more than
+* QUERY_CACHE_MAX_SPAN cells along either axis. An invalidation only has to walk the regions of the cells up to
+* QUERY_CACHE_MAX_SPAN cells left of and below the changed MBR, and the wide region, since no other entry's window can
+* overlap it. A changed MBR covering more than QUERY_CACHE_MAX_INVALIDATED_CELLS of those cells walks every entry
+* instead. cell_size works best at about the size of a typical window.
+*
+* The regions are spread over QUERY_CACHE_SHARDS shards, each with its own lock, hash table and LRU list, and its share
+* of the memory budget. Lookups from many threads only contend when they hit the same shard, and hold its lock just
+* long enough to copy the ids out, and an invalidation only locks the shards of the regions it walks. A shard over its
+* budget evicts its least recently used entries. The cache itself is safe to use from any number of threads, but
+* searching and writing the tree is up to the caller, as usual.
+*
+* A result computed while an invalidation was running could be stale by the time it is stored, so query_cache_store
+* takes the version of the window's region (query_cache_version) read before the search, and drops the result if an
+* invalidation has walked that region since. Invalidations elsewhere leave the version alone
+*/
+
+// Must be a power of 2
+#define QUERY_CACHE_SHARDS 16
+
+// Buckets each shard's hash table starts with. Must be a power of 2
+#define QUERY_CACHE_INITIAL_BUCKETS 64
+
+// Must be a multiple of QUERY_CACHE_SHARDS. Region 0 is the wide region, the cells hash to the others
+#define QUERY_CACHE_REGIONS 1024
+#define QUERY_CACHE_WIDE_REGION 0
+
+// Cells a window may span along either axis (past the one holding its min corner) without being filed as wide
+#define QUERY_CACHE_MAX_SPAN 2
+
+// Most cells an invalidation walks the regions of before it walks every entry instead
+#define QUERY_CACHE_MAX_INVALIDATED_CELLS 256
+
+
+typedef struct cache_entry {
+	MBR window;
+	uint64_t hash;
+	long region;
+
+	record_id *ids;
+	long num_ids;
+
+	// Next entry in the same bucket
+	struct cache_entry *next;
+
+	// Neighbours in the shard's LRU list, prev being the more recently used
+	struct cache_entry *prev_used;
+	struct cache_entry *next_used;
+
+	// Neighbours among the entries of the same region
+	struct cache_entry *prev_in_region;
+	struct cache_entry *next_in_region;
+} cache_entry;
+
+
+typedef struct cache_shard {
+	pthread_mutex_t lock;
+
+	cache_entry **buckets;
+	long num_buckets;
+	long num_entries;
+
+	// Most and least recently used entries
+	cache_entry *newest;
+	cache_entry *oldest;
+
+	// First entry of each region of the shard, region r being regions[r / QUERY_CACHE_SHARDS]
+	cache_entry *regions[QUERY_CACHE_REGIONS / QUERY_CACHE_SHARDS];
+
+	long bytes;
+} cache_shard;
+
+
+typedef struct query_cache {
+	cache_shard shards[QUERY_CACHE_SHARDS];
+	long shard_budget;
+	double cell_size;
+
+	// Bumped by every invalidation that walks the region
+	atomic_ulong versions[QUERY_CACHE_REGIONS];
+
+	// For benchmarking. checked counts the entries invalidations compared with the changed MBR
+	atomic_long hits;
+	atomic_long misses;
+	atomic_long evictions;
+	atomic_long invalidations;
+	atomic_long checked;
+} query_cache;
+
+
+// Creates an empty cache whose entries take up at most about memory_budget bytes, over a grid of cells cell_size across
+query_cache *create_query_cache(long memory_budget, double cell_size);
+
+
+// If window's results are cached, returns a malloc'd copy of their ids (their number in *num_ids) and marks the entry
+// as the most recently used. Returns NULL otherwise
+record_id *query_cache_lookup(query_cache *qc, MBR *window, long *num_ids);
+
+
+// Current version of window's region, to be read before the search whose result is passed to query_cache_store
+unsigned long query_cache_version(query_cache *qc, MBR *window);
+
+
+// Caches a copy of the num_ids ids found in window, unless window's region has been invalidated since version.
+// Replaces any entry for window already there
+void query_cache_store(query_cache *qc, MBR *window, record_id *ids, long num_ids, unsigned long version);
+
+
+// Drops every entry whose window overlaps changed, the MBR of a record just inserted or deleted
+void query_cache_invalidate(query_cache *qc, MBR *changed);
+
+
+// Bytes and number of entries in the cache
+long query_cache_bytes(query_cache *qc);
+long query_cache_entries(query_cache *qc);
+
+
+void free_query_cache(query_cache *qc);
+
+
+// Growable array of record ids, filled by collect_id. ids is malloc'd with room for capacity ids
+typedef struct id_list {
+	record_id *ids;
+	long num_ids;
+	long capacity;
+} id_list;
+
+
+// search() callback collecting the ids of the records found into the id_list arg
+void collect_id(index_record *ir, void *arg);
+
+
+// Returns a malloc'd array of the ids of the records in the tree rooted at root that overlap window, and their number
+// in *num_ids, from the cache if it can
+record_id *cached_search(query_cache *qc, r_tree_node *root, MBR *window, long *num_ids);
+
+
+// Same as insert, invalidating the entries the new record affects
+void cached_insert(query_cache *qc, r_tree_node **root, index_record *ir, int num_threads);
+
+
+// Same as delete_record, invalidating the entries the deleted record affected
+index_record *cached_delete(query_cache *qc, r_tree_node **root, MBR *mbr, record_id id);
+
+
+#endif
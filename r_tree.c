@@ -13,15 +13,178 @@ It also includes some custom algorithms by the writer of the code (Liam Ralph)
 #include "pick_seeds.h"
 #include "linear_split.h"
 #include "choose_leaf.h"
+#include "fanout_tree.h"
 
-int next_node_index = 0;
-long current_tree_size = 0;
-long num_tree_nodes = 0;
+// Atomic so that separate trees can be built on separate threads (see sharded_tree.h). Only used to label nodes, so
+// nothing is ordered by it
+_Atomic int next_node_index = 0;
+
+
+// One thread's share of the running totals. Only the thread using it writes to it
+typedef struct tree_counters {
+	_Alignas(COUNTERS_CACHE_LINE_SIZE) _Atomic long bytes;
+	_Atomic long nodes;
+	_Atomic long allocations;
+	_Atomic long splits;
+
+	// bytes when the thread last checked the total against MAX_TREE_SIZE
+	long checked_bytes;
+
+	// Cleared when the thread exits, so that another one can take the counters over, keeping what they hold
+	bool in_use;
+
+	struct tree_counters *next;
+} tree_counters;
+
+
+// Every thread's counters, for summing. Entries are never removed
+static tree_counters *all_counters = NULL;
+static pthread_mutex_t counters_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Calls release_counters when a thread that has counted exits
+static pthread_key_t counters_key;
+static pthread_once_t counters_key_once = PTHREAD_ONCE_INIT;
+
+static _Thread_local tree_counters *own_counters = NULL;
+
+
+static void release_counters(void *arg) {
+	pthread_mutex_lock(&counters_lock);
+	((tree_counters *)arg)->in_use = false;
+	pthread_mutex_unlock(&counters_lock);
+}
+
+
+static void create_counters_key() {
+	pthread_key_create(&counters_key, release_counters);
+}
+
+
+// Returns the calling thread's counters, taking over those of a thread that has exited if there are any
+static tree_counters *thread_counters() {
+	if (own_counters != NULL)
+		return own_counters;
+
+	pthread_once(&counters_key_once, create_counters_key);
+	pthread_mutex_lock(&counters_lock);
+
+	tree_counters *counters = all_counters;
+
+	while (counters != NULL && counters->in_use)
+		counters = counters->next;
+
+	if (counters == NULL) {
+		counters = (tree_counters *)aligned_alloc(COUNTERS_CACHE_LINE_SIZE, sizeof(tree_counters));
+
+		if (counters == NULL) {
+			fprintf(stderr, "Malloc failed in thread_counters(). Exiting program\n");
+			exit(1);
+		}
+
+		atomic_init(&counters->bytes, 0);
+		atomic_init(&counters->nodes, 0);
+		atomic_init(&counters->allocations, 0);
+		atomic_init(&counters->splits, 0);
+		counters->checked_bytes = 0;
+		counters->next = all_counters;
+		all_counters = counters;
+	}
+
+	counters->in_use = true;
+	pthread_mutex_unlock(&counters_lock);
+
+	pthread_setspecific(counters_key, counters);
+	own_counters = counters;
+
+	return counters;
+}
+
+
+// Only the owning thread writes counter, so a relaxed load and store do instead of a locked read-modify-write
+static void add_to_counter(_Atomic long *counter, long amount) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+
+// Adds bytes (which may be negative) to the bytes allocated for trees. Exits if the total goes over MAX_TREE_SIZE,
+// which each thread checks every TREE_SIZE_CHECK_INTERVAL bytes
+void count_tree_bytes(long bytes) {
+	tree_counters *counters = thread_counters();
+	add_to_counter(&counters->bytes, bytes);
+
+	long own_bytes = atomic_load_explicit(&counters->bytes, memory_order_relaxed);
+
+	if (own_bytes < counters->checked_bytes) {
+		counters->checked_bytes = own_bytes;
+	} else if (own_bytes - counters->checked_bytes >= TREE_SIZE_CHECK_INTERVAL) {
+		counters->checked_bytes = own_bytes;
+
+		if (current_tree_size() > MAX_TREE_SIZE) {
+			fprintf(stderr, "Max tree size exceeded. Exiting program\n");
+			exit(1);
+		}
+	}
+}
+
+
+// Counts an r_tree_node, a malloc call made for tree data and a node split
+void count_tree_node() {
+	add_to_counter(&thread_counters()->nodes, 1);
+}
+
+
+void count_allocation() {
+	add_to_counter(&thread_counters()->allocations, 1);
+}
+
+
+void count_split() {
+	add_to_counter(&thread_counters()->splits, 1);
+}
+
+
+// Sums the counter at offset in every thread's tree_counters
+static long sum_counters(size_t offset) {
+	long total = 0;
+
+	pthread_mutex_lock(&counters_lock);
+
+	tree_counters *counters;
+
+	for (counters = all_counters; counters != NULL; counters = counters->next)
+		total += atomic_load_explicit((_Atomic long *)((char *)counters + offset), memory_order_relaxed);
+
+	pthread_mutex_unlock(&counters_lock);
+
+	return total;
+}
+
+
+// Running totals of the bytes and r_tree_nodes allocated for trees
+long current_tree_size() {
+	return sum_counters(offsetof(tree_counters, bytes));
+}
+
+
+long num_tree_nodes() {
+	return sum_counters(offsetof(tree_counters, nodes));
+}
+
+
+// Number of malloc calls made for tree data and number of node splits, for benchmarking
+long num_allocations() {
+	return sum_counters(offsetof(tree_counters, allocations));
+}
+
+
+long num_splits() {
+	return sum_counters(offsetof(tree_counters, splits));
+}
 
 
 
 double get_area(MBR *mbr) {
-        return (mbr->max_x - mbr->min_x) * (mbr->max_y - mbr->min_y);
+        return (double)((span_t)mbr->max_x - mbr->min_x) * ((span_t)mbr->max_y - mbr->min_y);
 }
 
 
@@ -31,8 +194,9 @@ double get_area(MBR *mbr) {
 MBR *create_mbr(int min_x, int min_y, int max_x, int max_y) {
 
         MBR *new_mbr = (MBR *)malloc(sizeof(MBR));
+	count_allocation();
 
-	current_tree_size += sizeof(MBR);
+	count_tree_bytes(sizeof(MBR));
 
         if (new_mbr == NULL)
                 exit(1);
@@ -52,13 +216,9 @@ MBR *create_mbr(int min_x, int min_y, int max_x, int max_y) {
 // can be generated. Otherwise, it may be too big and not fit within its parent
 MBR *random_mbr(double min_min_x, double min_min_y, double max_max_x, double max_max_y) {
         MBR *new_mbr = (MBR *)malloc(sizeof(MBR));
+	count_allocation();
 
-	current_tree_size  = current_tree_size + sizeof(MBR);
-
-	if (current_tree_size > MAX_TREE_SIZE) {
-		fprintf(stderr, "Max tree size exceeded. Exiting program\n");
-		exit(1);
-	}
+	count_tree_bytes(sizeof(MBR));
 
         if (new_mbr == NULL)
                 exit(1);
@@ -70,10 +230,10 @@ MBR *random_mbr(double min_min_x, double min_min_y, double max_max_x, double max
 	double y2 = random_within_range(min_min_y, max_max_y);
 
 
-        new_mbr->min_x = fmin(x1, x2);
-        new_mbr->min_y = fmin(y1, y2);
-        new_mbr->max_x = fmax(x1, x2);
-        new_mbr->max_y = fmax(y1, y2);
+        new_mbr->min_x = coord_floor(fmin(x1, x2));
+        new_mbr->min_y = coord_floor(fmin(y1, y2));
+        new_mbr->max_x = coord_ceil(fmax(x1, x2));
+        new_mbr->max_y = coord_ceil(fmax(y1, y2));
 
 
         return new_mbr;
@@ -84,13 +244,9 @@ MBR *random_mbr(double min_min_x, double min_min_y, double max_max_x, double max
 // within min_min_x, min_min_y, max_max_x, and max_max_y
 MBR *random_small_mbr(double min_min_x, double min_min_y, double max_max_x, double max_max_y) {
 	MBR *new_mbr = (MBR*)malloc(sizeof(MBR));
+	count_allocation();
 
-	current_tree_size = current_tree_size + sizeof(MBR);
-
-	if (current_tree_size > MAX_TREE_SIZE) {
-		fprintf(stderr, "Max tree size exceeded. Exiting program\n");
-		exit(1);
-	}
+	count_tree_bytes(sizeof(MBR));
 
 	if (new_mbr == NULL)
 		exit(1);
@@ -100,10 +256,10 @@ MBR *random_small_mbr(double min_min_x, double min_min_y, double max_max_x, doub
 	double x2 = fmin(random_within_range(x1, x1 + 1), max_max_x);
 	double y2 = fmin(random_within_range(y1, y1 + 1), max_max_y);
 
-	new_mbr->min_x = x1;
-	new_mbr->min_y = y1;
-	new_mbr->max_x = x2;
-	new_mbr->max_y = y2;
+	new_mbr->min_x = coord_floor(x1);
+	new_mbr->min_y = coord_floor(y1);
+	new_mbr->max_x = coord_ceil(x2);
+	new_mbr->max_y = coord_ceil(y2);
 
 	return new_mbr;
 }
@@ -111,10 +267,10 @@ MBR *random_small_mbr(double min_min_x, double min_min_y, double max_max_x, doub
 // Given two MBRs, see what the area of their merged MBR is
 double get_merged_area(MBR *mbr1, MBR *mbr2) {
 
-	double new_width = fmax(mbr1->max_x, mbr2->max_x) - fmin(mbr1->min_x, mbr2->min_x);
-        double new_height = fmax(mbr1->max_y, mbr2->max_y) - fmin(mbr1->min_y, mbr2->min_y);
+	span_t new_width = (span_t)coord_max(mbr1->max_x, mbr2->max_x) - coord_min(mbr1->min_x, mbr2->min_x);
+        span_t new_height = (span_t)coord_max(mbr1->max_y, mbr2->max_y) - coord_min(mbr1->min_y, mbr2->min_y);
 
-	return new_width * new_height;
+	return (double)new_width * new_height;
 }
 
 
@@ -151,18 +307,16 @@ void expand_parent(MBR *parent_mbr, MBR *child_mbr) {
 double get_area_increase(MBR *original, MBR *new_child) {
         // Added small time delay to this function so that the effect of the parallelism with relation to context switching is more obvious
 
+	// A zero-area MBR (a point, or points on a line) still gets its real enlargement. Treating it as unusable left
+	// every leaf holding a single point out of all later insertions, so a tree of points degenerated into a list
 	double original_area = get_area(original);
 
 
-        if (original_area == 0)
-                return DBL_MAX;
+        span_t new_width = (span_t)coord_max(original->max_x, new_child->max_x) - coord_min(original->min_x, new_child->min_x);
+        span_t new_height = (span_t)coord_max(original->max_y, new_child->max_y) - coord_min(original->min_y, new_child->min_y);
 
 
-        double new_width = fmax(original->max_x, new_child->max_x) - fmin(original->min_x, new_child->min_x);
-        double new_height = fmax(original->max_y, new_child->max_y) - fmin(original->min_y, new_child->min_y);
-
-
-        double new_area = new_width * new_height;
+        double new_area = (double)new_width * new_height;
 
         return new_area - original_area;
 }
@@ -182,27 +336,29 @@ void expand_mbr(MBR *mbr, MBR *child_mbr) {
 
 // Returns the overlapping area of two minimum bounding rectangles
 double get_overlapping_area(MBR *mbr1, MBR *mbr2) {
-        double x_distance = fmin(mbr1->max_x, mbr2->max_x) - fmax(mbr1->min_x, mbr2->min_x);
-        double y_distance = fmin(mbr1->max_y, mbr2->max_y) - fmax(mbr1->min_y, mbr2->min_y);
+        span_t x_distance = (span_t)coord_min(mbr1->max_x, mbr2->max_x) - coord_max(mbr1->min_x, mbr2->min_x);
+        span_t y_distance = (span_t)coord_min(mbr1->max_y, mbr2->max_y) - coord_max(mbr1->min_y, mbr2->min_y);
 
         if (x_distance <= 0 || y_distance <= 0)
             return 0.0;
 
-	double overlapping_area = x_distance * y_distance;
+	double overlapping_area = (double)x_distance * y_distance;
 
 	return overlapping_area;
 }
 
+// Returns true if the two minimum bounding rectangles share at least one point (touching edges count)
+bool mbr_overlaps(MBR *mbr1, MBR *mbr2) {
+	return mbr1->min_x <= mbr2->max_x && mbr2->min_x <= mbr1->max_x &&
+		mbr1->min_y <= mbr2->max_y && mbr2->min_y <= mbr1->max_y;
+}
+
 
 index_record *initialize_ir(MBR *mbr) {
 	index_record *ir = (index_record *)malloc(sizeof(index_record));
+	count_allocation();
 
-	current_tree_size += sizeof(index_record);
-
-	if (current_tree_size > MAX_TREE_SIZE) {
-		fprintf(stderr, "Max tree size exceeded. Exiting program\n");
-		exit(1);
-	}
+	count_tree_bytes(sizeof(index_record));
 
 	if (ir == NULL) {
 		fprintf(stderr, "Malloc failed in initialize_ir(). Exiting program\n");
@@ -211,14 +367,59 @@ index_record *initialize_ir(MBR *mbr) {
 
 	ir->mbr = mbr;
 	ir->child = NULL;
+	ir->agg.count = 1;
+	ir->agg.sum = 1;
+	ir->id = 0;
 	return ir;
 }
 
+
+// Same as initialize_ir, for a leaf-level index_record standing for the object id
+index_record *initialize_record(MBR *mbr, record_id id) {
+	index_record *ir = initialize_ir(mbr);
+
+	ir->id = id;
+	return ir;
+}
+
+
+// Sets the weight of a leaf-level index_record. Must be done before it is inserted
+void set_weight(index_record *ir, double weight) {
+	ir->agg.sum = weight;
+}
+
+
+// Adds part into total
+void add_aggregate(aggregate *total, aggregate *part) {
+	total->count += part->count;
+	total->sum += part->sum;
+}
+
+
+// Takes part back out of total
+void subtract_aggregate(aggregate *total, aggregate *part) {
+	total->count -= part->count;
+	total->sum -= part->sum;
+}
+
+
+// Writes the combined aggregate of every index_record in node to result
+void sum_members(r_tree_node *node, aggregate *result) {
+	int i;
+
+	result->count = 0;
+	result->sum = 0;
+
+	for (i = 0; i < node->num_members; i++)
+		add_aggregate(result, &node->index_records[i]->agg);
+}
+
 // Given an MBR as a parameter, create an identical copy of that MBR at a different location in memory
 MBR *copy_mbr(MBR *original_mbr) {
 	MBR *copy = (MBR*)malloc(sizeof(MBR));
+	count_allocation();
 
-	current_tree_size += sizeof(MBR);
+	count_tree_bytes(sizeof(MBR));
 
 	if (copy == NULL) {
 		fprintf(stderr, "Malloc failed in original_mbr(). Exiting program\n");
@@ -234,54 +435,112 @@ MBR *copy_mbr(MBR *original_mbr) {
 }
 
 
-r_tree_node *initialize_rt(int max_members) {
-	r_tree_node *rt = (r_tree_node *)malloc(sizeof(r_tree_node));
+// Bytes used by one r_tree_node together with its index_records array
+static size_t node_block_size(int max_members) {
+	return sizeof(r_tree_node) + sizeof(index_record *) * max_members;
+}
 
-	current_tree_size += sizeof(r_tree_node);
-	num_tree_nodes = num_tree_nodes + 1;
 
-	if (current_tree_size > MAX_TREE_SIZE) {
-		fprintf(stderr, "Max tree size exceeded. Exiting program\n");
-		exit(1);
-	}
+// Fills in a freshly allocated r_tree_node whose index_records array is index_records
+static void setup_rt(r_tree_node *rt, int max_members, index_record **index_records) {
+	rt->max_members = max_members;
+	rt->num_members = 0;
+	rt->index_records = index_records;
+	rt->index = atomic_fetch_add_explicit(&next_node_index, 1, memory_order_relaxed);
+	rt->embeds_entry = false;
+	rt->buffer = NULL;
+
+#if BACK_POINTERS
+	rt->parent = NULL;
+#endif
+}
+
+
+// The index_records array lives in the same allocation as the r_tree_node itself
+r_tree_node *initialize_rt(int max_members) {
+	r_tree_node *rt = (r_tree_node *)malloc(node_block_size(max_members));
+	count_allocation();
+
+	count_tree_bytes(node_block_size(max_members));
+	count_tree_node();
 
 	if (rt == NULL) {
 		fprintf(stderr, "Malloc failed in initialize_rt(). Exiting program\n");
 		exit(1);
 	}
 
-	rt->max_members = max_members;
-	rt->num_members = 0;
-	rt->index_records = (index_record**)malloc(sizeof(index_record *) * max_members);
-	rt->index = next_node_index;
-	next_node_index++;
+	setup_rt(rt, max_members, (index_record **)(rt + 1));
+	return rt;
+}
 
-	if (rt->index_records == NULL) {
-		fprintf(stderr, "Malloc failed in initialize_rt(). Exiting program\n");
+
+// Creates an empty r_tree_node together with the index_record (holding a copy of mbr) that will point to it,
+// all in a single allocation. Used for the new sibling when a node splits
+index_record *initialize_split_node(int max_members, MBR *mbr) {
+	size_t size = node_block_size(max_members) + sizeof(index_record) + sizeof(MBR);
+	r_tree_node *rt = (r_tree_node *)malloc(size);
+	count_allocation();
+
+	count_tree_bytes(size);
+	count_tree_node();
+
+	if (rt == NULL) {
+		fprintf(stderr, "Malloc failed in initialize_split_node(). Exiting program\n");
 		exit(1);
 	}
 
-	rt->parent = NULL;
-	return rt;
+	// Layout: r_tree_node, index_record, MBR, index_records array
+	index_record *ir = (index_record *)(rt + 1);
+	MBR *ir_mbr = (MBR *)(ir + 1);
+
+	setup_rt(rt, max_members, (index_record **)(ir_mbr + 1));
+	rt->embeds_entry = true;
+
+	*ir_mbr = *mbr;
+	ir->mbr = ir_mbr;
+	ir->child = rt;
+	ir->agg.count = 0;
+	ir->agg.sum = 0;
+	ir->id = 0;
+
+#if BACK_POINTERS
+	rt->parent = ir;
+#endif
+
+	return ir;
+}
+
+
+// Creates a new r_tree_node holding the same index_records as rt. The index_records themselves are shared, not copied
+r_tree_node *copy_node(r_tree_node *rt) {
+	r_tree_node *copy = initialize_rt(rt->max_members);
+
+	memcpy(copy->index_records, rt->index_records, sizeof(index_record *) * rt->num_members);
+	copy->num_members = rt->num_members;
+
+#if BACK_POINTERS
+	int i;
+
+	for (i = 0; i < copy->num_members; i++)
+		copy->index_records[i]->host = copy;
+#endif
+
+	return copy;
 }
 
 
 // Returns true if successfully added a new index record to the r_tree_node, false if you have reached max capacity and need to split
+// Does not expand the MBRs above host_node, use adjust_tree for that
 bool add_member(r_tree_node *host_node, index_record *new_member) {
 	if (is_full(host_node))
 		return false;
 
+#if BACK_POINTERS
 	new_member->index = host_node->num_members;
+	new_member->host = host_node;
+#endif
 	host_node->index_records[host_node->num_members] = new_member;
 	host_node->num_members++;
-	new_member->host = host_node;
-
-	// expand parent index record's MBR if necessary
-	if (!is_parent(host_node)) {
-		MBR *parent_mbr = host_node->parent->mbr;
-		MBR *child_mbr = new_member->mbr;
-		expand_mbr(parent_mbr, child_mbr);
-	}
 
 	return true;
 }
@@ -301,8 +560,10 @@ index_record *remove_index_record(r_tree_node *rt, int index) {
 	// Move all index records after ir back by one to fill in the gap
 
 	for (i = index + 1; i < rt->num_members; i++) {
+#if BACK_POINTERS
 		// Change index of index_record to reflect new position
 		rt->index_records[i]->index--;
+#endif
 		rt->index_records[i- 1] = rt->index_records[i];
 	}
 
@@ -324,16 +585,18 @@ bool move_index_record(r_tree_node *r1, r_tree_node *r2, int index) {
 }
 
 
-// Returns true if the r_tree_node is a bottom-level node
+// Returns true if the r_tree_node is a bottom-level node. An empty node (only ever a brand new root) counts as a leaf
 bool is_leaf(r_tree_node *node) {
-	return node->index_records[0]->child == NULL;
+	return node->num_members == 0 || node->index_records[0]->child == NULL;
 }
 
 
+#if BACK_POINTERS
 // Returns true if the r_tree_node is a top-level node
 bool is_parent(r_tree_node *node) {
 	return node->parent == NULL;
 }
+#endif
 
 // Returns true if there is the max number of index_record's in your r_tree_node
 bool is_full(r_tree_node *node) {
@@ -341,111 +604,151 @@ bool is_full(r_tree_node *node) {
 }
 
 
-// (Used for when you have already found the leaf-level r_tree_node rt to insert your index_record ir into
-// Insertion function that can be parallized or not based on arguments
-// Finds the optimal insertion to minimize MBR overlap
-// The node splitting algorithm was made up by me
-// You need to pass root because it might change if a new root is created
-void insert_at_node(r_tree_node *rt, index_record *ir, r_tree_node **root, int num_threads) {
+// Appends node to path along with the index of the index_record the descent continues through (-1 at the leaf)
+void push_path(tree_path *path, r_tree_node *node, int index) {
+	if (path->depth == MAX_TREE_HEIGHT) {
+		fprintf(stderr, "Tree is deeper than MAX_TREE_HEIGHT. Exiting program\n");
+		exit(1);
+	}
 
-	// If the rt node has room, just add the index record like normal
-	if (!is_full(rt)) {
-		add_member(rt, ir);
-		adjust_tree(rt, ir);
-	} else {
+	path->nodes[path->depth] = node;
+	path->indices[path->depth] = index;
+	path->depth++;
+}
 
-		double biggest_waste;
-		int *seed_indices;
 
+// Kernels to split the full node rt with, NULL on the generic path
+static const fanout_kernels *level_kernels(const fanout_ops *ops, r_tree_node *rt) {
+	if (ops == NULL)
+		return NULL;
 
-		if (num_threads > 1)
-			seed_indices = pick_seeds_parallel(rt, ir, num_threads);
-		else
-			seed_indices = pick_seeds_sequential(rt->index_records, rt->num_members, &biggest_waste);
+	return is_leaf(rt) ? ops->leaf : ops->internal;
+}
 
 
-		index_record *seed_1 = rt->index_records[seed_indices[0]];
-		index_record *seed_2 = rt->index_records[seed_indices[1]];
+// Does the work of split_node. kernels, if not NULL, picks the seeds and hands out the rest instead of the
+// num_threads choice of sequential or parallel versions
+static index_record *split_with_kernels(r_tree_node *rt, index_record *rt_ir, index_record *ir, int num_threads, const fanout_kernels *kernels) {
+	int num_entries = rt->num_members + 1;
+	int seed_indices[2];
+	double biggest_waste;
+	int i, j;
 
-		MBR *ir_1_mbr = copy_mbr(seed_1->mbr);
-		MBR *ir_2_mbr = copy_mbr(seed_2->mbr);
+	// Scratch space for the members of rt plus ir lives on the caller's stack
+	index_record *entries[num_entries];
 
-		index_record *ir_1 = initialize_ir(ir_1_mbr);
-		index_record *ir_2 = initialize_ir(ir_2_mbr);
+	memcpy(entries, rt->index_records, sizeof(index_record *) * rt->num_members);
+	entries[num_entries - 1] = ir;
 
-		ir_1->child = initialize_rt(rt->max_members);
-		ir_2->child = initialize_rt(rt->max_members);
+	if (kernels != NULL)
+		kernels->pick_seeds(entries, num_entries, &biggest_waste, seed_indices);
+	else if (num_threads > 1)
+		pick_seeds_parallel(entries, num_entries, seed_indices, num_threads);
+	else
+		pick_seeds_sequential(entries, num_entries, &biggest_waste, seed_indices);
 
-		ir_1->child->parent = ir_1;
-		ir_2->child->parent = ir_2;
+	index_record *seed_1 = entries[seed_indices[0]];
+	index_record *seed_2 = entries[seed_indices[1]];
 
-		// Reminder: We don't have to manually put the seeds in ir_1->child and ir_2->child because
-		// linear_split will do that for us
+	index_record *sibling_ir = initialize_split_node(rt->max_members, seed_2->mbr);
+	*rt_ir->mbr = *seed_1->mbr;
 
-		// Split the rt node. Now every index_records previously in rt will now be in either
-		// ir_1->child->index_records or ir_2->child->index_records
+	rt->num_members = 0;
+	add_member(rt, seed_1);
+	add_member(sibling_ir->child, seed_2);
 
-		if (num_threads > 1)
-			linear_split_parallel(rt, ir_1, ir_2, num_threads);
-		else
-			linear_split_sequential(rt, ir_1, ir_2);
+	// Everything except the two seeds still has to be handed out
+	for (i = 0, j = 0; i < num_entries; i++) {
+		if (i != seed_indices[0] && i != seed_indices[1])
+			entries[j++] = entries[i];
+	}
 
-		// Now add the index record ir that is being added to either ir_1->child or ir_2->child,
-		// whichever is optimal
-		double expansion_1 = get_area_increase(ir->mbr, ir_1->mbr);
-		double expansion_2 = get_area_increase(ir->mbr, ir_2->mbr);
+	if (kernels != NULL)
+		kernels->split(entries, j, rt_ir, sibling_ir);
+	else if (num_threads > 1)
+		linear_split_parallel(entries, j, rt_ir, sibling_ir, num_threads);
+	else
+		linear_split_sequential(entries, j, rt_ir, sibling_ir);
 
-		// Since one of the new index_records points to an r_tree_node with the new inserted index_record ir,
-		// we have to keep track of it in order to perform adjust tree on its host r_tree_node
-		index_record *ir_expand = ir_1;
-		index_record *ir_same = ir_2;
+	sum_members(rt, &rt_ir->agg);
+	sum_members(sibling_ir->child, &sibling_ir->agg);
 
-		if (expansion_1 < expansion_2) {
-			add_member(ir_1->child, ir);
-		} else {
-			add_member(ir_2->child, ir);
+	count_split();
 
-			// By default, we make ir_expand = ir_1. Since we are actually adding the new index_record
-			// to ir_2, we switch ir_expand and ir_same
-			index_record *temp = ir_expand;
-			ir_expand = ir_same;
-			ir_same = temp;
-		}
+	return sibling_ir;
+}
 
-		if (rt->parent != NULL) {
 
-			r_tree_node *parent_r_tree_node = rt->parent->host;
-			remove_index_record(parent_r_tree_node, rt->parent->index);
-			add_member(parent_r_tree_node, ir_same);
+// Splits the full r_tree_node rt while inserting ir into it. rt keeps one group of index_records and a newly allocated
+// sibling gets the other, so the split costs a single allocation. rt_ir is the index_record pointing to rt, its MBR
+// and aggregate are recomputed for rt's new members. Returns the index_record pointing to the sibling, which still has
+// to be added to rt's parent
+index_record *split_node(r_tree_node *rt, index_record *rt_ir, index_record *ir, int num_threads) {
+	return split_with_kernels(rt, rt_ir, ir, num_threads, NULL);
+}
 
-			// free this r_tree_node since it will not be in the tree anymore
-			rt->parent = NULL;
 
-			// TO-DO: Free stuff that isn't being used anymore
-			int i;
+// Does the work of insert_at_node once the aggregates above the last node of path already include ir. Splits keep the
+// combined aggregate of the two halves equal to what the split node held plus ir, so nothing above has to change again.
+// ops is NULL for the generic path
+static void place_entry(tree_path *path, index_record *ir, r_tree_node **root, int num_threads, const fanout_ops *ops) {
 
-			// make sure that this old r_tree_node that we won't use anymore isn't pointing to any
-			// index records that are still going to be in the tree
-			for (i = 0; i < rt->num_members; i++) {
-				rt->index_records[i] = NULL;
-			}
+	r_tree_node *rt = path->nodes[path->depth - 1];
 
-			rt->num_members = 0;
-			free_tree(rt);
+	// Every MBR above rt has to cover ir whether or not rt ends up splitting
+	adjust_tree(path, ir);
 
-			insert_at_node(parent_r_tree_node, ir_expand, root, num_threads);
-		} else {
-			r_tree_node *next_parent = initialize_rt(rt->max_members);
+	// If the rt node has room, just add the index record like normal
+	if (add_member(rt, ir))
+		return;
 
-			add_member(next_parent, ir_1);
-			add_member(next_parent, ir_2);
+	if (path->depth > 1) {
+		// rt stays in the tree as one half of the split, so the index_record pointing to it is reused as is
+		index_record *rt_ir = path->nodes[path->depth - 2]->index_records[path->indices[path->depth - 2]];
+		index_record *sibling_ir = split_with_kernels(rt, rt_ir, ir, num_threads, level_kernels(ops, rt));
 
-			*root = next_parent;
-		}
+		// Continue one level up the path with the sibling, which might not fit in the parent either
+		path->depth--;
+		place_entry(path, sibling_ir, root, num_threads, ops);
+	} else {
+		// The root split, so the tree grows by one level
+		index_record *rt_ir = initialize_ir(copy_mbr(ir->mbr));
+		rt_ir->child = rt;
+#if BACK_POINTERS
+		rt->parent = rt_ir;
+#endif
+
+		index_record *sibling_ir = split_with_kernels(rt, rt_ir, ir, num_threads, level_kernels(ops, rt));
+		r_tree_node *next_parent = initialize_rt(ops != NULL ? ops->internal_members : rt->max_members);
+
+		add_member(next_parent, rt_ir);
+		add_member(next_parent, sibling_ir);
+
+		*root = next_parent;
 	}
 }
 
 
+// (Used for when you have already found the leaf-level r_tree_node to insert your index_record ir into
+// The leaf is the last node of path, as recorded by choose_leaf
+// Insertion function that can be parallized or not based on arguments
+// Finds the optimal insertion to minimize MBR overlap
+// The node splitting algorithm was made up by me
+// You need to pass root because it might change if a new root is created
+void insert_at_node(tree_path *path, index_record *ir, r_tree_node **root, int num_threads) {
+	add_to_path(path, &ir->agg);
+	place_entry(path, ir, root, num_threads, NULL);
+}
+
+
+// Same as insert_at_node, but every split is done by the kernels ops has for the level of the node being split, and a
+// root split makes a root of ops->internal_members (see fanout_tree.h)
+void insert_at_node_with_ops(tree_path *path, index_record *ir, r_tree_node **root, const fanout_ops *ops) {
+	add_to_path(path, &ir->agg);
+	place_entry(path, ir, root, 1, ops);
+}
+
+
 
 // General insertion function
 // You need to pass a pointer to a pointer of the root in case the root changes to a new root during the insertion process
@@ -457,25 +760,69 @@ void insert(r_tree_node **root, index_record *ir, int num_threads) {
 		exit(1);
 	}
 
-        r_tree_node *insertion_leaf;
+        tree_path path;
 
         if (num_threads > 1)
-                insertion_leaf = choose_leaf_parallel(*root, ir, num_threads);
+                choose_leaf_parallel(*root, ir, num_threads, &path);
         else
-                insertion_leaf = choose_leaf_sequential(*root, ir);
+                choose_leaf_sequential(*root, ir, &path);
 
-        insert_at_node(insertion_leaf, ir, root, num_threads);
+        insert_at_node(&path, ir, root, num_threads);
 }
 
-// Given an r_tree_node, ensures that its parent index_record has an MBR that is the minimum bounding rectangle of all children MBR's
-// Used so that generate_randoom_tree does not create MBRs that are not actually MBRs
-void validate_node(r_tree_node *rt) {
-	if (rt->parent == NULL || rt->num_members == 0) {
+// Number of levels in the tree rooted at root, counting the leaves as level 1
+int tree_height(r_tree_node *root) {
+	int height = 1;
+
+	while (!is_leaf(root)) {
+		root = root->index_records[0]->child;
+		height++;
+	}
+
+	return height;
+}
+
+
+// Grafts the subtree that subtree_ir points to (subtree_height levels tall, with its leaves at the bottom) into the
+// tree, at the level where its leaves line up with the tree's leaves. The tree has to be taller than the subtree
+void insert_subtree(r_tree_node **root, index_record *subtree_ir, int subtree_height, int num_threads) {
+	int height = tree_height(*root);
+
+	if (subtree_height >= height) {
+		fprintf(stderr, "Cannot graft a subtree of %d levels into a tree of %d levels\n", subtree_height, height);
+		exit(1);
+	}
+
+	if (num_threads > (*root)->max_members) {
+		fprintf(stderr, "Cannot use more threads than number of max_members in your r_tree_node\n");
+		fprintf(stderr, "Aborting insertion\n");
+		exit(1);
+	}
+
+	tree_path path;
+
+	if (num_threads > 1)
+		choose_leaf_parallel(*root, subtree_ir, num_threads, &path);
+	else
+		choose_leaf_sequential(*root, subtree_ir, &path);
+
+	// The descent is the same as for a record, it just stops at the node whose children are subtree_height levels tall
+	path.depth = height - subtree_height;
+	path.indices[path.depth - 1] = -1;
+
+	insert_at_node(&path, subtree_ir, root, num_threads);
+}
+
+
+// Sets the MBR of parent, the index_record pointing to rt, to the minimum bounding rectangle of rt's members. Leaves it
+// alone if rt is empty
+static void fit_mbr(r_tree_node *rt, index_record *parent) {
+	if (rt->num_members == 0) {
 		return;
 	}
 
 	// For finding the four extrema of all index_records in rt
-	double min_min_x, min_min_y, max_max_x, max_max_y;
+	coord_t min_min_x, min_min_y, max_max_x, max_max_y;
 
 	min_min_x = rt->index_records[0]->mbr->min_x;
 	min_min_y = rt->index_records[0]->mbr->min_y;
@@ -498,16 +845,169 @@ void validate_node(r_tree_node *rt) {
 
 	}
 
-	rt->parent->mbr->min_x = min_min_x;
-	rt->parent->mbr->min_y = min_min_y;
-	rt->parent->mbr->max_x = max_max_x;
-	rt->parent->mbr->max_y = max_max_y;
+	parent->mbr->min_x = min_min_x;
+	parent->mbr->min_y = min_min_y;
+	parent->mbr->max_x = max_max_x;
+	parent->mbr->max_y = max_max_y;
 }
 
 
-// Generates a random r-tree where each r_tree_node has r_tree_node->max_members * TREE_DENSITY entries
-// Pass current_level as 0
-void generate_random_tree(r_tree_node *node, int max_levels, int current_level) {
+// Extends path from node down to the leaf holding the leaf-level index_record with the given id whose MBR is mbr,
+// trying every entry whose MBR covers mbr. The last index on path is that of the record. Returns false if there is none
+static bool find_record(r_tree_node *node, MBR *mbr, record_id id, tree_path *path) {
+	bool leaf = is_leaf(node);
+	int i;
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *curr_ir = node->index_records[i];
+
+		if (!fully_contains(curr_ir->mbr, mbr))
+			continue;
+
+		if (leaf) {
+			if (curr_ir->id != id)
+				continue;
+
+			push_path(path, node, i);
+			return true;
+		}
+
+		push_path(path, node, i);
+
+		if (find_record(curr_ir->child, mbr, id, path))
+			return true;
+
+		path->depth--;
+	}
+
+	return false;
+}
+
+
+// Removes the leaf-level index_record with the given id and MBR from the tree and returns it (NULL if there is none),
+// leaving it to the caller to free. A node left with fewer than DELETE_MIN_FILL of its max_members is taken out of
+// the tree and its members are inserted again at their own level, and the MBRs and aggregates above are shrunk to fit
+// what is left. A root left with a single child is replaced by that child, so *root may change
+index_record *delete_record(r_tree_node **root, MBR *mbr, record_id id) {
+	tree_path path;
+	int num_orphans = 0;
+	int capacity = 0;
+	int level, i;
+
+	path.depth = 0;
+
+	if (!find_record(*root, mbr, id, &path))
+		return NULL;
+
+	index_record *ir = remove_index_record(path.nodes[path.depth - 1], path.indices[path.depth - 1]);
+	int depth = path.depth;
+
+	// The aggregates above only lose the record, the MBRs are refit on the way up since any of them may shrink
+	subtract_from_path(&path, &ir->agg);
+
+	for (level = 1; level < depth; level++)
+		capacity += path.nodes[level]->max_members;
+
+	// Members of the nodes taken out, and the height of the subtree each points to (0 for a leaf-level index_record)
+	index_record *orphans[capacity > 0 ? capacity : 1];
+	int heights[capacity > 0 ? capacity : 1];
+
+	// True while the node below the current one was left in the tree empty, as its parent's only child
+	bool below_empty = false;
+
+	// CondenseTree: walk back up, taking out underfull nodes and refitting the index_records pointing to the rest
+	for (level = depth - 1; level > 0; level--) {
+		r_tree_node *node = path.nodes[level];
+		r_tree_node *parent = path.nodes[level - 1];
+		index_record *node_ir = parent->index_records[path.indices[level - 1]];
+		bool underfull = below_empty || node->num_members < DELETE_MIN_FILL * node->max_members;
+
+		// An only child stays, the parent is underfull as well and is dealt with one level up (or by the root collapse)
+		if (!underfull || parent->num_members == 1) {
+			fit_mbr(node, node_ir);
+			below_empty = node->num_members == 0 || below_empty;
+			continue;
+		}
+
+		remove_index_record(parent, path.indices[level - 1]);
+
+		// What is left under node leaves the aggregates above parent here, and is added back as the orphans go back in
+		path.depth = level;
+		subtract_from_path(&path, &node_ir->agg);
+
+		for (i = 0; i < node->num_members; i++) {
+			index_record *member = node->index_records[i];
+
+			// Holds no records, so there is nothing to put back
+			if (below_empty && member->child == path.nodes[level + 1]) {
+				free_index_record(member);
+				continue;
+			}
+
+			orphans[num_orphans] = member;
+			heights[num_orphans] = depth - 1 - level;
+			num_orphans++;
+		}
+
+		// The members have all moved, only the node and the entry pointing to it are left
+		node->num_members = 0;
+		free_index_record(node_ir);
+		below_empty = false;
+	}
+
+	// Every leaf is still at the same depth, so the orphans go back in at the level they came from. The tree can only
+	// grow while they do, so it stays taller than any of their subtrees
+	for (i = num_orphans - 1; i >= 0; i--) {
+		if (heights[i] == 0)
+			insert(root, orphans[i], 1);
+		else
+			insert_subtree(root, orphans[i], heights[i], 1);
+	}
+
+	// The child becomes the root as it is, so leaves keep their leaf capacity and internal nodes theirs
+	while (!is_leaf(*root) && (*root)->num_members == 1) {
+		index_record *child_ir = (*root)->index_records[0];
+		r_tree_node *child = child_ir->child;
+
+		free_node(*root);
+		*root = child;
+#if BACK_POINTERS
+		child->parent = NULL;
+#endif
+
+		// Nothing points to the root, so an index_record embedded in it is unused from now on. The node is treated as
+		// a plain one, so that a root split can point a separate index_record at it
+		if (child->embeds_entry) {
+			child->embeds_entry = false;
+			count_tree_bytes(-(long)(sizeof(index_record) + sizeof(MBR)));
+		} else {
+			free_entry(child_ir);
+		}
+	}
+
+	return ir;
+}
+
+
+// Given an r_tree_node and the index_record pointing to it, ensures that the index_record has an MBR that is the minimum
+// bounding rectangle of all children MBR's, and the aggregate of all of them
+// Used so that generate_randoom_tree does not create MBRs that are not actually MBRs
+void validate_node(r_tree_node *rt, index_record *parent) {
+	if (parent == NULL || rt->num_members == 0) {
+		return;
+	}
+
+	fit_mbr(rt, parent);
+	sum_members(rt, &parent->agg);
+}
+
+
+// Id given to the next record generate_random_tree makes
+static record_id next_record_id = 0;
+
+
+// Does the work of generate_random_tree. parent is the index_record pointing to node (NULL at the root)
+static void generate_random_subtree(r_tree_node *node, index_record *parent, int max_levels, int current_level) {
 	int i;
 
 	// If you are at a leaf node
@@ -517,21 +1017,19 @@ void generate_random_tree(r_tree_node *node, int max_levels, int current_level)
 
 			MBR *rand_mbr;
 
-			if (node->parent != NULL)
-				rand_mbr = random_mbr(node->parent->mbr->min_x, node->parent->mbr->min_y, node->parent->mbr->max_x, node->parent->mbr->max_y);
+			if (parent != NULL)
+				rand_mbr = random_mbr(parent->mbr->min_x, parent->mbr->min_y, parent->mbr->max_x, parent->mbr->max_y);
 			else
 				rand_mbr = random_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
 
-			index_record *new_ir = initialize_ir(rand_mbr);
-
-			// In a real-world scenario these would contain pointers to database tuples, but in our simulation there is no need for that
-			new_ir->child = NULL;
+			// In a real-world scenario the id would name a database tuple, here every record just gets the next number
+			index_record *new_ir = initialize_record(rand_mbr, next_record_id++);
 
 			add_member(node, new_ir);
 
 		}
 
-		validate_node(node);
+		validate_node(node, parent);
 
 		return;
 	}
@@ -545,21 +1043,30 @@ void generate_random_tree(r_tree_node *node, int max_levels, int current_level)
 		if (current_level == 0)
 			rand_mbr = random_mbr(0, 0, MAX_RAND_NUM, MAX_RAND_NUM);
 		else
-			rand_mbr = random_mbr(node->parent->mbr->min_x, node->parent->mbr->min_y, node->parent->mbr->max_x, node->parent->mbr->max_y);
+			rand_mbr = random_mbr(parent->mbr->min_x, parent->mbr->min_y, parent->mbr->max_x, parent->mbr->max_y);
 
 		index_record *new_ir = initialize_ir(rand_mbr);
 
 		r_tree_node *child_node = initialize_rt(node->max_members);
 		new_ir->child = child_node;
+#if BACK_POINTERS
 		child_node->parent = new_ir;
+#endif
 
 		add_member(node, new_ir);
 
-		generate_random_tree(child_node, max_levels, current_level + 1);
+		generate_random_subtree(child_node, new_ir, max_levels, current_level + 1);
 	}
 
-	validate_node(node);
+	validate_node(node, parent);
+
+}
+
 
+// Generates a random r-tree where each r_tree_node has r_tree_node->max_members * TREE_DENSITY entries
+// Pass current_level as 0
+void generate_random_tree(r_tree_node *node, int max_levels, int current_level) {
+	generate_random_subtree(node, NULL, max_levels, current_level);
 }
 
 
@@ -580,7 +1087,7 @@ void print_tree(r_tree_node *node, int current_level) {
 		index_record *curr_ir = node->index_records[i];
 		MBR *curr_mbr = curr_ir->mbr;
 
-		printf(">(at %p): N%dR%d:(min_x: %lf, min_y: %lf, max_x: %lf, max_y: %lf)\n", curr_ir, node->index, curr_ir->index, curr_mbr->min_x, curr_mbr->min_y, curr_mbr->max_x, curr_mbr->max_y);
+		printf(">(at %p): N%dR%d:(min_x: %lf, min_y: %lf, max_x: %lf, max_y: %lf)\n", curr_ir, node->index, i, (double)curr_mbr->min_x, (double)curr_mbr->min_y, (double)curr_mbr->max_x, (double)curr_mbr->max_y);
 
 		if (!is_leaf(node))
 			print_tree(node->index_records[i]->child, current_level + 1);
@@ -589,29 +1096,82 @@ void print_tree(r_tree_node *node, int current_level) {
 
 }
 
-// Pass the root node of your tree to this function and it will free the entire tree
-void free_tree(r_tree_node *node) {
+// Frees an index_record and its MBR, along with the subtree below it
+void free_index_record(index_record *ir) {
+	if (ir->child != NULL && ir->child->embeds_entry) {
+		// ir and its MBR live inside the child's allocation
+		free_tree(ir->child);
+		return;
+	}
+
+	if (ir->child != NULL)
+		free_tree(ir->child);
+
+	free_entry(ir);
+}
+
+
+// Frees ir and its MBR, but not the subtree below it. Must not be used on an index_record embedded in its child
+void free_entry(index_record *ir) {
+	count_tree_bytes(-(long)(sizeof(MBR) + sizeof(index_record)));
+	free(ir->mbr);
+	free(ir);
+}
+
+
+// Frees every r_tree_node and internal index_record of the tree rooted at node, but hands the leaf-level index_records
+// (and their MBRs) over to records instead of freeing them. records needs room for every leaf-level index_record
+// Returns the number of index_records written
+long detach_leaf_records(r_tree_node *node, index_record **records) {
+	long count = 0;
 	int i;
 
 	for (i = 0; i < node->num_members; i++) {
+		index_record *curr_ir = node->index_records[i];
 
-		if (node->index_records[i]->child != NULL) {
-			current_tree_size -= sizeof(r_tree_node);
-			free_tree(node->index_records[i]->child);
+		if (curr_ir->child == NULL) {
+			records[count++] = curr_ir;
+			continue;
 		}
 
-		current_tree_size -= sizeof(MBR);
-		current_tree_size -= sizeof(index_record);
-		free(node->index_records[i]->mbr);
-		free(node->index_records[i]);
+		// Checked before the child is freed, since an embedded index_record goes with it
+		bool embedded = curr_ir->child->embeds_entry;
+
+		count += detach_leaf_records(curr_ir->child, records + count);
+
+		if (!embedded)
+			free_entry(curr_ir);
 	}
 
+	free_node(node);
+
+	return count;
+}
+
+
+// Pass the root node of your tree to this function and it will free the entire tree
+void free_tree(r_tree_node *node) {
+	int i;
+
+	for (i = 0; i < node->num_members; i++)
+		free_index_record(node->index_records[i]);
+
+#if BACK_POINTERS
 	if (node->parent != NULL)
 		node->parent->child = NULL;
+#endif
+
+	free_node(node);
+}
+
+
+// Frees node on its own (along with the index_record embedded in it, if any), leaving the index_records it holds alone
+void free_node(r_tree_node *node) {
+	count_tree_bytes(-(long)node_block_size(node->max_members));
+
+	if (node->embeds_entry)
+		count_tree_bytes(-(long)(sizeof(index_record) + sizeof(MBR)));
 
-	current_tree_size -= sizeof(node->index_records);
-	current_tree_size -= sizeof(node);
-	free(node->index_records);
 	free(node);
 }
 
@@ -619,13 +1179,84 @@ void free_tree(r_tree_node *node) {
 
 
 void print_tree_specs() {
-	if (current_tree_size < pow(2, 10))
-		printf("Tree size: %ld bytes\n", current_tree_size);
-	else if (current_tree_size < pow(2, 20))
-		printf("Tree size: %ld kilobytes\n", (long int) (current_tree_size/pow(2, 10)));
-	else if (current_tree_size < pow(2, 30))
-		printf("Tree size: %ld megabytes\n", (long int) (current_tree_size/pow(2, 20)));
-	printf("Num nodes: %ld\n", num_tree_nodes);
+	long tree_size = current_tree_size();
+
+	if (tree_size < pow(2, 10))
+		printf("Tree size: %ld bytes\n", tree_size);
+	else if (tree_size < pow(2, 20))
+		printf("Tree size: %ld kilobytes\n", (long int) (tree_size/pow(2, 10)));
+	else if (tree_size < pow(2, 30))
+		printf("Tree size: %ld megabytes\n", (long int) (tree_size/pow(2, 20)));
+	printf("Num nodes: %ld\n", num_tree_nodes());
+}
+
+
+// Finds every leaf-level index_record below node whose MBR overlaps window and passes it to callback
+// (callback may be NULL if you only want the count). Returns the number of index_records found
+long search(r_tree_node *node, MBR *window, search_callback callback, void *arg) {
+	long found = 0;
+	int i;
+
+	if (node->num_members == 0)
+		return 0;
+
+	bool leaf = is_leaf(node);
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *curr_ir = node->index_records[i];
+
+		if (!mbr_overlaps(curr_ir->mbr, window))
+			continue;
+
+		if (leaf) {
+			if (callback != NULL)
+				callback(curr_ir, arg);
+			found++;
+		} else {
+			found += search(curr_ir->child, window, callback, arg);
+		}
+	}
+
+	return found;
+}
+
+
+// Adds the aggregate of every leaf-level index_record below node overlapping window into result
+static void count_below(r_tree_node *node, MBR *window, aggregate *result) {
+	int i;
+
+	if (node->num_members == 0)
+		return;
+
+	bool leaf = is_leaf(node);
+
+	for (i = 0; i < node->num_members; i++) {
+		index_record *curr_ir = node->index_records[i];
+
+		if (!mbr_overlaps(curr_ir->mbr, window))
+			continue;
+
+		// Every record below an entry inside window overlaps it, so the entry's aggregate already is the answer
+		if (leaf || fully_contains(window, curr_ir->mbr))
+			add_aggregate(result, &curr_ir->agg);
+		else
+			count_below(curr_ir->child, window, result);
+	}
+}
+
+
+// Returns the number of leaf-level index_records below node whose MBR overlaps window, the same as search() with a
+// NULL callback, and writes their combined aggregate to result (which may be NULL). Subtrees whose MBR lies inside
+// window are counted from the aggregate of the index_record pointing to them without being visited
+long range_count(r_tree_node *node, MBR *window, aggregate *result) {
+	aggregate total = {0, 0};
+
+	count_below(node, window, &total);
+
+	if (result != NULL)
+		*result = total;
+
+	return total.count;
 }
 
 
@@ -640,7 +1271,7 @@ void write_tree_pre_order(FILE *f, r_tree_node *root, int level) {
 		index_record *curr_ir = root->index_records[i];
 		MBR *curr_mbr = curr_ir->mbr;
 
-		fprintf(f, "%d,%d,%lf,%lf,%lf,%lf,%d\n", root->index, i, curr_mbr->min_x, curr_mbr->min_y, curr_mbr->max_x, curr_mbr->max_y, level);
+		fprintf(f, "%d,%d,%lf,%lf,%lf,%lf,%d\n", root->index, i, (double)curr_mbr->min_x, (double)curr_mbr->min_y, (double)curr_mbr->max_x, (double)curr_mbr->max_y, level);
 		if (curr_ir->child != NULL)
 			write_tree_pre_order(f, curr_ir->child, level + 1);
 	}
@@ -9,8 +9,12 @@
 #include <math.h>
 #include <time.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-// Trees cannot exceed 4GB in total size
+// Trees cannot exceed 4GB in total size (paged_tree.h has a tree bounded by a memory budget instead)
 #define MAX_TREE_SIZE 4294967296
 
 
@@ -25,25 +29,120 @@
 #define PRINT_TREE_SPECS true
 #define NUM_CORES 12
 
+// Set to false (make BACK_POINTERS=false) to drop the host/index fields of index_records and the parent field of
+// r_tree_nodes. Insertion only relies on the tree_path recorded by choose_leaf, so the tree works the same either way
+#ifndef BACK_POINTERS
+#define BACK_POINTERS true
+#endif
+
+// Bytes of caller data stored inline in every index_record (make PAYLOAD_SIZE=n). 0 leaves the payload out
+#ifndef RECORD_PAYLOAD_SIZE
+#define RECORD_PAYLOAD_SIZE 0
+#endif
+
+// Fraction of its max_members a node needs to keep after a deletion to stay in the tree (see delete_record)
+#define DELETE_MIN_FILL 0.4
+
+// Deepest tree a tree_path can describe
+#define MAX_TREE_HEIGHT 64
+
 
 //int next_node_index = 0;
 //long current_tree_size = 0;
 //long num_tree_nodes = 0;
 
+// Bytes a thread allocates for trees between two checks of the total against MAX_TREE_SIZE
+#define TREE_SIZE_CHECK_INTERVAL 1048576
+
+// Each thread counts into its own cache line, which only it writes, so threads building separate trees (see
+// sharded_tree.h) never contend over the counts. The totals below are summed over every thread on demand
+#define COUNTERS_CACHE_LINE_SIZE 64
+
+
+// Adds bytes (which may be negative) to the bytes allocated for trees. Exits if the total goes over MAX_TREE_SIZE,
+// which each thread checks every TREE_SIZE_CHECK_INTERVAL bytes
+void count_tree_bytes(long bytes);
+
+// Counts an r_tree_node, a malloc call made for tree data and a node split
+void count_tree_node();
+void count_allocation();
+void count_split();
+
+// Running totals of the bytes and r_tree_nodes allocated for trees
+long current_tree_size();
+long num_tree_nodes();
+
+// Number of malloc calls made for tree data and number of node splits, for benchmarking
+long num_allocations();
+long num_splits();
+
+
+// Coordinate type used by every MBR in the tree. Chosen at build time with make COORD=double|float|int32
+// span_t is wide enough to hold the difference of any two coordinates. Areas are always accumulated as doubles,
+// so int32 trees can't overflow when two 33-bit spans are multiplied
+#if defined(COORD_FLOAT)
+typedef float coord_t;
+typedef double span_t;
+#define COORD_NAME "float"
+#elif defined(COORD_INT32)
+typedef int32_t coord_t;
+typedef int64_t span_t;
+#define COORD_NAME "int32"
+#else
+typedef double coord_t;
+typedef double span_t;
+#define COORD_NAME "double"
+#endif
+
+#define coord_min(a, b) ((a) < (b) ? (a) : (b))
+#define coord_max(a, b) ((a) > (b) ? (a) : (b))
+
+// Converts a double to a coordinate, rounding down (for lower bounds) or up (for upper bounds)
+// so that integer rectangles never shrink
+#if defined(COORD_INT32)
+#define coord_floor(v) ((coord_t) floor(v))
+#define coord_ceil(v) ((coord_t) ceil(v))
+#else
+#define coord_floor(v) ((coord_t) (v))
+#define coord_ceil(v) ((coord_t) (v))
+#endif
+
 
 typedef struct MBR {
-	double min_x;
-	double min_y;
-	double max_x;
-	double max_y;
+	coord_t min_x;
+	coord_t min_y;
+	coord_t max_x;
+	coord_t max_y;
 } MBR;
 
 
+// Summary of the leaf-level records below an index_record: how many there are and the sum of their weights.
+// A leaf-level index_record summarizes itself. To aggregate something else, add a field here and combine it in
+// add_aggregate and subtract_aggregate; every place that keeps the summaries up to date goes through those two
+typedef struct aggregate {
+	long count;
+	double sum;
+} aggregate;
+
+
+// Identifies the object a leaf-level index_record stands for, such as a row id
+typedef int64_t record_id;
+
+
 typedef struct index_record {
 	struct MBR *mbr;
 	struct r_tree_node *child;
+	struct aggregate agg;
+
+	// Only meaningful in leaf-level index_records, which the callbacks of search() and friends get to read them from
+	record_id id;
+#if RECORD_PAYLOAD_SIZE > 0
+	unsigned char payload[RECORD_PAYLOAD_SIZE];
+#endif
+#if BACK_POINTERS
 	struct r_tree_node *host;
 	int index;
+#endif
 } index_record;
 
 
@@ -51,11 +150,30 @@ typedef struct r_tree_node {
 	int max_members;
 	int num_members;
 	int index;
+
+	// True if the index_record pointing to this node (and its MBR) were allocated together with the node
+	// by initialize_split_node, in which case they are freed together with it
+	bool embeds_entry;
+#if BACK_POINTERS
 	struct index_record *parent;
+#endif
 	struct index_record **index_records;
+
+	// Records waiting to be pushed down into this node's children by a buffer_tree (see buffer_tree.h), otherwise NULL
+	struct node_buffer *buffer;
 } r_tree_node;
 
 
+// The root-to-leaf path taken by choose_leaf. nodes[0] is the root and nodes[depth - 1] is the leaf.
+// nodes[i]->index_records[indices[i]] is the index_record pointing to nodes[i + 1]
+// adjust_tree and the node splits in insert_at_node walk back up this path instead of following back-pointers
+typedef struct tree_path {
+	struct r_tree_node *nodes[MAX_TREE_HEIGHT];
+	int indices[MAX_TREE_HEIGHT];
+	int depth;
+} tree_path;
+
+
 double get_area(MBR *mbr);
 
 
@@ -85,20 +203,54 @@ double get_area_increase(MBR *original, MBR *new_child);
 // Does nothing if child_mbr is fully contained withing mbr
 void expand_mbr(MBR *mbr, MBR *child_mbr);
 
+// Given an MBR parent and an MBR child where child is being added as a child to parent,
+// check if parent fully contains child
+bool fully_contains(MBR *parent_mbr, MBR *child_mbr);
+
 // Returns the overlapping area of two minimum bounding rectangles
 double get_overlapping_area(MBR *mbr1, MBR *mbr2);
 
+// Returns true if the two minimum bounding rectangles share at least one point (touching edges count)
+bool mbr_overlaps(MBR *mbr1, MBR *mbr2);
 
+
+// The new index_record summarizes a single record of weight 1, and has id 0
 index_record *initialize_ir(MBR *mbr);
 
+// Same as initialize_ir, for a leaf-level index_record standing for the object id
+index_record *initialize_record(MBR *mbr, record_id id);
+
+// Sets the weight of a leaf-level index_record. Must be done before it is inserted
+void set_weight(index_record *ir, double weight);
+
+// Adds part into total
+void add_aggregate(aggregate *total, aggregate *part);
+
+// Takes part back out of total
+void subtract_aggregate(aggregate *total, aggregate *part);
+
+// Writes the combined aggregate of every index_record in node to result
+void sum_members(r_tree_node *node, aggregate *result);
+
 // Given an MBR as a parameter, create an identical copy of that MBR at a different location in memory
 MBR *copy_mbr(MBR *original_mbr);
 
 
+// The index_records array lives in the same allocation as the r_tree_node itself
 r_tree_node *initialize_rt(int max_members);
 
 
+// Creates an empty r_tree_node together with the index_record (holding a copy of mbr) that will point to it,
+// all in a single allocation. Used for the new sibling when a node splits
+index_record *initialize_split_node(int max_members, MBR *mbr);
+
+
+// Creates a new r_tree_node holding the same index_records as rt. The index_records themselves are shared, not copied
+r_tree_node *copy_node(r_tree_node *rt);
+
+
 // Returns true if successfully added a new index record to the r_tree_node, false if you have reached max capacity and need to split
+// Does not expand the MBRs above host_node, use adjust_tree for that
 bool add_member(r_tree_node *host_node, index_record *new_member);
 
 
@@ -110,31 +262,63 @@ index_record *remove_index_record(r_tree_node *r, int index);
 bool move_index_record(r_tree_node *r1, r_tree_node *r2, int index);
 
 
-// Returns true if the r_tree_node is a bottom-level node
+// Returns true if the r_tree_node is a bottom-level node. An empty node (only ever a brand new root) counts as a leaf
 bool is_leaf(r_tree_node *node);
 
 
+#if BACK_POINTERS
 // Returns true if the r_tree_node is a top-level node
 bool is_parent(r_tree_node *node);
+#endif
 
 
 // Returns true if there is the max number of index_record's in your r_tree_node
 bool is_full(r_tree_node *node);
 
-// (Used for when you have already found the leaf-level r_tree_node rt to insert your index_record ir into
+// Appends node to path along with the index of the index_record the descent continues through (-1 at the leaf)
+void push_path(tree_path *path, r_tree_node *node, int index);
+
+// Splits the full r_tree_node rt while inserting ir into it. rt keeps one group of index_records and a newly allocated
+// sibling gets the other, so the split costs a single allocation. rt_ir is the index_record pointing to rt, its MBR
+// and aggregate are recomputed for rt's new members. Returns the index_record pointing to the sibling, which still has
+// to be added to rt's parent
+index_record *split_node(r_tree_node *rt, index_record *rt_ir, index_record *ir, int num_threads);
+
+// (Used for when you have already found the leaf-level r_tree_node to insert your index_record ir into
+// The leaf is the last node of path, as recorded by choose_leaf
 // Insertion function that can be parallized or not based on arguments
 // Finds the optimal insertion to minimize MBR overlap
 // The node splitting algorithm was made up by me
 // You need to pass root because it might change if a new root is created
-void insert_at_node(r_tree_node *rt, index_record *ir, r_tree_node **root, int num_threads);
+void insert_at_node(tree_path *path, index_record *ir, r_tree_node **root, int num_threads);
+
+struct fanout_ops;
+
+// Same as insert_at_node, but every split is done by the kernels ops has for the level of the node being split, and a
+// root split makes a root of ops->internal_members (see fanout_tree.h)
+void insert_at_node_with_ops(tree_path *path, index_record *ir, r_tree_node **root, const struct fanout_ops *ops);
 
 // General insertion function
 // You need to pass a pointer to a pointer of the root in case the root changes to a new root during the insertion process
 void insert(r_tree_node **root, index_record *ir, int num_threads);
 
-// Given an r_tree_node, ensures that its parent index_record has an MBR that is the minimum bounding rectangle of all children MBR's
+// Removes the leaf-level index_record with the given id and MBR from the tree and returns it (NULL if there is none),
+// leaving it to the caller to free. A node left with fewer than DELETE_MIN_FILL of its max_members is taken out of
+// the tree and its members are inserted again at their own level, and the MBRs and aggregates above are shrunk to fit
+// what is left. A root left with a single child is replaced by that child, so *root may change
+index_record *delete_record(r_tree_node **root, MBR *mbr, record_id id);
+
+// Number of levels in the tree rooted at root, counting the leaves as level 1
+int tree_height(r_tree_node *root);
+
+// Grafts the subtree that subtree_ir points to (subtree_height levels tall, with its leaves at the bottom) into the
+// tree, at the level where its leaves line up with the tree's leaves. The tree has to be taller than the subtree
+void insert_subtree(r_tree_node **root, index_record *subtree_ir, int subtree_height, int num_threads);
+
+// Given an r_tree_node and the index_record pointing to it, ensures that the index_record has an MBR that is the minimum
+// bounding rectangle of all children MBR's, and the aggregate of all of them
 // Used so that generate_randoom_tree does not create MBRs that are not actually MBRs
-void validate_node(r_tree_node *rt);
+void validate_node(r_tree_node *rt, index_record *parent);
 
 
 // Generates a random r-tree where each r_tree_node has r_tree_node->max_members / 2 entries
@@ -149,9 +333,42 @@ void print_tree(r_tree_node *node, int current_level);
 void print_tree_specs();
 
 
+// Called by search() once for every leaf-level index_record whose MBR overlaps the search window
+typedef void (*search_callback)(index_record *ir, void *arg);
+
+
+// Finds every leaf-level index_record below node whose MBR overlaps window and passes it to callback
+// (callback may be NULL if you only want the count). Returns the number of index_records found
+long search(r_tree_node *node, MBR *window, search_callback callback, void *arg);
+
+
+// Returns the number of leaf-level index_records below node whose MBR overlaps window, the same as search() with a
+// NULL callback, and writes their combined aggregate to result (which may be NULL). Subtrees whose MBR lies inside
+// window are counted from the aggregate of the index_record pointing to them without being visited
+long range_count(r_tree_node *node, MBR *window, aggregate *result);
+
+
 void free_tree(r_tree_node *node);
 
 
+// Frees an index_record and its MBR, along with the subtree below it
+void free_index_record(index_record *ir);
+
+
+// Frees ir and its MBR, but not the subtree below it. Must not be used on an index_record embedded in its child
+void free_entry(index_record *ir);
+
+
+// Frees node on its own (along with the index_record embedded in it, if any), leaving the index_records it holds alone
+void free_node(r_tree_node *node);
+
+
+// Frees every r_tree_node and internal index_record of the tree rooted at node, but hands the leaf-level index_records
+// (and their MBRs) over to records instead of freeing them. records needs room for every leaf-level index_record
+// Returns the number of index_records written
+long detach_leaf_records(r_tree_node *node, index_record **records);
+
+
 /* Does a pre-order traversal of the R-tree, writing each index record in the format:
 * node_number,index_record_number,min_x,min_y,max_x,max_y,level
 */
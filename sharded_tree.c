@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+
+#include "r_tree.h"
+#include "bulk_load.h"
+#include "sharded_tree.h"
+
+#include <sched.h>
+
+
+// Centre of an MBR along axis (0 = x, 1 = y)
+static double mbr_centre(MBR *mbr, int axis) {
+	if (axis == 0)
+		return ((double)mbr->min_x + mbr->max_x) / 2;
+	return ((double)mbr->min_y + mbr->max_y) / 2;
+}
+
+
+// Follows the split planes down to the shard whose region holds the centre of mbr
+static int route(sharded_tree *st, MBR *mbr) {
+	shard_split *split = &st->splits[0];
+
+	while (split->shard < 0) {
+		if (mbr_centre(mbr, split->axis) < split->value)
+			split = &st->splits[split->left];
+		else
+			split = &st->splits[split->right];
+	}
+
+	return split->shard;
+}
+
+
+// Adds a split node for num_shards shards (first_shard onwards) that evenly divide the region
+// (min_x, min_y) - (max_x, max_y). Returns the index of the node in st->splits
+static int build_even_splits(sharded_tree *st, int *next_split, int first_shard, int num_shards,
+	double min_x, double min_y, double max_x, double max_y) {
+	int index = (*next_split)++;
+	shard_split *split = &st->splits[index];
+
+	if (num_shards == 1) {
+		split->shard = first_shard;
+		return index;
+	}
+
+	int left_shards = num_shards / 2;
+
+	split->shard = -1;
+	split->axis = (max_x - min_x >= max_y - min_y) ? 0 : 1;
+
+	if (split->axis == 0) {
+		split->value = min_x + (max_x - min_x) * left_shards / num_shards;
+		split->left = build_even_splits(st, next_split, first_shard, left_shards, min_x, min_y, split->value, max_y);
+		split->right = build_even_splits(st, next_split, first_shard + left_shards, num_shards - left_shards, split->value, min_y, max_x, max_y);
+	} else {
+		split->value = min_y + (max_y - min_y) * left_shards / num_shards;
+		split->left = build_even_splits(st, next_split, first_shard, left_shards, min_x, min_y, max_x, split->value);
+		split->right = build_even_splits(st, next_split, first_shard + left_shards, num_shards - left_shards, min_x, split->value, max_x, max_y);
+	}
+
+	return index;
+}
+
+
+static int compare_centre_x(const void *a, const void *b) {
+	double centre_a = mbr_centre((*(index_record **)a)->mbr, 0);
+	double centre_b = mbr_centre((*(index_record **)b)->mbr, 0);
+	return (centre_a > centre_b) - (centre_a < centre_b);
+}
+
+
+static int compare_centre_y(const void *a, const void *b) {
+	double centre_a = mbr_centre((*(index_record **)a)->mbr, 1);
+	double centre_b = mbr_centre((*(index_record **)b)->mbr, 1);
+	return (centre_a > centre_b) - (centre_a < centre_b);
+}
+
+
+// Like build_even_splits, but places the split planes at the median centre of records, so every shard
+// gets (close to) the same number of them. records is reordered so each shard's records end up next to each other,
+// and the shard is pointed at them. A region with no records in it is split evenly, between (min_x, min_y) and
+// (max_x, max_y)
+static int build_median_splits(sharded_tree *st, int *next_split, int first_shard, int num_shards,
+	index_record **records, long num_records, double min_x, double min_y, double max_x, double max_y) {
+	if (num_records == 0)
+		return build_even_splits(st, next_split, first_shard, num_shards, min_x, min_y, max_x, max_y);
+
+	int index = (*next_split)++;
+	shard_split *split = &st->splits[index];
+	long i;
+
+	if (num_shards == 1) {
+		split->shard = first_shard;
+		st->shards[first_shard].records = records;
+		st->shards[first_shard].num_records = num_records;
+		return index;
+	}
+
+	// Split along whichever axis the centres are more spread out on
+	double low_x = DBL_MAX, low_y = DBL_MAX, high_x = -DBL_MAX, high_y = -DBL_MAX;
+
+	for (i = 0; i < num_records; i++) {
+		low_x = fmin(low_x, mbr_centre(records[i]->mbr, 0));
+		high_x = fmax(high_x, mbr_centre(records[i]->mbr, 0));
+		low_y = fmin(low_y, mbr_centre(records[i]->mbr, 1));
+		high_y = fmax(high_y, mbr_centre(records[i]->mbr, 1));
+	}
+
+	int left_shards = num_shards / 2;
+	long split_index = num_records * left_shards / num_shards;
+
+	split->shard = -1;
+	split->axis = (high_x - low_x >= high_y - low_y) ? 0 : 1;
+
+	qsort(records, num_records, sizeof(index_record *), split->axis == 0 ? compare_centre_x : compare_centre_y);
+
+	split->value = mbr_centre(records[split_index]->mbr, split->axis);
+
+	if (split->axis == 0) {
+		split->left = build_median_splits(st, next_split, first_shard, left_shards, records, split_index,
+			min_x, min_y, split->value, max_y);
+		split->right = build_median_splits(st, next_split, first_shard + left_shards, num_shards - left_shards,
+			records + split_index, num_records - split_index, split->value, min_y, max_x, max_y);
+	} else {
+		split->left = build_median_splits(st, next_split, first_shard, left_shards, records, split_index,
+			min_x, min_y, max_x, split->value);
+		split->right = build_median_splits(st, next_split, first_shard + left_shards, num_shards - left_shards,
+			records + split_index, num_records - split_index, min_x, split->value, max_x, max_y);
+	}
+
+	return index;
+}
+
+
+// Bulk loads the shard from the records the producer handed over. Only called on the owner thread
+static void rebuild_shard(shard *sh) {
+	long i;
+
+	sh->has_bounds = sh->num_records > 0;
+	sh->root = sh->has_bounds ? bulk_load(sh->records, sh->num_records, sh->max_members) : initialize_rt(sh->max_members);
+
+	if (sh->has_bounds)
+		sh->bounds = *sh->records[0]->mbr;
+
+	for (i = 1; i < sh->num_records; i++)
+		expand_mbr(&sh->bounds, sh->records[i]->mbr);
+
+	atomic_store_explicit(&sh->num_inserted, sh->num_records, memory_order_relaxed);
+
+	// Hands the rebuilt tree back to the producer
+	atomic_store_explicit(&sh->rebuild, false, memory_order_release);
+}
+
+
+// Pins the owner thread to its core and inserts whatever the producer routes to the shard until told to stop
+static void *shard_owner(void *arg) {
+	shard *sh = (shard *)arg;
+	spsc_queue *queue = &sh->queue;
+	cpu_set_t cpus;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(sh->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+
+	while (true) {
+		size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+		size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+		if (head == tail) {
+			if (atomic_load_explicit(&sh->rebuild, memory_order_acquire)) {
+				rebuild_shard(sh);
+				continue;
+			}
+
+			if (atomic_load_explicit(&sh->stop, memory_order_acquire))
+				break;
+
+			sched_yield();
+			continue;
+		}
+
+		index_record *ir = queue->slots[head & (SHARD_QUEUE_CAPACITY - 1)];
+		atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+		insert(&sh->root, ir, 1);
+
+		if (sh->has_bounds) {
+			expand_mbr(&sh->bounds, ir->mbr);
+		} else {
+			sh->bounds = *ir->mbr;
+			sh->has_bounds = true;
+		}
+
+		// Publishes the insertion (and the tree it changed) to the producer
+		atomic_fetch_add_explicit(&sh->num_inserted, 1, memory_order_release);
+	}
+
+	pthread_exit(NULL);
+}
+
+
+// Creates num_shards empty shards that evenly split space, and starts one owner thread per shard
+sharded_tree *create_sharded_tree(int num_shards, int max_members, MBR *space) {
+	sharded_tree *st = (sharded_tree *)malloc(sizeof(sharded_tree));
+	int i;
+
+	if (st == NULL) {
+		fprintf(stderr, "Malloc failed in create_sharded_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	st->num_shards = num_shards;
+	st->max_members = max_members;
+	st->insertions_since_check = 0;
+	st->space = *space;
+	st->splits = (shard_split *)malloc(sizeof(shard_split) * (2 * num_shards - 1));
+
+	// Each shard has its own queue and counters, so keep them apart on cache line boundaries
+	st->shards = (shard *)aligned_alloc(CACHE_LINE_SIZE, sizeof(shard) * num_shards);
+
+	if (st->splits == NULL || st->shards == NULL) {
+		fprintf(stderr, "Malloc failed in create_sharded_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	int next_split = 0;
+	build_even_splits(st, &next_split, 0, num_shards, space->min_x, space->min_y, space->max_x, space->max_y);
+
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (i = 0; i < num_shards; i++) {
+		shard *sh = &st->shards[i];
+
+		sh->root = initialize_rt(max_members);
+		sh->has_bounds = false;
+		sh->max_members = max_members;
+		sh->num_pushed = 0;
+		sh->cpu = i % num_cpus;
+		atomic_init(&sh->queue.head, 0);
+		atomic_init(&sh->queue.tail, 0);
+		atomic_init(&sh->num_inserted, 0);
+		atomic_init(&sh->rebuild, false);
+		atomic_init(&sh->stop, false);
+
+		pthread_create(&sh->thread, NULL, shard_owner, (void *)sh);
+	}
+
+	return st;
+}
+
+
+// Routes ir to the shard owning the centre of its MBR. Must always be called from the same (producer) thread
+void sharded_insert(sharded_tree *st, index_record *ir) {
+	shard *sh = &st->shards[route(st, ir->mbr)];
+	spsc_queue *queue = &sh->queue;
+	size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+	// Wait for the owner thread if the queue is full
+	while (tail - atomic_load_explicit(&queue->head, memory_order_acquire) == SHARD_QUEUE_CAPACITY)
+		sched_yield();
+
+	queue->slots[tail & (SHARD_QUEUE_CAPACITY - 1)] = ir;
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	sh->num_pushed++;
+
+	if (++st->insertions_since_check < SHARD_REBALANCE_INTERVAL)
+		return;
+
+	st->insertions_since_check = 0;
+
+	long total = 0, largest = 0;
+	int i;
+
+	for (i = 0; i < st->num_shards; i++) {
+		total += st->shards[i].num_pushed;
+		if (st->shards[i].num_pushed > largest)
+			largest = st->shards[i].num_pushed;
+	}
+
+	if (st->num_shards > 1 && total >= SHARD_REBALANCE_INTERVAL && largest > SHARD_REBALANCE_FACTOR * total / st->num_shards)
+		rebalance_sharded_tree(st);
+}
+
+
+// Waits until every shard's owner thread has inserted everything that was routed to it
+void flush_sharded_tree(sharded_tree *st) {
+	int i;
+
+	for (i = 0; i < st->num_shards; i++) {
+		shard *sh = &st->shards[i];
+
+		while (atomic_load_explicit(&sh->num_inserted, memory_order_acquire) != sh->num_pushed)
+			sched_yield();
+	}
+}
+
+
+// Same as search() in r_tree.h, but only visits the shards whose contents overlap window.
+// Call from the producer thread. Flushes the shards first so that every routed index_record is found
+long sharded_search(sharded_tree *st, MBR *window, search_callback callback, void *arg) {
+	long found = 0;
+	int i;
+
+	flush_sharded_tree(st);
+
+	for (i = 0; i < st->num_shards; i++) {
+		shard *sh = &st->shards[i];
+
+		if (sh->has_bounds && mbr_overlaps(&sh->bounds, window))
+			found += search(sh->root, window, callback, arg);
+	}
+
+	return found;
+}
+
+
+// Rebuilds every shard around median split planes of the records stored so far, each on its owner thread
+void rebalance_sharded_tree(sharded_tree *st) {
+	long total = 0, offset = 0;
+	int i;
+
+	// Once flushed, the owner threads only spin on their empty queues, so the shards can be taken apart from here
+	flush_sharded_tree(st);
+
+	for (i = 0; i < st->num_shards; i++)
+		total += st->shards[i].num_pushed;
+
+	index_record **records = (index_record **)malloc(sizeof(index_record *) * (total > 0 ? total : 1));
+
+	if (records == NULL) {
+		fprintf(stderr, "Malloc failed in rebalance_sharded_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	for (i = 0; i < st->num_shards; i++) {
+		shard *sh = &st->shards[i];
+
+		offset += detach_leaf_records(sh->root, records + offset);
+		sh->records = NULL;
+		sh->num_records = 0;
+	}
+
+	int next_split = 0;
+	build_median_splits(st, &next_split, 0, st->num_shards, records, offset,
+		st->space.min_x, st->space.min_y, st->space.max_x, st->space.max_y);
+
+	// The release store hands each shard's records to its owner thread, and they all rebuild at once
+	for (i = 0; i < st->num_shards; i++) {
+		st->shards[i].num_pushed = st->shards[i].num_records;
+		atomic_store_explicit(&st->shards[i].rebuild, true, memory_order_release);
+	}
+
+	for (i = 0; i < st->num_shards; i++) {
+		while (atomic_load_explicit(&st->shards[i].rebuild, memory_order_acquire))
+			sched_yield();
+	}
+
+	free(records);
+}
+
+
+// Stops the owner threads and frees every shard (including the index_records inserted into them)
+void free_sharded_tree(sharded_tree *st) {
+	int i;
+
+	flush_sharded_tree(st);
+
+	for (i = 0; i < st->num_shards; i++)
+		atomic_store_explicit(&st->shards[i].stop, true, memory_order_release);
+
+	for (i = 0; i < st->num_shards; i++) {
+		pthread_join(st->shards[i].thread, NULL);
+		free_tree(st->shards[i].root);
+	}
+
+	free(st->shards);
+	free(st->splits);
+	free(st);
+}
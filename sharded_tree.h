@@ -0,0 +1,127 @@
+#ifndef _sharded_tree_h
+#define _sharded_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Shared-nothing sharded r-tree.
+*
+* Space is cut into num_shards regions by a small kd-tree of split planes. Each region is backed by its own r-tree,
+* which is only ever touched by the shard's owner thread (pinned to one core), so insert_at_node runs without any locks.
+* One producer thread routes index_records to shards by the centre of their MBR through per-shard single-producer /
+* single-consumer queues. Queries from the producer thread first wait for the queues to drain and then only visit the
+* shards whose contents overlap the query window.
+*
+* The first partition splits the space evenly. When one shard ends up with more than SHARD_REBALANCE_FACTOR times the
+* average number of records, every shard is rebuilt around median split planes of the data inserted so far. The
+* producer only works out which records go to which shard, and every owner thread then bulk loads its own shard, so
+* the shards are rebuilt in parallel. A region of the new partition holding no records is split evenly instead
+*/
+
+// Must be a power of 2
+#define SHARD_QUEUE_CAPACITY 4096
+
+// A shard holding more than this many times the average number of records triggers a rebalance
+#define SHARD_REBALANCE_FACTOR 2
+
+// How many insertions the producer makes between checks of the shard sizes, and the fewest records worth rebalancing
+#define SHARD_REBALANCE_INTERVAL 4096
+
+#define CACHE_LINE_SIZE 64
+
+
+// Single-producer / single-consumer ring of index_records waiting to be inserted into a shard
+typedef struct spsc_queue {
+	index_record *slots[SHARD_QUEUE_CAPACITY];
+
+	// head is only written by the consumer and tail only by the producer, so keep them on separate cache lines
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+} spsc_queue;
+
+
+// One node of the kd-tree of split planes that routes index_records to shards
+typedef struct shard_split {
+	// -1 for a split plane, otherwise the shard that owns this region
+	int shard;
+
+	// Centres with a coordinate (0 = x, 1 = y) less than value go left
+	int axis;
+	double value;
+	int left;
+	int right;
+} shard_split;
+
+
+typedef struct shard {
+	r_tree_node *root;
+
+	// Covers everything stored in the shard. Records only have to have their centre inside the shard's region,
+	// so this can stick out of the region
+	MBR bounds;
+	bool has_bounds;
+
+	spsc_queue queue;
+
+	// Records pushed by the producer (producer only) and records inserted by the owner thread (owner only)
+	long num_pushed;
+	_Alignas(CACHE_LINE_SIZE) atomic_long num_inserted;
+
+	// Set by the producer once records holds the num_records records the owner thread has to rebuild the shard from,
+	// and cleared by the owner thread once it has
+	index_record **records;
+	long num_records;
+	atomic_bool rebuild;
+
+	atomic_bool stop;
+	pthread_t thread;
+	int cpu;
+	int max_members;
+} shard;
+
+
+typedef struct sharded_tree {
+	int num_shards;
+	int max_members;
+	shard *shards;
+
+	// Split evenly by the first partition, and by the parts of later ones that hold no records
+	MBR space;
+
+	// 2 * num_shards - 1 nodes, splits[0] is the root
+	shard_split *splits;
+
+	long insertions_since_check;
+} sharded_tree;
+
+
+// Creates num_shards empty shards that evenly split space, and starts one owner thread per shard
+sharded_tree *create_sharded_tree(int num_shards, int max_members, MBR *space);
+
+
+// Routes ir to the shard owning the centre of its MBR. Must always be called from the same (producer) thread
+void sharded_insert(sharded_tree *st, index_record *ir);
+
+
+// Waits until every shard's owner thread has inserted everything that was routed to it
+void flush_sharded_tree(sharded_tree *st);
+
+
+// Same as search() in r_tree.h, but only visits the shards whose contents overlap window.
+// Call from the producer thread. Flushes the shards first so that every routed index_record is found
+long sharded_search(sharded_tree *st, MBR *window, search_callback callback, void *arg);
+
+
+// Rebuilds every shard around median split planes of the records stored so far, each on its owner thread
+void rebalance_sharded_tree(sharded_tree *st);
+
+
+// Stops the owner threads and frees every shard (including the index_records inserted into them)
+void free_sharded_tree(sharded_tree *st);
+
+
+#endif
@@ -0,0 +1,202 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "r_tree.h"
+#include "shared_tree.h"
+
+
+// The node at offset in the segment
+#define shared_node(st, offset) ((tree_page *)((st)->base + (offset)))
+
+
+// Bytes taken by one node, rounded up so every node stays aligned
+static size_t shared_node_size(int max_members) {
+	size_t size = sizeof(tree_page) + sizeof(page_entry) * max_members;
+	return (size + 7) & ~(size_t)7;
+}
+
+
+// Carves a zeroed node out of the unused end of the segment and returns its offset
+static long allocate_shared_node(shared_tree *st) {
+	size_t size = shared_node_size(st->header->max_members);
+
+	if (st->header->used + size > st->header->segment_size) {
+		fprintf(stderr, "Shared tree segment of %zu bytes is full. Exiting program\n", st->header->segment_size);
+		exit(1);
+	}
+
+	long offset = (long)st->header->used;
+	st->header->used += size;
+	memset(st->base + offset, 0, size);
+
+	return offset;
+}
+
+
+// Maps the whole of the segment open at fd
+static shared_tree *map_segment(int fd, size_t segment_size) {
+	shared_tree *st = (shared_tree *)malloc(sizeof(shared_tree));
+
+	if (st == NULL) {
+		fprintf(stderr, "Malloc failed in map_segment(). Exiting program\n");
+		exit(1);
+	}
+
+	st->base = (char *)mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (st->base == MAP_FAILED) {
+		fprintf(stderr, "Mmap failed in map_segment(). Exiting program\n");
+		exit(1);
+	}
+
+	st->header = (shared_header *)st->base;
+
+	return st;
+}
+
+
+// Creates the shared memory segment name (which must not exist yet) of segment_size bytes, holding an empty tree whose
+// nodes hold up to max_members members, and attaches to it
+shared_tree *create_shared_tree(const char *name, int max_members, size_t segment_size) {
+	if (max_members < 2) {
+		fprintf(stderr, "Nodes need room for at least 2 members. Exiting program\n");
+		exit(1);
+	}
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	if (fd < 0 || ftruncate(fd, segment_size) != 0) {
+		fprintf(stderr, "Could not create shared memory segment %s. Exiting program\n", name);
+		exit(1);
+	}
+
+	shared_tree *st = map_segment(fd, segment_size);
+	shared_header *header = st->header;
+
+	header->segment_size = segment_size;
+	header->used = (sizeof(shared_header) + 7) & ~(size_t)7;
+	header->max_members = max_members;
+	header->height = 1;
+	header->num_records = 0;
+
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_rwlock_init(&header->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	header->root = allocate_shared_node(st);
+	shared_node(st, header->root)->leaf = true;
+
+	// Published last, so a process attaching early can tell the header isn't ready
+	__atomic_store_n(&header->magic, SHARED_TREE_MAGIC, __ATOMIC_RELEASE);
+
+	return st;
+}
+
+
+// Attaches to the tree in the existing segment name
+shared_tree *attach_shared_tree(const char *name) {
+	struct stat info;
+	int fd = shm_open(name, O_RDWR, 0600);
+
+	if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(shared_header)) {
+		fprintf(stderr, "Could not open shared memory segment %s. Exiting program\n", name);
+		exit(1);
+	}
+
+	shared_tree *st = map_segment(fd, info.st_size);
+
+	if (__atomic_load_n(&st->header->magic, __ATOMIC_ACQUIRE) != SHARED_TREE_MAGIC) {
+		fprintf(stderr, "Shared memory segment %s does not hold a tree. Exiting program\n", name);
+		exit(1);
+	}
+
+	return st;
+}
+
+
+// Nodes are found by their offset in the segment, and stay in place (allocating can't move the segment), so there is
+// nothing to do when insert_into_pages is done with one
+static tree_page *get_shared_page(void *arg, long offset) {
+	return shared_node((shared_tree *)arg, offset);
+}
+
+
+static void put_shared_page(void *arg, long offset, bool dirty) {
+}
+
+
+static tree_page *new_shared_page(void *arg, long *offset) {
+	*offset = allocate_shared_node((shared_tree *)arg);
+	return shared_node((shared_tree *)arg, *offset);
+}
+
+
+static const page_ops shared_page_ops = {get_shared_page, put_shared_page, new_shared_page};
+
+
+// Adds a record with the given MBR and id. Exits if the segment is full
+void shared_insert(shared_tree *st, MBR *mbr, long record_id) {
+	shared_header *header = st->header;
+
+	pthread_rwlock_wrlock(&header->lock);
+
+	if (insert_into_pages(&shared_page_ops, st, &header->root, header->max_members, mbr, record_id))
+		header->height++;
+
+	header->num_records++;
+
+	pthread_rwlock_unlock(&header->lock);
+}
+
+
+// Recursive part of shared_search
+static long search_shared_node(shared_tree *st, long offset, MBR *window, paged_search_callback callback, void *arg) {
+	tree_page *page = shared_node(st, offset);
+	long found = 0;
+	int i;
+
+	for (i = 0; i < page->num_members; i++) {
+		page_entry *entry = &page->entries[i];
+
+		if (!mbr_overlaps(&entry->mbr, window))
+			continue;
+
+		if (!page->leaf) {
+			found += search_shared_node(st, entry->child, window, callback, arg);
+			continue;
+		}
+
+		if (callback != NULL)
+			callback(&entry->mbr, entry->child, arg);
+		found++;
+	}
+
+	return found;
+}
+
+
+// Same as search() in r_tree.h, passing callback the MBR and id of every record found
+long shared_search(shared_tree *st, MBR *window, paged_search_callback callback, void *arg) {
+	pthread_rwlock_rdlock(&st->header->lock);
+	long found = search_shared_node(st, st->header->root, window, callback, arg);
+	pthread_rwlock_unlock(&st->header->lock);
+
+	return found;
+}
+
+
+// Unmaps the segment from this process and frees st. The segment and the tree in it stay in place
+void detach_shared_tree(shared_tree *st) {
+	munmap(st->base, st->header->segment_size);
+	free(st);
+}
+
+
+// Removes the segment name. Processes still attached keep their mapping until they detach
+void destroy_shared_tree(const char *name) {
+	shm_unlink(name);
+}
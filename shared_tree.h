@@ -0,0 +1,72 @@
+#ifndef _shared_tree_h
+#define _shared_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "paged_tree.h"
+
+/* R-tree in a POSIX shared memory segment, so several processes can query one copy of it.
+*
+* The segment can be mapped at a different address in every process, so nothing in it holds a pointer. Nodes are
+* tree_pages (see paged_tree.h) whose entries hold the segment offset of the child node, or the caller's record id in
+* leaves, and the header at the start of the segment holds the offset of the root. Nodes are carved out of the segment
+* one after the other and never freed, since the tree only grows.
+*
+* Any number of processes can attach and search, while one at a time inserts. They synchronise through a
+* process-shared rwlock in the header: searches hold it for reading, insertions for writing
+*/
+
+typedef struct shared_header {
+	// Set to SHARED_TREE_MAGIC once the header is set up
+	long magic;
+
+	size_t segment_size;
+	size_t used;
+
+	long root;
+	int max_members;
+	int height;
+	long num_records;
+
+	pthread_rwlock_t lock;
+} shared_header;
+
+
+#define SHARED_TREE_MAGIC 0x5254524545L
+
+
+// A process's view of the segment. Only the segment is shared, every process has its own shared_tree
+typedef struct shared_tree {
+	shared_header *header;
+	char *base;
+} shared_tree;
+
+
+// Creates the shared memory segment name (which must not exist yet) of segment_size bytes, holding an empty tree whose
+// nodes hold up to max_members members, and attaches to it
+shared_tree *create_shared_tree(const char *name, int max_members, size_t segment_size);
+
+
+// Attaches to the tree in the existing segment name
+shared_tree *attach_shared_tree(const char *name);
+
+
+// Adds a record with the given MBR and id. Exits if the segment is full
+void shared_insert(shared_tree *st, MBR *mbr, long record_id);
+
+
+// Same as search() in r_tree.h, passing callback the MBR and id of every record found
+long shared_search(shared_tree *st, MBR *window, paged_search_callback callback, void *arg);
+
+
+// Unmaps the segment from this process and frees st. The segment and the tree in it stay in place
+void detach_shared_tree(shared_tree *st);
+
+
+// Removes the segment name. Processes still attached keep their mapping until they detach
+void destroy_shared_tree(const char *name);
+
+
+#endif
@@ -0,0 +1,183 @@
+#include "r_tree.h"
+#include "spatial_join.h"
+
+
+// Each worker counts its own results, on its own cache line
+typedef struct join_counter {
+	_Alignas(CACHE_LINE_SIZE) long found;
+} join_counter;
+
+
+typedef struct join_context {
+	join_callback callback;
+	void *arg;
+	join_counter *counters;
+} join_context;
+
+
+// A task's id holds the heights of its two nodes
+#define join_task_id(height_a, height_b) (((long)(height_a) << 8) | (height_b))
+
+
+// Writes the MBR of node's members to mbr. node must not be empty
+static void node_mbr(r_tree_node *node, MBR *mbr) {
+	int i;
+
+	*mbr = *node->index_records[0]->mbr;
+
+	for (i = 1; i < node->num_members; i++)
+		expand_mbr(mbr, node->index_records[i]->mbr);
+}
+
+
+static int compare_min_x(const void *a, const void *b) {
+	coord_t x_a = (*(index_record **)a)->mbr->min_x;
+	coord_t x_b = (*(index_record **)b)->mbr->min_x;
+
+	return (x_a > x_b) - (x_a < x_b);
+}
+
+
+// Collects the members of node overlapping window into members, sorted by min_x. Returns how many there are
+static int overlapping_members(r_tree_node *node, MBR *window, index_record **members) {
+	int num_members = 0;
+	int i;
+
+	for (i = 0; i < node->num_members; i++) {
+		if (mbr_overlaps(node->index_records[i]->mbr, window))
+			members[num_members++] = node->index_records[i];
+	}
+
+	qsort(members, num_members, sizeof(index_record *), compare_min_x);
+
+	return num_members;
+}
+
+
+// Reports a pair of overlapping leaf-level members, or queues the pair of nodes below two internal members
+static void join_pair(work_pool *pool, int worker, index_record *a, index_record *b, int height) {
+	join_context *context = (join_context *)pool->context;
+
+	if (height > 1) {
+		work_task task = {a->child, b->child, join_task_id(height - 1, height - 1)};
+		submit_task(pool, worker, &task);
+		return;
+	}
+
+	if (context->callback != NULL)
+		context->callback(a, b, worker, context->arg);
+	context->counters[worker].found++;
+}
+
+
+// Joins the pair of nodes in task
+static void join_nodes(work_pool *pool, int worker, work_task *task) {
+	r_tree_node *a = (r_tree_node *)task->first;
+	r_tree_node *b = (r_tree_node *)task->second;
+	int height_a = (int)(task->id >> 8);
+	int height_b = (int)(task->id & 0xff);
+	MBR mbr_a, mbr_b;
+	int i, j, k;
+
+	if (a->num_members == 0 || b->num_members == 0)
+		return;
+
+	node_mbr(a, &mbr_a);
+	node_mbr(b, &mbr_b);
+
+	// Only the taller side goes down a level until the two line up
+	if (height_a != height_b) {
+		r_tree_node *taller = height_a > height_b ? a : b;
+		MBR *other_mbr = height_a > height_b ? &mbr_b : &mbr_a;
+
+		for (i = 0; i < taller->num_members; i++) {
+			index_record *member = taller->index_records[i];
+
+			if (!mbr_overlaps(member->mbr, other_mbr))
+				continue;
+
+			work_task child_task = *task;
+
+			if (height_a > height_b) {
+				child_task.first = member->child;
+				child_task.id = join_task_id(height_a - 1, height_b);
+			} else {
+				child_task.second = member->child;
+				child_task.id = join_task_id(height_a, height_b - 1);
+			}
+
+			submit_task(pool, worker, &child_task);
+		}
+
+		return;
+	}
+
+	if (!mbr_overlaps(&mbr_a, &mbr_b))
+		return;
+
+	// Members outside the overlap of the two nodes can't meet anything on the other side
+	MBR window = {
+		coord_max(mbr_a.min_x, mbr_b.min_x), coord_max(mbr_a.min_y, mbr_b.min_y),
+		coord_min(mbr_a.max_x, mbr_b.max_x), coord_min(mbr_a.max_y, mbr_b.max_y)
+	};
+
+	index_record *members_a[a->num_members];
+	index_record *members_b[b->num_members];
+	int num_a = overlapping_members(a, &window, members_a);
+	int num_b = overlapping_members(b, &window, members_b);
+
+	// Plane sweep: the member with the smaller min_x is tested against the members of the other side that start
+	// before it ends along x, then dropped
+	i = 0;
+	j = 0;
+
+	while (i < num_a && j < num_b) {
+		if (members_a[i]->mbr->min_x <= members_b[j]->mbr->min_x) {
+			for (k = j; k < num_b && members_b[k]->mbr->min_x <= members_a[i]->mbr->max_x; k++) {
+				if (mbr_overlaps(members_a[i]->mbr, members_b[k]->mbr))
+					join_pair(pool, worker, members_a[i], members_b[k], height_a);
+			}
+
+			i++;
+		} else {
+			for (k = i; k < num_a && members_a[k]->mbr->min_x <= members_b[j]->mbr->max_x; k++) {
+				if (mbr_overlaps(members_a[k]->mbr, members_b[j]->mbr))
+					join_pair(pool, worker, members_a[k], members_b[j], height_a);
+			}
+
+			j++;
+		}
+	}
+}
+
+
+// Finds every pair of overlapping leaf-level index_records between the trees rooted at root_a and root_b, using
+// num_threads workers. callback may be NULL if only the count is needed. Returns the number of pairs found
+long spatial_join(r_tree_node *root_a, r_tree_node *root_b, int num_threads, join_callback callback, void *arg) {
+	join_counter *counters = (join_counter *)aligned_alloc(CACHE_LINE_SIZE, sizeof(join_counter) * num_threads);
+	long found = 0;
+	int i;
+
+	if (counters == NULL) {
+		fprintf(stderr, "Malloc failed in spatial_join(). Exiting program\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_threads; i++)
+		counters[i].found = 0;
+
+	join_context context = {callback, arg, counters};
+	work_pool *pool = create_work_pool(num_threads, join_nodes, &context);
+	work_task root_task = {root_a, root_b, join_task_id(tree_height(root_a), tree_height(root_b))};
+
+	submit_task(pool, 0, &root_task);
+	run_work_pool(pool);
+
+	for (i = 0; i < num_threads; i++)
+		found += counters[i].found;
+
+	free_work_pool(pool);
+	free(counters);
+
+	return found;
+}
@@ -0,0 +1,31 @@
+#ifndef _spatial_join_h
+#define _spatial_join_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "work_pool.h"
+
+/* Spatial join of two r-trees.
+*
+* Both trees are descended together as pairs of nodes, starting from the two roots. Within a pair, only the members
+* overlapping the other node's MBR are kept, and the overlapping pairs among them are found by a plane sweep along x
+* (both sides sorted by min_x, so each member is only tested against the members of the other side whose x range it
+* meets). Every overlapping pair of internal members becomes a new task on a work_pool, so the independent parts of the
+* join spread over the workers as they are discovered. When the trees have different heights, the taller one is
+* descended on its own until the two line up.
+*
+* Results are handed to a callback together with the worker that found them, so callers can collect them into
+* per-worker buffers without locking
+*/
+
+// Called once for every pair of leaf-level index_records (a from the first tree, b from the second) whose MBRs overlap
+typedef void (*join_callback)(index_record *a, index_record *b, int worker, void *arg);
+
+
+// Finds every pair of overlapping leaf-level index_records between the trees rooted at root_a and root_b, using
+// num_threads workers. callback may be NULL if only the count is needed. Returns the number of pairs found
+long spatial_join(r_tree_node *root_a, r_tree_node *root_b, int num_threads, join_callback callback, void *arg);
+
+
+#endif
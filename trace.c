@@ -0,0 +1,310 @@
+#include "r_tree.h"
+#include "math_utils.h"
+#include "work_pool.h"
+#include "trace.h"
+
+
+// Nanoseconds from start to end
+static int64_t nanoseconds_between(struct timespec *start, struct timespec *end) {
+	return (int64_t)(end->tv_sec - start->tv_sec) * 1000000000 + (end->tv_nsec - start->tv_nsec);
+}
+
+
+static void write_header(FILE *f, long num_entries) {
+	trace_header header = {TRACE_MAGIC, TRACE_VERSION, num_entries};
+
+	fseek(f, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, f);
+}
+
+
+// Creates (or truncates) the trace file at path and returns a recorder writing to it. Returns NULL if the file can't be
+// opened
+trace_recorder *open_trace_recorder(const char *path) {
+	FILE *f = fopen(path, "wb");
+
+	if (f == NULL)
+		return NULL;
+
+	trace_recorder *recorder = (trace_recorder *)malloc(sizeof(trace_recorder));
+
+	if (recorder == NULL) {
+		fprintf(stderr, "Malloc failed in open_trace_recorder(). Exiting program\n");
+		exit(1);
+	}
+
+	// Rewritten with the real number of entries by close_trace_recorder
+	write_header(f, 0);
+
+	recorder->f = f;
+	recorder->num_entries = 0;
+	pthread_mutex_init(&recorder->lock, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &recorder->last);
+
+	return recorder;
+}
+
+
+// Appends an operation on mbr (and the record id, for inserts and deletes) to the trace
+void record_operation(trace_recorder *recorder, trace_op op, MBR *mbr, record_id id) {
+	trace_entry entry = {op, 0, id, mbr->min_x, mbr->min_y, mbr->max_x, mbr->max_y};
+	struct timespec now;
+
+	pthread_mutex_lock(&recorder->lock);
+
+	// Taken under the lock, so the deltas of the entries are never negative
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t delta = nanoseconds_between(&recorder->last, &now);
+
+	entry.delta_ns = delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta;
+	recorder->last = now;
+
+	fwrite(&entry, sizeof(entry), 1, recorder->f);
+	recorder->num_entries++;
+
+	pthread_mutex_unlock(&recorder->lock);
+}
+
+
+// Writes the final header and closes the file
+void close_trace_recorder(trace_recorder *recorder) {
+	write_header(recorder->f, recorder->num_entries);
+	fclose(recorder->f);
+	pthread_mutex_destroy(&recorder->lock);
+	free(recorder);
+}
+
+
+// Same as insert, recording the insertion of ir
+void traced_insert(trace_recorder *recorder, r_tree_node **root, index_record *ir, int num_threads) {
+	record_operation(recorder, TRACE_INSERT, ir->mbr, ir->id);
+	insert(root, ir, num_threads);
+}
+
+
+// Same as search, recording the search
+long traced_search(trace_recorder *recorder, r_tree_node *root, MBR *window, search_callback callback, void *arg) {
+	record_operation(recorder, TRACE_SEARCH, window, 0);
+	return search(root, window, callback, arg);
+}
+
+
+// Same as delete_record, recording the deletion
+index_record *traced_delete(trace_recorder *recorder, r_tree_node **root, MBR *mbr, record_id id) {
+	record_operation(recorder, TRACE_DELETE, mbr, id);
+	return delete_record(root, mbr, id);
+}
+
+
+// Reads the trace file at path. Returns NULL if it can't be read or isn't a trace
+trace *load_trace(const char *path) {
+	FILE *f = fopen(path, "rb");
+	trace_header header;
+
+	if (f == NULL)
+		return NULL;
+
+	if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION || header.num_entries < 0) {
+		fclose(f);
+		return NULL;
+	}
+
+	trace *t = (trace *)malloc(sizeof(trace));
+	trace_entry *entries = (trace_entry *)malloc(sizeof(trace_entry) * (header.num_entries > 0 ? header.num_entries : 1));
+
+	if (t == NULL || entries == NULL) {
+		fprintf(stderr, "Malloc failed in load_trace(). Exiting program\n");
+		exit(1);
+	}
+
+	// A trace whose recorder was never closed has a header count of 0 and nothing is read from it
+	if ((long)fread(entries, sizeof(trace_entry), header.num_entries, f) != header.num_entries) {
+		free(entries);
+		free(t);
+		fclose(f);
+		return NULL;
+	}
+
+	fclose(f);
+
+	t->entries = entries;
+	t->num_entries = header.num_entries;
+
+	return t;
+}
+
+
+void free_trace(trace *t) {
+	free(t->entries);
+	free(t);
+}
+
+
+typedef struct replay_context {
+	trace *t;
+	r_tree_node **root;
+	pthread_rwlock_t lock;
+	bool paced;
+
+	struct timespec start;
+
+	// When each operation is due, counting from start, and how long it took
+	int64_t *due_ns;
+	double *latencies;
+
+	atomic_long next_op;
+	atomic_long found;
+} replay_context;
+
+
+// Hands out the operations in trace order
+static bool next_operation(work_pool *pool, int worker, work_task *task) {
+	replay_context *context = (replay_context *)pool->context;
+	long op = atomic_fetch_add(&context->next_op, 1);
+
+	if (op >= context->t->num_entries)
+		return false;
+
+	task->first = NULL;
+	task->second = NULL;
+	task->id = op;
+
+	return true;
+}
+
+
+// Adds ns nanoseconds to time
+static void add_nanoseconds(struct timespec *time, int64_t ns) {
+	int64_t total = time->tv_nsec + ns;
+
+	time->tv_sec += total / 1000000000;
+	time->tv_nsec = total % 1000000000;
+}
+
+
+// Waits until due. The last REPLAY_SPIN_NS are spun through rather than slept, as a sleep overshoots by more than the
+// gap between most operations of a trace
+static void wait_until(struct timespec *due) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t remaining = nanoseconds_between(&now, due);
+
+	if (remaining > REPLAY_SPIN_NS) {
+		struct timespec wake = now;
+
+		add_nanoseconds(&wake, remaining - REPLAY_SPIN_NS);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+	}
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (nanoseconds_between(&now, due) > 0);
+}
+
+
+// Replays the operation in task
+static void replay_operation(work_pool *pool, int worker, work_task *task) {
+	replay_context *context = (replay_context *)pool->context;
+	trace_entry *entry = &context->t->entries[task->id];
+	struct timespec begin, end;
+
+	MBR mbr = {coord_floor(entry->min_x), coord_floor(entry->min_y), coord_ceil(entry->max_x), coord_ceil(entry->max_y)};
+
+	if (context->paced) {
+		begin = context->start;
+		add_nanoseconds(&begin, context->due_ns[task->id]);
+		wait_until(&begin);
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+	}
+
+	switch (entry->op) {
+	case TRACE_INSERT:
+		pthread_rwlock_wrlock(&context->lock);
+		insert(context->root, initialize_record(copy_mbr(&mbr), entry->id), 1);
+		pthread_rwlock_unlock(&context->lock);
+		break;
+	case TRACE_SEARCH:
+		pthread_rwlock_rdlock(&context->lock);
+		atomic_fetch_add(&context->found, search(*context->root, &mbr, NULL, NULL));
+		pthread_rwlock_unlock(&context->lock);
+		break;
+	case TRACE_DELETE: {
+		pthread_rwlock_wrlock(&context->lock);
+		index_record *ir = delete_record(context->root, &mbr, entry->id);
+		pthread_rwlock_unlock(&context->lock);
+
+		if (ir != NULL)
+			free_entry(ir);
+		break;
+	}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	context->latencies[task->id] = nanoseconds_between(&begin, &end) / 1000000000.0;
+}
+
+
+// Applies every operation of t to the tree rooted at *root on num_threads threads, at the pacing of the trace if paced
+// and as fast as possible otherwise, and writes the throughput and latencies to stats. Inserted records are created by
+// the replay, deleted ones are freed by it
+void replay_trace(trace *t, r_tree_node **root, int num_threads, bool paced, replay_stats *stats) {
+	long num_entries = t->num_entries;
+	replay_context context;
+	struct timespec end;
+	int64_t due = 0;
+	long i;
+
+	context.t = t;
+	context.root = root;
+	context.paced = paced;
+	context.due_ns = (int64_t *)malloc(sizeof(int64_t) * (num_entries > 0 ? num_entries : 1));
+	context.latencies = (double *)malloc(sizeof(double) * (num_entries > 0 ? num_entries : 1));
+	atomic_init(&context.next_op, 0);
+	atomic_init(&context.found, 0);
+	pthread_rwlock_init(&context.lock, NULL);
+
+	if (context.due_ns == NULL || context.latencies == NULL) {
+		fprintf(stderr, "Malloc failed in replay_trace(). Exiting program\n");
+		exit(1);
+	}
+
+	memset(stats, 0, sizeof(replay_stats));
+	stats->num_threads = num_threads;
+	stats->paced = paced;
+
+	for (i = 0; i < num_entries; i++) {
+		due += t->entries[i].delta_ns;
+		context.due_ns[i] = due;
+
+		if (t->entries[i].op < NUM_TRACE_OPS)
+			stats->num_ops[t->entries[i].op]++;
+	}
+
+	work_pool *pool = create_work_pool(num_threads, replay_operation, &context);
+	pool->source = next_operation;
+
+	clock_gettime(CLOCK_MONOTONIC, &context.start);
+	run_work_pool(pool);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	free_work_pool(pool);
+
+	stats->wall_seconds = nanoseconds_between(&context.start, &end) / 1000000000.0;
+	stats->records_found = atomic_load(&context.found);
+
+	if (num_entries > 0) {
+		qsort(context.latencies, num_entries, sizeof(double), compare_doubles);
+
+		stats->p50 = percentile(context.latencies, num_entries, 0.5);
+		stats->p90 = percentile(context.latencies, num_entries, 0.9);
+		stats->p99 = percentile(context.latencies, num_entries, 0.99);
+		stats->p999 = percentile(context.latencies, num_entries, 0.999);
+		stats->max = percentile(context.latencies, num_entries, 1);
+	}
+
+	pthread_rwlock_destroy(&context.lock);
+	free(context.due_ns);
+	free(context.latencies);
+}
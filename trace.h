@@ -0,0 +1,134 @@
+#ifndef _trace_h
+#define _trace_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Capture and replay of the operations applied to a tree.
+*
+* A trace_recorder appends one fixed-size trace_entry per insert, search or delete to a binary file: the operation,
+* the nanoseconds since the operation before it, the record id and the MBR (stored as doubles whatever COORD is, so a
+* trace replays on any build). The file starts with a trace_header and is written in host byte order. Recording is
+* safe from several threads at once, the entries being written in the order the operations reached the recorder.
+*
+* replay_trace applies a loaded trace to a tree on num_threads threads, either as fast as it can or at the pacing the
+* trace was recorded at. Operations are handed out to the threads in trace order; searches run side by side under a
+* read lock, while inserts and deletes hold it on their own. With one thread the replay is exactly the recorded
+* sequence, with more, operations handed out close together may take the lock in either order. Latencies of a paced
+* replay count from the time an operation was due rather than from when it started, so a replay falling behind the
+* trace shows up in them
+*/
+
+// "RTRC" in a little-endian file
+#define TRACE_MAGIC 0x43525452
+#define TRACE_VERSION 1
+
+// A paced replay sleeps until this many nanoseconds before an operation is due and spins through the rest
+#define REPLAY_SPIN_NS 200000
+
+
+typedef enum trace_op {
+	TRACE_INSERT,
+	TRACE_SEARCH,
+	TRACE_DELETE,
+	NUM_TRACE_OPS
+} trace_op;
+
+
+typedef struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t num_entries;
+} trace_header;
+
+
+typedef struct trace_entry {
+	uint32_t op;
+
+	// Nanoseconds since the previous operation, capped at UINT32_MAX (a little over 4 seconds)
+	uint32_t delta_ns;
+
+	// The id of an inserted or deleted record, 0 for searches
+	int64_t id;
+
+	// The record's MBR, or the search window
+	double min_x;
+	double min_y;
+	double max_x;
+	double max_y;
+} trace_entry;
+
+
+typedef struct trace_recorder {
+	FILE *f;
+	pthread_mutex_t lock;
+	struct timespec last;
+	long num_entries;
+} trace_recorder;
+
+
+typedef struct trace {
+	trace_entry *entries;
+	long num_entries;
+} trace;
+
+
+typedef struct replay_stats {
+	int num_threads;
+	bool paced;
+
+	long num_ops[NUM_TRACE_OPS];
+	long records_found;
+	double wall_seconds;
+
+	// Percentiles of the latencies of every operation, in seconds
+	double p50;
+	double p90;
+	double p99;
+	double p999;
+	double max;
+} replay_stats;
+
+
+// Creates (or truncates) the trace file at path and returns a recorder writing to it. Returns NULL if the file can't be
+// opened
+trace_recorder *open_trace_recorder(const char *path);
+
+
+// Appends an operation on mbr (and the record id, for inserts and deletes) to the trace
+void record_operation(trace_recorder *recorder, trace_op op, MBR *mbr, record_id id);
+
+
+// Writes the final header and closes the file
+void close_trace_recorder(trace_recorder *recorder);
+
+
+// Same as insert, recording the insertion of ir
+void traced_insert(trace_recorder *recorder, r_tree_node **root, index_record *ir, int num_threads);
+
+
+// Same as search, recording the search
+long traced_search(trace_recorder *recorder, r_tree_node *root, MBR *window, search_callback callback, void *arg);
+
+
+// Same as delete_record, recording the deletion
+index_record *traced_delete(trace_recorder *recorder, r_tree_node **root, MBR *mbr, record_id id);
+
+
+// Reads the trace file at path. Returns NULL if it can't be read or isn't a trace
+trace *load_trace(const char *path);
+
+
+void free_trace(trace *t);
+
+
+// Applies every operation of t to the tree rooted at *root on num_threads threads, at the pacing of the trace if paced
+// and as fast as possible otherwise, and writes the throughput and latencies to stats. Inserted records are created by
+// the replay, deleted ones are freed by it
+void replay_trace(trace *t, r_tree_node **root, int num_threads, bool paced, replay_stats *stats);
+
+
+#endif
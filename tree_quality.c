@@ -0,0 +1,515 @@
+#include "r_tree.h"
+#include "math_utils.h"
+#include "bulk_load.h"
+#include "tree_quality.h"
+
+
+// A subtree repack_step might rebuild, and the slot pointing to it (parent is NULL for the root)
+typedef struct repack_candidate {
+	r_tree_node *node;
+	r_tree_node *parent;
+	int index;
+	double score;
+} repack_candidate;
+
+
+typedef struct candidate_list {
+	repack_candidate *candidates;
+	long num_candidates;
+	long capacity;
+} candidate_list;
+
+
+static void retire_node(void *ptr) {
+	free_node((r_tree_node *)ptr);
+}
+
+
+static void retire_entry(void *ptr) {
+	free_entry((index_record *)ptr);
+}
+
+
+// Writes the MBR of node's members to mbr. node must not be empty
+static void members_mbr(r_tree_node *node, MBR *mbr) {
+	int i;
+
+	*mbr = *node->index_records[0]->mbr;
+
+	for (i = 1; i < node->num_members; i++)
+		expand_mbr(mbr, node->index_records[i]->mbr);
+}
+
+
+// Sum of the overlapping area of every pair of node's members
+static double members_overlap(r_tree_node *node) {
+	double overlap = 0;
+	int i, j;
+
+	for (i = 0; i < node->num_members; i++)
+		for (j = i + 1; j < node->num_members; j++)
+			overlap += get_overlapping_area(node->index_records[i]->mbr, node->index_records[j]->mbr);
+
+	return overlap;
+}
+
+
+// Adds node and everything below it, depth levels below the root, to metrics
+static void measure_node(r_tree_node *node, int depth, tree_metrics *metrics) {
+	level_metrics *level = &metrics->levels[depth];
+	double members_area = 0;
+	double overlap, dead_space;
+	MBR mbr;
+	int i;
+
+	level->num_nodes++;
+	level->num_entries += node->num_members;
+
+	// fill_factor holds the room of the level's nodes until measure_tree divides
+	level->fill_factor += node->max_members;
+
+	if (node->num_members == 0)
+		return;
+
+	for (i = 0; i < node->num_members; i++)
+		members_area += get_area(node->index_records[i]->mbr);
+
+	overlap = members_overlap(node);
+	members_mbr(node, &mbr);
+	dead_space = get_area(&mbr) - (members_area - overlap);
+
+	level->overlap += overlap;
+	level->dead_space += dead_space > 0 ? dead_space : 0;
+	level->area += members_area;
+
+	if (is_leaf(node))
+		return;
+
+	for (i = 0; i < node->num_members; i++)
+		measure_node(node->index_records[i]->child, depth + 1, metrics);
+}
+
+
+// Fills in metrics for the tree rooted at root
+void measure_tree(r_tree_node *root, tree_metrics *metrics) {
+	long num_slots = 0;
+	long num_entries = 0;
+	int depth;
+
+	memset(metrics, 0, sizeof(tree_metrics));
+	metrics->height = tree_height(root);
+	measure_node(root, 0, metrics);
+
+	for (depth = 0; depth < metrics->height; depth++) {
+		level_metrics *level = &metrics->levels[depth];
+
+		num_slots += (long) level->fill_factor;
+		num_entries += level->num_entries;
+		level->fill_factor = level->num_entries / level->fill_factor;
+
+		metrics->num_nodes += level->num_nodes;
+		metrics->overlap += level->overlap;
+		metrics->dead_space += level->dead_space;
+	}
+
+	metrics->num_records = metrics->levels[metrics->height - 1].num_entries;
+	metrics->fill_factor = (double)num_entries / num_slots;
+}
+
+
+// Prints metrics, one line for the tree and one for every level, prefixed by name
+void print_tree_metrics(const char *name, tree_metrics *metrics) {
+	int depth;
+
+	fprintf(stderr, "%s: height %d, %ld nodes, %ld records, fill %.3f, overlap %.1f, dead space %.1f\n", name, metrics->height,
+		metrics->num_nodes, metrics->num_records, metrics->fill_factor, metrics->overlap, metrics->dead_space);
+
+	for (depth = 0; depth < metrics->height; depth++) {
+		level_metrics *level = &metrics->levels[depth];
+
+		fprintf(stderr, "  level %d: %ld nodes, %ld entries, fill %.3f, overlap %.1f, dead space %.1f, area %.1f\n", depth,
+			level->num_nodes, level->num_entries, level->fill_factor, level->overlap, level->dead_space, level->area);
+	}
+}
+
+
+// Number of nodes search() visits to search window
+long count_node_visits(r_tree_node *root, MBR *window) {
+	long visits = 1;
+	int i;
+
+	if (is_leaf(root))
+		return visits;
+
+	for (i = 0; i < root->num_members; i++) {
+		if (mbr_overlaps(root->index_records[i]->mbr, window))
+			visits += count_node_visits(root->index_records[i]->child, window);
+	}
+
+	return visits;
+}
+
+
+// Overlap between the members of node and of the nodes right below it (unless those are leaves), over the area of
+// node's MBR
+double subtree_score(r_tree_node *node) {
+	double overlap;
+	double area;
+	MBR mbr;
+	int i;
+
+	if (node->num_members == 0)
+		return 0;
+
+	overlap = members_overlap(node);
+
+	// Overlap between the records themselves is down to the data, and no packing changes it
+	if (!is_leaf(node) && !is_leaf(node->index_records[0]->child)) {
+		for (i = 0; i < node->num_members; i++)
+			overlap += members_overlap(node->index_records[i]->child);
+	}
+
+	members_mbr(node, &mbr);
+	area = get_area(&mbr);
+
+	return area > 0 ? overlap / area : 0;
+}
+
+
+static void add_candidate(candidate_list *list, r_tree_node *node, r_tree_node *parent, int index) {
+	if (list->num_candidates == list->capacity) {
+		list->capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+		list->candidates = (repack_candidate *)realloc(list->candidates, sizeof(repack_candidate) * list->capacity);
+
+		if (list->candidates == NULL) {
+			fprintf(stderr, "Malloc failed in add_candidate(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	repack_candidate *candidate = &list->candidates[list->num_candidates++];
+	candidate->node = node;
+	candidate->parent = parent;
+	candidate->index = index;
+	candidate->score = subtree_score(node);
+}
+
+
+// Adds every node depth levels below node to list
+static void collect_candidates(candidate_list *list, r_tree_node *node, int depth) {
+	int i;
+
+	for (i = 0; i < node->num_members; i++) {
+		r_tree_node *child = node->index_records[i]->child;
+
+		if (depth == 1)
+			add_candidate(list, child, node, i);
+		else
+			collect_candidates(list, child, depth - 1);
+	}
+}
+
+
+static int compare_score(const void *a, const void *b) {
+	double score_a = ((repack_candidate *)a)->score;
+	double score_b = ((repack_candidate *)b)->score;
+	return (score_a < score_b) - (score_a > score_b);
+}
+
+
+// Number of leaf-level index_records below node
+static long count_records(r_tree_node *node) {
+	long num_records = 0;
+	int i;
+
+	if (is_leaf(node))
+		return node->num_members;
+
+	for (i = 0; i < node->num_members; i++)
+		num_records += count_records(node->index_records[i]->child);
+
+	return num_records;
+}
+
+
+// Writes the leaf-level index_records below node to records, returning how many there are
+static long collect_records(r_tree_node *node, index_record **records) {
+	long num_records = 0;
+	int i;
+
+	if (is_leaf(node)) {
+		memcpy(records, node->index_records, sizeof(index_record *) * node->num_members);
+		return node->num_members;
+	}
+
+	for (i = 0; i < node->num_members; i++)
+		num_records += collect_records(node->index_records[i]->child, records + num_records);
+
+	return num_records;
+}
+
+
+// Hands every node of the subtree rooted at node, and every internal index_record in it, to the epoch_domain
+static void retire_subtree(concurrent_tree *ct, r_tree_node *node) {
+	int i;
+
+	if (!is_leaf(node)) {
+		for (i = 0; i < node->num_members; i++) {
+			r_tree_node *child = node->index_records[i]->child;
+
+			retire_subtree(ct, child);
+
+			if (!child->embeds_entry)
+				epoch_retire(ct->epochs, node->index_records[i], retire_entry);
+		}
+	}
+
+	epoch_retire(ct->epochs, node, retire_node);
+}
+
+
+// Frees the nodes of a subtree no reader has seen, leaving its leaf-level index_records alone
+static void discard_subtree(r_tree_node *node) {
+	int i;
+
+	if (!is_leaf(node)) {
+		for (i = 0; i < node->num_members; i++)
+			discard_subtree(node->index_records[i]->child);
+	}
+
+	free_node(node);
+}
+
+
+#if BACK_POINTERS
+// Points the leaf-level index_records below node back at the leaves holding them
+static void restore_hosts(r_tree_node *node) {
+	int i;
+
+	for (i = 0; i < node->num_members; i++) {
+		if (is_leaf(node)) {
+			node->index_records[i]->host = node;
+			node->index_records[i]->index = i;
+		} else {
+			restore_hosts(node->index_records[i]->child);
+		}
+	}
+}
+#endif
+
+
+// Rebuilds the subtree candidate points to, height levels tall, and swaps it in. Returns the root of the new subtree,
+// or NULL (leaving the old one in place) if the rebuilt subtree scores no better
+static r_tree_node *repack_subtree(concurrent_tree *ct, repack_candidate *candidate, int height) {
+	r_tree_node *node = candidate->node;
+	long num_records = count_records(node);
+	index_record **records = (index_record **)malloc(sizeof(index_record *) * num_records);
+	r_tree_node *rebuilt;
+
+	if (records == NULL) {
+		fprintf(stderr, "Malloc failed in repack_subtree(). Exiting program\n");
+		exit(1);
+	}
+
+	collect_records(node, records);
+	rebuilt = bulk_load_height(records, num_records, node->max_members, height);
+	free(records);
+
+	// A small subtree can already be packed as well as its records allow
+	if (subtree_score(rebuilt) >= candidate->score) {
+		discard_subtree(rebuilt);
+#if BACK_POINTERS
+		restore_hosts(node);
+#endif
+		return NULL;
+	}
+
+	if (candidate->parent == NULL) {
+		atomic_store_explicit(&ct->root, rebuilt, memory_order_release);
+	} else {
+		r_tree_node *parent = candidate->parent;
+		index_record *old_ir = parent->index_records[candidate->index];
+		MBR mbr;
+
+		members_mbr(rebuilt, &mbr);
+
+		index_record *new_ir = initialize_ir(copy_mbr(&mbr));
+		new_ir->child = rebuilt;
+		sum_members(rebuilt, &new_ir->agg);
+#if BACK_POINTERS
+		rebuilt->parent = new_ir;
+		new_ir->host = parent;
+		new_ir->index = candidate->index;
+#endif
+		__atomic_store_n(&parent->index_records[candidate->index], new_ir, __ATOMIC_RELEASE);
+
+		if (!node->embeds_entry)
+			epoch_retire(ct->epochs, old_ir, retire_entry);
+	}
+
+	// Readers that started before the swap may still be in the old nodes
+	retire_subtree(ct, node);
+	return rebuilt;
+}
+
+
+static int compare_packed_node(const void *a, const void *b) {
+	uintptr_t node_a = (uintptr_t)((packed_subtree *)a)->node;
+	uintptr_t node_b = (uintptr_t)((packed_subtree *)b)->node;
+	return (node_a > node_b) - (node_a < node_b);
+}
+
+
+// Returns the entry of history for node, or NULL if it wasn't repacked (or has been replaced since)
+static packed_subtree *find_packed(repack_history *history, r_tree_node *node) {
+	packed_subtree key = { node, 0 };
+
+	if (history->num_subtrees == 0)
+		return NULL;
+
+	return (packed_subtree *)bsearch(&key, history->subtrees, history->num_subtrees, sizeof(packed_subtree), compare_packed_node);
+}
+
+
+static void add_packed(repack_history *history, r_tree_node *node, double score) {
+	if (history->num_subtrees == history->capacity) {
+		history->capacity = history->capacity > 0 ? history->capacity * 2 : 64;
+		history->subtrees = (packed_subtree *)realloc(history->subtrees, sizeof(packed_subtree) * history->capacity);
+
+		if (history->subtrees == NULL) {
+			fprintf(stderr, "Malloc failed in add_packed(). Exiting program\n");
+			exit(1);
+		}
+	}
+
+	history->subtrees[history->num_subtrees].node = node;
+	history->subtrees[history->num_subtrees].score = score;
+	history->num_subtrees++;
+}
+
+
+// Frees the memory history holds, leaving it empty
+void clear_repack_history(repack_history *history) {
+	free(history->subtrees);
+	history->subtrees = NULL;
+	history->num_subtrees = 0;
+	history->capacity = 0;
+}
+
+
+// Repacks the worst subtrees of ct as described above, skipping those history says are still packed well enough, and
+// updates history. history may be NULL to consider every subtree. Returns how many were repacked
+long repack_step(concurrent_tree *ct, repack_options *options, repack_history *history) {
+	candidate_list list = { NULL, 0, 0 };
+	repack_history packed = { NULL, 0, 0 };
+	struct timespec start;
+	long num_repacked = 0;
+	long i;
+
+	pthread_mutex_lock(&ct->writer_lock);
+
+	r_tree_node *root = atomic_load_explicit(&ct->root, memory_order_relaxed);
+	int tree_levels = tree_height(root);
+	int height = options->height < tree_levels ? options->height : tree_levels;
+
+	if (root->num_members == 0) {
+		pthread_mutex_unlock(&ct->writer_lock);
+		return 0;
+	}
+
+	if (height == tree_levels)
+		add_candidate(&list, root, NULL, -1);
+	else
+		collect_candidates(&list, root, tree_levels - height);
+
+	// Subtrees packed by an earlier step that haven't got noticeably worse since are left alone, and carried over.
+	// Those no longer among the candidates were replaced by splits and are forgotten
+	for (i = 0; history != NULL && i < list.num_candidates; i++) {
+		repack_candidate *candidate = &list.candidates[i];
+		packed_subtree *earlier = find_packed(history, candidate->node);
+
+		if (earlier != NULL && candidate->score <= earlier->score * (1 + REPACK_RESCORE_MARGIN)) {
+			add_packed(&packed, candidate->node, earlier->score);
+			candidate->score = -1;
+		}
+	}
+
+	qsort(list.candidates, list.num_candidates, sizeof(repack_candidate), compare_score);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < list.num_candidates && seconds_since(&start) < options->budget_seconds; i++) {
+		if (list.candidates[i].score <= options->threshold)
+			break;
+
+		r_tree_node *rebuilt = repack_subtree(ct, &list.candidates[i], height);
+
+		if (rebuilt != NULL) {
+			add_packed(&packed, rebuilt, subtree_score(rebuilt));
+			num_repacked++;
+		} else {
+			add_packed(&packed, list.candidates[i].node, list.candidates[i].score);
+		}
+	}
+
+	pthread_mutex_unlock(&ct->writer_lock);
+	free(list.candidates);
+
+	if (history != NULL) {
+		qsort(packed.subtrees, packed.num_subtrees, sizeof(packed_subtree), compare_packed_node);
+		clear_repack_history(history);
+		*history = packed;
+	} else {
+		clear_repack_history(&packed);
+	}
+
+	return num_repacked;
+}
+
+
+static void *run_repacker(void *arg) {
+	repacker *rp = (repacker *)arg;
+	struct timespec start;
+
+	while (!atomic_load(&rp->stop)) {
+		atomic_fetch_add(&rp->num_repacked, repack_step(rp->ct, &rp->options, &rp->history));
+		atomic_fetch_add(&rp->num_steps, 1);
+
+		// Sleep in short naps so that stop_repacker doesn't have to wait out a long interval
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		while (!atomic_load(&rp->stop) && seconds_since(&start) < rp->options.interval_seconds)
+			usleep(1000);
+	}
+
+	return NULL;
+}
+
+
+// Starts a thread running repack_step every options->interval_seconds
+repacker *start_repacker(concurrent_tree *ct, repack_options *options) {
+	repacker *rp = (repacker *)malloc(sizeof(repacker));
+
+	if (rp == NULL) {
+		fprintf(stderr, "Malloc failed in start_repacker(). Exiting program\n");
+		exit(1);
+	}
+
+	rp->ct = ct;
+	rp->options = *options;
+	atomic_init(&rp->stop, false);
+	atomic_init(&rp->num_steps, 0);
+	atomic_init(&rp->num_repacked, 0);
+	rp->history = (repack_history){ NULL, 0, 0 };
+
+	pthread_create(&rp->thread, NULL, run_repacker, rp);
+	return rp;
+}
+
+
+// Stops and frees the repacker, waiting for the step it may be running
+void stop_repacker(repacker *rp) {
+	atomic_store(&rp->stop, true);
+	pthread_join(rp->thread, NULL);
+	clear_repack_history(&rp->history);
+	free(rp);
+}
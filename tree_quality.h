@@ -0,0 +1,147 @@
+#ifndef _tree_quality_h
+#define _tree_quality_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "concurrent_tree.h"
+
+/* Tree quality metrics, and a background reorganiser that repacks the worst subtrees of a concurrent_tree.
+*
+* measure_tree reports, for the whole tree and for every level (0 being the root, as in write_tree_pre_order), how
+* full the nodes are, how much the MBRs of sibling index_records overlap (get_overlapping_area, summed over every pair
+* in a node) and how much dead space nodes cover, that is the area of a node's MBR not covered by any of its members.
+* Dead space is worked out from get_area by inclusion-exclusion up to pairs of members, which is exact unless three or
+* more members overlap at the same spot.
+*
+* repack_step looks at every subtree whose root is options->height levels above the leaves and scores it by the
+* overlap between the members of its root and of the nodes right below (but not between the records themselves),
+* relative to the area it covers. It then rebuilds the worst subtrees (score above options->threshold, worst first)
+* with Sort-Tile-Recursive packing, keeping their height and spreading the records evenly over it (bulk_load_height),
+* until options->budget_seconds (not counting the scoring) is used up. A rebuilt subtree that scores no better than
+* the old one is thrown away again. Like a split in concurrent_insert, each rebuilt subtree is built privately and
+* swapped in with a single atomic store (of the parent's index_record slot, or of the root), so lock-free readers see
+* either the old subtree or the new one. The old nodes are retired through the tree's epoch_domain; the leaf-level
+* index_records are moved over, not copied. A step holds writer_lock throughout, scoring included, so writers wait
+* for it.
+*
+* A repack_history remembers the subtrees a step rebuilt, or found it couldn't improve, and their score then. Later
+* steps leave them alone until their score has grown by more than REPACK_RESCORE_MARGIN, since packing the same records
+* again would give much the same subtree. A subtree that a split has replaced since is a new node, and is scored
+* afresh.
+*
+* start_repacker runs repack_step on its own thread every options->interval_seconds until stop_repacker is called
+*/
+
+// Growth in score, relative to its score right after being repacked, before a subtree is considered again
+#define REPACK_RESCORE_MARGIN 0.25
+
+// Score below which subtrees are left alone, unless the caller asks for another threshold
+#define REPACK_DEFAULT_THRESHOLD 0.5
+
+
+typedef struct level_metrics {
+	long num_nodes;
+	long num_entries;
+
+	// num_entries over the room the level's nodes have
+	double fill_factor;
+
+	double overlap;
+	double dead_space;
+
+	// Combined area of the MBRs of the level's index_records
+	double area;
+} level_metrics;
+
+
+typedef struct tree_metrics {
+	int height;
+	long num_nodes;
+	long num_records;
+	double fill_factor;
+	double overlap;
+	double dead_space;
+
+	level_metrics levels[MAX_TREE_HEIGHT];
+} tree_metrics;
+
+
+typedef struct repack_options {
+	// Height of the subtrees repacked, counting leaves as 1. Taller than the tree means the whole tree
+	int height;
+
+	// Subtrees scoring at or below this are left alone
+	double threshold;
+
+	// Longest a step may go on repacking, and how long the background thread waits between steps
+	double budget_seconds;
+	double interval_seconds;
+} repack_options;
+
+
+typedef struct packed_subtree {
+	r_tree_node *node;
+	double score;
+} packed_subtree;
+
+
+// The subtrees repacked by earlier steps, sorted by node address. Starts out as { NULL, 0, 0 }
+typedef struct repack_history {
+	packed_subtree *subtrees;
+	long num_subtrees;
+	long capacity;
+} repack_history;
+
+
+typedef struct repacker {
+	concurrent_tree *ct;
+	repack_options options;
+	repack_history history;
+	pthread_t thread;
+	atomic_bool stop;
+
+	// For benchmarking
+	atomic_long num_steps;
+	atomic_long num_repacked;
+} repacker;
+
+
+// Fills in metrics for the tree rooted at root
+void measure_tree(r_tree_node *root, tree_metrics *metrics);
+
+
+// Prints metrics, one line for the tree and one for every level, prefixed by name
+void print_tree_metrics(const char *name, tree_metrics *metrics);
+
+
+// Number of nodes search() visits to search window
+long count_node_visits(r_tree_node *root, MBR *window);
+
+
+// Overlap between the members of node and of the nodes right below it (unless those are leaves), over the area of
+// node's MBR
+double subtree_score(r_tree_node *node);
+
+
+// Repacks the worst subtrees of ct as described above, skipping those history says are still packed well enough, and
+// updates history. history may be NULL to consider every subtree. Returns how many were repacked
+long repack_step(concurrent_tree *ct, repack_options *options, repack_history *history);
+
+
+// Frees the memory history holds, leaving it empty
+void clear_repack_history(repack_history *history);
+
+
+// Starts a thread running repack_step every options->interval_seconds
+repacker *start_repacker(concurrent_tree *ct, repack_options *options);
+
+
+// Stops and frees the repacker, waiting for the step it may be running
+void stop_repacker(repacker *rp);
+
+
+#endif
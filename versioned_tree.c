@@ -0,0 +1,226 @@
+#include "r_tree.h"
+#include "choose_leaf.h"
+#include "versioned_tree.h"
+
+
+// Frees the nodes and index_records of batch, then batch itself
+static void free_batch(retired_batch *batch) {
+	int i;
+
+	for (i = 0; i < batch->num_nodes; i++)
+		free_node((r_tree_node *)batch->items[i]);
+
+	for (i = 0; i < batch->num_entries; i++)
+		free_entry((index_record *)batch->items[batch->num_nodes + i]);
+
+	free(batch);
+}
+
+
+// Frees every retired batch no live snapshot can still see. Caller holds vt->lock
+static void reclaim_batches(versioned_tree *vt) {
+	long horizon = vt->oldest_snapshot != NULL ? vt->oldest_snapshot->version : vt->version;
+
+	while (vt->oldest_batch != NULL && vt->oldest_batch->version <= horizon) {
+		retired_batch *batch = vt->oldest_batch;
+
+		vt->oldest_batch = batch->next;
+		free_batch(batch);
+	}
+
+	if (vt->oldest_batch == NULL)
+		vt->newest_batch = NULL;
+}
+
+
+// Creates an empty versioned_tree whose nodes hold up to max_members index_records
+versioned_tree *create_versioned_tree(int max_members) {
+	versioned_tree *vt = (versioned_tree *)malloc(sizeof(versioned_tree));
+
+	if (vt == NULL) {
+		fprintf(stderr, "Malloc failed in create_versioned_tree(). Exiting program\n");
+		exit(1);
+	}
+
+	vt->root = initialize_rt(max_members);
+	vt->version = 0;
+	vt->oldest_snapshot = NULL;
+	vt->newest_snapshot = NULL;
+	vt->oldest_batch = NULL;
+	vt->newest_batch = NULL;
+	pthread_mutex_init(&vt->lock, NULL);
+
+	return vt;
+}
+
+
+// Inserts ir into a new version of the tree. Snapshots taken before keep seeing the old version.
+// num_threads works the same as in insert()
+void versioned_insert(versioned_tree *vt, index_record *ir, int num_threads) {
+	pthread_mutex_lock(&vt->lock);
+
+	if (num_threads > vt->root->max_members) {
+		fprintf(stderr, "Cannot use more threads than number of max_members in your r_tree_node\n");
+		fprintf(stderr, "Aborting insertion\n");
+		exit(1);
+	}
+
+	tree_path path;
+	tree_path copy_path;
+	int i;
+
+	if (num_threads > 1)
+		choose_leaf_parallel(vt->root, ir, num_threads, &path);
+	else
+		choose_leaf_sequential(vt->root, ir, &path);
+
+	// Every node on the path is replaced, and so is every index_record pointing to one of them,
+	// except those embedded in the node they point to, which go with it
+	index_record *replaced_irs[MAX_TREE_HEIGHT];
+	int num_replaced_irs = 0;
+
+	copy_path.depth = 0;
+
+	for (i = 0; i < path.depth; i++) {
+		r_tree_node *copy = copy_node(path.nodes[i]);
+
+		if (i > 0) {
+			r_tree_node *parent_copy = copy_path.nodes[i - 1];
+			index_record *old_ir = path.nodes[i - 1]->index_records[path.indices[i - 1]];
+			index_record *copy_ir = initialize_ir(copy_mbr(old_ir->mbr));
+
+			copy_ir->child = copy;
+			copy_ir->agg = old_ir->agg;
+			parent_copy->index_records[path.indices[i - 1]] = copy_ir;
+#if BACK_POINTERS
+			copy->parent = copy_ir;
+			copy_ir->host = parent_copy;
+			copy_ir->index = path.indices[i - 1];
+#endif
+
+			if (!path.nodes[i]->embeds_entry)
+				replaced_irs[num_replaced_irs++] = old_ir;
+		}
+
+		push_path(&copy_path, copy, path.indices[i]);
+	}
+
+	// The copies are private to this insertion, so the ordinary adjust_tree and splits can change them in place
+	r_tree_node *root = copy_path.nodes[0];
+	insert_at_node(&copy_path, ir, &root, num_threads);
+
+	vt->root = root;
+	vt->version++;
+
+	// Without a live snapshot nothing can still see the old path
+	if (vt->oldest_snapshot == NULL) {
+		for (i = 0; i < path.depth; i++)
+			free_node(path.nodes[i]);
+		for (i = 0; i < num_replaced_irs; i++)
+			free_entry(replaced_irs[i]);
+
+		pthread_mutex_unlock(&vt->lock);
+		return;
+	}
+
+	retired_batch *batch = (retired_batch *)malloc(sizeof(retired_batch) + sizeof(void *) * (path.depth + num_replaced_irs));
+
+	if (batch == NULL) {
+		fprintf(stderr, "Malloc failed in versioned_insert(). Exiting program\n");
+		exit(1);
+	}
+
+	batch->version = vt->version;
+	batch->num_nodes = path.depth;
+	batch->num_entries = num_replaced_irs;
+	batch->next = NULL;
+
+	memcpy(batch->items, path.nodes, sizeof(void *) * path.depth);
+	memcpy(batch->items + path.depth, replaced_irs, sizeof(void *) * num_replaced_irs);
+
+	if (vt->newest_batch != NULL)
+		vt->newest_batch->next = batch;
+	else
+		vt->oldest_batch = batch;
+	vt->newest_batch = batch;
+
+	pthread_mutex_unlock(&vt->lock);
+}
+
+
+// Returns a snapshot of the current version in O(1). Release it with release_snapshot once done
+tree_snapshot *take_snapshot(versioned_tree *vt) {
+	pthread_mutex_lock(&vt->lock);
+
+	tree_snapshot *snap = vt->newest_snapshot;
+
+	// Snapshots of the same version share one tree_snapshot
+	if (snap != NULL && snap->version == vt->version) {
+		snap->refs++;
+		pthread_mutex_unlock(&vt->lock);
+		return snap;
+	}
+
+	snap = (tree_snapshot *)malloc(sizeof(tree_snapshot));
+
+	if (snap == NULL) {
+		fprintf(stderr, "Malloc failed in take_snapshot(). Exiting program\n");
+		exit(1);
+	}
+
+	snap->root = vt->root;
+	snap->version = vt->version;
+	snap->refs = 1;
+	snap->next = NULL;
+	snap->prev = vt->newest_snapshot;
+
+	if (vt->newest_snapshot != NULL)
+		vt->newest_snapshot->next = snap;
+	else
+		vt->oldest_snapshot = snap;
+	vt->newest_snapshot = snap;
+
+	pthread_mutex_unlock(&vt->lock);
+	return snap;
+}
+
+
+// Drops a reference to snap, freeing whatever only it kept alive
+void release_snapshot(versioned_tree *vt, tree_snapshot *snap) {
+	pthread_mutex_lock(&vt->lock);
+
+	if (--snap->refs > 0) {
+		pthread_mutex_unlock(&vt->lock);
+		return;
+	}
+
+	if (snap->prev != NULL)
+		snap->prev->next = snap->next;
+	else
+		vt->oldest_snapshot = snap->next;
+
+	if (snap->next != NULL)
+		snap->next->prev = snap->prev;
+	else
+		vt->newest_snapshot = snap->prev;
+
+	free(snap);
+	reclaim_batches(vt);
+
+	pthread_mutex_unlock(&vt->lock);
+}
+
+
+// Same as search() in r_tree.h, on the version snap was taken of. Safe to run while insertions continue
+long snapshot_search(tree_snapshot *snap, MBR *window, search_callback callback, void *arg) {
+	return search(snap->root, window, callback, arg);
+}
+
+
+// Frees the tree (including the index_records inserted into it). Every snapshot has to be released first
+void free_versioned_tree(versioned_tree *vt) {
+	reclaim_batches(vt);
+	free_tree(vt->root);
+	pthread_mutex_destroy(&vt->lock);
+	free(vt);
+}
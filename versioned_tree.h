@@ -0,0 +1,84 @@
+#ifndef _versioned_tree_h
+#define _versioned_tree_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Copy-on-write r-tree with point-in-time snapshots.
+*
+* Every insertion copies the root-to-leaf path chosen by choose_leaf (with fresh index_records pointing to the copies)
+* and runs insert_at_node on the copies, so it ends with a new root while every untouched subtree stays shared with
+* older versions. Published nodes and MBRs are never modified again, so a snapshot is just a counted reference to one
+* root and can be searched without locks while insertions continue.
+*
+* The nodes and index_records an insertion replaced are kept until no live snapshot is older than the version that
+* replaced them. With no snapshot alive they are freed straight away
+*/
+
+typedef struct tree_snapshot {
+	r_tree_node *root;
+	long version;
+	int refs;
+
+	// Live snapshots form a list ordered by version, oldest first
+	struct tree_snapshot *prev;
+	struct tree_snapshot *next;
+} tree_snapshot;
+
+
+// The nodes and index_records replaced by the insertion that created version, freed together
+typedef struct retired_batch {
+	long version;
+	int num_nodes;
+	int num_entries;
+	struct retired_batch *next;
+
+	// num_nodes r_tree_nodes followed by num_entries index_records
+	void *items[];
+} retired_batch;
+
+
+typedef struct versioned_tree {
+	r_tree_node *root;
+	long version;
+
+	tree_snapshot *oldest_snapshot;
+	tree_snapshot *newest_snapshot;
+
+	// Oldest first
+	retired_batch *oldest_batch;
+	retired_batch *newest_batch;
+
+	// Serialises insertions with taking and releasing snapshots. Searching a snapshot needs no lock
+	pthread_mutex_t lock;
+} versioned_tree;
+
+
+// Creates an empty versioned_tree whose nodes hold up to max_members index_records
+versioned_tree *create_versioned_tree(int max_members);
+
+
+// Inserts ir into a new version of the tree. Snapshots taken before keep seeing the old version.
+// num_threads works the same as in insert()
+void versioned_insert(versioned_tree *vt, index_record *ir, int num_threads);
+
+
+// Returns a snapshot of the current version in O(1). Release it with release_snapshot once done
+tree_snapshot *take_snapshot(versioned_tree *vt);
+
+
+// Drops a reference to snap, freeing whatever only it kept alive
+void release_snapshot(versioned_tree *vt, tree_snapshot *snap);
+
+
+// Same as search() in r_tree.h, on the version snap was taken of. Safe to run while insertions continue
+long snapshot_search(tree_snapshot *snap, MBR *window, search_callback callback, void *arg);
+
+
+// Frees the tree (including the index_records inserted into it). Every snapshot has to be released first
+void free_versioned_tree(versioned_tree *vt);
+
+
+#endif
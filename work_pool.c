@@ -0,0 +1,248 @@
+#include <sched.h>
+#include <time.h>
+#include "math_utils.h"
+#include "work_pool.h"
+
+
+typedef struct worker_args {
+	work_pool *pool;
+	int worker;
+} worker_args;
+
+
+// Slots can be read by a thief while the owner fills others, so they are copied a word at a time
+static void store_task(work_task *slot, work_task *task) {
+	__atomic_store_n(&slot->first, task->first, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->second, task->second, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->id, task->id, __ATOMIC_RELAXED);
+}
+
+
+static void load_task(work_task *slot, work_task *task) {
+	task->first = __atomic_load_n(&slot->first, __ATOMIC_RELAXED);
+	task->second = __atomic_load_n(&slot->second, __ATOMIC_RELAXED);
+	task->id = __atomic_load_n(&slot->id, __ATOMIC_RELAXED);
+}
+
+
+// Owner only. Returns false if the deque is full
+static bool push_task(work_deque *deque, work_task *task) {
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+	if (bottom - top >= WORK_DEQUE_CAPACITY)
+		return false;
+
+	store_task(&deque->slots[bottom & (WORK_DEQUE_CAPACITY - 1)], task);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+	return true;
+}
+
+
+// Owner only. Takes the most recently pushed task, racing thieves for the last one
+static bool pop_task(work_deque *deque, work_task *task) {
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+
+	atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	if (top > bottom) {
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+		return false;
+	}
+
+	load_task(&deque->slots[bottom & (WORK_DEQUE_CAPACITY - 1)], task);
+
+	if (top < bottom)
+		return true;
+
+	bool won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+	return won;
+}
+
+
+// Any thread. Takes the oldest task
+static bool steal_task(work_deque *deque, work_task *task) {
+	long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+	if (top >= bottom)
+		return false;
+
+	load_task(&deque->slots[top & (WORK_DEQUE_CAPACITY - 1)], task);
+
+	return atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+
+// Tries every other worker's deque once, starting from a random one
+static bool steal_from_others(work_pool *pool, int worker, unsigned int *seed, work_task *task) {
+	int start = rand_r(seed) % pool->num_workers;
+	int i;
+
+	for (i = 0; i < pool->num_workers; i++) {
+		int victim = (start + i) % pool->num_workers;
+
+		if (victim != worker && steal_task(&pool->deques[victim], task))
+			return true;
+	}
+
+	return false;
+}
+
+
+// Runs tasks from worker's own deque, stealing when it runs dry, until no task is left anywhere
+static void work(work_pool *pool, int worker) {
+	work_deque *own = &pool->deques[worker];
+	unsigned int seed = worker + 1;
+	struct timespec idle_start;
+	bool idle = false;
+	work_task task;
+
+	while (true) {
+		bool found = pop_task(own, &task);
+
+		// Helping with work already started comes before starting something new, so a big task spread over the other
+		// deques isn't left waiting behind fresh ones from the source
+		if (!found && steal_from_others(pool, worker, &seed, &task)) {
+			found = true;
+			own->steals++;
+		}
+
+		// A task from the source was never submitted, so it is counted as pending only while it runs. The count goes
+		// up before asking, so no other worker can see nothing pending while a task is on its way out of the source
+		if (!found && pool->source != NULL) {
+			atomic_fetch_add(&pool->pending, 1);
+			found = pool->source(pool, worker, &task);
+
+			if (!found)
+				atomic_fetch_sub(&pool->pending, 1);
+		}
+
+		if (found) {
+			if (idle) {
+				own->idle_seconds += seconds_since(&idle_start);
+				idle = false;
+			}
+
+			pool->run(pool, worker, &task);
+			own->tasks_run++;
+			atomic_fetch_sub(&pool->pending, 1);
+			continue;
+		}
+
+		// A task still running could submit more, so only stop once none is pending (and the source is dry)
+		if (atomic_load(&pool->pending) == 0)
+			break;
+
+		if (!idle) {
+			clock_gettime(CLOCK_MONOTONIC, &idle_start);
+			idle = true;
+		}
+
+		sched_yield();
+	}
+
+	if (idle)
+		own->idle_seconds += seconds_since(&idle_start);
+}
+
+
+static void *worker_thread(void *arg) {
+	worker_args *args = (worker_args *)arg;
+
+	work(args->pool, args->worker);
+	pthread_exit(NULL);
+}
+
+
+// Creates a pool of num_workers workers that run every task with run. context is left in pool->context for run
+work_pool *create_work_pool(int num_workers, task_function run, void *context) {
+	int i;
+
+	if (num_workers < 1) {
+		fprintf(stderr, "A work_pool needs at least one worker. Exiting program\n");
+		exit(1);
+	}
+
+	work_pool *pool = (work_pool *)aligned_alloc(CACHE_LINE_SIZE, sizeof(work_pool));
+	work_deque *deques = (work_deque *)aligned_alloc(CACHE_LINE_SIZE, sizeof(work_deque) * num_workers);
+
+	if (pool == NULL || deques == NULL) {
+		fprintf(stderr, "Malloc failed in create_work_pool(). Exiting program\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		atomic_init(&deques[i].top, 0);
+		atomic_init(&deques[i].bottom, 0);
+		deques[i].tasks_run = 0;
+		deques[i].steals = 0;
+		deques[i].idle_seconds = 0;
+	}
+
+	pool->num_workers = num_workers;
+	pool->deques = deques;
+	pool->run = run;
+	pool->context = context;
+	pool->source = NULL;
+	atomic_init(&pool->pending, 0);
+
+	return pool;
+}
+
+
+// Queues task on worker's deque. Only worker itself may call this while the pool is running (from inside a task);
+// before run_work_pool any worker's deque can be filled
+void submit_task(work_pool *pool, int worker, work_task *task) {
+	// Counted before it can be stolen, so pending never drops to 0 while it is queued
+	atomic_fetch_add(&pool->pending, 1);
+
+	if (push_task(&pool->deques[worker], task))
+		return;
+
+	// The deque is full. The task submitting this one is still pending, so running it here can't end the pool early
+	atomic_fetch_sub(&pool->pending, 1);
+	pool->run(pool, worker, task);
+	pool->deques[worker].tasks_run++;
+}
+
+
+// Runs the queued tasks, and every task they submit, on num_workers threads (the calling thread being worker 0).
+// Returns once they are all done. The per-worker counters are reset first
+void run_work_pool(work_pool *pool) {
+	int num_threads = pool->num_workers - 1;
+	pthread_t thread_ids[num_threads > 0 ? num_threads : 1];
+	worker_args args[pool->num_workers];
+	int i;
+
+	for (i = 0; i < pool->num_workers; i++) {
+		pool->deques[i].tasks_run = 0;
+		pool->deques[i].steals = 0;
+		pool->deques[i].idle_seconds = 0;
+
+		args[i].pool = pool;
+		args[i].worker = i;
+	}
+
+	for (i = 1; i < pool->num_workers; i++)
+		pthread_create(&thread_ids[i - 1], NULL, worker_thread, (void *)&args[i]);
+
+	work(pool, 0);
+
+	for (i = 1; i < pool->num_workers; i++)
+		pthread_join(thread_ids[i - 1], NULL);
+}
+
+
+void free_work_pool(work_pool *pool) {
+	free(pool->deques);
+	free(pool);
+}
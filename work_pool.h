@@ -0,0 +1,94 @@
+#ifndef _work_pool_h
+#define _work_pool_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* Work-stealing thread pool.
+*
+* Every worker owns a Chase-Lev deque of tasks: it pushes and pops at the bottom of its own deque without any locks,
+* while idle workers steal from the top of other workers' deques with a single compare-and-swap. Tasks are small
+* fixed-size structs copied in and out of the deques, and a task can submit more tasks as it runs, so a recursive
+* traversal spreads itself over the workers as it goes. run_work_pool returns once every task (including the ones
+* submitted along the way) has run.
+*
+* The deques don't grow: a task submitted to a full deque is run on the spot by the submitting worker instead.
+* Work too plentiful to queue up front can be handed out through the pool's source instead, which idle workers only
+* draw from once they find nothing to steal
+*/
+
+// Must be a power of 2
+#define WORK_DEQUE_CAPACITY 4096
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+
+typedef struct work_task {
+	void *first;
+	void *second;
+	long id;
+} work_task;
+
+
+struct work_pool;
+
+// Runs task on worker (0 .. num_workers - 1). The pool's context is in pool->context
+typedef void (*task_function)(struct work_pool *pool, int worker, work_task *task);
+
+
+// Writes the next task for worker to task, or returns false once it has nothing left to hand out (for good)
+typedef bool (*task_source)(struct work_pool *pool, int worker, work_task *task);
+
+
+typedef struct work_deque {
+	// top is advanced by thieves and bottom only moved by the owner, so keep them on separate cache lines
+	_Alignas(CACHE_LINE_SIZE) atomic_long top;
+	_Alignas(CACHE_LINE_SIZE) atomic_long bottom;
+
+	work_task slots[WORK_DEQUE_CAPACITY];
+
+	// Written only by the owner, for benchmarking
+	long tasks_run;
+	long steals;
+	double idle_seconds;
+} work_deque;
+
+
+typedef struct work_pool {
+	int num_workers;
+	work_deque *deques;
+
+	task_function run;
+	void *context;
+
+	// NULL unless set after create_work_pool
+	task_source source;
+
+	// Tasks submitted but not finished yet
+	_Alignas(CACHE_LINE_SIZE) atomic_long pending;
+} work_pool;
+
+
+// Creates a pool of num_workers workers that run every task with run. context is left in pool->context for run
+work_pool *create_work_pool(int num_workers, task_function run, void *context);
+
+
+// Queues task on worker's deque. Only worker itself may call this while the pool is running (from inside a task);
+// before run_work_pool any worker's deque can be filled
+void submit_task(work_pool *pool, int worker, work_task *task);
+
+
+// Runs the queued tasks, and every task they submit, on num_workers threads (the calling thread being worker 0).
+// Returns once they are all done. The per-worker counters are reset first
+void run_work_pool(work_pool *pool);
+
+
+void free_work_pool(work_pool *pool);
+
+
+#endif